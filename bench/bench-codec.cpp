@@ -0,0 +1,445 @@
+/**
+ * @file   bench-codec.cpp
+ * @brief  Speed and compression ratio of each filter on a synthetic corpus.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include <math.h>
+#include <boost/bind.hpp>
+#include <boost/program_options.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <camoto/filter_coroutine.hpp>
+#include <camoto/filter_dummy.hpp>
+#include <camoto/lzw.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_memory.hpp>
+#include "bench.hpp"
+
+namespace po = boost::program_options;
+using namespace camoto;
+
+/// Size of the output buffer used when calling transform() directly.
+#define DIRECT_BUFFER_SIZE 65536
+
+/// Creates a new instance of a filter.
+typedef boost::function<filter_sptr()> fn_make_filter;
+
+/// A compressor and matching decompressor.
+struct codec {
+	std::string name;
+	fn_make_filter encode;
+	fn_make_filter decode;
+};
+
+/// One file in the test corpus.
+struct corpus_item {
+	std::string name;
+	std::vector<uint8_t> data;
+};
+
+/// Simple repeatable random number generator.
+class bench_rng
+{
+	public:
+		bench_rng(uint32_t seed)
+			:	x(seed)
+		{
+		}
+
+		uint32_t next()
+		{
+			this->x = this->x * 1103515245U + 12345U;
+			return this->x >> 8;
+		}
+
+	protected:
+		uint32_t x;
+};
+
+/// Level map made of runs of a few tile codes, like most tile-based games.
+static void makeTilemap(std::vector<uint8_t>& out, stream::len size)
+{
+	bench_rng rng(1);
+	const unsigned int width = 128;
+	out.resize(size);
+	for (stream::len i = 0; i < size; ) {
+		// Copy the row above some of the time, otherwise lay down runs of tiles.
+		if ((i >= width) && (rng.next() % 4 == 0)) {
+			for (unsigned int x = 0; (x < width) && (i < size); x++, i++) {
+				out[i] = out[i - width];
+			}
+			continue;
+		}
+		uint8_t tile = rng.next() % 24;
+		unsigned int run = 1 + rng.next() % 12;
+		for (unsigned int r = 0; (r < run) && (i < size); r++, i++) {
+			out[i] = tile;
+		}
+	}
+	return;
+}
+
+/// English-like text built from a small vocabulary.
+static void makeText(std::vector<uint8_t>& out, stream::len size)
+{
+	static const char *words[] = {
+		"the", "of", "and", "to", "a", "in", "is", "you", "that", "it", "he",
+		"was", "for", "on", "are", "as", "with", "his", "they", "at", "be",
+		"this", "have", "from", "or", "one", "had", "by", "word", "but", "not",
+		"what", "all", "were", "we", "when", "your", "can", "said", "there",
+		"level", "player", "enemy", "door", "key", "treasure", "castle",
+		"dungeon", "score", "extra", "life", "bonus", "secret", "episode",
+	};
+	const unsigned int numWords = sizeof(words) / sizeof(words[0]);
+	bench_rng rng(2);
+	out.clear();
+	out.reserve(size);
+	unsigned int lineLen = 0;
+	while (out.size() < size) {
+		const char *w = words[rng.next() % numWords];
+		for (; *w && (out.size() < size); w++) out.push_back(*w);
+		lineLen += 6;
+		if (out.size() < size) out.push_back(lineLen > 70 ? '\n' : ' ');
+		if (lineLen > 70) lineLen = 0;
+	}
+	return;
+}
+
+/// Unsigned 8-bit audio: a couple of tones with some noise.
+static void makePCM(std::vector<uint8_t>& out, stream::len size)
+{
+	bench_rng rng(3);
+	out.resize(size);
+	for (stream::len i = 0; i < size; i++) {
+		double v = 50 * sin(i * 0.031) + 30 * sin(i * 0.0077)
+			+ (int)(rng.next() % 9) - 4;
+		out[i] = (uint8_t)(128 + (int)v);
+	}
+	return;
+}
+
+/// Incompressible data.
+static void makeRandom(std::vector<uint8_t>& out, stream::len size)
+{
+	out.resize(size);
+	bench_fill(&out[0], size, 4);
+	return;
+}
+
+static filter_sptr makeDummy()
+{
+	return filter_sptr(new filter_dummy());
+}
+
+/// Byte-at-a-time copy through filter_coroutine.
+/**
+ * This does the same job as filter_dummy, so the difference between the two
+ * is the cost of the coroutine adapter itself.
+ */
+class filter_bench_copy: public filter_coroutine
+{
+	protected:
+		virtual void run()
+		{
+			uint8_t b;
+			while (this->read(&b)) this->write(b);
+		}
+};
+
+static filter_sptr makeCoroutineCopy()
+{
+	return filter_sptr(new filter_bench_copy());
+}
+
+static filter_sptr makeLZWEncode(int initialBits, int maxBits, int firstCode,
+	int eofCode, int resetCode, int flags)
+{
+	return filter_sptr(new filter_lzw_compress(initialBits, maxBits, firstCode,
+		eofCode, resetCode, flags));
+}
+
+static filter_sptr makeLZWDecode(int initialBits, int maxBits, int firstCode,
+	int eofCode, int resetCode, int flags)
+{
+	return filter_sptr(new filter_lzw_decompress(initialBits, maxBits,
+		firstCode, eofCode, resetCode, flags));
+}
+
+/// Add an LZW variant to the list of codecs.
+static void addLZW(std::vector<codec>& codecs, const std::string& name,
+	int initialBits, int maxBits, int firstCode, int eofCode, int resetCode,
+	int flags)
+{
+	codec c;
+	c.name = name;
+	c.encode = boost::bind(makeLZWEncode, initialBits, maxBits, firstCode,
+		eofCode, resetCode, flags);
+	c.decode = boost::bind(makeLZWDecode, initialBits, maxBits, firstCode,
+		eofCode, resetCode, flags);
+	codecs.push_back(c);
+	return;
+}
+
+/// Run data through a filter by calling transform() directly.
+static void runDirect(filter& f, const std::vector<uint8_t>& in,
+	std::vector<uint8_t>& out)
+{
+	out.clear();
+	uint8_t buffer[DIRECT_BUFFER_SIZE];
+	f.reset(in.size());
+	stream::len offIn = 0;
+	stream::len lenIn, lenOut;
+	do {
+		lenIn = in.size() - offIn;
+		lenOut = DIRECT_BUFFER_SIZE;
+		f.transform(buffer, &lenOut, in.empty() ? NULL : &in[offIn], &lenIn);
+		offIn += lenIn;
+		out.insert(out.end(), buffer, buffer + lenOut);
+	} while ((lenIn != 0) || (lenOut != 0));
+	return;
+}
+
+/// Run data through a filter using a filtered stream, as a format handler
+/// would.
+static void runFiltered(filter_sptr f, bool encode,
+	const std::vector<uint8_t>& in, std::vector<uint8_t>& out)
+{
+	stream::memory_sptr src(new stream::memory());
+	src->write(&in[0], in.size());
+	src->seekg(0, stream::start);
+	stream::memory_sptr dst(new stream::memory());
+
+	if (encode) {
+		stream::output_filtered_sptr o(new stream::output_filtered());
+		o->open(dst, f, NULL);
+		stream::copy(o, src);
+		o->flush();
+	} else {
+		stream::input_filtered_sptr i(new stream::input_filtered());
+		i->open(src, f);
+		stream::copy(dst, i);
+	}
+
+	out.resize(dst->size());
+	dst->seekg(0, stream::start);
+	if (!out.empty()) dst->read(&out[0], out.size());
+	return;
+}
+
+/// Benchmark body running one direction of a codec.
+static void benchCodec(fn_make_filter make, bool direct, bool encode,
+	const std::vector<uint8_t> *in, std::vector<uint8_t> *out,
+	stream::len lenOriginal, bench_timing& t)
+{
+	filter_sptr f = make();
+	if (direct) runDirect(*f, *in, *out);
+	else runFiltered(f, encode, *in, *out);
+	t.ops++;
+	// Always count the uncompressed size, so MB/s is comparable between
+	// encoding and decoding.
+	t.bytes += lenOriginal;
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long sizeKB;
+	double minTime, threshold;
+	std::string format, only, baselineFile, saveFile;
+
+	po::options_description opts("Options");
+	opts.add_options()
+		("help,h", "show this help")
+		("size,s", po::value<unsigned long>(&sizeKB)->default_value(1024),
+			"size of each corpus file, in kB")
+		("min-time,t", po::value<double>(&minTime)->default_value(0.2),
+			"minimum time to run each case, in seconds")
+		("format,f", po::value<std::string>(&format)->default_value("csv"),
+			"output format, csv or json")
+		("only,o", po::value<std::string>(&only)->default_value(""),
+			"only run codecs containing this text")
+		("baseline,b", po::value<std::string>(&baselineFile),
+			"CSV output from an earlier run to compare against")
+		("threshold", po::value<double>(&threshold)->default_value(0.2),
+			"fail if throughput drops by more than this fraction of the baseline")
+		("save", po::value<std::string>(&saveFile),
+			"also write the results to this file as CSV, for use as a baseline")
+	;
+	po::variables_map vm;
+	try {
+		po::store(po::parse_command_line(argc, argv, opts), vm);
+		po::notify(vm);
+	} catch (const po::error& e) {
+		std::cerr << "bench-codec: " << e.what() << "\n" << opts;
+		return 1;
+	}
+	if (vm.count("help")) {
+		std::cout << "Measure the speed and compression ratio of each filter.\n\n"
+			<< opts;
+		return 0;
+	}
+
+	std::vector<std::string> keyFields;
+	keyFields.push_back("codec");
+	keyFields.push_back("corpus");
+	keyFields.push_back("mode");
+	keyFields.push_back("direction");
+	bench_baseline baseline;
+	if (!baselineFile.empty()) {
+		std::ifstream b(baselineFile.c_str());
+		if (!b) {
+			std::cerr << "bench-codec: unable to open baseline " << baselineFile
+				<< std::endl;
+			return 1;
+		}
+		try {
+			baseline = bench_load_baseline(b, keyFields, "mb_per_s");
+		} catch (const std::exception& e) {
+			std::cerr << "bench-codec: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	stream::len size = (stream::len)sizeKB * 1024;
+	std::vector<corpus_item> corpus(4);
+	corpus[0].name = "tilemap";
+	makeTilemap(corpus[0].data, size);
+	corpus[1].name = "text";
+	makeText(corpus[1].data, size);
+	corpus[2].name = "pcm";
+	makePCM(corpus[2].data, size);
+	corpus[3].name = "random";
+	makeRandom(corpus[3].data, size);
+
+	std::vector<codec> codecs;
+	codec dummy;
+	dummy.name = "dummy";
+	dummy.encode = makeDummy;
+	dummy.decode = makeDummy;
+	codecs.push_back(dummy);
+	codec coroutine;
+	coroutine.name = "coroutine-copy";
+	coroutine.encode = makeCoroutineCopy;
+	coroutine.decode = makeCoroutineCopy;
+	codecs.push_back(coroutine);
+	addLZW(codecs, "lzw-9-9-be", 9, 9, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	addLZW(codecs, "lzw-9-12-be", 9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	addLZW(codecs, "lzw-9-12-le", 9, 12, 0x101, 0x100, 0,
+		LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID);
+	addLZW(codecs, "lzw-9-12-be-resetfull", 9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT);
+	// Reset codeword 0x100 and EOF codeword 0x101, as in many game formats
+	addLZW(codecs, "lzw-9-12-be-resetcode", 9, 12, 0x102, 0x101, 0x100,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+		| LZW_RESET_FULL_DICT);
+	addLZW(codecs, "lzw-9-12-be-resetcode-flush", 9, 12, 0x102, 0x101, 0x100,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+		| LZW_RESET_FULL_DICT | LZW_FLUSH_ON_RESET);
+	addLZW(codecs, "lzw-9-12-be-resetcode-keepbits", 9, 12, 0x102, 0x101, 0x100,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+		| LZW_RESET_FULL_DICT | LZW_NO_BITSIZE_RESET);
+	// No EOF codeword, the data just ends
+	addLZW(codecs, "lzw-9-12-le-noeof", 9, 12, 0x100, 0, 0,
+		LZW_LITTLE_ENDIAN);
+	addLZW(codecs, "lzw-9-14-be", 9, 14, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	addLZW(codecs, "lzw-9-16-le", 9, 16, 0x101, 0x100, 0,
+		LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID);
+
+	std::ofstream saved;
+	if (!saveFile.empty()) saved.open(saveFile.c_str());
+
+	unsigned int regressions = 0;
+	try {
+		bench_report report(std::cout, format);
+		boost::scoped_ptr<bench_report> saveReport;
+		if (saved.is_open()) saveReport.reset(new bench_report(saved, "csv"));
+
+		for (std::vector<codec>::const_iterator
+			c = codecs.begin(); c != codecs.end(); c++
+		) {
+			if (c->name.find(only) == std::string::npos) continue;
+			for (std::vector<corpus_item>::const_iterator
+				item = corpus.begin(); item != corpus.end(); item++
+			) {
+				// Compress once up front, to get the ratio and the input for the
+				// decompression cases, and to make sure the data survives the trip.
+				std::vector<uint8_t> encoded, decoded;
+				runDirect(*c->encode(), item->data, encoded);
+				runDirect(*c->decode(), encoded, decoded);
+				if (decoded != item->data) {
+					std::cerr << "bench-codec: " << c->name << " did not decode "
+						<< item->name << " back to the original data" << std::endl;
+					return 2;
+				}
+				double ratio = item->data.empty()
+					? 1 : (double)encoded.size() / item->data.size();
+
+				for (unsigned int direct = 0; direct < 2; direct++) {
+					for (unsigned int encode = 0; encode < 2; encode++) {
+						std::vector<uint8_t> out;
+						bench_reset_peak_rss();
+						bench_timing t = bench_run(boost::bind(benchCodec,
+							encode ? c->encode : c->decode, direct == 1, encode == 1,
+							encode ? &item->data : &encoded, &out, item->data.size(), _1),
+							minTime);
+						long rss = bench_peak_rss_kb();
+
+						bench_row row;
+						row.add("codec", c->name)
+							.add("corpus", item->name)
+							.add("mode", std::string(direct ? "direct" : "filtered"))
+							.add("direction", std::string(encode ? "encode" : "decode"))
+							.add(t)
+							.add("ratio", ratio)
+							.add("peak_rss_kb", (double)rss);
+						report.add(row);
+						if (saveReport) saveReport->add(row);
+
+						if (!baseline.empty()) {
+							std::string key = c->name + "/" + item->name + "/"
+								+ (direct ? "direct" : "filtered") + "/"
+								+ (encode ? "encode" : "decode");
+							bench_baseline::const_iterator b = baseline.find(key);
+							if (
+								(b != baseline.end())
+								&& (t.mbPerSecond() < b->second * (1 - threshold))
+							) {
+								std::cerr << "bench-codec: regression in " << key << ": "
+									<< t.mbPerSecond() << " MB/s, baseline " << b->second
+									<< " MB/s" << std::endl;
+								regressions++;
+							}
+						}
+					}
+				}
+			}
+		}
+	} catch (const std::exception& e) {
+		std::cerr << "bench-codec: " << e.what() << std::endl;
+		return 2;
+	}
+	if (regressions) {
+		std::cerr << "bench-codec: " << regressions << " case(s) slower than the "
+			"baseline by more than " << threshold * 100 << "%" << std::endl;
+		return 3;
+	}
+	return 0;
+}
@@ -0,0 +1,338 @@
+/**
+ * @file   bench-seg.cpp
+ * @brief  Cost of editing archive-sized files through a seg stream.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/program_options.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_memory.hpp>
+#include <camoto/stream_metered.hpp>
+#include <camoto/stream_seg.hpp>
+#include "bench.hpp"
+
+namespace po = boost::program_options;
+using namespace camoto;
+
+typedef boost::chrono::steady_clock bench_clock;
+
+/// Size of the member added or removed by the structured edit patterns.
+#define MEMBER_SIZE 4096
+
+/// Size of each entry added to the FAT by the grow-fat pattern.
+#define FAT_ENTRY_SIZE 16
+
+/// Offset of the FAT from the start of the file, after a small header.
+#define FAT_OFFSET 32
+
+/// Largest edit made by the tiny-edits pattern.
+#define TINY_EDIT_MAX 16
+
+/// Creates a stream of the given size filled with data.
+typedef boost::function<stream::inout_sptr(stream::len)> fn_make_stream;
+
+/// Totals from running one edit pattern.
+struct edit_result {
+	unsigned long ops;        ///< Number of edits made
+	unsigned long flushes;    ///< Number of times the seg was flushed
+	double editSeconds;       ///< Time spent in insert/remove/write calls
+	double flushSeconds;      ///< Time spent in flush()
+	unsigned long long bytesMoved;   ///< Bytes read back from the parent
+	unsigned long long bytesWritten; ///< Bytes written to the parent
+
+	edit_result()
+		:	ops(0),
+			flushes(0),
+			editSeconds(0),
+			flushSeconds(0),
+			bytesMoved(0),
+			bytesWritten(0)
+	{
+	}
+};
+
+/// Applies one edit pattern to a seg stream.
+/**
+ * @param s
+ *   Stream to edit.
+ *
+ * @param edits
+ *   Number of edits to make.
+ *
+ * @param flush
+ *   Function to call to flush \e s, which keeps track of the flush time.
+ *
+ * @param result
+ *   Edit count and time to update.
+ */
+typedef boost::function<void(stream::seg_sptr s, unsigned long edits,
+	boost::function<void()> flush, edit_result& result)> fn_edit_pattern;
+
+/// Fill a new stream with \e size bytes and seek back to the start.
+static void fillStream(stream::inout_sptr s, stream::len size)
+{
+	std::vector<uint8_t> buffer(BUFFER_SIZE);
+	uint32_t block = 0;
+	while (size) {
+		stream::len len = std::min(size, (stream::len)BUFFER_SIZE);
+		bench_fill(&buffer[0], len, block++);
+		s->write(&buffer[0], len);
+		size -= len;
+	}
+	s->seekp(0, stream::start);
+	return;
+}
+
+static stream::inout_sptr makeMemory(stream::len size)
+{
+	stream::memory_sptr s(new stream::memory());
+	fillStream(s, size);
+	return s;
+}
+
+static stream::inout_sptr makeFile(const std::string& filename,
+	stream::len size)
+{
+	stream::file_sptr s(new stream::file());
+	s->create(filename);
+	s->remove();
+	fillStream(s, size);
+	return s;
+}
+
+static double secondsSince(bench_clock::time_point tStart)
+{
+	boost::chrono::duration<double> elapsed = bench_clock::now() - tStart;
+	return elapsed.count();
+}
+
+/// Add a member to the end of the archive, then save it.
+static void editAppend(stream::seg_sptr s, unsigned long edits,
+	boost::function<void()> flush, edit_result& result)
+{
+	std::vector<uint8_t> member(MEMBER_SIZE);
+	for (unsigned long i = 0; i < edits; i++) {
+		bench_fill(&member[0], member.size(), i);
+		bench_clock::time_point tStart = bench_clock::now();
+		s->seekp(0, stream::end);
+		s->insert(MEMBER_SIZE);
+		s->write(&member[0], MEMBER_SIZE);
+		result.editSeconds += secondsSince(tStart);
+		result.ops++;
+		flush();
+	}
+	return;
+}
+
+/// Add an entry to a FAT near the start of the file, then save it.
+/**
+ * This is the worst case for a seg, as every byte after the FAT has to be
+ * shifted along on every flush.
+ */
+static void editGrowFAT(stream::seg_sptr s, unsigned long edits,
+	boost::function<void()> flush, edit_result& result)
+{
+	uint8_t entry[FAT_ENTRY_SIZE];
+	for (unsigned long i = 0; i < edits; i++) {
+		bench_fill(entry, sizeof(entry), i);
+		bench_clock::time_point tStart = bench_clock::now();
+		s->seekp(FAT_OFFSET + i * FAT_ENTRY_SIZE, stream::start);
+		s->insert(FAT_ENTRY_SIZE);
+		s->write(entry, FAT_ENTRY_SIZE);
+		result.editSeconds += secondsSince(tStart);
+		result.ops++;
+		flush();
+	}
+	return;
+}
+
+/// Remove a member from the middle of the archive, then save it.
+static void editDeleteMiddle(stream::seg_sptr s, unsigned long edits,
+	boost::function<void()> flush, edit_result& result)
+{
+	for (unsigned long i = 0; i < edits; i++) {
+		stream::len size = s->size();
+		if (size < MEMBER_SIZE) break;
+		bench_clock::time_point tStart = bench_clock::now();
+		s->seekp((size - MEMBER_SIZE) / 2, stream::start);
+		s->remove(MEMBER_SIZE);
+		result.editSeconds += secondsSince(tStart);
+		result.ops++;
+		flush();
+	}
+	return;
+}
+
+/// Make many small inserts and removes all over the file, then save once.
+/**
+ * Inserts and removes alternate so the file stays about the same size.
+ */
+static void editTiny(stream::seg_sptr s, unsigned long edits,
+	boost::function<void()> flush, edit_result& result)
+{
+	uint8_t data[TINY_EDIT_MAX];
+	bench_fill(data, sizeof(data), 0);
+	uint32_t rng = 1;
+	stream::len size = s->size();
+	bench_clock::time_point tStart = bench_clock::now();
+	for (unsigned long i = 0; i < edits; i++) {
+		rng = rng * 1103515245U + 12345U;
+		stream::len len = 1 + (rng >> 8) % TINY_EDIT_MAX;
+		if (size <= len) break;
+		rng = rng * 1103515245U + 12345U;
+		stream::pos pos = (((stream::pos)rng << 16) ^ (rng >> 8)) % (size - len);
+		s->seekp(pos, stream::start);
+		if (i & 1) {
+			s->remove(len);
+			size -= len;
+		} else {
+			s->insert(len);
+			s->write(data, len);
+			size += len;
+		}
+		result.ops++;
+	}
+	result.editSeconds += secondsSince(tStart);
+	flush();
+	return;
+}
+
+/// Flush a seg stream, adding the time taken to \e result.
+static void timedFlush(stream::seg_sptr s, edit_result *result)
+{
+	bench_clock::time_point tStart = bench_clock::now();
+	s->flush();
+	result->flushSeconds += secondsSince(tStart);
+	result->flushes++;
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<unsigned long> sizesMB;
+	unsigned long edits, tinyEdits;
+	std::string format, only, tempFile;
+
+	po::options_description opts("Options");
+	opts.add_options()
+		("help,h", "show this help")
+		("size,s", po::value<std::vector<unsigned long> >(&sizesMB)->multitoken(),
+			"size of the file being edited, in MB (may be given more than once, "
+			"default 1 16 256)")
+		("edits,n", po::value<unsigned long>(&edits)->default_value(8),
+			"number of edits (each followed by a flush) in the structured patterns")
+		("tiny-edits", po::value<unsigned long>(&tinyEdits)->default_value(1000),
+			"number of edits before the single flush in the tiny-edits pattern")
+		("format,f", po::value<std::string>(&format)->default_value("csv"),
+			"output format, csv or json")
+		("only,o", po::value<std::string>(&only)->default_value(""),
+			"only run patterns or parents containing this text")
+		("temp", po::value<std::string>(&tempFile)
+			->default_value("bench-seg.tmp"),
+			"temporary file to use for file-backed parents")
+	;
+	po::variables_map vm;
+	try {
+		po::store(po::parse_command_line(argc, argv, opts), vm);
+		po::notify(vm);
+	} catch (const po::error& e) {
+		std::cerr << "bench-seg: " << e.what() << "\n" << opts;
+		return 1;
+	}
+	if (vm.count("help")) {
+		std::cout << "Measure the cost of inserting and removing data with a seg "
+			"stream.\n\nMemory-backed parents are held entirely in RAM, so only "
+			"ask for sizes that\nwill fit.\n\n" << opts;
+		return 0;
+	}
+	if (sizesMB.empty()) {
+		sizesMB.push_back(1);
+		sizesMB.push_back(16);
+		sizesMB.push_back(256);
+	}
+
+	std::vector<std::pair<std::string, fn_make_stream> > parents;
+	parents.push_back(std::make_pair("memory", fn_make_stream(makeMemory)));
+	parents.push_back(std::make_pair("file",
+		fn_make_stream(boost::bind(makeFile, tempFile, _1))));
+
+	std::vector<std::pair<std::string, fn_edit_pattern> > patterns;
+	patterns.push_back(std::make_pair("append", fn_edit_pattern(editAppend)));
+	patterns.push_back(std::make_pair("grow-fat", fn_edit_pattern(editGrowFAT)));
+	patterns.push_back(std::make_pair("delete-middle",
+		fn_edit_pattern(editDeleteMiddle)));
+	patterns.push_back(std::make_pair("tiny-edits", fn_edit_pattern(editTiny)));
+
+	stream::meter_registry::enable(true);
+	try {
+		bench_report report(std::cout, format);
+		for (unsigned int si = 0; si < sizesMB.size(); si++) {
+			stream::len size = (stream::len)sizesMB[si] * 1024 * 1024;
+			for (unsigned int pi = 0; pi < parents.size(); pi++) {
+				for (unsigned int ei = 0; ei < patterns.size(); ei++) {
+					if (
+						(patterns[ei].first.find(only) == std::string::npos)
+						&& (parents[pi].first.find(only) == std::string::npos)
+					) continue;
+
+					// Populate the parent before resetting the peak, so only the
+					// memory used by the seg itself is counted.
+					stream::inout_sptr parent = parents[pi].second(size);
+					bench_reset_peak_rss();
+
+					stream::metered_sptr meter(new stream::metered());
+					meter->open(parent, "parent");
+					stream::seg_sptr s(new stream::seg());
+					s->open(meter);
+
+					edit_result result;
+					unsigned long count = patterns[ei].first == "tiny-edits"
+						? tinyEdits : edits;
+					patterns[ei].second(s, count,
+						boost::bind(timedFlush, s, &result), result);
+
+					stream::meter_snapshot snap = meter->snapshot();
+					result.bytesMoved = snap.counters.bytesRead;
+					result.bytesWritten = snap.counters.bytesWritten;
+					long rss = bench_peak_rss_kb();
+
+					bench_row row;
+					row.add("pattern", patterns[ei].first)
+						.add("parent", parents[pi].first)
+						.add("size", (double)size)
+						.add("ops", (double)result.ops)
+						.add("edit_us_per_op", result.ops
+							? result.editSeconds * 1e6 / result.ops : 0)
+						.add("flushes", (double)result.flushes)
+						.add("flush_ms_per_flush", result.flushes
+							? result.flushSeconds * 1e3 / result.flushes : 0)
+						.add("bytes_moved", (double)result.bytesMoved)
+						.add("bytes_written", (double)result.bytesWritten)
+						.add("peak_rss_kb", (double)rss);
+					report.add(row);
+				}
+			}
+		}
+	} catch (const std::exception& e) {
+		std::cerr << "bench-seg: " << e.what() << std::endl;
+		return 2;
+	}
+	return 0;
+}
@@ -0,0 +1,296 @@
+/**
+ * @file   bench-stream.cpp
+ * @brief  Read, write and seek throughput of each stream type.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/program_options.hpp>
+#include <camoto/filter_dummy.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_memory.hpp>
+#include <camoto/stream_seg.hpp>
+#include <camoto/stream_simulated.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/stream_sub.hpp>
+#include "bench.hpp"
+
+namespace po = boost::program_options;
+using namespace camoto;
+
+/// Gap left either side of a substream inside its parent.
+#define SUB_PADDING 4096
+
+/// Access sizes tested, from single fields up to bulk transfers.
+static const stream::len accessSizes[] = {
+	1, 4, 16, 512, 4096, 65536, 1024 * 1024
+};
+
+/// Creates a stream of the given size filled with data.
+typedef boost::function<stream::inout_sptr(stream::len)> fn_make_stream;
+
+/// Fill a new stream with \e size bytes and seek back to the start.
+static void fillStream(stream::inout_sptr s, stream::len size)
+{
+	std::vector<uint8_t> buffer(BUFFER_SIZE);
+	uint32_t block = 0;
+	while (size) {
+		stream::len len = std::min(size, (stream::len)BUFFER_SIZE);
+		bench_fill(&buffer[0], len, block++);
+		s->write(&buffer[0], len);
+		size -= len;
+	}
+	s->seekp(0, stream::start);
+	return;
+}
+
+static stream::inout_sptr makeMemory(stream::len size)
+{
+	stream::memory_sptr s(new stream::memory());
+	fillStream(s, size);
+	return s;
+}
+
+static stream::inout_sptr makeString(stream::len size)
+{
+	stream::string_sptr s(new stream::string());
+	fillStream(s, size);
+	return s;
+}
+
+static stream::inout_sptr makeFile(const std::string& filename,
+	stream::len size)
+{
+	stream::file_sptr s(new stream::file());
+	s->create(filename);
+	s->remove();
+	fillStream(s, size);
+	return s;
+}
+
+/// Stream on a simulated storage device.
+static stream::inout_sptr makeSimulated(fn_make_stream parent,
+	stream::sim_device dev, stream::len size)
+{
+	stream::simulated_sptr s(new stream::simulated());
+	s->open(parent(size), dev);
+	return s;
+}
+
+/// Substream in the middle of a larger stream.
+static stream::inout_sptr makeSub(fn_make_stream parent, stream::len size)
+{
+	stream::sub_sptr s(new stream::sub());
+	s->open(parent(size + 2 * SUB_PADDING), SUB_PADDING, size, NULL);
+	return s;
+}
+
+static stream::inout_sptr makeSeg(fn_make_stream parent, stream::len size)
+{
+	stream::seg_sptr s(new stream::seg());
+	s->open(parent(size));
+	return s;
+}
+
+static stream::inout_sptr makeFiltered(fn_make_stream parent,
+	stream::len size)
+{
+	filter_sptr f(new filter_dummy());
+	stream::filtered_sptr s(new stream::filtered());
+	s->open(parent(size), f, f, NULL);
+	s->size(); // populate now rather than during the first timed read
+	return s;
+}
+
+/// Sequential reads, wrapping back to the start at EOF.
+/**
+ * A short read is retried, as only reading nothing at all means the end of
+ * the stream has been reached.
+ */
+static void benchRead(stream::inout_sptr s, std::vector<uint8_t> *buffer,
+	stream::len access, unsigned long batch, bench_timing& t)
+{
+	for (unsigned long i = 0; i < batch; i++) {
+		stream::len got = 0;
+		while (got < access) {
+			stream::len r = s->try_read(&(*buffer)[got], access - got);
+			if (r == 0) break;
+			got += r;
+		}
+		if (got < access) s->seekg(0, stream::start);
+		t.bytes += got;
+	}
+	t.ops += batch;
+	return;
+}
+
+/// Sequential writes over existing data, wrapping back to the start.
+static void benchWrite(stream::inout_sptr s, std::vector<uint8_t> *buffer,
+	stream::len access, stream::len size, unsigned long batch, bench_timing& t)
+{
+	for (unsigned long i = 0; i < batch; i++) {
+		if (s->tellp() + access > size) s->seekp(0, stream::start);
+		t.bytes += s->try_write(&(*buffer)[0], access);
+	}
+	t.ops += batch;
+	return;
+}
+
+/// Seek to a pseudo-random position and read one field.
+static void benchSeek(stream::inout_sptr s, std::vector<uint8_t> *buffer,
+	stream::len access, stream::len size, uint32_t *rng, unsigned long batch,
+	bench_timing& t)
+{
+	stream::len slots = size / access;
+	for (unsigned long i = 0; i < batch; i++) {
+		*rng = *rng * 1103515245U + 12345U;
+		s->seekg((stream::pos)(*rng % slots) * access, stream::start);
+		t.bytes += s->try_read(&(*buffer)[0], access);
+	}
+	t.ops += batch;
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long sizeMB;
+	double minTime;
+	std::string format, only, tempFile, device;
+
+	po::options_description opts("Options");
+	opts.add_options()
+		("help,h", "show this help")
+		("size,s", po::value<unsigned long>(&sizeMB)->default_value(16),
+			"size of each test stream, in MB")
+		("min-time,t", po::value<double>(&minTime)->default_value(0.2),
+			"minimum time to run each case, in seconds")
+		("format,f", po::value<std::string>(&format)->default_value("csv"),
+			"output format, csv or json")
+		("only,o", po::value<std::string>(&only)->default_value(""),
+			"only run stream types containing this text")
+		("temp", po::value<std::string>(&tempFile)
+			->default_value("bench-stream.tmp"),
+			"temporary file to use for file streams")
+		("device,d", po::value<std::string>(&device)->default_value("none"),
+			"make the memory and file streams behave like a slower device: none, "
+			"hdd or network")
+	;
+	po::variables_map vm;
+	try {
+		po::store(po::parse_command_line(argc, argv, opts), vm);
+		po::notify(vm);
+	} catch (const po::error& e) {
+		std::cerr << "bench-stream: " << e.what() << "\n" << opts;
+		return 1;
+	}
+	if (vm.count("help")) {
+		std::cout << "Measure read, write and seek throughput of each stream "
+			"type.\n\n" << opts;
+		return 0;
+	}
+
+	stream::len size = (stream::len)sizeMB * 1024 * 1024;
+	fn_make_stream memory = makeMemory;
+	fn_make_stream file = boost::bind(makeFile, tempFile, _1);
+	if (device != "none") {
+		stream::sim_device dev;
+		if (device == "hdd") dev = stream::sim_device::hdd();
+		else if (device == "network") dev = stream::sim_device::network();
+		else {
+			std::cerr << "bench-stream: unknown device \"" << device << "\"\n"
+				<< opts;
+			return 1;
+		}
+		dev.realTime = true;
+		memory = boost::bind(makeSimulated, memory, dev, _1);
+		file = boost::bind(makeSimulated, file, dev, _1);
+	}
+
+	std::vector<std::pair<std::string, fn_make_stream> > types;
+	types.push_back(std::make_pair("memory", memory));
+	types.push_back(std::make_pair("string", fn_make_stream(makeString)));
+	types.push_back(std::make_pair("file", file));
+	types.push_back(std::make_pair("sub(memory)",
+		fn_make_stream(boost::bind(makeSub, memory, _1))));
+	types.push_back(std::make_pair("seg(memory)",
+		fn_make_stream(boost::bind(makeSeg, memory, _1))));
+	types.push_back(std::make_pair("filtered(memory)",
+		fn_make_stream(boost::bind(makeFiltered, memory, _1))));
+	types.push_back(std::make_pair("sub(file)",
+		fn_make_stream(boost::bind(makeSub, file, _1))));
+	types.push_back(std::make_pair("sub(seg(file))",
+		fn_make_stream(boost::bind(makeSub,
+			fn_make_stream(boost::bind(makeSeg, file, _1)), _1))));
+	types.push_back(std::make_pair("filtered(sub(file))",
+		fn_make_stream(boost::bind(makeFiltered,
+			fn_make_stream(boost::bind(makeSub, file, _1)), _1))));
+	types.push_back(std::make_pair("sub(sub(memory))",
+		fn_make_stream(boost::bind(makeSub,
+			fn_make_stream(boost::bind(makeSub, memory, _1)), _1))));
+
+	try {
+		bench_report report(std::cout, format);
+		std::vector<uint8_t> buffer(accessSizes[
+			sizeof(accessSizes) / sizeof(accessSizes[0]) - 1]);
+		bench_fill(&buffer[0], buffer.size(), 0);
+
+		for (unsigned int ti = 0; ti < types.size(); ti++) {
+			if (types[ti].first.find(only) == std::string::npos) continue;
+			stream::inout_sptr s = types[ti].second(size);
+
+			for (unsigned int ai = 0;
+				ai < sizeof(accessSizes) / sizeof(accessSizes[0]); ai++
+			) {
+				stream::len access = accessSizes[ai];
+				if (access > size) break;
+				// Check the clock roughly every 64 kB, or every 256 ops for small
+				// fields.
+				unsigned long batch = std::max(256UL,
+					(unsigned long)(65536 / access));
+				if (access >= 65536) batch = 1;
+				// Each operation on a simulated device takes long enough to time on
+				// its own.
+				if (device != "none") batch = 1;
+				uint32_t rng = 1;
+
+				const char *opNames[] = {"read", "write", "seek+read"};
+				fn_bench_body bodies[] = {
+					boost::bind(benchRead, s, &buffer, access, batch, _1),
+					boost::bind(benchWrite, s, &buffer, access, size, batch, _1),
+					boost::bind(benchSeek, s, &buffer, access, size, &rng, batch, _1),
+				};
+				for (unsigned int oi = 0; oi < 3; oi++) {
+					s->seekg(0, stream::start);
+					bench_timing t = bench_run(bodies[oi], minTime);
+					bench_row row;
+					row.add("stream", types[ti].first)
+						.add("device", device)
+						.add("op", std::string(opNames[oi]))
+						.add("access", (double)access)
+						.add(t);
+					report.add(row);
+				}
+			}
+		}
+	} catch (const std::exception& e) {
+		std::cerr << "bench-stream: " << e.what() << std::endl;
+		return 2;
+	}
+	return 0;
+}
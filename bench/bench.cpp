@@ -0,0 +1,226 @@
+/**
+ * @file   bench.cpp
+ * @brief  Common code for the benchmark programs.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <stdexcept>
+#include <sys/resource.h>
+#include <boost/chrono.hpp>
+#include "bench.hpp"
+
+bench_timing::bench_timing()
+	:	ops(0),
+		bytes(0),
+		seconds(0)
+{
+}
+
+double bench_timing::opsPerSecond() const
+{
+	return this->seconds > 0 ? this->ops / this->seconds : 0;
+}
+
+double bench_timing::mbPerSecond() const
+{
+	return this->seconds > 0
+		? this->bytes / this->seconds / (1024.0 * 1024.0) : 0;
+}
+
+bench_timing bench_run(fn_bench_body body, double minSeconds)
+{
+	typedef boost::chrono::steady_clock clock;
+	bench_timing t;
+
+	// One untimed call to warm up caches and fault in any buffers.
+	bench_timing warmup;
+	body(warmup);
+
+	clock::time_point tStart = clock::now();
+	boost::chrono::duration<double> elapsed;
+	do {
+		body(t);
+		elapsed = clock::now() - tStart;
+	} while (elapsed.count() < minSeconds);
+	t.seconds = elapsed.count();
+	return t;
+}
+
+long bench_peak_rss_kb()
+{
+	// Linux keeps a resettable peak in /proc, which getrusage() doesn't see.
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, 6, "VmHWM:") == 0) {
+			return strtol(line.c_str() + 6, NULL, 10);
+		}
+	}
+
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return usage.ru_maxrss;
+}
+
+bool bench_reset_peak_rss()
+{
+	std::ofstream clear("/proc/self/clear_refs");
+	if (!clear) return false;
+	clear << "5" << std::flush;
+	return clear.good();
+}
+
+bench_row& bench_row::add(const std::string& key, const std::string& value)
+{
+	this->keys.push_back(key);
+	this->values.push_back(value);
+	this->isText.push_back(true);
+	return *this;
+}
+
+bench_row& bench_row::add(const std::string& key, double value)
+{
+	std::ostringstream ss;
+	ss.precision(10);
+	ss << value;
+	this->keys.push_back(key);
+	this->values.push_back(ss.str());
+	this->isText.push_back(false);
+	return *this;
+}
+
+bench_row& bench_row::add(const bench_timing& t)
+{
+	this->add("ops", (double)t.ops);
+	this->add("bytes", (double)t.bytes);
+	this->add("seconds", t.seconds);
+	this->add("ops_per_s", t.opsPerSecond());
+	this->add("mb_per_s", t.mbPerSecond());
+	return *this;
+}
+
+bench_report::bench_report(std::ostream& s, const std::string& format)
+	:	s(s),
+		first(true)
+{
+	if (format == "json") this->json = true;
+	else if (format == "csv") this->json = false;
+	else throw std::invalid_argument("Unknown output format: " + format);
+
+	if (this->json) this->s << "[";
+}
+
+bench_report::~bench_report()
+{
+	if (this->json) this->s << "\n]\n";
+	this->s << std::flush;
+}
+
+void bench_report::add(const bench_row& row)
+{
+	if (this->json) {
+		this->s << (this->first ? "\n" : ",\n") << "{";
+		for (unsigned int i = 0; i < row.keys.size(); i++) {
+			if (i) this->s << ",";
+			this->s << "\"" << row.keys[i] << "\":";
+			if (row.isText[i]) this->s << "\"" << row.values[i] << "\"";
+			else this->s << row.values[i];
+		}
+		this->s << "}";
+	} else {
+		if (this->first) {
+			for (unsigned int i = 0; i < row.keys.size(); i++) {
+				if (i) this->s << ",";
+				this->s << row.keys[i];
+			}
+			this->s << "\n";
+		}
+		for (unsigned int i = 0; i < row.values.size(); i++) {
+			if (i) this->s << ",";
+			this->s << row.values[i];
+		}
+		this->s << "\n";
+	}
+	this->s << std::flush;
+	this->first = false;
+	return;
+}
+
+/// Split one line of CSV into fields.  Quoting is not supported, as
+/// bench_report never writes any.
+static std::vector<std::string> splitCSV(const std::string& line)
+{
+	std::vector<std::string> fields;
+	std::string::size_type start = 0, comma;
+	do {
+		comma = line.find(',', start);
+		fields.push_back(line.substr(start, comma - start));
+		start = comma + 1;
+	} while (comma != std::string::npos);
+	return fields;
+}
+
+bench_baseline bench_load_baseline(std::istream& s,
+	const std::vector<std::string>& keys, const std::string& value)
+{
+	bench_baseline baseline;
+	std::string line;
+	if (!std::getline(s, line)) return baseline;
+
+	std::vector<std::string> header = splitCSV(line);
+	std::vector<unsigned int> keyCols;
+	unsigned int valueCol = header.size();
+	for (unsigned int k = 0; k < keys.size(); k++) {
+		unsigned int i = std::find(header.begin(), header.end(), keys[k])
+			- header.begin();
+		if (i == header.size()) {
+			throw std::invalid_argument("Baseline has no \"" + keys[k]
+				+ "\" column");
+		}
+		keyCols.push_back(i);
+	}
+	valueCol = std::find(header.begin(), header.end(), value) - header.begin();
+	if (valueCol == header.size()) {
+		throw std::invalid_argument("Baseline has no \"" + value + "\" column");
+	}
+
+	while (std::getline(s, line)) {
+		std::vector<std::string> fields = splitCSV(line);
+		if (fields.size() != header.size()) continue;
+		std::string key;
+		for (unsigned int k = 0; k < keyCols.size(); k++) {
+			if (k) key += '/';
+			key += fields[keyCols[k]];
+		}
+		baseline[key] = strtod(fields[valueCol].c_str(), NULL);
+	}
+	return baseline;
+}
+
+void bench_fill(uint8_t *buffer, camoto::stream::len len, uint32_t seed)
+{
+	uint32_t x = seed * 2654435761U + 1;
+	for (camoto::stream::len i = 0; i < len; i++) {
+		x = x * 1103515245U + 12345U;
+		buffer[i] = x >> 24;
+	}
+	return;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file   bench.hpp
+ * @brief  Common code for the benchmark programs.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_BENCH_HPP_
+#define _CAMOTO_BENCH_HPP_
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <camoto/stream.hpp>
+
+/// Totals from running a benchmark body.
+struct bench_timing {
+	unsigned long long ops;    ///< Number of operations performed
+	unsigned long long bytes;  ///< Number of bytes processed
+	double seconds;            ///< Time taken
+
+	bench_timing();
+
+	/// Operations per second.
+	double opsPerSecond() const;
+
+	/// Megabytes (2^20 bytes) per second.
+	double mbPerSecond() const;
+};
+
+/// Benchmark body.
+/**
+ * Each call should perform a small batch of operations, adding the number of
+ * operations and bytes processed to the bench_timing passed in.
+ */
+typedef boost::function<void(bench_timing&)> fn_bench_body;
+
+/// Call a benchmark body repeatedly until a minimum time has passed.
+/**
+ * @param body
+ *   Function to call.
+ *
+ * @param minSeconds
+ *   Keep calling \e body until at least this much time has passed.
+ *
+ * @return Totals across all calls.
+ */
+bench_timing bench_run(fn_bench_body body, double minSeconds);
+
+/// Peak resident set size of this process, in kilobytes.
+/**
+ * This is the peak since the process started, or since the last call to
+ * bench_reset_peak_rss() if the OS supports resetting it.
+ */
+long bench_peak_rss_kb();
+
+/// Start measuring peak memory usage again from the current usage.
+/**
+ * @return true on success, false if the OS can't do this, in which case
+ *   bench_peak_rss_kb() continues to report the peak for the whole process.
+ */
+bool bench_reset_peak_rss();
+
+/// One line of benchmark output.
+class bench_row
+{
+	public:
+		/// Add a text field.
+		bench_row& add(const std::string& key, const std::string& value);
+
+		/// Add a numeric field.
+		bench_row& add(const std::string& key, double value);
+
+		/// Add the standard fields from a bench_timing.
+		/**
+		 * This adds ops, bytes, seconds, ops_per_s and mb_per_s.
+		 */
+		bench_row& add(const bench_timing& t);
+
+		/// Field names, in the order they were added.
+		std::vector<std::string> keys;
+
+		/// Field values, already formatted.
+		std::vector<std::string> values;
+
+		/// Which values are text, and need quoting in JSON.
+		std::vector<bool> isText;
+};
+
+/// Writes benchmark results in a machine-readable format.
+/**
+ * Rows are written out as they are added, so a long run can be watched as it
+ * happens.  Every row should have the same fields in the same order.
+ */
+class bench_report
+{
+	public:
+		/// Constructor.
+		/**
+		 * @param s
+		 *   Where to write the results.
+		 *
+		 * @param format
+		 *   "csv" or "json".
+		 *
+		 * @throw std::invalid_argument
+		 *   Unknown format.
+		 */
+		bench_report(std::ostream& s, const std::string& format);
+
+		/// Finish off the output.
+		~bench_report();
+
+		/// Write out one row.
+		void add(const bench_row& row);
+
+	protected:
+		std::ostream& s;  ///< Output stream
+		bool json;        ///< JSON if true, CSV if false
+		bool first;       ///< No rows written yet
+};
+
+/// Baseline results, mapping a case's key to the value being compared.
+typedef std::map<std::string, double> bench_baseline;
+
+/// Load results previously written by bench_report in CSV format.
+/**
+ * @param s
+ *   CSV data to read.
+ *
+ * @param keys
+ *   Names of the fields identifying each case.  Their values are joined with
+ *   '/' to form the key in the returned map.
+ *
+ * @param value
+ *   Name of the field to store in the map, e.g. "mb_per_s".
+ *
+ * @throw std::invalid_argument
+ *   The CSV header is missing one of the requested fields.
+ */
+bench_baseline bench_load_baseline(std::istream& s,
+	const std::vector<std::string>& keys, const std::string& value);
+
+/// Fill a buffer with repeatable data.
+/**
+ * @param buffer
+ *   Buffer to fill.
+ *
+ * @param len
+ *   Size of \e buffer.
+ *
+ * @param seed
+ *   The same seed always produces the same data.
+ */
+void bench_fill(uint8_t *buffer, camoto::stream::len len, uint32_t seed);
+
+#endif // _CAMOTO_BENCH_HPP_
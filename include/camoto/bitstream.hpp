@@ -144,7 +144,7 @@ class DLL_EXPORT bitstream {
 		 *
 		 * @return The number of *bits* read, or < 0 on error (e.g. EOF/-1)
 		 */
-		int read(fn_getnextchar fnNextChar, unsigned int bits, unsigned int *out);
+		int read(const fn_getnextchar& fnNextChar, unsigned int bits, unsigned int *out);
 
 		/// Write some bits out to the stream.
 		/**
@@ -184,7 +184,7 @@ class DLL_EXPORT bitstream {
 		 *
 		 * @return The number of *bits* written, or < 0 on error (e.g. EOF/-1)
 		 */
-		int write(fn_putnextchar fnNextChar, unsigned int bits, unsigned int in);
+		int write(const fn_putnextchar& fnNextChar, unsigned int bits, unsigned int in);
 
 		/// Seek to a given bit position within the stream.
 		/**
@@ -237,7 +237,7 @@ class DLL_EXPORT bitstream {
 		 * @param fnNextChar
 		 *   The function to call to write the next byte.
 		 */
-		void flushByte(fn_putnextchar fnNextChar);
+		void flushByte(const fn_putnextchar& fnNextChar);
 
 		/// Write bufByte out to the parent stream if it has changed.
 		/**
@@ -0,0 +1,228 @@
+/**
+ * @file  camoto/chunk_index.hpp
+ * @brief Saved tables of chunk offsets, for reopening containers quickly.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_CHUNK_INDEX_HPP_
+#define _CAMOTO_CHUNK_INDEX_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+
+/// Table of the chunks found in a container file.
+/**
+ * Parsing a container usually means walking from one chunk header to the
+ * next, with a seek and a small read for each one.  On slow storage this can
+ * take much longer than the file's size would suggest.  A chunk_index holds
+ * the results of that walk so they can be saved and loaded again next time,
+ * in a format that any container parser can use.
+ *
+ * Chunks are grouped into lists, one per level of the container's tree.  Each
+ * list is identified by the offset in the file where its first chunk header
+ * would be, which is unique within a file.  A parser looks up a list before
+ * reading the headers itself, and adds the list after reading them if it
+ * wasn't there.
+ *
+ * The index records which file it was made from, and index_cache uses this
+ * to make sure an index is never used once the file has changed.
+ */
+class DLL_EXPORT chunk_index
+{
+	public:
+		/// Details of the file an index was made from.
+		struct key {
+			std::string path;     ///< Filename of the container
+			stream::len size;     ///< Size of the file in bytes
+			int64_t mtime;        ///< Last modification time, in seconds
+			uint64_t headerHash;  ///< Hash of the start of the file
+
+			key();
+
+			/// Do both keys refer to the same version of the same file?
+			bool operator==(const key& other) const;
+		};
+
+		/// One chunk in a list.
+		struct entry {
+			std::string name;  ///< Chunk ID or filename, as the parser defines
+			stream::pos start; ///< Offset of the chunk's content
+			stream::len len;   ///< Length of the chunk's content
+			std::string type;  ///< Subtype (e.g. of a LIST chunk), or empty
+
+			entry();
+		};
+
+		/// A list of chunks at one level of the tree.
+		typedef std::vector<entry> list;
+
+		/// Create an empty index.
+		chunk_index();
+
+		/// File this index was made from.
+		key id;
+
+		/// Get a previously added list of chunks.
+		/**
+		 * @param parent
+		 *   Offset identifying the list.
+		 *
+		 * @return The list, or NULL if it hasn't been added.
+		 */
+		const list *find(stream::pos parent) const;
+
+		/// Add or replace a list of chunks.
+		/**
+		 * @param parent
+		 *   Offset identifying the list.
+		 *
+		 * @param chunks
+		 *   Chunks in the list, which may be empty.
+		 */
+		void add(stream::pos parent, const list& chunks);
+
+		/// Set the subtype of one chunk in a list.
+		/**
+		 * Some formats only reveal a chunk's subtype once the chunk is opened,
+		 * so this records it for next time.
+		 *
+		 * @param parent
+		 *   Offset identifying the list.  The list must have been added.
+		 *
+		 * @param index
+		 *   Index of the chunk in the list.
+		 *
+		 * @param type
+		 *   Subtype to store.
+		 */
+		void setType(stream::pos parent, unsigned int index,
+			const std::string& type);
+
+		/// Has anything been added since the index was created or loaded?
+		bool changed() const;
+
+		/// Write the index out.
+		/**
+		 * @param out
+		 *   Stream to write to, starting at its current write pointer.
+		 */
+		void write(stream::output_sptr out) const;
+
+		/// Replace the index with one previously written.
+		/**
+		 * @param in
+		 *   Stream to read from, starting at its current read pointer.
+		 *
+		 * @throw stream::error
+		 *   The data is not an index, is from an unknown version of this library
+		 *   or is truncated.  The index is left empty.
+		 */
+		void read(stream::input_sptr in);
+
+	protected:
+		std::map<stream::pos, list> lists; ///< Lists by parent offset
+		bool isChanged;                    ///< Has anything been added?
+};
+
+/// Shared pointer to a chunk_index.
+typedef boost::shared_ptr<chunk_index> chunk_index_sptr;
+
+/// Saves and loads chunk indices on disk.
+/**
+ * @code
+ * index_cache cache("");
+ * chunk_index_sptr index = cache.load(filename, content);
+ * IFFReader iff(content, IFF::Filetype_RIFF, index);
+ * // ... read the file ...
+ * cache.save(index);
+ * @endcode
+ */
+class DLL_EXPORT index_cache
+{
+	public:
+		/// Prepare to load and save indices.
+		/**
+		 * @param dir
+		 *   Directory to keep the indices in, named after a hash of each
+		 *   container's path.  If this is empty, each index is kept next to its
+		 *   container as a sidecar file, named after it with ".cidx" appended.
+		 */
+		index_cache(const std::string& dir);
+
+		/// Work out the key for a file as it is now.
+		/**
+		 * @param path
+		 *   Filename of the container.
+		 *
+		 * @param content
+		 *   The container's content, already open.  Up to the first 4 kB is
+		 *   read to check it hasn't changed in a way that kept the same size and
+		 *   modification time.  Its read pointer is restored afterwards.
+		 *
+		 * @throw stream::error
+		 *   The file does not exist or could not be read.
+		 */
+		static chunk_index::key makeKey(const std::string& path,
+			stream::input_sptr content);
+
+		/// Get the saved index for a file.
+		/**
+		 * @param path
+		 *   Filename of the container.  The same file must always be given with
+		 *   the same path, e.g. always absolute, for its index to be found.
+		 *
+		 * @param content
+		 *   The container's content, already open.
+		 *
+		 * @return The saved index, or if there is none or the file has changed
+		 *   since, an empty index with the file's current key ready to be filled
+		 *   in and saved.
+		 *
+		 * @throw stream::error
+		 *   The container itself could not be read.  Problems with the saved
+		 *   index just return an empty one.
+		 */
+		chunk_index_sptr load(const std::string& path,
+			stream::input_sptr content);
+
+		/// Save an index, if anything has been added to it.
+		/**
+		 * The index is written to a temporary file first and then renamed, so
+		 * another process never sees a half-written index.
+		 *
+		 * @param index
+		 *   Index to save, as returned by load().
+		 *
+		 * @throw stream::error
+		 *   The index could not be written.
+		 */
+		void save(chunk_index_sptr index);
+
+		/// Filename where the index for a given container is kept.
+		std::string indexPath(const std::string& path) const;
+
+	protected:
+		std::string dir; ///< Directory holding the indices, or empty
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_CHUNK_INDEX_HPP_
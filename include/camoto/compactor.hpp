@@ -0,0 +1,160 @@
+/**
+ * @file  camoto/compactor.hpp
+ * @brief Remove the holes from an archive, moving as little data as possible.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_COMPACTOR_HPP_
+#define _CAMOTO_COMPACTOR_HPP_
+
+#include <vector>
+#include <camoto/stream.hpp>
+#include <camoto/stream_sub.hpp>
+
+/// Size of each block copied by the compactor.
+#define COMPACT_BLOCK_SIZE PIPELINE_BUFFER_SIZE
+
+namespace camoto {
+
+/// Moves archive members together to remove the holes between them.
+/**
+ * Updating members in place (see free_space) leaves holes behind, and after
+ * many edits an archive should be compacted.  The members still in use are
+ * added, a plan is made, and then the plan is carried out with stream::move()
+ * one member at a time, relocating each member's substream as it goes.
+ *
+ * Where the format allows members in any order, members past the compacted
+ * size are moved into the holes before it, so only those are copied.  If
+ * they can't be packed into the holes exactly, or the order must be kept,
+ * each member is instead slid down against the one before it.
+ *
+ * Compaction can be spread over several calls to run() with a time limit,
+ * updating the FAT in between.  If run() stops partway through a member, only
+ * that member is unusable until the next call.
+ * Once done() is true the parent can be truncated to extent().
+ *
+ * @code
+ * compactor c(content, lenHeader, false);
+ * for (each file) c.add(file.substream);
+ * while (!c.run(50)) {
+ *   // Write the new offsets to the FAT, handle UI events, etc.
+ * }
+ * content->truncate(c.extent());
+ * @endcode
+ */
+class DLL_EXPORT compactor
+{
+	public:
+		/// One member's move.
+		struct step {
+			stream::sub_sptr member; ///< Member to move
+			stream::pos from;        ///< Offset of the member before the move
+			stream::pos to;          ///< Offset of the member after the move
+		};
+
+		/// Prepare to compact an archive.
+		/**
+		 * @param parent
+		 *   The archive's content, which all the members are substreams of.
+		 *
+		 * @param base
+		 *   Offset of the first byte members may use, e.g. after a header.
+		 *
+		 * @param keepOrder
+		 *   true if the members must stay in the same order in the file.
+		 */
+		compactor(stream::inout_sptr parent, stream::pos base, bool keepOrder);
+
+		/// Add a member that is in use.
+		/**
+		 * Members must not overlap each other or start before \e base.
+		 *
+		 * @param member
+		 *   Substream holding the member, opened over \e parent.
+		 */
+		void add(stream::sub_sptr member);
+
+		/// Work out which members to move and where.
+		/**
+		 * This is called automatically by run(), but can be called first to
+		 * look at the plan.  No more members can be added afterwards.
+		 *
+		 * @return The moves, in the order they will be made.
+		 */
+		const std::vector<step>& plan();
+
+		/// Carry out some or all of the plan.
+		/**
+		 * Members are copied in blocks of COMPACT_BLOCK_SIZE bytes through a
+		 * buffer kept by the compactor.  A member is only relocated once all of
+		 * it has been copied.
+		 *
+		 * @param msLimit
+		 *   Stop once this many milliseconds have passed, checked between
+		 *   blocks.  At least one block is always copied so each call makes
+		 *   progress.  0 means no limit.
+		 *
+		 * @return true if the plan is complete.  If false, the call may have
+		 *   stopped partway through a member.  That member's data is then split
+		 *   between its old and new places, so it must not be accessed until a
+		 *   later call to run() has finished moving it.  Every other member can
+		 *   be used as normal.
+		 *
+		 * @throw stream::error
+		 *   A member could not be moved.  Members moved before it have been
+		 *   relocated.  The block being copied is kept in memory, and the rest
+		 *   of the member is never overwritten before it is copied, so calling
+		 *   run() again carries on from the failed block.  Nothing else may
+		 *   write to the parent in between.
+		 */
+		bool run(unsigned long msLimit);
+
+		/// Has every step in the plan been carried out?
+		bool done() const;
+
+		/// Number of bytes still to be moved by the plan.
+		stream::len bytesToMove() const;
+
+		/// Size of the archive once compaction is complete.
+		stream::len extent() const;
+
+	protected:
+		stream::inout_sptr parent;            ///< Archive content
+		stream::pos base;                     ///< First usable offset
+		bool keepOrder;                       ///< Keep members in order?
+		std::vector<stream::sub_sptr> members; ///< Members in use
+		std::vector<step> steps;              ///< The plan
+		unsigned int nextStep;                ///< Index of the next move
+		stream::len stepDone;                 ///< Bytes of the next move done
+		std::vector<uint8_t> block;           ///< Buffer for copying
+		stream::len blockLen;                 ///< Bytes in block not yet written
+		bool planned;                         ///< Has plan() been run?
+		stream::len lenLive;                  ///< Total size of all members
+
+		/// Plan to fill the holes with members from the end.
+		/**
+		 * @return false if the members won't fit, leaving \e steps empty.
+		 */
+		bool planFill();
+
+		/// Plan to slide every member down against the one before it.
+		void planSlide();
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_COMPACTOR_HPP_
@@ -0,0 +1,137 @@
+/**
+ * @file  camoto/cpu.hpp
+ * @brief Pick the fastest version of a kernel for the CPU we're running on.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_CPU_HPP_
+#define _CAMOTO_CPU_HPP_
+
+#include <string>
+
+#ifndef DLL_EXPORT
+#define DLL_EXPORT
+#endif
+
+namespace camoto {
+
+/// Instruction set levels a kernel can be written for, slowest first.
+/**
+ * Each level implies all the ones before it.
+ */
+enum cpu_level {
+	cpu_scalar, ///< Plain C++, runs anywhere
+	cpu_sse42,  ///< x86 with SSE4.2 (and so SSSE3)
+	cpu_avx2,   ///< x86 with AVX2
+	cpu_avx512, ///< x86 with AVX-512F and AVX-512BW
+	cpu_level_count ///< Number of levels, not a valid level
+};
+
+/// Highest level the CPU and operating system support.
+cpu_level DLL_EXPORT cpu_detected();
+
+/// Level kernels are selected for.
+/**
+ * This is cpu_detected(), unless the CAMOTO_CPU_LEVEL environment variable
+ * was set when the library was loaded.  It can be set to any name returned by
+ * cpu_level_name() to force a lower level, for testing or comparing speed.
+ * Asking for a level the CPU doesn't support gets the highest one it does.
+ */
+cpu_level DLL_EXPORT cpu_active();
+
+/// Short name of a level, as used by CAMOTO_CPU_LEVEL.
+const char DLL_EXPORT *cpu_level_name(cpu_level level);
+
+/// Find a level by the name returned by cpu_level_name().
+/**
+ * @param name
+ *   Level name, e.g. "avx2".
+ *
+ * @param level
+ *   Set to the level on success, unchanged otherwise.
+ *
+ * @return true if \e name was found, false if not.
+ */
+bool DLL_EXPORT cpu_level_from_name(const std::string& name, cpu_level *level);
+
+/// One implementation of a kernel.
+template <typename Fn>
+struct cpu_variant {
+	cpu_level level; ///< Lowest level this implementation will run on
+	Fn fn;           ///< Implementation
+};
+
+/// A kernel with an implementation for one or more cpu_level values.
+/**
+ * The fastest implementation that can run at cpu_active() is picked once,
+ * when the kernel is constructed, so calling it costs a single indirect call.
+ * Kernels are constructed as globals at load time, so they can't be called
+ * from other global constructors.
+ *
+ * @code
+ * static const cpu_variant<fn_example> example_variants[] = {
+ *   {cpu_scalar, example_scalar},
+ *   {cpu_avx2, example_avx2},
+ * };
+ * const cpu_kernel<fn_example> kernel_example("example", example_variants, 2);
+ * @endcode
+ */
+template <typename Fn>
+class cpu_kernel
+{
+	public:
+		/// Pick the best implementation for this CPU.
+		/**
+		 * @param name
+		 *   Name of the kernel, for messages.
+		 *
+		 * @param variants
+		 *   Array of implementations, in order of increasing level.  The first
+		 *   must be the cpu_scalar one, which is the reference the others must
+		 *   match.  The array must outlive this object.
+		 *
+		 * @param count
+		 *   Number of entries in \e variants.
+		 */
+		cpu_kernel(const char *name, const cpu_variant<Fn> *variants,
+			unsigned int count)
+			:	name(name),
+				variants(variants),
+				count(count),
+				fn(this->variant(cpu_active()))
+		{
+		}
+
+		/// Best implementation that runs at the given level.
+		Fn variant(cpu_level level) const
+		{
+			Fn best = this->variants[0].fn;
+			for (unsigned int i = 1; i < this->count; i++) {
+				if (this->variants[i].level <= level) best = this->variants[i].fn;
+			}
+			return best;
+		}
+
+		const char *name;                  ///< Kernel name
+		const cpu_variant<Fn> *variants;   ///< All implementations
+		unsigned int count;                ///< Number of \e variants
+		Fn fn;                             ///< Implementation to call
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_CPU_HPP_
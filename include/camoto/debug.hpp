@@ -24,6 +24,7 @@
 #ifndef _CAMOTO_DEBUG_HPP_
 #define _CAMOTO_DEBUG_HPP_
 
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <camoto/stream.hpp>
@@ -64,10 +65,14 @@ namespace camoto {
  *
  * @post Stream is unchanged - read pointer is restored to where it
  *   was when this function was called.
+ *
+ * @see stream::hexdump() for a conventional layout that can be written to
+ *   any std::ostream.
  */
 inline void hexdumpStream(stream::input_sptr data, stream::len start = 0,
 	stream::len end = 0, unsigned int width = 16, bool hexOnly = false)
 {
+	static const char hex[] = "0123456789abcdef";
 	stream::pos orig = data->tellg();
 	stream::len lenData;
 	if (end > 0) lenData = std::min(end, data->size());
@@ -79,35 +84,55 @@ inline void hexdumpStream(stream::input_sptr data, stream::len start = 0,
 	}
 	lenData -= start;
 	data->seekg(start, stream::start);
-	std::string buf;
+
+	// Read and format a block at a time, so huge streams don't have to fit in
+	// memory and cout is only called once per block.
+	uint8_t buf[BUFFER_SIZE];
+	std::string text;
+	text.reserve(BUFFER_SIZE * 4);
+	stream::len i = 0;
 	try {
-		buf = data->read(lenData);
+		while (i < lenData) {
+			stream::len chunk = std::min(lenData - i, (stream::len)BUFFER_SIZE);
+			data->read(buf, chunk);
+			text.clear();
+			for (stream::len j = 0; j < chunk; j++, i++) {
+				if (i % width == 0) {
+					text += CLR_NORM;
+					if (i > 0) text += '\n';
+					char offset[16];
+					unsigned int n = 0;
+					stream::len v = i;
+					do {
+						offset[n++] = hex[v & 0x0F];
+						v >>= 4;
+					} while (v);
+					while (n < 3) offset[n++] = '0';
+					while (n) text += offset[--n];
+					text += ": " CLR_GREEN;
+				}
+				uint8_t c = buf[j];
+				if (hexOnly) {
+					text += "\\x";
+					text += hex[c >> 4];
+					text += hex[c & 0x0F];
+				} else if ((c < 32) || (c >= 127)) {
+					text += hex[c >> 4];
+					text += hex[c & 0x0F];
+					text += ' ';
+				} else {
+					text += '_';
+					text += (char)c;
+					text += ' ';
+				}
+			}
+			std::cout.write(text.data(), text.length());
+		}
 	} catch (const stream::read_error&) {
-		std::cout << "hexdumpStream(): read error" << std::endl;
+		std::cout << CLR_NORM << "\nhexdumpStream(): read error" << std::endl;
 		data->seekg(orig, stream::start);
 		return;
 	}
-	for (stream::len i = 0; i < lenData; i++) {
-		if (i % width == 0) {
-			std::cout << CLR_NORM;
-			if (i > 0) {
-				std::cout << "\n";
-			}
-			std::cout << std::setfill('0') << std::setw(3)
-				<< std::hex << i << ": " << CLR_GREEN;
-		}
-		if (hexOnly) {
-			std::cout << "\\x" << std::setfill('0') << std::setw(2)
-				<< std::hex << (int)((uint8_t)buf[i]);
-		} else {
-			if ((buf[i] < 32) || (buf[i] == 127)) {
-				std::cout << std::setfill('0') << std::setw(2)
-					<< std::hex << (int)((uint8_t)buf[i]) << ' ';
-			} else {
-				std::cout << '_' << buf[i] << ' ';
-			}
-		}
-	}
 	std::cout << CLR_NORM << std::endl;
 	data->seekg(orig, stream::start);
 	return;
@@ -120,6 +120,20 @@ class DLL_EXPORT filter
 		 */
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn) = 0;
+
+		/// Identify the encoding this filter reads or writes.
+		/**
+		 * Two filtered streams whose filters return the same fingerprint hold
+		 * their data in exactly the same encoding, so the encoded data can be
+		 * copied from one to the other as it is with stream::copy_encoded().
+		 * A decoding filter must return the same value as the encoding filter
+		 * for the same format and parameters.
+		 *
+		 * @return A string naming the format and every parameter that affects
+		 *   the encoded data, or an empty string if the data must always be
+		 *   decoded and encoded again.  The default is an empty string.
+		 */
+		virtual std::string fingerprint() const;
 };
 
 /// Shared pointer to a filter.
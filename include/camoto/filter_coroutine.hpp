@@ -0,0 +1,188 @@
+/**
+ * @file  camoto/filter_coroutine.hpp
+ * @brief Adapter allowing a filter algorithm to be written as straight-line
+ *        code, run incrementally as a coroutine.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FILTER_COROUTINE_HPP_
+#define _CAMOTO_FILTER_COROUTINE_HPP_
+
+#include <boost/coroutine2/coroutine.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <camoto/bitstream.hpp>
+#include <camoto/filter.hpp>
+
+#ifndef DLL_EXPORT
+#define DLL_EXPORT
+#endif
+
+namespace camoto {
+
+/// Base class for filters written as a single pass over the data.
+/**
+ * A normal filter has to save its state whenever transform() runs out of
+ * input data or output space, and pick up where it left off on the next
+ * call.  This gets complicated when a codeword spans two input buffers.
+ *
+ * A filter deriving from this class instead implements run(), which reads
+ * the entire input with read() or readBits() and writes the entire output
+ * with write() or writeBits(), as if both were unlimited.  run() is executed
+ * as a coroutine: whenever it needs more input or more output space it is
+ * suspended, transform() returns, and it is resumed on the next call to
+ * transform() exactly where it was.
+ *
+ * The coroutine's stack is allocated once in reset(), so transform() itself
+ * does not allocate any memory.
+ *
+ * @code
+ * class filter_xor: public filter_coroutine {
+ *   protected:
+ *     virtual void run()
+ *     {
+ *       uint8_t b;
+ *       while (this->read(&b)) this->write(b ^ 0xFF);
+ *     }
+ * };
+ * @endcode
+ *
+ * @note run() is unwound with a special exception if the filter is reset or
+ *   destroyed before it has finished.  Any catch(...) blocks inside run() must
+ *   rethrow what they catch.
+ */
+class DLL_EXPORT filter_coroutine: public filter
+{
+	public:
+		/// Constructor.
+		/**
+		 * @param endianType
+		 *   Bit order used by readBits() and writeBits().
+		 */
+		filter_coroutine(bitstream::endian endianType = bitstream::littleEndian);
+
+		virtual ~filter_coroutine();
+
+		virtual void reset(stream::len lenInput);
+		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
+			stream::len *lenIn);
+
+	protected:
+		/// The filter algorithm.
+		/**
+		 * This is called once per reset(), and must process all the input
+		 * data before returning.
+		 *
+		 * @throw filter_error
+		 *   The data was corrupted and could not be filtered.  The exception is
+		 *   passed on to the caller of transform().
+		 */
+		virtual void run() = 0;
+
+		/// Read the next byte of input.
+		/**
+		 * @param b
+		 *   Where to store the byte.
+		 *
+		 * @return true if a byte was read, false at the end of the input data.
+		 */
+		inline bool read(uint8_t *b)
+		{
+			while (this->inPos == this->inEnd) {
+				if (this->inEOF) return false;
+				this->suspend();
+			}
+			*b = *this->inPos++;
+			return true;
+		}
+
+		/// Read some bits from the input data.
+		/**
+		 * @param bits
+		 *   Number of bits to read, up to 24.
+		 *
+		 * @param out
+		 *   Where to store the value read.
+		 *
+		 * @return The number of bits actually read, which will only be less
+		 *   than \e bits at the end of the input data.  As with bitstream::read(),
+		 *   a short big-endian value is padded with zero bits at the end.
+		 */
+		unsigned int readBits(unsigned int bits, unsigned int *out);
+
+		/// Discard any bits left over in the current input byte.
+		/**
+		 * The next readBits() call will start at the following byte boundary.
+		 */
+		void flushReadBits();
+
+		/// Write one byte of output.
+		/**
+		 * @param b
+		 *   Byte to write.
+		 */
+		inline void write(uint8_t b)
+		{
+			while (this->outPos == this->outEnd) this->suspend();
+			*this->outPos++ = b;
+		}
+
+		/// Write some bits to the output data.
+		/**
+		 * @param bits
+		 *   Number of bits to write, up to 24.
+		 *
+		 * @param in
+		 *   The value to write.  Only the lower \e bits bits are used.
+		 */
+		void writeBits(unsigned int bits, unsigned int in);
+
+		/// Write out any partially filled output byte, padded with zero bits.
+		void flushWriteBits();
+
+		/// Length of the input data, as passed to reset().
+		stream::len lenInput;
+
+		/// Bit order used by readBits() and writeBits().
+		bitstream::endian endianType;
+
+	private:
+		typedef boost::coroutines2::coroutine<void> coroutine;
+
+		/// Return to transform(), to be resumed by the next call.
+		void suspend();
+
+		/// Coroutine entry point, calls run().
+		void entry(coroutine::pull_type& caller);
+
+		boost::scoped_ptr<coroutine::push_type> coro; ///< Running run()
+		coroutine::pull_type *caller; ///< Used to suspend the coroutine
+
+		const uint8_t *inPos;  ///< Next byte to be read
+		const uint8_t *inEnd;  ///< One past the last byte of available input
+		bool inEOF;            ///< No more input will arrive after inEnd
+		uint8_t *outPos;       ///< Where the next byte is written
+		uint8_t *outEnd;       ///< One past the last byte of output space
+
+		uint32_t readBuf;      ///< Bits read from the input but not yet used
+		unsigned int readBufBits; ///< Number of valid bits in readBuf
+		uint32_t writeBuf;     ///< Bits waiting to be written as a full byte
+		unsigned int writeBufBits; ///< Number of valid bits in writeBuf
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_FILTER_COROUTINE_HPP_
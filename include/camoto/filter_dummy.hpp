@@ -33,6 +33,7 @@ class DLL_EXPORT filter_dummy: public filter
 		virtual void reset(stream::len lenInput);
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
+		virtual std::string fingerprint() const;
 };
 
 } // namespace camoto
@@ -0,0 +1,153 @@
+/**
+ * @file  camoto/free_space.hpp
+ * @brief Track unused space in an archive, to update it in place.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FREE_SPACE_HPP_
+#define _CAMOTO_FREE_SPACE_HPP_
+
+#include <map>
+#include <camoto/stream.hpp>
+#include <camoto/stream_sub.hpp>
+
+namespace camoto {
+
+/// Map of the unused space (holes) in an archive.
+/**
+ * Growing a member in the middle of an archive normally means shifting
+ * everything after it along.  If the archive format allows members to be
+ * stored out of order, the member can instead be moved into a hole left by
+ * a deleted or shrunk member, or to the end of the file, so only the member
+ * itself is copied and only its FAT entry changes.
+ *
+ * Offsets are relative to the start of the area being managed.  Everything
+ * before extent() that isn't a hole is in use, and everything after it is
+ * free.
+ */
+class DLL_EXPORT free_space
+{
+	public:
+		/// Where allocate() puts new data.
+		enum placement {
+			/// Use the smallest hole that fits, or the end if none do.
+			best_fit,
+
+			/// Always use the end, leaving holes alone.
+			append,
+		};
+
+		/// Map out an area that is entirely in use.
+		/**
+		 * @param extent
+		 *   Size of the area, usually the archive's size.  Holes are then
+		 *   added with release().
+		 */
+		free_space(stream::len extent);
+
+		/// Mark part of the area as unused.
+		/**
+		 * Neighbouring holes are merged, and a hole reaching extent() makes
+		 * the area smaller instead.
+		 *
+		 * @param start
+		 *   Offset of the first unused byte.
+		 *
+		 * @param len
+		 *   Number of unused bytes.  It is not an error for these to already
+		 *   be free.
+		 */
+		void release(stream::pos start, stream::len len);
+
+		/// Mark part of the area as in use.
+		/**
+		 * @param start
+		 *   Offset of the first byte now in use.  The area grows if needed.
+		 *
+		 * @param len
+		 *   Number of bytes now in use.
+		 */
+		void reserve(stream::pos start, stream::len len);
+
+		/// Find space for new data and mark it as in use.
+		/**
+		 * @param len
+		 *   Number of bytes needed.
+		 *
+		 * @param policy
+		 *   Where to look for the space.
+		 *
+		 * @return Offset of the space.  If this is at the end the area has
+		 *   grown, and the caller must extend the underlying stream to match.
+		 */
+		stream::pos allocate(stream::len len, placement policy);
+
+		/// Change the size of a member of an archive, moving it if needed.
+		/**
+		 * A member that shrinks frees its tail.  A member that grows takes the
+		 * space after it if that is free, and otherwise its data is moved to
+		 * space found by allocate() and the old space freed.  Either way the
+		 * substream is relocated and resized to match, so the only thing left
+		 * for the caller to do is update the member's FAT entry.
+		 *
+		 * @param parent
+		 *   The archive's content, which \e member is a substream of.  It is
+		 *   extended if the member's new place goes past its end, but never
+		 *   shrunk.
+		 *
+		 * @param member
+		 *   Substream holding the member, opened over \e parent.
+		 *
+		 * @param newLen
+		 *   New size of the member.  Space past the old size is not cleared.
+		 *
+		 * @param policy
+		 *   Where to look if the member has to move.
+		 *
+		 * @return The member's offset within \e parent, which may be new.
+		 *
+		 * @throw stream::error
+		 *   The data could not be moved.  The space map is left as it was.
+		 */
+		stream::pos resize(stream::inout_sptr parent, stream::sub_sptr member,
+			stream::len newLen, placement policy);
+
+		/// Size of the area, up to the end of the last byte in use.
+		stream::len extent() const;
+
+		/// Total size of all holes.
+		stream::len totalFree() const;
+
+		/// All holes, by offset.
+		const std::map<stream::pos, stream::len>& holes() const;
+
+	protected:
+		std::map<stream::pos, stream::len> byStart;     ///< Holes by offset
+		std::multimap<stream::len, stream::pos> bySize; ///< Holes by size
+		stream::len length;                             ///< Size of the area
+		stream::len freeBytes;                          ///< Sum of hole sizes
+
+		/// Add a hole that doesn't touch any other.
+		void addHole(stream::pos start, stream::len len);
+
+		/// Remove a hole, which must exist exactly as given.
+		void removeHole(stream::pos start, stream::len len);
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_FREE_SPACE_HPP_
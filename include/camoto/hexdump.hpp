@@ -0,0 +1,143 @@
+/**
+ * @file  camoto/hexdump.hpp
+ * @brief Hex dumps and binary comparisons of streams of any size.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_HEXDUMP_HPP_
+#define _CAMOTO_HEXDUMP_HPP_
+
+#include <iosfwd>
+#include <vector>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Layout of a hex dump.
+struct DLL_EXPORT hexdump_options {
+	/// Number of bytes on each line.
+	unsigned int width;
+
+	/// Show printable characters after the hex codes?
+	bool ascii;
+
+	/// Text to put at the start of every line.
+	std::string prefix;
+
+	/// Default layout, 16 bytes per line with ASCII.
+	hexdump_options();
+};
+
+/// Write a hex dump of part of a stream.
+/**
+ * Each line looks like this, with the offset widening to 16 digits for
+ * streams over 4GB:
+ *
+ * @code
+ * 00000010: 41 42 43 44 45 46 47 48 49 4a 4b 4c 4d 4e 4f 50  ABCDEFGHIJKLMNOP
+ * @endcode
+ *
+ * The stream is read a block at a time and each block is formatted in one
+ * go, so any amount of data can be dumped quickly in constant memory.
+ *
+ * @param out
+ *   Where to write the dump.
+ *
+ * @param data
+ *   Stream to dump.
+ *
+ * @param start
+ *   Offset of the first byte to dump.  Offsets shown are from the start of
+ *   the stream, not from here.
+ *
+ * @param len
+ *   Number of bytes to dump.  This is cut short at the end of the stream, so
+ *   the default dumps everything after \e start.
+ *
+ * @param opts
+ *   Layout of the dump.
+ *
+ * @post The read pointer is back where it was before the call.
+ */
+void DLL_EXPORT hexdump(std::ostream& out, input_sptr data, stream::pos start = 0,
+	stream::len len = (stream::len)-1,
+	const hexdump_options& opts = hexdump_options());
+
+/// A run of bytes that differs between two streams.
+struct diff_range {
+	stream::pos start; ///< Offset of the first differing byte
+	stream::len len;   ///< Number of bytes to the end of the run
+};
+
+/// Find where two streams differ.
+/**
+ * Both streams are read a block at a time, and blocks that match are skipped
+ * with a single memcmp(), so large streams with few changes compare quickly
+ * in constant memory.
+ *
+ * @param a
+ *   First stream.
+ *
+ * @param b
+ *   Second stream.
+ *
+ * @param maxRanges
+ *   Stop after finding this many ranges, or 0 to find them all.  If the limit
+ *   is reached there may be more differences after the last range.
+ *
+ * @param merge
+ *   Treat differences separated by this many matching bytes or fewer as one
+ *   range.  0 gives one range per run of differing bytes.
+ *
+ * @return The differing ranges in order.  If one stream is longer than the
+ *   other, the extra data is included as a difference.
+ *
+ * @post The read pointers of both streams are back where they were before the
+ *   call.
+ */
+std::vector<diff_range> DLL_EXPORT diff(input_sptr a, input_sptr b,
+	unsigned int maxRanges = 0, stream::len merge = 0);
+
+/// Write a hex dump of both sides of each difference.
+/**
+ * Each range is shown as whole lines from \e a, prefixed with "- ", then the
+ * same lines from \e b, prefixed with "+ ".
+ *
+ * @param out
+ *   Where to write the dump.
+ *
+ * @param a
+ *   First stream, usually the expected data.
+ *
+ * @param b
+ *   Second stream, usually the actual data.
+ *
+ * @param ranges
+ *   Differences returned by diff().
+ *
+ * @param opts
+ *   Layout of the dump.  The prefix is added before the "- " and "+ ".
+ */
+void DLL_EXPORT hexdumpDiff(std::ostream& out, input_sptr a, input_sptr b,
+	const std::vector<diff_range>& ranges,
+	const hexdump_options& opts = hexdump_options());
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_HEXDUMP_HPP_
@@ -23,6 +23,7 @@
 
 #include <vector>
 #include <camoto/stream.hpp>
+#include <camoto/chunk_index.hpp>
 
 #ifndef DLL_EXPORT
 #define DLL_EXPORT
@@ -55,6 +56,25 @@ class DLL_EXPORT IFFReader: public IFF
 	public:
 		IFFReader(stream::input_sptr iff, Filetype filetype);
 
+		/// Read a file, using and updating a saved table of its chunks.
+		/**
+		 * Chunk lists found in \e index are used as they are, without reading
+		 * any chunk headers from the file.  Lists that aren't there are read
+		 * from the file as usual and added, so the index can be saved with
+		 * index_cache::save() afterwards.
+		 *
+		 * @param iff
+		 *   File to read.
+		 *
+		 * @param filetype
+		 *   Type of file.
+		 *
+		 * @param index
+		 *   Index for this file, usually from index_cache::load().
+		 */
+		IFFReader(stream::input_sptr iff, Filetype filetype,
+			chunk_index_sptr index);
+
 		/// Return to the file root.
 		/**
 		 * From this point, the next step is always to open() the RIFF chunk.
@@ -132,12 +152,10 @@ class DLL_EXPORT IFFReader: public IFF
 	protected:
 		stream::input_sptr iff;         ///< File to read
 		Filetype filetype;              ///< Type of file (RIFF, IFF, etc.)
-		struct Chunk {
-			fourcc name;
-			stream::pos start;
-			stream::len len;
-		};
+		typedef chunk_index::entry Chunk;
 		std::vector<Chunk> chunks;
+		chunk_index_sptr index;         ///< Saved chunk lists, or NULL
+		stream::pos listStart;          ///< Offset of first chunk in \e chunks
 
 		void loadChunks(stream::len lenChunk);
 };
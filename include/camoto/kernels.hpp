@@ -0,0 +1,74 @@
+/**
+ * @file  camoto/kernels.hpp
+ * @brief Bulk data processing routines with versions for each CPU level.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_KERNELS_HPP_
+#define _CAMOTO_KERNELS_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <camoto/cpu.hpp>
+
+namespace camoto {
+
+/// Reverse the byte order of each 16-bit value in an array.
+/**
+ * @param data
+ *   Values to swap, in place.  Need not be aligned.
+ *
+ * @param count
+ *   Number of values (not bytes) in \e data.
+ */
+typedef void (*fn_swap16)(uint16_t *data, size_t count);
+
+/// Reverse the byte order of each 32-bit value in an array.
+/**
+ * @copydetails fn_swap16
+ */
+typedef void (*fn_swap32)(uint32_t *data, size_t count);
+
+/// All versions of swap16_array(), for testing and benchmarks.
+extern DLL_EXPORT const cpu_kernel<fn_swap16> kernel_swap16;
+
+/// All versions of swap32_array(), for testing and benchmarks.
+extern DLL_EXPORT const cpu_kernel<fn_swap32> kernel_swap32;
+
+/// Reverse the byte order of each 16-bit value in an array.
+/**
+ * @copydetails fn_swap16
+ */
+inline void swap16_array(uint16_t *data, size_t count)
+{
+	kernel_swap16.fn(data, count);
+	return;
+}
+
+/// Reverse the byte order of each 32-bit value in an array.
+/**
+ * @copydetails fn_swap16
+ */
+inline void swap32_array(uint32_t *data, size_t count)
+{
+	kernel_swap32.fn(data, count);
+	return;
+}
+
+} // namespace camoto
+
+#endif // _CAMOTO_KERNELS_HPP_
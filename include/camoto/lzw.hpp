@@ -23,7 +23,6 @@
 #define _CAMOTO_LZW_HPP_
 
 #include <vector>
-#include <deque>
 
 #include <camoto/bitstream.hpp>
 #include <camoto/filter.hpp>
@@ -71,7 +70,7 @@ public:
 	Dictionary(unsigned maxBits, unsigned codeStart);
 
 	void decode(unsigned oldCode, unsigned code,
-		std::deque<byte>& outStream);
+		std::vector<byte>& outStream);
 
 	unsigned size() const;
 
@@ -103,12 +102,16 @@ class DLL_EXPORT filter_lzw_decompress: public filter
 		/// The maximum codeword value at the current bit length
 		unsigned int maxCode;
 
+		/// The first valid codeword
+		unsigned int firstCode;
+
 		/// Length of initial codeword, and codeword length after a dictionary
 		/// reset (unless LZW_NO_BITSIZE_RESET is given, when the codeword length
 		/// is unchanged after a dictionary reset.)
 		unsigned int initialBits;
 
-		std::deque<char> buffer;
+		std::vector<char> buffer;  ///< Decoded bytes waiting to be returned
+		std::vector<char>::size_type bufferPos; ///< Next byte in buffer to return
 		Dictionary dictionary;
 		unsigned int currentBits;     ///< Current codeword size in bits
 		//unsigned int nextBitIncLimit; ///< Last codeword value before currentBits is next incremented
@@ -153,6 +156,7 @@ class DLL_EXPORT filter_lzw_decompress: public filter
 		virtual void reset(stream::len lenInput);
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
+		virtual std::string fingerprint() const;
 
 		void resetDictionary();
 
@@ -238,6 +242,7 @@ class DLL_EXPORT filter_lzw_compress: public filter
 		virtual void reset(stream::len lenInput);
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
+		virtual std::string fingerprint() const;
 
 		void resetDictionary();
 
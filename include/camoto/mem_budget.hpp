@@ -0,0 +1,212 @@
+/**
+ * @file  camoto/mem_budget.hpp
+ * @brief Accounting and limits for stream data held in memory.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_MEM_BUDGET_HPP_
+#define _CAMOTO_MEM_BUDGET_HPP_
+
+#include <iosfwd>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Kinds of buffer that are counted separately.
+enum mem_pool {
+	mem_memory,         ///< Content of memory streams
+	mem_filtered_read,  ///< Decoded data held by input_filtered and filtered
+	mem_filtered_write, ///< Data staged by output_filtered until flush()
+	mem_seg_insert,     ///< Inserted data held by seg until flush()
+	mem_pool_count      ///< Number of pools, not a valid pool
+};
+
+/// What to do when a buffer would grow past the budget.
+enum mem_policy {
+	/// Wait until other threads release enough memory.
+	/**
+	 * This only makes sense when other threads will release memory.  A single
+	 * request larger than the whole budget can never be satisfied, so it
+	 * throws budget_error instead of waiting forever.
+	 */
+	mem_block,
+
+	/// Move the buffer's content into a temporary file.
+	/**
+	 * Only memory streams (and so filtered streams) can do this.  Buffers that
+	 * can't be spilled, such as seg inserts, are allowed to exceed the budget.
+	 */
+	mem_spill,
+
+	/// Throw budget_error straight away.
+	mem_fail
+};
+
+/// A buffer could not grow without exceeding the memory budget.
+class DLL_EXPORT budget_error: public error
+{
+	public:
+		/// Constructor.
+		/**
+		 * @param msg
+		 *   Error description for UI messages.
+		 */
+		budget_error(const std::string& msg);
+};
+
+/// Process-wide view and control of buffered stream data.
+/**
+ * All counts are in bytes of stream data, not including allocator overhead
+ * or spare vector capacity.  There is no limit by default.
+ */
+class DLL_EXPORT mem_budget
+{
+	public:
+		/// Total bytes currently held in memory by all pools.
+		static stream::len used();
+
+		/// Bytes currently held in memory by one pool.
+		static stream::len used(mem_pool pool);
+
+		/// Highest value used() has reached since the last resetPeak().
+		static stream::len peak();
+
+		/// Set the peak back to the current value of used().
+		static void resetPeak();
+
+		/// Total bytes currently moved out to temporary files.
+		static stream::len spilled();
+
+		/// Limit the total memory used by all pools.
+		/**
+		 * @param bytes
+		 *   Budget in bytes, or 0 for no limit.  Buffers already over a new
+		 *   limit are left alone until they next grow.
+		 *
+		 * @param policy
+		 *   What to do when a buffer wants to grow past the limit.
+		 */
+		static void setLimit(stream::len bytes, mem_policy policy);
+
+		/// Current limit, or 0 if there is none.
+		static stream::len limit();
+
+		/// Current policy set by setLimit().
+		static mem_policy policy();
+
+		/// Set the folder spilled data is written to.
+		/**
+		 * @param dir
+		 *   Folder for temporary files, or an empty string to use $TMPDIR, or
+		 *   /tmp if that isn't set.
+		 */
+		static void setSpillDir(const std::string& dir);
+
+		/// Create an empty temporary file, deleted again when closed.
+		/**
+		 * @throw open_error
+		 *   The file could not be created.
+		 */
+		static inout_sptr createSpillFile();
+
+		/// Write a human-readable summary of each pool to a stream.
+		static void print(std::ostream& s);
+};
+
+/// Amount of memory held by one buffer, counted towards the budget.
+/**
+ * Owners call resize() before a buffer grows and after it shrinks.  The
+ * amount is released again when the account is destroyed.
+ *
+ * @note Not thread safe, just like the streams that own them.
+ */
+class DLL_EXPORT mem_account
+{
+	public:
+		/// Open an empty account.
+		mem_account(mem_pool pool);
+
+		~mem_account();
+
+		/// Bytes counted against this account, in memory or spilled.
+		stream::len held() const;
+
+		/// Has the owner moved its data out to a temporary file?
+		bool spilled() const;
+
+		/// Change which pool the held bytes are counted in.
+		void setPool(mem_pool pool);
+
+		/// Record a change in the size of the buffer.
+		/**
+		 * @param bytes
+		 *   New size of the buffer.
+		 *
+		 * @return true if the buffer can stay in memory.  false if the spill
+		 *   policy is in force and the owner should call spill() after moving
+		 *   its data to disk.  In this case nothing has been counted yet.  Once
+		 *   spilled, the account always returns false and \e bytes is counted
+		 *   as spilled instead.
+		 *
+		 * @throw budget_error
+		 *   The fail policy is in force and the buffer can't grow.
+		 */
+		bool resize(stream::len bytes);
+
+		/// Record a change in the size of a buffer that may not be able to spill.
+		/**
+		 * @param bytes
+		 *   New size of the buffer.
+		 *
+		 * @param canSpill
+		 *   true to behave exactly like resize(bytes).  false if the owner has
+		 *   no way to move its data to disk, in which case the spill policy
+		 *   counts the bytes anyway and lets the total go over the budget.
+		 *
+		 * @return As for resize(bytes).  Always true when \e canSpill is false
+		 *   and the account has not been spilled.
+		 *
+		 * @throw budget_error
+		 *   The fail policy is in force and the buffer can't grow.
+		 */
+		bool resize(stream::len bytes, bool canSpill);
+
+		/// Note that the owner's data now lives in a temporary file.
+		/**
+		 * The bytes held so far stop counting towards used() and are counted
+		 * by mem_budget::spilled() instead.
+		 */
+		void spill();
+
+		/// Exchange the held bytes with another account in the same pool.
+		void swap(mem_account& other);
+
+	protected:
+		mem_pool pool;     ///< Pool the bytes are counted in
+		stream::len bytes; ///< Bytes counted
+		bool onDisk;       ///< Are the bytes spilled rather than in memory?
+
+	private:
+		mem_account(const mem_account&);
+		mem_account& operator=(const mem_account&);
+};
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_MEM_BUDGET_HPP_
@@ -0,0 +1,167 @@
+/**
+ * @file  camoto/read_scheduler.hpp
+ * @brief Read many parts of an archive in one pass through the file.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_READ_SCHEDULER_HPP_
+#define _CAMOTO_READ_SCHEDULER_HPP_
+
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include <camoto/stream.hpp>
+
+/// Largest gap between two reads that read_scheduler will read through.
+#define SCHEDULER_MERGE_GAP 65536
+
+/// Largest single read read_scheduler will make when merging reads.
+#define SCHEDULER_MAX_READ (4 * 1024 * 1024)
+
+namespace camoto {
+namespace stream {
+
+/// Reads a batch of requests in order of where the data really is.
+/**
+ * Extracting archive members in FAT order from a fragmented archive seeks
+ * back and forth through the file, which is slow on spinning disks and
+ * network storage.  Instead, every read is queued with add(), and run()
+ * works out where each one really comes from by looking through any
+ * substreams and segmented streams.  The reads are then sorted by offset,
+ * reads that are next to or near each other are merged into one large read,
+ * and the data is copied out to each destination.
+ *
+ * @code
+ * read_scheduler batch;
+ * for (each file) {
+ *   file.data.resize(file.size);
+ *   batch.add(file.substream, 0, file.size, &file.data[0]);
+ * }
+ * batch.run();
+ * @endcode
+ *
+ * None of the streams may be used by anything else until the batch is done,
+ * as their read pointers are moved.
+ */
+class DLL_EXPORT read_scheduler
+{
+	public:
+		/// Prepare an empty batch.
+		/**
+		 * @param mergeGap
+		 *   Two reads separated by this many bytes or fewer are made as one
+		 *   read, with the bytes in between thrown away.
+		 *
+		 * @param maxRead
+		 *   Merged reads are not made any larger than this.  Single requests
+		 *   larger than this are still read in one go, straight into their
+		 *   destination.
+		 */
+		read_scheduler(stream::len mergeGap = SCHEDULER_MERGE_GAP,
+			stream::len maxRead = SCHEDULER_MAX_READ);
+
+		/// Wait for the batch to finish, if running in the background.
+		~read_scheduler();
+
+		/// Queue a read.
+		/**
+		 * @param src
+		 *   Stream to read from.  input_sub and seg are looked through to find
+		 *   the underlying stream.  Data that is only in memory (e.g. inserted
+		 *   into a seg but not yet flushed) is copied straight away.
+		 *
+		 * @param off
+		 *   Offset in \e src of the first byte to read.
+		 *
+		 * @param len
+		 *   Number of bytes to read.
+		 *
+		 * @param dest
+		 *   Where to put the data.  It must stay valid until the batch is done.
+		 *
+		 * @throw read_error
+		 *   The read goes past the end of a substream or seg.
+		 */
+		void add(input_sptr src, stream::pos off, stream::len len, uint8_t *dest);
+
+		/// Make all the queued reads.
+		/**
+		 * The queue is empty afterwards, ready for another batch.
+		 *
+		 * @throw read_error
+		 *   A read failed.  Some destinations may have been filled in.
+		 *
+		 * @throw incomplete_read
+		 *   A read went past the end of a stream.
+		 */
+		void run();
+
+		/// Make all the queued reads in a background thread.
+		/**
+		 * Call wait() to find out when the reads are done.
+		 */
+		void start();
+
+		/// Wait until a batch started with start() is done.
+		/**
+		 * @throw read_error
+		 *   A read failed, with the message of the original error.
+		 */
+		void wait();
+
+		/// Number of reads made from underlying streams by the last batch.
+		unsigned long reads() const;
+
+		/// Number of bytes read from underlying streams by the last batch.
+		/**
+		 * This includes the gaps read through when merging.
+		 */
+		stream::len bytesRead() const;
+
+	protected:
+		/// Part of a request that comes from one underlying stream.
+		struct piece {
+			input *src;         ///< Underlying stream
+			stream::pos off;    ///< Offset in \e src
+			stream::len len;    ///< Number of bytes
+			uint8_t *dest;      ///< Where the data goes
+		};
+
+		stream::len mergeGap;        ///< Largest gap to read through
+		stream::len maxRead;         ///< Largest merged read
+		std::vector<piece> pieces;   ///< Queued reads
+		std::vector<input_sptr> keep; ///< Streams to keep open until done
+		unsigned long numReads;      ///< Reads in the last batch
+		stream::len numBytes;        ///< Bytes read in the last batch
+		boost::thread worker;        ///< Background thread, if started
+		bool failed;                 ///< Did the background thread fail?
+		std::string failure;         ///< Error from the background thread
+
+		/// Split a request into pieces from underlying streams.
+		void resolve(input_sptr src, stream::pos off, stream::len len,
+			uint8_t *dest);
+
+		/// Sort by stream then offset.
+		static bool byLocation(const piece& a, const piece& b);
+
+		/// Body of the background thread.
+		void runInThread();
+};
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_READ_SCHEDULER_HPP_
@@ -32,6 +32,15 @@ namespace stream {
 /// Buffer size to use in copy() and move().
 #define BUFFER_SIZE 4096
 
+/// Size of each block in the copy_pipelined() buffer ring.
+#define PIPELINE_BUFFER_SIZE (1024 * 1024)
+
+/// Number of blocks in the copy_pipelined() buffer ring.
+#define PIPELINE_BUFFER_COUNT 4
+
+/// Smallest amount of data for which copy() will switch to copy_pipelined().
+#define PIPELINE_MIN_LENGTH (4 * PIPELINE_BUFFER_SIZE)
+
 /// Signed integer data type.  Internal use only.
 typedef long long signed_int_type;
 
@@ -130,6 +139,19 @@ class DLL_EXPORT seek_error: public error
 		 *   Error description for UI messages.
 		 */
 		seek_error(const std::string& msg);
+
+		/// Constructor for an attempt to seek past the end of the stream.
+		/**
+		 * @param streamType
+		 *   Name of the stream type for the message, e.g. "substream".
+		 *
+		 * @param offset
+		 *   Offset the caller tried to seek to.
+		 *
+		 * @param length
+		 *   Length of the stream.
+		 */
+		seek_error(const char *streamType, stream::pos offset, stream::len length);
 };
 
 /// Not all the expected data could be written to the stream.
@@ -169,6 +191,68 @@ enum seek_from {
 	end    ///< Move from the end of the stream
 };
 
+/// Flags for caps::flags.
+enum cap_flag {
+	cap_seekable   = 0x01, ///< Can seek anywhere, not just forwards
+	cap_memory     = 0x02, ///< Data is already in memory, so access costs no I/O
+	cap_mappable   = 0x04, ///< Data is in a regular local file
+	cap_positional = 0x08, ///< Never moves a pointer shared with other streams, see caps
+	cap_size_fast  = 0x10, ///< size() does no I/O or decoding
+	cap_holes      = 0x20, ///< Can report (input) or create (output) holes in sparse data
+	cap_leaf       = 0x40  ///< Holds its own data, rather than accessing another stream
+};
+
+/// What a stream can do cheaply, so generic code can pick the fastest method.
+/**
+ * Streams that pass their data through to a parent (e.g. stream::sub) take
+ * their capabilities from the parent, minus any they can't pass on.
+ *
+ * cap_positional describes how separate stream objects over the same data
+ * behave, not one object on its own.  Each read or write goes to the data at
+ * the stream's own offset without moving a pointer that any other stream
+ * uses, so several such streams (typically clones from clone_cursor()) can be
+ * read from different threads at once.  As with every stream, one object must
+ * still only be used by one thread at a time.
+ */
+struct DLL_EXPORT caps {
+	unsigned int flags;    ///< Combination of cap_flag values
+	stream::len blockSize; ///< Preferred size of each read/write, or 0 for any
+
+	/// No capabilities and no preferred block size.
+	caps();
+
+	/// Set the capabilities.
+	caps(unsigned int flags, stream::len blockSize);
+
+	/// Does the stream have all the given capabilities?
+	/**
+	 * @param f
+	 *   One or more cap_flag values.
+	 */
+	bool has(unsigned int f) const
+	{
+		return (this->flags & f) == f;
+	}
+
+	/// Capabilities of a stream passing all its I/O through to this one.
+	/**
+	 * @param keep
+	 *   cap_flag values the stream can pass on.  cap_leaf is never kept.
+	 *
+	 * @return Only the flags in \e keep, with the same block size.
+	 */
+	caps inherit(unsigned int keep) const
+	{
+		return caps(this->flags & keep & ~(unsigned int)cap_leaf,
+			this->blockSize);
+	}
+};
+
+class input;
+
+/// Shared pointer to an input stream.
+typedef boost::shared_ptr<input> input_sptr;
+
 /// Base stream interface for reading data.
 /**
  * @post A newly created stream's seek pointer is always at the start (offset 0).
@@ -305,10 +389,39 @@ class DLL_EXPORT input {
 		 *   operation.
 		 */
 		virtual stream::pos size() const = 0;
-};
 
-/// Shared pointer to an input stream.
-typedef boost::shared_ptr<input> input_sptr;
+		/// Find out what reading from this stream can do cheaply.
+		/**
+		 * This never does any I/O, so it can be called at any time.  The
+		 * default is a seekable stream with no preferred block size.
+		 *
+		 * @return The stream's capabilities when reading.
+		 */
+		virtual caps read_caps() const;
+
+		/// Get a second read pointer over the same content.
+		/**
+		 * The new stream reads the same data as this one, without copying it,
+		 * but has its own seek pointer, starting at this stream's current read
+		 * position.  Seeking or reading with one has no effect on the other, so
+		 * several consumers can each take a clone of an opened archive instead
+		 * of reopening it or taking turns with the one pointer.
+		 *
+		 * Where the clone reports cap_positional in read_caps(), each clone may
+		 * be read from a different thread at the same time.  Otherwise clones
+		 * still share state underneath and must not be used concurrently.
+		 *
+		 * Changes made through this stream after the clone was taken may or may
+		 * not be visible through the clone, depending on the stream type.
+		 *
+		 * @return A new read-only stream.
+		 *
+		 * @throw error
+		 *   This type of stream can't be cloned, or can't be cloned in its
+		 *   current state.  The default implementation always throws this.
+		 */
+		virtual input_sptr clone_cursor() const;
+};
 
 /// Base stream interface for writing data.
 /**
@@ -457,6 +570,12 @@ class DLL_EXPORT output {
 		 *   operation.
 		 */
 		virtual void flush() = 0;
+
+		/// Find out what writing to this stream can do cheaply.
+		/**
+		 * @copydetails input::read_caps()
+		 */
+		virtual caps write_caps() const;
 };
 
 /// Shared pointer to an output stream.
@@ -495,14 +614,39 @@ class DLL_EXPORT expanding_inout: virtual public inout, virtual public expanding
 /// Shared pointer to an inout stream.
 typedef boost::shared_ptr<expanding_inout> expanding_inout_sptr;
 
+/// Details about a completed copy operation.
+struct DLL_EXPORT copy_stats {
+	stream::len bytes;  ///< Number of bytes written to the destination
+	double seconds;     ///< Time taken by the whole copy, in seconds
+	bool pipelined;     ///< Were reading and writing done on separate threads?
+	stream::len holes;  ///< Bytes of \e bytes recreated as holes, not copied
+
+	copy_stats();
+
+	/// Average transfer rate.
+	/**
+	 * @return Number of bytes copied per second, or 0 if the copy was too quick
+	 *   to measure.
+	 */
+	double throughput() const;
+};
+
 /// Copy one stream into another.
 /**
+ * If prefer_sparse() finds holes in the source, this function hands the job
+ * over to copy_sparse().  Otherwise if prefer_pipelined() decides the copy
+ * will be limited by slow I/O, it hands the job over to copy_pipelined().
+ *
  * @param dest
  *   Target stream to write data into, beginning at the current seek position.
  *
  * @param src
  *   Source stream to read data from, beginning from the current seek position.
  *
+ * @param stats
+ *   Optional.  If not NULL, filled with the amount of data copied and how long
+ *   it took, once the copy has completed successfully.
+ *
  * @throw read_error
  *   Data could not be read from src.
  *
@@ -516,10 +660,76 @@ typedef boost::shared_ptr<expanding_inout> expanding_inout_sptr;
  *   There was an error decoding the data required to perform this
  *   operation.
  */
-void DLL_EXPORT copy(output_sptr dest, input_sptr src);
+void DLL_EXPORT copy(output_sptr dest, input_sptr src,
+	copy_stats *stats = NULL);
+
+/// Copy one stream into another, reading and writing on separate threads.
+/**
+ * A background thread reads from \e src into a ring of PIPELINE_BUFFER_COUNT
+ * blocks, each PIPELINE_BUFFER_SIZE bytes long, while the calling thread
+ * writes the filled blocks out to \e dest.  This keeps both devices busy when
+ * they are limited by different things (e.g. two separate disks.)
+ *
+ * The data written is identical to that written by copy(), including the
+ * handling of incomplete writes.
+ *
+ * @note \e src and \e dest must not share an underlying stream (for example
+ *   two substreams of the same file), as both will be accessed at the same
+ *   time.
+ *
+ * @copydetails copy()
+ */
+void DLL_EXPORT copy_pipelined(output_sptr dest, input_sptr src,
+	copy_stats *stats = NULL);
+
+/// Check whether a copy between two streams is worth pipelining.
+/**
+ * This returns true when at least PIPELINE_MIN_LENGTH bytes are left to copy,
+ * one end is a local file, and the other end is either a different local file
+ * or held entirely in memory, so that running the reader and writer at the
+ * same time cannot cause them to interfere with each other.
+ *
+ * @param dest
+ *   Stream the data will be written to.
+ *
+ * @param src
+ *   Stream the data will be read from.
+ *
+ * @return true if copy() should use copy_pipelined().
+ */
+bool DLL_EXPORT prefer_pipelined(output_sptr dest, input_sptr src);
+
+/// Copy one stream into another, recreating holes instead of copying them.
+/**
+ * Only the runs of data in \e src are read.  The holes between them are
+ * punched into \e dest if it is a local file, otherwise they are written out
+ * as zeroes.  Either way the data written is identical to that written by
+ * copy(), but copying a mostly empty disk image takes a fraction of the time
+ * and disk space.
+ *
+ * @copydetails copy()
+ */
+void DLL_EXPORT copy_sparse(output_sptr dest, input_sptr src,
+	copy_stats *stats = NULL);
+
+/// Check whether a copy between two streams is worth doing sparsely.
+/**
+ * @param dest
+ *   Stream the data will be written to.
+ *
+ * @param src
+ *   Stream the data will be read from.
+ *
+ * @return true if \e src is a local file containing at least one hole
+ *   between its read pointer and its end, so copy() should use copy_sparse().
+ */
+bool DLL_EXPORT prefer_sparse(output_sptr dest, input_sptr src);
 
 /// Copy possibly overlapping data from one position in a stream to another.
 /**
+ * If \e data is a local file, blocks within holes are not read, and holes are
+ * punched at the destination in their place.
+ *
  * @param data
  *   Target stream to move data around in.
  *
@@ -52,11 +52,16 @@ class DLL_EXPORT open_error: public error
 class DLL_EXPORT file_core
 {
 	protected:
-		FILE *handle;  ///< stdio file handle
+		FILE *handle;  ///< stdio file handle, NULL in a clone
 		bool close;    ///< Do we need to close \e handle ?
+		int cloneFd;   ///< Clone's own descriptor, read with pread(), or -1
+		stream::pos cloneOffset; ///< Clone's read pointer
 
 		file_core();
 
+		/// Descriptor of the open file.
+		int fd() const;
+
 		/// Common seek function for reading and writing.
 		/**
 		 * @copydetails input::seekg()
@@ -65,6 +70,21 @@ class DLL_EXPORT file_core
 
 		/// Common function for obtaining current seek position.
 		stream::pos tell() const;
+
+		/// Find the next run of data, skipping over any holes.
+		/**
+		 * @copydetails input_file::nextData()
+		 */
+		bool nextData(stream::pos from, stream::pos *start, stream::pos *end)
+			const;
+
+		/// Capabilities common to reading and writing.
+		/**
+		 * Regular files are seekable and mappable, with the filesystem's block
+		 * size.  Clones are also positional.  Pipes and devices have no
+		 * capabilities beyond cap_leaf.
+		 */
+		caps fileCaps() const;
 };
 
 /// Read-only stream to access a local file.
@@ -83,6 +103,23 @@ class DLL_EXPORT input_file: virtual public input,
 		virtual void seekg(stream::delta off, seek_from from);
 		virtual stream::pos tellg() const;
 		virtual stream::pos size() const;
+		virtual caps read_caps() const;
+
+		/// Get a second read pointer over the same file.
+		/**
+		 * The clone has its own duplicate of the file descriptor and reads it
+		 * with pread(), so it never moves this stream's pointer and any number
+		 * of clones can be read from different threads at once.  Anything
+		 * written through this stream is flushed first so the clone sees it,
+		 * but later writes are only visible to the clone after flush().
+		 *
+		 * Clones report every part of the file as data in nextData().
+		 *
+		 * @throw error
+		 *   The file is not a regular file (e.g. a pipe) or the platform has no
+		 *   positional reads.
+		 */
+		virtual input_sptr clone_cursor() const;
 
 		/// Open an existing file.
 		/**
@@ -97,6 +134,47 @@ class DLL_EXPORT input_file: virtual public input,
 		/// @copydoc open(const char *)
 		void open(const std::string& filename);
 
+		/// Find the next run of data, skipping over any holes.
+		/**
+		 * Sparse files can contain holes, ranges that have never been written
+		 * (or have been punched out) which read back as zeroes but take up no
+		 * disk space.  Copying only the data between them is much quicker than
+		 * reading gigabytes of zeroes.
+		 *
+		 * Where the operating system or filesystem can't report holes, the whole
+		 * file is treated as data.
+		 *
+		 * @param from
+		 *   Offset to start looking from.
+		 *
+		 * @param start
+		 *   Set to the offset of the first byte of data at or after \e from.
+		 *
+		 * @param end
+		 *   Set to the offset just past the end of that run of data, which is
+		 *   either the start of the next hole or the end of the file.
+		 *
+		 * @return true if data was found, false if there is only a hole between
+		 *   \e from and the end of the file.
+		 *
+		 * @throw read_error
+		 *   The file's layout could not be obtained.
+		 */
+		bool nextData(stream::pos from, stream::pos *start, stream::pos *end)
+			const;
+
+		/// Is a range of the file entirely a hole?
+		/**
+		 * @param start
+		 *   Offset of the first byte to check.
+		 *
+		 * @param len
+		 *   Number of bytes to check.
+		 *
+		 * @return true if there is no data stored anywhere in the range.
+		 */
+		bool isHole(stream::pos start, stream::len len) const;
+
 		friend input_sptr open_stdin();
 };
 
@@ -120,6 +198,7 @@ class DLL_EXPORT output_file: virtual public output,
 		virtual stream::pos tellp() const;
 		virtual void truncate(stream::pos size);
 		virtual void flush();
+		virtual caps write_caps() const;
 
 		/// Open an existing file.
 		/**
@@ -150,9 +229,41 @@ class DLL_EXPORT output_file: virtual public output,
 		/// Delete the file upon close.
 		void remove();
 
+		/// Replace a range of the file with a hole.
+		/**
+		 * The range reads back as zeroes afterwards, but no longer takes up any
+		 * disk space.  The file is extended if the range goes past the end.
+		 * Where holes aren't supported, zeroes are written instead.
+		 *
+		 * @param start
+		 *   Offset of the first byte to free.
+		 *
+		 * @param len
+		 *   Number of bytes to free.
+		 *
+		 * @throw write_error
+		 *   The range could not be freed or zeroed.
+		 *
+		 * @post The write pointer is unchanged.
+		 */
+		void punchHole(stream::pos start, stream::len len);
+
+		/// Turn blocks of zeroes into holes as they are written.
+		/**
+		 * When enabled, any call to try_write() of at least BUFFER_SIZE bytes
+		 * that are all zero punches a hole instead of writing the data.  This
+		 * is off by default, as it costs a scan of every large write.
+		 *
+		 * @param sparse
+		 *   true to punch holes, false to always write the data.
+		 */
+		void setSparse(bool sparse);
+
 		friend output_sptr open_stdout();
+		friend class region_writer;
 
 	protected:
+		bool sparse;           ///< Punch holes for zero writes?
 		bool do_remove;        ///< Delete file on close?
 		std::string filename;  ///< Copy of filename for deletion
 
@@ -21,13 +21,61 @@
 #ifndef _CAMOTO_STREAM_FILTERED_HPP_
 #define _CAMOTO_STREAM_FILTERED_HPP_
 
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
 #include <camoto/filter.hpp>
 #include <camoto/stream_memory.hpp>
 
 namespace camoto {
 namespace stream {
 
+class input_filtered;
+class filtered;
+
+/// Copy a filtered stream's encoded data into another, without refiltering.
+/**
+ * If both streams use the same encoding, as reported by filter::fingerprint(),
+ * the parent data of \e src is copied straight to the parent of \e dest.
+ * Nothing is decoded or encoded, so merging compressed files between archives
+ * costs only the I/O.
+ *
+ * The whole content of \e dest is replaced, regardless of its pointers.  If
+ * \e src had already been decoded, \e dest shares the decoded data, otherwise
+ * \e dest decodes its new parent data the first time it is read.  Either way
+ * \e dest doesn't need flushing afterwards.
+ *
+ * @param dest
+ *   Stream to replace.  It is read/write so that it can still be read from
+ *   and written to afterwards.
+ *
+ * @param src
+ *   Stream to copy.
+ *
+ * @param lenDecoded
+ *   Decoded size of \e src, as stored in its archive's FAT, which is passed
+ *   to the resize function of \e dest.  If \e src has already been decoded
+ *   this is ignored and the actual size used instead.
+ *
+ * @return true if the data was copied, or false if nothing was done because
+ *   the encodings differ or \e src has changes that haven't been flushed.
+ *   The caller should then use copy() instead.
+ *
+ * @throw read_error
+ *   The parent of \e src could not be read.
+ *
+ * @throw write_error
+ *   The parent of \e dest could not be written.
+ */
+bool DLL_EXPORT copy_encoded(boost::shared_ptr<filtered> dest,
+	boost::shared_ptr<input_filtered> src, stream::len lenDecoded);
+
 /// Read-only stream applying a filter to another read-only stream.
+/**
+ * The parent is decoded in full the first time the data is needed.  This is
+ * safe to trigger from several threads at once, and the filter only ever
+ * runs once.  Each thread should still read through its own clone_cursor(),
+ * as the read pointer itself is not shared safely.
+ */
 class DLL_EXPORT input_filtered: virtual public input_memory
 {
 	public:
@@ -39,6 +87,26 @@ class DLL_EXPORT input_filtered: virtual public input_memory
 
 		virtual stream::pos size() const;
 
+		/// Find out what reading from this stream can do cheaply.
+		/**
+		 * The decoded data is held in memory, so these are the capabilities of
+		 * a memory stream rather than the parent's, except size() isn't cheap
+		 * until the data has been decoded.
+		 */
+		virtual caps read_caps() const;
+
+		/// Get a second read pointer over the decoded data.
+		/**
+		 * The data is decoded first if it hasn't been already, then the clone
+		 * is a memory stream sharing the decoded buffer, so the filter only
+		 * ever runs once no matter how many clones are taken.
+		 *
+		 * The shared buffer is never changed.  Writing to a read/write filtered
+		 * stream gives it a private copy first, so clones keep seeing the data
+		 * as it was when they were taken.
+		 */
+		virtual input_sptr clone_cursor() const;
+
 		/// Apply a filter to the given stream.
 		/**
 		 * As data is read from this stream (the input_filtered instance), data is
@@ -65,12 +133,24 @@ class DLL_EXPORT input_filtered: virtual public input_memory
 		virtual void populate() const;
 
 		/// Non-const version of populate() that actually does the work.
+		/**
+		 * If another thread is already decoding the data, this waits for it to
+		 * finish rather than decoding it again.
+		 */
 		void realPopulate();
 
 	protected:
 		filter_sptr read_filter; ///< Filter to pass data through
 		input_sptr in_parent;   ///< Parent stream for reading
-		bool populated; ///< Has the input data been run through the filter yet?
+
+		/// Has the input data been run through the filter yet?
+		boost::atomic<bool> populated;
+
+		/// Held while running the filter, so only one thread does it.
+		boost::mutex populateMutex;
+
+		friend bool copy_encoded(boost::shared_ptr<filtered> dest,
+			boost::shared_ptr<input_filtered> src, stream::len lenDecoded);
 };
 
 /// Shared pointer to a readable filtered stream.
@@ -126,6 +206,10 @@ class DLL_EXPORT output_filtered: virtual public output_memory
 		output_sptr out_parent;   ///< Parent stream for writing
 		fn_truncate fn_resize;    ///< Size-change notification function
 		bool done_filter;         ///< Set to true once filter has been run once
+		bool changed;             ///< Written to since opened or last flushed?
+
+		friend bool copy_encoded(boost::shared_ptr<filtered> dest,
+			boost::shared_ptr<input_filtered> src, stream::len lenDecoded);
 };
 
 /// Shared pointer to a writable filtered stream.
@@ -174,6 +258,10 @@ class DLL_EXPORT filtered: virtual public inout,
 			filter_sptr write_filter, fn_truncate resize);
 
 		virtual void populate() const;
+
+		using memory_core::memoryHeld;
+		using memory_core::spilled;
+		using memory_core::contents;
 };
 
 /// Shared pointer to a readable and writable filtered stream.
@@ -0,0 +1,215 @@
+/**
+ * @file  camoto/stream_iostream.hpp
+ * @brief Adapters between camoto streams and C++ iostreams.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_IOSTREAM_HPP_
+#define _CAMOTO_STREAM_IOSTREAM_HPP_
+
+#include <iostream>
+#include <streambuf>
+#include <vector>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+class input_memory;
+class input_string;
+
+/// std::streambuf reading from and writing to a camoto stream.
+/**
+ * This lets a camoto stream be passed to code expecting a std::istream,
+ * std::ostream or std::iostream, without copying it into a stringstream
+ * first:
+ *
+ * @code
+ * stream::streambuf buf(content, stream::output_sptr());
+ * std::istream in(&buf);
+ * decodeImage(in);
+ * @endcode
+ *
+ * Reads from memory, filtered and string streams use the stream's storage
+ * directly.  Other streams are read and written through a buffer of a
+ * configurable size, and reads or writes at least that big skip the buffer
+ * entirely.
+ *
+ * Like std::filebuf there is a single position for reading and writing.  It
+ * starts at zero and is independent of the camoto stream's own pointers
+ * until sync() (or std::ostream::flush()) is called, which moves them to
+ * match.  The camoto stream must not be changed other than through this
+ * object while it is in use.
+ */
+class DLL_EXPORT streambuf: public std::streambuf
+{
+	public:
+		/// Adapt a camoto stream.
+		/**
+		 * @param in
+		 *   Stream to read from, or an empty pointer if reading isn't needed.
+		 *
+		 * @param out
+		 *   Stream to write to, or an empty pointer if writing isn't needed.
+		 *   For a read/write stream pass the same stream as \e in and \e out.
+		 *
+		 * @param bufferSize
+		 *   Size of the buffer used for streams that can't be accessed
+		 *   directly, in bytes.
+		 */
+		streambuf(input_sptr in, output_sptr out,
+			std::size_t bufferSize = BUFFER_SIZE);
+
+		/// Write out any buffered data.
+		virtual ~streambuf();
+
+		/// Are reads currently coming straight from the stream's storage?
+		bool borrowed() const;
+
+	protected:
+		virtual int_type underflow();
+		virtual int_type overflow(int_type c);
+		virtual std::streamsize xsgetn(char *s, std::streamsize n);
+		virtual std::streamsize xsputn(const char *s, std::streamsize n);
+		virtual std::streamsize showmanyc();
+		virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+			std::ios_base::openmode which);
+		virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+		virtual int sync();
+
+		input_sptr in;             ///< Stream to read from, may be empty
+		output_sptr out;           ///< Stream to write to, may be empty
+		input_memory *inMemory;    ///< \e in if it's a memory stream
+		input_string *inString;    ///< \e in if it's a string stream
+		std::vector<char> buffer;  ///< Get or put area when not borrowing
+		stream::pos base;          ///< Stream offset of the get or put area
+		bool isBorrowed;           ///< Is the get area the stream's storage?
+		bool dirty;                ///< Written to since the last sync()?
+
+		/// Current position in the stream.
+		stream::pos position() const;
+
+		/// Write out and discard the put area.
+		/**
+		 * @return false on a write error.
+		 */
+		bool flushPut();
+
+		/// Discard the get and put areas, leaving the position at \e pos.
+		void reset(stream::pos pos);
+
+		/// Get the stream's storage, if it can be read directly.
+		/**
+		 * @param len
+		 *   Set to the size of the storage.
+		 *
+		 * @return Pointer to the storage, or NULL if it has to be read.
+		 */
+		const char *borrow(stream::len *len);
+};
+
+/// Read-only camoto stream reading from a C++ std::istream.
+/**
+ * Data is read through the std::istream's buffer, without going through the
+ * std::istream itself, so its error flags are never set.
+ */
+class DLL_EXPORT input_iostream: virtual public input
+{
+	public:
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::pos size() const;
+		virtual caps read_caps() const;
+
+		/// Read from a std::istream.
+		/**
+		 * @param parent
+		 *   Stream to read.  It must remain valid as long as this object
+		 *   exists.
+		 */
+		void open(std::istream& parent);
+
+	protected:
+		std::streambuf *in_parent; ///< Buffer of the std::istream
+};
+
+/// Shared pointer to a readable iostream adapter.
+typedef boost::shared_ptr<input_iostream> input_iostream_sptr;
+
+/// Write-only camoto stream writing to a C++ std::ostream.
+/**
+ * Data is written through the std::ostream's buffer, without going through
+ * the std::ostream itself, so its error flags are never set.
+ */
+class DLL_EXPORT output_iostream: virtual public output
+{
+	public:
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+
+		/// Change the size of the stream.
+		/**
+		 * C++ streams can't be made shorter, so this can only extend the stream
+		 * with zeroes.
+		 *
+		 * @throw write_error
+		 *   \e size is smaller than the current size.
+		 */
+		virtual void truncate(stream::pos size);
+
+		virtual void flush();
+		virtual caps write_caps() const;
+
+		/// Write to a std::ostream.
+		/**
+		 * @param parent
+		 *   Stream to write to.  It must remain valid as long as this object
+		 *   exists.
+		 */
+		void open(std::ostream& parent);
+
+	protected:
+		std::streambuf *out_parent; ///< Buffer of the std::ostream
+};
+
+/// Shared pointer to a writable iostream adapter.
+typedef boost::shared_ptr<output_iostream> output_iostream_sptr;
+
+/// Read/write camoto stream accessing a C++ std::iostream.
+class DLL_EXPORT iostream: virtual public inout,
+                           virtual public input_iostream,
+                           virtual public output_iostream
+{
+	public:
+		/// Read from and write to a std::iostream.
+		/**
+		 * @param parent
+		 *   Stream to access.  It must remain valid as long as this object
+		 *   exists.
+		 */
+		void open(std::iostream& parent);
+};
+
+/// Shared pointer to a readable and writable iostream adapter.
+typedef boost::shared_ptr<iostream> iostream_sptr;
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_IOSTREAM_HPP_
@@ -22,17 +22,54 @@
 #define _CAMOTO_STREAM_MEMORY_HPP_
 
 #include <vector>
+#include <boost/thread/mutex.hpp>
 #include <camoto/stream.hpp>
+#include <camoto/mem_budget.hpp>
 
 namespace camoto {
 namespace stream {
 
+/// Content of a memory stream, shared with any clones of it.
+/**
+ * The content is counted towards the mem_budget.  If the budget runs out
+ * under the mem_spill policy, the content is moved into a temporary file and
+ * \e data is left empty for the rest of the stream's life.
+ */
+struct DLL_EXPORT memory_store
+{
+	std::vector<uint8_t> data;   ///< Stream content, unless spilled
+	mem_account account;         ///< Size of the content in the budget
+	inout_sptr spill;            ///< Temporary file holding the content
+	stream::len spillLen;        ///< Size of the content in \e spill
+	boost::mutex spillMutex;     ///< Protects the pointer of \e spill
+
+	memory_store();
+};
+
 /// memory stream parts in common with read and write
 class DLL_EXPORT memory_core
 {
+	public:
+		/// Number of bytes of content held, in memory or spilled to disk.
+		stream::len memoryHeld() const;
+
+		/// Has the content been moved out to a temporary file?
+		bool spilled() const;
+
+		/// Direct access to the content, without copying it.
+		/**
+		 * @param len
+		 *   Set to the size of the content.
+		 *
+		 * @return Pointer to the first byte, which stays valid until the stream
+		 *   is next written to or resized.  NULL if the content has been
+		 *   spilled to disk, or is empty.
+		 */
+		const uint8_t *contents(stream::len *len) const;
+
 	protected:
-		std::vector<uint8_t> data;   ///< Stream content
-		stream::pos offset;          ///< Current pointer position
+		boost::shared_ptr<memory_store> store; ///< Content, maybe shared
+		stream::pos offset;                    ///< Current pointer position
 
 		memory_core();
 		~memory_core();
@@ -42,6 +79,54 @@ class DLL_EXPORT memory_core
 		 * @copydetails input::seekg()
 		 */
 		void seek(stream::delta off, seek_from from);
+
+		/// Size of the content, wherever it is.
+		stream::len dataSize() const;
+
+		/// Change the size of the content.
+		/**
+		 * New space is filled with zeroes.
+		 *
+		 * @param size
+		 *   New size in bytes.
+		 *
+		 * @throw budget_error
+		 *   The content can't grow without exceeding the memory budget.
+		 */
+		void resizeData(stream::len size);
+
+		/// Copy part of the content out, which must be within dataSize().
+		void readData(stream::pos off, uint8_t *buffer, stream::len len);
+
+		/// Overwrite part of the content, which must be within dataSize().
+		void writeData(stream::pos off, const uint8_t *buffer, stream::len len);
+
+		/// Move the content out to a temporary file.
+		void spillData();
+
+		/// Give this stream its own copy of the content, if clones share it.
+		/**
+		 * Call this before writing, to leave the clones' view of the content
+		 * unchanged.
+		 *
+		 * @param pool
+		 *   Pool of the mem_budget to count the copy in.
+		 *
+		 * @throw budget_error
+		 *   There isn't enough memory for the copy.  The content is left
+		 *   shared.
+		 */
+		void unshare(mem_pool pool);
+
+		/// Capabilities common to reading and writing.
+		/**
+		 * cap_memory is dropped once the content has been spilled to a
+		 * temporary file.  Each object has its own offset into the shared
+		 * content, so clones can be read in parallel and cap_positional is
+		 * reported either way.  The object itself is no more thread safe than
+		 * any other stream.
+		 */
+		caps memoryCaps() const;
 };
 
 /// Read-only stream to access a C++ vector.
@@ -59,6 +144,19 @@ class DLL_EXPORT input_memory: virtual public input,
 		virtual void seekg(stream::delta off, seek_from from);
 		virtual stream::pos tellg() const;
 		virtual stream::pos size() const;
+		virtual caps read_caps() const;
+
+		/// Get a second read pointer over the same content.
+		/**
+		 * The clone shares this stream's content, so writes made through this
+		 * stream are visible to it.  Reading clones from several threads at
+		 * once is safe as long as nothing writes to the content meanwhile.
+		 */
+		virtual input_sptr clone_cursor() const;
+
+		using memory_core::memoryHeld;
+		using memory_core::spilled;
+		using memory_core::contents;
 };
 
 /// Shared pointer to a readable memory.
@@ -80,6 +178,11 @@ class DLL_EXPORT output_memory: virtual public expanding_output,
 		virtual stream::pos tellp() const;
 		virtual void truncate(stream::pos size);
 		virtual void flush();
+		virtual caps write_caps() const;
+
+		using memory_core::memoryHeld;
+		using memory_core::spilled;
+		using memory_core::contents;
 };
 
 /// Shared pointer to a writable memory.
@@ -92,6 +195,10 @@ class DLL_EXPORT memory: virtual public expanding_inout,
 {
 	public:
 		memory();
+
+		using memory_core::memoryHeld;
+		using memory_core::spilled;
+		using memory_core::contents;
 };
 
 /// Shared pointer to a readable and writable memory.
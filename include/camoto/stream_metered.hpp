@@ -0,0 +1,259 @@
+/**
+ * @file  camoto/stream_metered.hpp
+ * @brief Stream decorator counting and timing the operations performed on
+ *        another stream.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_METERED_HPP_
+#define _CAMOTO_STREAM_METERED_HPP_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Number of buckets in each latency histogram.
+#define METER_BUCKETS 32
+
+/// Operations counted and timed by a metered stream.
+enum meter_op {
+	meter_read,     ///< try_read()
+	meter_write,    ///< try_write()
+	meter_seek,     ///< seekg() and seekp()
+	meter_tell,     ///< tellg() and tellp()
+	meter_size,     ///< size()
+	meter_truncate, ///< truncate()
+	meter_flush,    ///< flush()
+	meter_op_count  ///< Number of entries in this enum
+};
+
+/// Counters collected by a metered stream.
+struct DLL_EXPORT meter_counters {
+	/// Number of calls to each operation.
+	unsigned long long calls[meter_op_count];
+
+	/// Total time spent in each operation, in nanoseconds.
+	unsigned long long nsTotal[meter_op_count];
+
+	/// Latency histogram for each operation.
+	/**
+	 * Bucket \e n counts the calls that took between 2^n and 2^(n+1)
+	 * nanoseconds, with bucket 0 also including calls that took no measurable
+	 * time and the last bucket including everything longer.
+	 */
+	unsigned long long latency[meter_op_count][METER_BUCKETS];
+
+	unsigned long long bytesRead;     ///< Total bytes returned by try_read()
+	unsigned long long bytesWritten;  ///< Total bytes accepted by try_write()
+	unsigned long long seeksRedundant; ///< Seeks to the position already current
+	unsigned long long shortReads;    ///< Reads returning less than requested
+	unsigned long long shortWrites;   ///< Writes accepting less than requested
+
+	meter_counters();
+
+	/// Set all counters back to zero.
+	void clear();
+
+	/// Add another set of counters to this one.
+	meter_counters& operator += (const meter_counters& other);
+
+	/// Estimate a latency percentile from the histogram.
+	/**
+	 * @param op
+	 *   Operation to examine.
+	 *
+	 * @param fraction
+	 *   Percentile as a fraction, e.g. 0.99 for the 99th percentile.
+	 *
+	 * @return Upper bound of the histogram bucket containing the requested
+	 *   percentile, in nanoseconds, or 0 if the operation was never called.
+	 */
+	unsigned long long percentile(meter_op op, double fraction) const;
+};
+
+/// Copy of a metered stream's counters at a point in time.
+struct DLL_EXPORT meter_snapshot {
+	std::string label;        ///< Label given to the stream in open()
+	meter_counters counters;  ///< Counters at the time of the snapshot
+};
+
+/// Process-wide control of all metered streams.
+/**
+ * Metering is disabled by default.  While disabled, metered streams pass
+ * every call straight through to their parent without reading the clock or
+ * updating any counters.
+ */
+class DLL_EXPORT meter_registry
+{
+	public:
+		/// Turn metering on or off for every metered stream.
+		static void enable(bool on);
+
+		/// Is metering currently turned on?
+		static bool enabled();
+
+		/// Get the counters of every metered stream that currently exists.
+		/**
+		 * @return One entry per stream, in creation order.  Streams sharing a
+		 *   label are reported separately.
+		 */
+		static std::vector<meter_snapshot> snapshot();
+
+		/// Set the counters of every metered stream back to zero.
+		static void clear();
+
+		/// Write a human-readable summary of snapshot() to a stream.
+		static void print(std::ostream& s);
+};
+
+class meter_timer;
+
+/// Metered stream parts in common with read and write
+class DLL_EXPORT metered_core
+{
+	public:
+		/// Get a copy of this stream's counters.
+		meter_snapshot snapshot() const;
+
+	protected:
+		std::string label;         ///< Name reported in snapshots
+		mutable meter_counters counters; ///< Counters for this stream
+		mutable boost::mutex mutex; ///< Protects counters
+
+		/// Expected seek position in the parent, for spotting redundant seeks.
+		/**
+		 * Read and write share this, as every seekable stream in this library
+		 * uses the same pointer for both.
+		 */
+		mutable stream::pos pos;
+		mutable bool posKnown;     ///< Is pos valid?
+
+		metered_core();
+		~metered_core();
+
+		/// Update the expected position for a seek, and count it if redundant.
+		/**
+		 * @param off
+		 *   Seek offset, as passed to seekg() or seekp().
+		 *
+		 * @param from
+		 *   Seek origin, as passed to seekg() or seekp().
+		 */
+		void trackSeek(stream::delta off, seek_from from);
+
+		/// Record one call to an operation.
+		/**
+		 * @param op
+		 *   Operation that was called.
+		 *
+		 * @param ns
+		 *   Time taken by the call, in nanoseconds.
+		 */
+		void record(meter_op op, unsigned long long ns) const;
+
+		friend class meter_registry;
+		friend class meter_timer;
+};
+
+/// Read-only stream counting operations on another stream.
+class DLL_EXPORT input_metered: virtual public input,
+                                virtual protected metered_core
+{
+	public:
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::pos size() const;
+		virtual caps read_caps() const;
+
+		/// Meter all reads from another stream.
+		/**
+		 * @param parent
+		 *   Parent stream to pass all operations on to.
+		 *
+		 * @param label
+		 *   Name identifying this stream in meter_registry snapshots.
+		 */
+		void open(input_sptr parent, const std::string& label);
+
+		using metered_core::snapshot;
+
+	protected:
+		input_sptr in_parent;  ///< Parent stream for reading
+};
+
+/// Shared pointer to a readable metered stream.
+typedef boost::shared_ptr<input_metered> input_metered_sptr;
+
+/// Write-only stream counting operations on another stream.
+class DLL_EXPORT output_metered: virtual public output,
+                                 virtual protected metered_core
+{
+	public:
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+		virtual void flush();
+		virtual caps write_caps() const;
+
+		/// Meter all writes to another stream.
+		/**
+		 * @param parent
+		 *   Parent stream to pass all operations on to.
+		 *
+		 * @param label
+		 *   Name identifying this stream in meter_registry snapshots.
+		 */
+		void open(output_sptr parent, const std::string& label);
+
+		using metered_core::snapshot;
+
+	protected:
+		output_sptr out_parent; ///< Parent stream for writing
+};
+
+/// Shared pointer to a writable metered stream.
+typedef boost::shared_ptr<output_metered> output_metered_sptr;
+
+/// Read/write stream counting operations on another stream.
+class DLL_EXPORT metered: virtual public inout,
+                          virtual public input_metered,
+                          virtual public output_metered
+{
+	public:
+		/// Meter all reads from and writes to another stream.
+		/**
+		 * @copydetails input_metered::open()
+		 */
+		void open(inout_sptr parent, const std::string& label);
+
+		using metered_core::snapshot;
+};
+
+/// Shared pointer to a readable and writable metered stream.
+typedef boost::shared_ptr<metered> metered_sptr;
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_METERED_HPP_
@@ -0,0 +1,225 @@
+/**
+ * @file  camoto/stream_packed.hpp
+ * @brief Memory stream holding its content compressed.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_PACKED_HPP_
+#define _CAMOTO_STREAM_PACKED_HPP_
+
+#include <vector>
+#include <camoto/stream.hpp>
+#include <camoto/mem_budget.hpp>
+
+/// Size of each independently compressed page in a packed stream.
+#define PACKED_PAGE_SIZE 32768
+
+/// Default number of decompressed pages a packed stream keeps.
+#define PACKED_CACHE_PAGES 4
+
+namespace camoto {
+namespace stream {
+
+/// packed stream parts in common with read and write
+/**
+ * The content is split into pages of PACKED_PAGE_SIZE bytes, each compressed
+ * on its own with a simple LZ77 codec that favours speed over ratio.  The
+ * most recently used pages are kept decompressed in a small cache, and only
+ * compressed again when they drop out of it or flush() is called.  Pages of
+ * zeroes take up no space at all, and pages that don't compress are stored
+ * as they are.
+ *
+ * The compressed pages and the cache are counted in the mem_memory pool of
+ * the mem_budget.  They can't be spilled to disk, so under the mem_spill
+ * policy they may go over budget.
+ */
+class DLL_EXPORT packed_core
+{
+	public:
+		/// Number of bytes held in memory, compressed and in the cache.
+		stream::len memoryHeld() const;
+
+		/// Change how many decompressed pages are kept.
+		/**
+		 * @param pages
+		 *   Number of pages to cache.  At least one is always kept.  Pages
+		 *   that no longer fit are compressed and dropped straight away.
+		 */
+		void setCachePages(unsigned int pages);
+
+	protected:
+		/// One page of the content.
+		struct page {
+			std::vector<uint8_t> data; ///< Content, empty for a page of zeroes
+			bool raw;                  ///< Is \e data stored uncompressed?
+
+			page();
+		};
+
+		/// A decompressed page in the cache.
+		struct slot {
+			unsigned long index;       ///< Page number
+			std::vector<uint8_t> data; ///< Decompressed content
+			bool dirty;                ///< Changed since it was decompressed?
+			unsigned long lastUse;     ///< Value of \e clock when last used
+		};
+
+		std::vector<page> pages;  ///< Content, in pages
+		std::vector<slot> cache;  ///< Decompressed pages
+		unsigned int cachePages;  ///< Maximum size of \e cache
+		unsigned long clock;      ///< Incremented on every cache access
+		stream::len length;       ///< Size of the content
+		stream::len packedBytes;  ///< Total size of all pages' data
+		stream::len cacheBytes;   ///< Total size of all slots' data
+		mem_account account;      ///< Memory held in the budget
+		stream::pos offset;       ///< Current pointer position
+
+		packed_core();
+
+		/// Common seek function for reading and writing.
+		/**
+		 * @copydetails input::seekg()
+		 */
+		void seek(stream::delta off, seek_from from);
+
+		/// Change the size of the content.
+		/**
+		 * New space is filled with zeroes.
+		 */
+		void resizeData(stream::len size);
+
+		/// Copy part of the content out, which must be within \e length.
+		void readData(stream::pos off, uint8_t *buffer, stream::len len);
+
+		/// Overwrite part of the content, which must be within \e length.
+		void writeData(stream::pos off, const uint8_t *buffer, stream::len len);
+
+		/// Compress every changed page in the cache, keeping them cached.
+		void packDirty();
+
+		/// Capabilities common to reading and writing.
+		/**
+		 * Access costs decompression rather than I/O, so cap_memory isn't
+		 * reported.  The block size is PACKED_PAGE_SIZE.
+		 */
+		caps packedCaps() const;
+
+	private:
+		/// Size of a page, which is only short for the last one.
+		stream::len pageLength(unsigned long index) const;
+
+		/// Get a page from the cache, decompressing it if needed.
+		/**
+		 * @param index
+		 *   Page number.
+		 *
+		 * @param write
+		 *   true if the page is about to be changed.
+		 */
+		slot& loadPage(unsigned long index, bool write);
+
+		/// Compress a cached page back into \e pages.
+		void packSlot(slot& s);
+
+		/// Remove a page from the cache, compressing it first if changed.
+		void evict(std::vector<slot>::iterator s);
+
+		/// Count a change in memory use in the budget.
+		void recount();
+};
+
+/// Read-only stream holding its content compressed in memory.
+class DLL_EXPORT input_packed: virtual public input,
+                               virtual protected packed_core
+{
+	public:
+		/// Default constructor.
+		/**
+		 * @note Initialises with no content.
+		 */
+		input_packed();
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::pos size() const;
+		virtual caps read_caps() const;
+
+		using packed_core::memoryHeld;
+		using packed_core::setCachePages;
+};
+
+/// Shared pointer to a readable packed stream.
+typedef boost::shared_ptr<input_packed> input_packed_sptr;
+
+/// Write-only stream holding its content compressed in memory.
+class DLL_EXPORT output_packed: virtual public expanding_output,
+                                virtual protected packed_core
+{
+	public:
+		/// Default constructor.
+		/**
+		 * @note Initialises with no content.
+		 */
+		output_packed();
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+
+		/// Compress any pages changed since they were last compressed.
+		/**
+		 * The pages stay in the cache, so this doesn't slow down later access.
+		 * It is worth calling when a stream is about to sit idle, so that
+		 * memoryHeld() reflects the compressed size.
+		 */
+		virtual void flush();
+
+		virtual caps write_caps() const;
+
+		using packed_core::memoryHeld;
+		using packed_core::setCachePages;
+};
+
+/// Shared pointer to a writable packed stream.
+typedef boost::shared_ptr<output_packed> output_packed_sptr;
+
+/// Read/write stream holding its content compressed in memory.
+/**
+ * This can be used in place of stream::memory for large buffers that sit
+ * idle most of the time, trading some CPU time on access for a much smaller
+ * memory footprint.
+ */
+class DLL_EXPORT packed: virtual public expanding_inout,
+                         virtual public input_packed,
+                         virtual public output_packed
+{
+	public:
+		packed();
+
+		using packed_core::memoryHeld;
+		using packed_core::setCachePages;
+};
+
+/// Shared pointer to a readable and writable packed stream.
+typedef boost::shared_ptr<packed> packed_sptr;
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_PACKED_HPP_
@@ -0,0 +1,281 @@
+/**
+ * @file  camoto/stream_recorder.hpp
+ * @brief Record the sequence of operations performed on streams, and replay
+ *        them later against synthetic data.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_RECORDER_HPP_
+#define _CAMOTO_STREAM_RECORDER_HPP_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/chrono.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/stream_seg.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// One operation in a recording.
+struct DLL_EXPORT io_op {
+	/// Type of operation.
+	enum type {
+		open,     ///< Stream opened, \e arg is its size at the time
+		read,     ///< try_read(), \e arg is the length requested
+		write,    ///< try_write(), \e arg is the length requested
+		seek,     ///< seekg() or seekp(), \e arg is the offset
+		truncate, ///< truncate(), \e arg is the new size
+		flush,    ///< flush()
+		insert,   ///< seg::insert(), \e arg is the length inserted
+		remove    ///< seg::remove(), \e arg is the length removed
+	};
+
+	unsigned long long time;     ///< Nanoseconds since recording began
+	unsigned long long duration; ///< Nanoseconds taken by the operation
+	unsigned int id;             ///< Which stream, numbered from 0
+	type op;                     ///< What was done
+	stream::delta arg;           ///< Length, offset or size, depending on \e op
+	seek_from from;              ///< Seek origin, for \e seek only
+	stream::len result;          ///< Bytes actually read or written
+};
+
+/// List of operations performed on a group of streams.
+/**
+ * Only the lengths and offsets are kept, never the data itself, so a
+ * recording taken while processing private files can be shared and replayed
+ * elsewhere.
+ */
+class DLL_EXPORT recording
+{
+	public:
+		/// Start a new, empty recording.  Times are relative to now.
+		recording();
+
+		/// Allocate an ID for a new stream.
+		unsigned int nextId();
+
+		/// Add an operation to the end of the recording.
+		/**
+		 * This may be called by multiple threads at once.
+		 *
+		 * @param op
+		 *   Operation to add.  The \e time field is ignored and replaced with the
+		 *   time \e tStart.
+		 *
+		 * @param tStart
+		 *   Time the operation started.
+		 */
+		void add(io_op op, boost::chrono::steady_clock::time_point tStart);
+
+		/// Get a copy of all the operations recorded so far.
+		std::vector<io_op> ops() const;
+
+		/// Write the recording out as text, one operation per line.
+		void save(std::ostream& s) const;
+
+		/// Replace the contents of this recording with one previously saved.
+		/**
+		 * @throw stream::read_error
+		 *   The data was not in the format written by save().
+		 */
+		void load(std::istream& s);
+
+	protected:
+		mutable boost::mutex mutex;  ///< Protects everything below
+		boost::chrono::steady_clock::time_point tBegin; ///< Time zero
+		std::vector<io_op> list;     ///< Operations recorded so far
+		unsigned int lastId;         ///< Number of IDs allocated by nextId()
+};
+
+/// Shared pointer to a recording.
+typedef boost::shared_ptr<recording> recording_sptr;
+
+/// Recorder parts in common with read and write
+class DLL_EXPORT recorder_core
+{
+	protected:
+		recording_sptr rec;  ///< Where to add operations
+		unsigned int id;     ///< This stream's ID in \e rec
+
+		recorder_core();
+
+		/// Record an operation that started at \e tStart and has just finished.
+		void add(io_op::type op, stream::delta arg, seek_from from,
+			stream::len result, boost::chrono::steady_clock::time_point tStart);
+};
+
+/// Read-only stream recording the operations passed on to another stream.
+class DLL_EXPORT input_recorder: virtual public input,
+                                 virtual protected recorder_core
+{
+	public:
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::pos size() const;
+		virtual caps read_caps() const;
+
+		/// Record all operations on another stream.
+		/**
+		 * @param parent
+		 *   Parent stream to pass all operations on to.
+		 *
+		 * @param rec
+		 *   Recording to add the operations to.  The same recording can be
+		 *   shared by any number of streams.
+		 */
+		void open(input_sptr parent, recording_sptr rec);
+
+	protected:
+		input_sptr in_parent;  ///< Parent stream for reading
+};
+
+/// Shared pointer to a readable recorder.
+typedef boost::shared_ptr<input_recorder> input_recorder_sptr;
+
+/// Write-only stream recording the operations passed on to another stream.
+class DLL_EXPORT output_recorder: virtual public output,
+                                  virtual protected recorder_core
+{
+	public:
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+		virtual void flush();
+		virtual caps write_caps() const;
+
+		/// @copydoc input_recorder::open()
+		void open(output_sptr parent, recording_sptr rec);
+
+	protected:
+		output_sptr out_parent; ///< Parent stream for writing
+};
+
+/// Shared pointer to a writable recorder.
+typedef boost::shared_ptr<output_recorder> output_recorder_sptr;
+
+/// Read/write stream recording the operations passed on to another stream.
+class DLL_EXPORT recorder: virtual public inout,
+                           virtual public input_recorder,
+                           virtual public output_recorder
+{
+	public:
+		/// @copydoc input_recorder::open()
+		void open(inout_sptr parent, recording_sptr rec);
+
+		/// Record all operations on a segmented stream.
+		/**
+		 * @copydetails input_recorder::open()
+		 *
+		 * Using this version allows insert() and remove() to be used.
+		 */
+		void open(seg_sptr parent, recording_sptr rec);
+
+		/// Call seg::insert() on the parent stream.
+		/**
+		 * @throw stream::write_error
+		 *   The parent stream was not opened as a seg.
+		 */
+		void insert(stream::len lenInsert);
+
+		/// Call seg::remove() on the parent stream.
+		/**
+		 * @throw stream::write_error
+		 *   The parent stream was not opened as a seg.
+		 */
+		void remove(stream::len lenRemove);
+
+	protected:
+		seg_sptr seg_parent; ///< Parent stream, if it is a seg
+};
+
+/// Shared pointer to a readable and writable recorder.
+typedef boost::shared_ptr<recorder> recorder_sptr;
+
+
+/// Function creating a stream to replay a recording against.
+/**
+ * The function is called once for each stream in the recording, with the
+ * size the stream had when it was opened.  It must return a stream of that
+ * size filled with any data, with the seek pointer at the start.
+ */
+typedef boost::function<inout_sptr(stream::len)> fn_replay_backend;
+
+/// Replay backend keeping each stream in memory.
+DLL_EXPORT inout_sptr replay_memory(stream::len size);
+
+/// Replay backend keeping each stream in a temporary file.
+/**
+ * @param prefix
+ *   Path and start of the filename.  A number is appended to make each
+ *   file unique.  The files are deleted when the replay finishes.
+ *
+ * @param size
+ *   Initial size of the stream.
+ *
+ * Use with boost::bind, e.g. boost::bind(replay_file, "/tmp/replay", _1).
+ */
+DLL_EXPORT inout_sptr replay_file(const std::string& prefix, stream::len size);
+
+/// Replay backend using a seg on top of a memory stream.
+DLL_EXPORT inout_sptr replay_seg(stream::len size);
+
+/// Results of replaying a recording.
+struct DLL_EXPORT replay_stats {
+	unsigned long ops;         ///< Number of operations replayed
+	stream::len bytesRead;     ///< Total bytes read
+	stream::len bytesWritten;  ///< Total bytes written
+	unsigned long mismatches;  ///< Reads/writes transferring a different
+	                           ///< amount to when they were recorded
+	double seconds;            ///< Time taken by the whole replay
+
+	replay_stats();
+};
+
+/// Perform the operations in a recording again, on synthetic data.
+/**
+ * @param rec
+ *   Recording to replay.
+ *
+ * @param backend
+ *   Function creating each stream to replay against, e.g. replay_memory.
+ *
+ * @param paced
+ *   false to run each operation as soon as the previous one finishes, true
+ *   to wait until the same time since the start as when it was recorded.
+ *
+ * @return Totals for the replay.
+ *
+ * If the streams returned by \e backend are not seg instances, recorded
+ * insert and remove operations are carried out with stream::move() and
+ * truncate() instead, which is how code not using seg would have to do it.
+ *
+ * @throw stream::error
+ *   Any error from the backend streams is passed on.
+ */
+DLL_EXPORT replay_stats replay(const recording& rec, fn_replay_backend backend,
+	bool paced = false);
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_RECORDER_HPP_
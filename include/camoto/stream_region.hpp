@@ -0,0 +1,162 @@
+/**
+ * @file  camoto/stream_region.hpp
+ * @brief Write disjoint parts of one file from several threads at once.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_REGION_HPP_
+#define _CAMOTO_STREAM_REGION_HPP_
+
+#include <map>
+#include <boost/thread/mutex.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/stream_file.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// State shared between a region_writer and the regions it hands out.
+struct DLL_EXPORT region_target
+{
+	output_file_sptr dest;   ///< File being written
+	int fd;                  ///< Descriptor for positional writes
+	boost::mutex mutex;      ///< Serialises writes where pwrite() is missing
+
+	/// Write the whole buffer at the given offset in the file.
+	/**
+	 * @throw write_error
+	 *   The write failed.
+	 */
+	void writeAt(stream::pos off, const uint8_t *buffer, stream::len len);
+};
+
+/// Fixed-size window onto part of a file, handed out by region_writer.
+/**
+ * Unlike output_sub, each region has its own write pointer and never moves
+ * the file's, so regions can be written by different threads at the same
+ * time.  A region can't grow, so writes past its end are short.
+ */
+class DLL_EXPORT output_region: virtual public output
+{
+	public:
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+
+		/// Regions have a fixed size.
+		/**
+		 * @throw write_error
+		 *   Always, unless \e size is the region's current size.
+		 */
+		virtual void truncate(stream::pos size);
+
+		/// Does nothing, as writes go straight to the file.
+		/**
+		 * Use region_writer::flush() once every region has been written.
+		 */
+		virtual void flush();
+
+		virtual caps write_caps() const;
+
+	protected:
+		boost::shared_ptr<region_target> target; ///< File to write to
+		stream::pos start;      ///< Offset of the region in the file
+		stream::len stream_len; ///< Size of the region
+		stream::pos offset;     ///< Current pointer position
+
+		output_region(boost::shared_ptr<region_target> target, stream::pos start,
+			stream::len len);
+
+		friend class region_writer;
+};
+
+/// Shared pointer to a region of a file.
+typedef boost::shared_ptr<output_region> output_region_sptr;
+
+/// Hands out non-overlapping regions of a file for writing in parallel.
+/**
+ * When the final offset of every member of an archive is known in advance,
+ * the members can be encoded and written by worker threads at the same time
+ * instead of one after another through the file's single write pointer.
+ *
+ * @code
+ * region_writer w(file, totalSize);
+ * // On any thread:
+ * output_sptr r = w.region(member.offset, member.size);
+ * encode(member, r);
+ * // Once all the workers have finished:
+ * w.flush();
+ * @endcode
+ *
+ * The file must not be written through its own pointer while regions are
+ * being written, and regions must not be used after flush().
+ */
+class DLL_EXPORT region_writer
+{
+	public:
+		/// Prepare a file for writing in regions.
+		/**
+		 * @param dest
+		 *   File to write.  Any buffered writes are flushed first.
+		 *
+		 * @param size
+		 *   Final size of the file.  The file is extended to this size and the
+		 *   space allocated up front where the filesystem supports it, so
+		 *   concurrent writes don't fragment it.  The file is never shrunk.
+		 *
+		 * @throw write_error
+		 *   The file could not be extended.
+		 */
+		region_writer(output_file_sptr dest, stream::len size);
+
+		/// Get a writable window onto part of the file.
+		/**
+		 * This may be called from any thread.
+		 *
+		 * @param start
+		 *   Offset of the region in the file.
+		 *
+		 * @param len
+		 *   Size of the region.
+		 *
+		 * @return A stream of exactly \e len bytes, with its write pointer at
+		 *   the start.
+		 *
+		 * @throw write_error
+		 *   The region goes past the size given to the constructor, or
+		 *   overlaps a region already handed out.
+		 */
+		output_sptr region(stream::pos start, stream::len len);
+
+		/// Finish writing.
+		/**
+		 * Call this once, after every region has been written, so the file's
+		 * own stream sees the new content.
+		 */
+		void flush();
+
+	protected:
+		boost::shared_ptr<region_target> target; ///< File to write to
+		stream::len size;                ///< Size of the file
+		std::map<stream::pos, stream::len> used; ///< Regions handed out
+		boost::mutex mutex;              ///< Protects \e used
+};
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_REGION_HPP_
@@ -25,6 +25,7 @@
 
 #include <vector>
 #include <camoto/stream.hpp>
+#include <camoto/mem_budget.hpp>
 
 namespace camoto {
 namespace stream {
@@ -46,6 +47,8 @@ typedef boost::shared_ptr<seg> seg_sptr;
 class DLL_EXPORT seg: virtual public inout
 {
 	public:
+		seg();
+
 		virtual stream::len try_read(uint8_t *buffer, stream::len len);
 		virtual void seekg(stream::delta off, seek_from from);
 		virtual stream::pos tellg() const;
@@ -56,6 +59,32 @@ class DLL_EXPORT seg: virtual public inout
 		virtual void truncate(stream::pos size);
 		virtual void flush();
 
+		/// Find out what reading from this stream can do cheaply.
+		/**
+		 * These are the parent's capabilities, except that data inserted since
+		 * the last flush() lives in memory, so only cap_seekable, cap_memory and
+		 * cap_mappable are passed on.  size() is always cheap.
+		 */
+		virtual caps read_caps() const;
+
+		/// Find out what writing to this stream can do cheaply.
+		/**
+		 * @copydetails read_caps()
+		 */
+		virtual caps write_caps() const;
+
+		/// Get a second read pointer over the same content.
+		/**
+		 * Inserted data lives in this object until flush(), so only a seg with
+		 * no pending inserts or removals can be cloned.  The clone is then a
+		 * substream over a clone of the parent.
+		 *
+		 * @throw error
+		 *   There are changes that haven't been flushed yet, or the parent
+		 *   stream can't be cloned.
+		 */
+		virtual input_sptr clone_cursor() const;
+
 		/// Create a segmented stream backed onto another stream.
 		/**
 		 * @param parent
@@ -107,13 +136,24 @@ class DLL_EXPORT seg: virtual public inout
 		 */
 		void remove(stream::len lenRemove);
 
+		/// Number of bytes of inserted data held in memory until flush().
+		/**
+		 * Inserted data is counted in the mem_seg_insert pool of the mem_budget.
+		 * It can't be spilled to disk, so under the mem_spill policy it may go
+		 * over budget.
+		 */
+		stream::len memoryHeld() const;
+
 	protected:
 		inout_sptr parent;                  ///< Parent stream
 		stream::pos off_parent;             ///< Offset into parent stream
 		stream::pos off_endparent;          ///< Offset of vcSecond
 		std::vector<uint8_t> vcSecond;      ///< Data to place after parent stream
+		mem_account vcSecondAccount;        ///< Size of vcSecond in the budget
 		seg_sptr psegThird;                 ///< Data to place after vcSecond
 
+		friend class read_scheduler;
+
 		/// Offset into self (starts at 0)
 		/**
 		 * When offset == 0, the parent stream file pointer is at off_parent.
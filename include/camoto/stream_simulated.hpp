@@ -0,0 +1,225 @@
+/**
+ * @file  camoto/stream_simulated.hpp
+ * @brief Stream decorator making another stream behave like slower storage.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_SIMULATED_HPP_
+#define _CAMOTO_STREAM_SIMULATED_HPP_
+
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Performance characteristics of a simulated storage device.
+struct DLL_EXPORT sim_device {
+	/// Fixed cost of every read, write, truncate and flush, in nanoseconds.
+	unsigned long long latencyNs;
+
+	/// Extra cost when a read or write doesn't start where the last one ended.
+	unsigned long long seekNs;
+
+	/// Maximum transfer rate in bytes per second, or 0 for unlimited.
+	unsigned long long bytesPerSecond;
+
+	/// Chance of a read returning less data than requested, from 0 to 1.
+	/**
+	 * A short read returns between one byte and one byte less than requested,
+	 * even when more data is available, as can happen with pipes and network
+	 * filesystems.  Code reading through the stream must cope with this by
+	 * calling try_read() again.  Much of the library treats a short read as
+	 * the end of the data (e.g. stream::copy() and input::read()), so this is
+	 * 0 in every preset and must be turned on explicitly to test a caller.
+	 */
+	double shortReadChance;
+
+	/// Seed for deciding which reads come up short.
+	/**
+	 * Two simulated streams with the same seed and the same sequence of calls
+	 * always behave identically.
+	 */
+	uint32_t seed;
+
+	/// Sleep for the simulated time as well as adding it to the clock?
+	/**
+	 * If false, operations run at full speed and only the virtual clock
+	 * returned by simulated_core::elapsedNs() shows the simulated cost.
+	 */
+	bool realTime;
+
+	/// Default device, which is as fast as the parent stream.
+	sim_device();
+
+	/// Typical spinning hard disk.
+	static sim_device hdd();
+
+	/// Typical network filesystem, with high latency and a slow transfer rate.
+	static sim_device network();
+};
+
+/// Simulated stream parts in common with read and write
+class DLL_EXPORT simulated_core
+{
+	public:
+		/// Total simulated time of all operations so far, in nanoseconds.
+		unsigned long long elapsedNs() const;
+
+		/// Number of reads and writes that were charged a seek penalty.
+		unsigned long long seeks() const;
+
+		/// Number of reads cut short on purpose.
+		unsigned long long shortReads() const;
+
+		/// Set the clock and counters back to zero.
+		void resetClock();
+
+	protected:
+		sim_device dev;                ///< Device being simulated
+		uint32_t rng;                  ///< Random number state for short reads
+		unsigned long long clockNs;    ///< Simulated time so far
+		unsigned long long seekCount;  ///< Number of seek penalties charged
+		unsigned long long shortCount; ///< Number of short reads
+		stream::pos pos;               ///< Current position in the parent
+		stream::pos lastEnd;           ///< Where the last read or write ended
+
+		simulated_core();
+
+		/// Start simulating a device.
+		/**
+		 * @param dev
+		 *   Device to simulate.
+		 *
+		 * @param pos
+		 *   Current position in the parent, so the first access from here
+		 *   isn't charged a seek.
+		 */
+		void start(const sim_device& dev, stream::pos pos);
+
+		/// Charge the cost of an operation to the clock.
+		/**
+		 * @param bytes
+		 *   Number of bytes transferred.
+		 *
+		 * @param access
+		 *   true for reads and writes, which are charged a seek penalty if they
+		 *   don't start where the last one ended.
+		 */
+		void charge(stream::len bytes, bool access);
+
+		/// Decide how much of a read to actually perform.
+		/**
+		 * @param len
+		 *   Number of bytes requested.
+		 *
+		 * @return \e len, or less if this read should come up short.
+		 */
+		stream::len readLength(stream::len len);
+};
+
+/// Read-only stream simulating a slower device on top of another stream.
+class DLL_EXPORT input_simulated: virtual public input,
+                                  virtual protected simulated_core
+{
+	public:
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::pos size() const;
+		virtual caps read_caps() const;
+
+		/// Simulate a device on top of another stream.
+		/**
+		 * @param parent
+		 *   Parent stream to pass all operations on to.
+		 *
+		 * @param dev
+		 *   Device to simulate.
+		 */
+		void open(input_sptr parent, const sim_device& dev);
+
+		using simulated_core::elapsedNs;
+		using simulated_core::seeks;
+		using simulated_core::shortReads;
+		using simulated_core::resetClock;
+
+	protected:
+		input_sptr in_parent;  ///< Parent stream for reading
+};
+
+/// Shared pointer to a readable simulated stream.
+typedef boost::shared_ptr<input_simulated> input_simulated_sptr;
+
+/// Write-only stream simulating a slower device on top of another stream.
+class DLL_EXPORT output_simulated: virtual public output,
+                                   virtual protected simulated_core
+{
+	public:
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+		virtual void flush();
+		virtual caps write_caps() const;
+
+		/// Simulate a device on top of another stream.
+		/**
+		 * @param parent
+		 *   Parent stream to pass all operations on to.
+		 *
+		 * @param dev
+		 *   Device to simulate.
+		 */
+		void open(output_sptr parent, const sim_device& dev);
+
+		using simulated_core::elapsedNs;
+		using simulated_core::seeks;
+		using simulated_core::shortReads;
+		using simulated_core::resetClock;
+
+	protected:
+		output_sptr out_parent; ///< Parent stream for writing
+};
+
+/// Shared pointer to a writable simulated stream.
+typedef boost::shared_ptr<output_simulated> output_simulated_sptr;
+
+/// Read/write stream simulating a slower device on top of another stream.
+class DLL_EXPORT simulated: virtual public inout,
+                            virtual public input_simulated,
+                            virtual public output_simulated
+{
+	public:
+		/// Simulate a device on top of another stream.
+		/**
+		 * @copydetails input_simulated::open()
+		 */
+		void open(inout_sptr parent, const sim_device& dev);
+
+		using simulated_core::elapsedNs;
+		using simulated_core::seeks;
+		using simulated_core::shortReads;
+		using simulated_core::resetClock;
+};
+
+/// Shared pointer to a readable and writable simulated stream.
+typedef boost::shared_ptr<simulated> simulated_sptr;
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_SIMULATED_HPP_
@@ -65,6 +65,15 @@ class DLL_EXPORT input_string:
 		virtual void seekg(stream::delta off, seek_from from);
 		virtual stream::pos tellg() const;
 		virtual stream::pos size() const;
+		virtual caps read_caps() const;
+
+		/// Get a second read pointer over the same string.
+		/**
+		 * The clone shares the string, so writes made through this stream are
+		 * visible to it.  Reading clones from several threads at once is safe
+		 * as long as nothing writes to the string meanwhile.
+		 */
+		virtual input_sptr clone_cursor() const;
 
 		/// Wrap around an existing string.
 		/**
@@ -99,6 +108,7 @@ class DLL_EXPORT output_string:
 		virtual stream::pos tellp() const;
 		virtual void truncate(stream::pos size);
 		virtual void flush();
+		virtual caps write_caps() const;
 
 		/// Wrap around an existing string.
 		/**
@@ -82,6 +82,27 @@ class DLL_EXPORT input_sub: virtual public input,
 
 		virtual stream::pos size() const;
 
+		/// Find out what reading from this stream can do cheaply.
+		/**
+		 * These are the parent's capabilities, without cap_holes as the offsets
+		 * differ, and with cap_size_fast as the length is stored.  Each read
+		 * seeks the parent first, so cap_positional is only kept by clones,
+		 * which have a parent of their own.
+		 */
+		virtual caps read_caps() const;
+
+		/// Get a second read pointer over the same section.
+		/**
+		 * The clone is a substream over a clone of the parent, so it can be read
+		 * in parallel with this one if the parent allows it.  It covers the
+		 * section as it is now, and is not moved or resized by later calls to
+		 * relocate() or resize() on this substream.
+		 *
+		 * @throw error
+		 *   The parent stream can't be cloned.
+		 */
+		virtual input_sptr clone_cursor() const;
+
 		/// Map onto a subsection of another stream.
 		/**
 		 * @param parent
@@ -103,6 +124,9 @@ class DLL_EXPORT input_sub: virtual public input,
 
 	protected:
 		input_sptr in_parent; ///< Parent stream for reading
+		bool ownParent;       ///< Is in_parent used by this stream only?
+
+		friend class read_scheduler;
 };
 
 /// Shared pointer to a readable substream.
@@ -123,6 +147,14 @@ class DLL_EXPORT output_sub: virtual public output,
 
 		virtual void flush();
 
+		/// Find out what writing to this stream can do cheaply.
+		/**
+		 * These are the parent's capabilities, without cap_holes as the offsets
+		 * differ, and with cap_size_fast as the length is stored.  Each write
+		 * seeks the parent first, so cap_positional is never kept.
+		 */
+		virtual caps write_caps() const;
+
 		/// Map onto a subsection of another stream.
 		/**
 		 * @param parent
@@ -0,0 +1,169 @@
+/**
+ * @file  camoto/trace.hpp
+ * @brief Timeline capture of stream and filter operations.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_TRACE_HPP_
+#define _CAMOTO_TRACE_HPP_
+
+#include <stdint.h>
+#include <iostream>
+#include <boost/atomic.hpp>
+
+#ifndef DLL_EXPORT
+#define DLL_EXPORT
+#endif
+
+/// Number of events kept per thread before the oldest are overwritten.
+#define TRACE_BUFFER_EVENTS 65536
+
+namespace camoto {
+
+/// Timeline capture of stream and filter operations.
+/**
+ * Trace points are placed in the stream classes, the filtered streams and the
+ * LZW filter.  While tracing is enabled, each one records when it started,
+ * how long it took, which thread it ran on, which object it ran on and one
+ * numeric argument (usually a length or offset).
+ *
+ * Each thread records into its own fixed-size ring buffer, allocated the first
+ * time that thread records an event, so recording never takes a lock.  Once
+ * the buffer is full the oldest events are overwritten.  When a thread exits
+ * its buffer is kept, with its events, and handed on to the next new thread,
+ * so threads that come and go (such as the reader in copy_pipelined()) share
+ * a buffer and show up in the trace as one thread.
+ *
+ * The captured events can be written out in the Chrome trace JSON format,
+ * which can be loaded into Perfetto (ui.perfetto.dev) or chrome://tracing.
+ *
+ * @code
+ * camoto::trace::enable(true);
+ * // ... do some work ...
+ * camoto::trace::enable(false);
+ * std::ofstream json("trace.json");
+ * camoto::trace::exportChrome(json);
+ * @endcode
+ */
+namespace trace {
+
+/// Set by enable(), checked by every trace point.  Internal use only.
+extern DLL_EXPORT boost::atomic<bool> active;
+
+/// Start or stop recording events.
+/**
+ * Events already recorded are kept when tracing is stopped, until clear() is
+ * called.
+ */
+DLL_EXPORT void enable(bool on);
+
+/// Is tracing currently turned on?
+DLL_EXPORT bool enabled();
+
+/// Discard every recorded event on every thread.
+/**
+ * Buffers left by threads that have exited are freed.
+ *
+ * This must not be called while other threads are recording events.
+ */
+DLL_EXPORT void clear();
+
+/// Number of ring buffers currently allocated, one per recording thread.
+DLL_EXPORT unsigned long buffers();
+
+/// Write all recorded events as a Chrome trace JSON document.
+/**
+ * @param s
+ *   Stream to write the JSON to.
+ *
+ * Events being recorded on other threads while this runs may be left out,
+ * but will never be written out half-finished.
+ */
+DLL_EXPORT void exportChrome(std::ostream& s);
+
+/// Total number of events exportChrome() would currently write out.
+/**
+ * Once a thread's buffer has filled, one slot is always reserved for the
+ * event being recorded, so at most TRACE_BUFFER_EVENTS - 1 are kept.
+ */
+DLL_EXPORT unsigned long events();
+
+/// Record one event covering the lifetime of this object.
+/**
+ * Use the CAMOTO_TRACE() macro rather than creating these directly.
+ */
+class DLL_EXPORT scope
+{
+	public:
+		/// Start timing an event, if tracing is enabled.
+		/**
+		 * @param category
+		 *   Broad type of event, e.g. "stream" or "filter".  Must be a string
+		 *   constant, as only the pointer is stored.
+		 *
+		 * @param name
+		 *   Event name, e.g. "file::try_read".  Must be a string constant.
+		 *
+		 * @param obj
+		 *   Object the operation is being performed on, used to tell streams of
+		 *   the same type apart.  May be NULL.
+		 *
+		 * @param arg
+		 *   Any number relevant to the event, such as a length or offset.
+		 */
+		inline scope(const char *category, const char *name, const void *obj,
+			uint64_t arg)
+			:	name(NULL)
+		{
+			if (active.load(boost::memory_order_relaxed)) {
+				this->begin(category, name, obj, arg);
+			}
+		}
+
+		inline ~scope()
+		{
+			if (this->name) this->end();
+		}
+
+	protected:
+		void begin(const char *category, const char *name, const void *obj,
+			uint64_t arg);
+		void end();
+
+		const char *category;
+		const char *name;     ///< NULL if this event isn't being recorded
+		const void *obj;
+		uint64_t arg;
+		uint64_t tStart;      ///< Start time in nanoseconds
+};
+
+} // namespace trace
+} // namespace camoto
+
+#ifdef CAMOTO_NO_TRACE
+#define CAMOTO_TRACE(category, name, obj, arg)
+#else
+/// Record an event lasting until the end of the enclosing block.
+/**
+ * Define CAMOTO_NO_TRACE before including this file to compile trace points
+ * out entirely.
+ */
+#define CAMOTO_TRACE(category, name, obj, arg) \
+	::camoto::trace::scope camoto_trace_scope_((category), (name), (obj), (arg))
+#endif
+
+#endif // _CAMOTO_TRACE_HPP_
@@ -59,7 +59,7 @@ int bitstream::read(unsigned int bits, unsigned int *out)
 	return this->read(NULL, bits, out);
 }
 
-int bitstream::read(fn_getnextchar fnNextChar, unsigned int bits, unsigned int *out)
+int bitstream::read(const fn_getnextchar& fnNextChar, unsigned int bits, unsigned int *out)
 {
 	*out = 0;
 	int bitsread = 0;
@@ -173,7 +173,7 @@ int bitstream::write(unsigned int bits, unsigned int in)
 	return this->write(NULL, bits, in);
 }
 
-int bitstream::write(fn_putnextchar fnNextChar, unsigned int bits, unsigned int in)
+int bitstream::write(const fn_putnextchar& fnNextChar, unsigned int bits, unsigned int in)
 {
 	// Make sure the number being written can actually fit in this many bits.
 	assert((bits == 32) || (in < (1u << bits)));
@@ -337,7 +337,7 @@ void bitstream::flushByte()
 	return;
 }
 
-void bitstream::flushByte(fn_putnextchar fnNextChar)
+void bitstream::flushByte(const fn_putnextchar& fnNextChar)
 {
 	// Write out the buf byte (if it has been changed)
 	if (this->parent) this->writeBufByte();
@@ -0,0 +1,306 @@
+/**
+ * @file   chunk_index.cpp
+ * @brief  Saved tables of chunk offsets, for reopening containers quickly.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <camoto/chunk_index.hpp>
+#include <camoto/iostream_helpers.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/util.hpp> // createString
+
+namespace camoto {
+
+/// Signature at the start of a saved index.
+#define CIDX_MAGIC "CIDX"
+
+/// Version of the saved index format.
+#define CIDX_VERSION 1
+
+/// Number of bytes at the start of a container that are hashed.
+#define CIDX_HEADER_LEN 4096
+
+/// Smallest possible size of a saved entry, for sanity checking counts.
+#define CIDX_MIN_ENTRY (8 + 8 + 1 + 1)
+
+/// 64-bit FNV-1a hash.
+static uint64_t fnv1a(const uint8_t *data, stream::len len, uint64_t h)
+{
+	for (stream::len i = 0; i < len; i++) {
+		h ^= data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/// FNV-1a starting value.
+#define FNV_OFFSET 14695981039346656037ULL
+
+/// Write a string with an 8-bit length in front.
+static void writeShort(stream::output_sptr out, const std::string& s)
+{
+	uint8_t len = std::min(s.length(), (std::string::size_type)255);
+	out << u8(len);
+	out->write(s.data(), len);
+	return;
+}
+
+/// Read a string with an 8-bit length in front.
+static std::string readShort(stream::input_sptr in)
+{
+	uint8_t len;
+	std::string s;
+	in >> u8(len) >> fixedLength(s, len);
+	return s;
+}
+
+
+chunk_index::key::key()
+	:	size(0),
+		mtime(0),
+		headerHash(0)
+{
+}
+
+bool chunk_index::key::operator==(const key& other) const
+{
+	return (this->size == other.size)
+		&& (this->mtime == other.mtime)
+		&& (this->headerHash == other.headerHash)
+		&& (this->path == other.path);
+}
+
+chunk_index::entry::entry()
+	:	start(0),
+		len(0)
+{
+}
+
+chunk_index::chunk_index()
+	:	isChanged(false)
+{
+}
+
+const chunk_index::list *chunk_index::find(stream::pos parent) const
+{
+	std::map<stream::pos, list>::const_iterator i = this->lists.find(parent);
+	if (i == this->lists.end()) return NULL;
+	return &i->second;
+}
+
+void chunk_index::add(stream::pos parent, const list& chunks)
+{
+	this->lists[parent] = chunks;
+	this->isChanged = true;
+	return;
+}
+
+void chunk_index::setType(stream::pos parent, unsigned int index,
+	const std::string& type)
+{
+	std::map<stream::pos, list>::iterator i = this->lists.find(parent);
+	assert(i != this->lists.end());
+	assert(index < i->second.size());
+	if (i->second[index].type == type) return;
+	i->second[index].type = type;
+	this->isChanged = true;
+	return;
+}
+
+bool chunk_index::changed() const
+{
+	return this->isChanged;
+}
+
+void chunk_index::write(stream::output_sptr out) const
+{
+	out
+		<< nullPadded(CIDX_MAGIC, 4)
+		<< u16le(CIDX_VERSION)
+		<< u16le(this->id.path.length())
+	;
+	out->write(this->id.path);
+	out
+		<< u64le(this->id.size)
+		<< s64le(this->id.mtime)
+		<< u64le(this->id.headerHash)
+		<< u32le(this->lists.size())
+	;
+	for (std::map<stream::pos, list>::const_iterator
+		i = this->lists.begin(); i != this->lists.end(); i++
+	) {
+		out
+			<< u64le(i->first)
+			<< u32le(i->second.size())
+		;
+		for (list::const_iterator
+			j = i->second.begin(); j != i->second.end(); j++
+		) {
+			out
+				<< u64le(j->start)
+				<< u64le(j->len)
+			;
+			writeShort(out, j->name);
+			writeShort(out, j->type);
+		}
+	}
+	return;
+}
+
+void chunk_index::read(stream::input_sptr in)
+{
+	this->lists.clear();
+	this->isChanged = false;
+	this->id = key();
+	try {
+		std::string magic;
+		unsigned int version, lenPath;
+		in >> fixedLength(magic, 4) >> u16le(version);
+		if ((magic.compare(CIDX_MAGIC) != 0) || (version != CIDX_VERSION)) {
+			throw stream::error("Not a chunk index, or an unsupported version");
+		}
+		in >> u16le(lenPath) >> fixedLength(this->id.path, lenPath);
+		unsigned int numLists;
+		in
+			>> u64le(this->id.size)
+			>> s64le(this->id.mtime)
+			>> u64le(this->id.headerHash)
+			>> u32le(numLists)
+		;
+		for (unsigned int i = 0; i < numLists; i++) {
+			stream::pos parent;
+			unsigned int count;
+			in >> u64le(parent) >> u32le(count);
+			// Don't let a corrupted count allocate gigabytes
+			stream::len remaining = in->size() - in->tellg();
+			if ((stream::len)count * CIDX_MIN_ENTRY > remaining) {
+				throw stream::error("Chunk index is truncated");
+			}
+			list& chunks = this->lists[parent];
+			chunks.resize(count);
+			for (list::iterator j = chunks.begin(); j != chunks.end(); j++) {
+				in
+					>> u64le(j->start)
+					>> u64le(j->len)
+				;
+				j->name = readShort(in);
+				j->type = readShort(in);
+			}
+		}
+	} catch (const stream::incomplete_read&) {
+		this->lists.clear();
+		this->id = key();
+		throw stream::error("Chunk index is truncated");
+	} catch (const stream::error&) {
+		this->lists.clear();
+		this->id = key();
+		throw;
+	}
+	return;
+}
+
+
+index_cache::index_cache(const std::string& dir)
+	:	dir(dir)
+{
+}
+
+chunk_index::key index_cache::makeKey(const std::string& path,
+	stream::input_sptr content)
+{
+	chunk_index::key k;
+	k.path = path;
+
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0) {
+		throw stream::error(createString("Unable to examine " << path << ": "
+			<< strerror(errno)));
+	}
+	k.size = st.st_size;
+	k.mtime = st.st_mtime;
+
+	uint8_t header[CIDX_HEADER_LEN];
+	stream::pos orig = content->tellg();
+	content->seekg(0, stream::start);
+	stream::len r = content->try_read(header, sizeof(header));
+	content->seekg(orig, stream::start);
+	k.headerHash = fnv1a(header, r, FNV_OFFSET);
+	return k;
+}
+
+chunk_index_sptr index_cache::load(const std::string& path,
+	stream::input_sptr content)
+{
+	chunk_index::key k = index_cache::makeKey(path, content);
+	chunk_index_sptr index(new chunk_index());
+	try {
+		stream::input_file_sptr saved(new stream::input_file());
+		saved->open(this->indexPath(path));
+		index->read(saved);
+		if (index->id == k) return index;
+	} catch (const stream::error&) {
+		// No usable index, so start a new one
+	}
+	index.reset(new chunk_index());
+	index->id = k;
+	return index;
+}
+
+void index_cache::save(chunk_index_sptr index)
+{
+	if (!index->changed()) return;
+	std::string dest = this->indexPath(index->id.path);
+	std::string temp = dest + ".tmp";
+	{
+		stream::output_file_sptr out(new stream::output_file());
+		out->create(temp);
+		try {
+			index->write(out);
+			out->flush();
+		} catch (const stream::error&) {
+			out->remove();
+			throw;
+		}
+	}
+#ifdef WIN32
+	// rename() won't replace an existing file
+	::remove(dest.c_str());
+#endif
+	if (rename(temp.c_str(), dest.c_str()) < 0) {
+		int e = errno;
+		::remove(temp.c_str());
+		throw stream::write_error(createString("Unable to save chunk index to "
+			<< dest << ": " << strerror(e)));
+	}
+	return;
+}
+
+std::string index_cache::indexPath(const std::string& path) const
+{
+	if (this->dir.empty()) return path + ".cidx";
+	uint64_t h = fnv1a((const uint8_t *)path.data(), path.length(), FNV_OFFSET);
+	char name[21];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)h);
+	return this->dir + "/" + name + ".cidx";
+}
+
+} // namespace camoto
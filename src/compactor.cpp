@@ -0,0 +1,238 @@
+/**
+ * @file   compactor.cpp
+ * @brief  Remove the holes from an archive, moving as little data as possible.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <boost/chrono.hpp>
+#include <camoto/compactor.hpp>
+#include <camoto/trace.hpp>
+
+namespace camoto {
+
+/// A gap between members.
+struct compact_hole {
+	stream::pos start;
+	stream::len len;
+};
+
+/// Sort members by where they are in the parent.
+static bool byOffset(const stream::sub_sptr& a, const stream::sub_sptr& b)
+{
+	return a->get_offset() < b->get_offset();
+}
+
+/// Sort members largest first.
+static bool bySizeDesc(const stream::sub_sptr& a, const stream::sub_sptr& b)
+{
+	return a->size() > b->size();
+}
+
+/// Sort steps by destination, so the writes go through the file in order.
+static bool byDest(const compactor::step& a, const compactor::step& b)
+{
+	return a.to < b.to;
+}
+
+compactor::compactor(stream::inout_sptr parent, stream::pos base,
+	bool keepOrder)
+	:	parent(parent),
+		base(base),
+		keepOrder(keepOrder),
+		nextStep(0),
+		stepDone(0),
+		blockLen(0),
+		planned(false),
+		lenLive(0)
+{
+}
+
+void compactor::add(stream::sub_sptr member)
+{
+	assert(!this->planned);
+	assert(member->get_offset() >= this->base);
+	this->members.push_back(member);
+	this->lenLive += member->size();
+	return;
+}
+
+const std::vector<compactor::step>& compactor::plan()
+{
+	if (this->planned) return this->steps;
+	this->planned = true;
+	std::sort(this->members.begin(), this->members.end(), byOffset);
+	if (this->keepOrder || !this->planFill()) this->planSlide();
+	return this->steps;
+}
+
+bool compactor::run(unsigned long msLimit)
+{
+	this->plan();
+	boost::chrono::steady_clock::time_point tStart =
+		boost::chrono::steady_clock::now();
+	while (this->nextStep < this->steps.size()) {
+		step& s = this->steps[this->nextStep];
+		stream::len len = s.member->size();
+		CAMOTO_TRACE("stream", "compact", s.member.get(), len);
+		assert(s.member->get_offset() == s.from);
+
+		// Members are copied a block at a time through this->block.  When the
+		// source and destination overlap, writing a block may overwrite part of
+		// its own source, so the block is kept until it has been written in
+		// full and a retry writes it again rather than reading it back.  The
+		// rest of the source is always ahead of the writes, so it stays intact.
+		if (this->block.empty()) this->block.resize(COMPACT_BLOCK_SIZE);
+		bool stop = false;
+		while (this->stepDone < len) {
+			stream::len remaining = len - this->stepDone;
+			stream::len piece = std::min(remaining,
+				(stream::len)this->block.size());
+			// Moving down works from the start, moving up from the end
+			stream::pos off = (s.to < s.from) ? this->stepDone : remaining - piece;
+			if (this->blockLen == 0) {
+				this->parent->seekg(s.from + off, stream::start);
+				this->parent->read(&this->block[0], piece);
+				this->blockLen = piece;
+			}
+			assert(this->blockLen == piece);
+			this->parent->seekp(s.to + off, stream::start);
+			this->parent->write(&this->block[0], piece);
+			this->blockLen = 0;
+			this->stepDone += piece;
+
+			if (msLimit && (this->stepDone < len)) {
+				boost::chrono::milliseconds elapsed =
+					boost::chrono::duration_cast<boost::chrono::milliseconds>(
+						boost::chrono::steady_clock::now() - tStart);
+				if ((unsigned long)elapsed.count() >= msLimit) {
+					stop = true;
+					break;
+				}
+			}
+		}
+		if (stop) break;
+		s.member->relocate((stream::delta)s.to - (stream::delta)s.from);
+		this->nextStep++;
+		this->stepDone = 0;
+
+		if (msLimit) {
+			boost::chrono::milliseconds elapsed =
+				boost::chrono::duration_cast<boost::chrono::milliseconds>(
+					boost::chrono::steady_clock::now() - tStart);
+			if ((unsigned long)elapsed.count() >= msLimit) break;
+		}
+	}
+	return this->done();
+}
+
+bool compactor::done() const
+{
+	return this->planned && (this->nextStep >= this->steps.size());
+}
+
+stream::len compactor::bytesToMove() const
+{
+	stream::len total = 0;
+	for (unsigned int i = this->nextStep; i < this->steps.size(); i++) {
+		total += this->steps[i].member->size();
+	}
+	return total - this->stepDone;
+}
+
+stream::len compactor::extent() const
+{
+	return this->base + this->lenLive;
+}
+
+bool compactor::planFill()
+{
+	stream::pos end = this->extent();
+
+	// Find the holes before the compacted end, and the members after it
+	std::vector<compact_hole> holes;
+	std::vector<stream::sub_sptr> movers;
+	stream::pos cursor = this->base;
+	for (std::vector<stream::sub_sptr>::const_iterator
+		i = this->members.begin(); i != this->members.end(); i++
+	) {
+		stream::pos start = (*i)->get_offset();
+		stream::len len = (*i)->size();
+		if ((start > cursor) && (cursor < end)) {
+			compact_hole h;
+			h.start = cursor;
+			h.len = std::min(start, end) - cursor;
+			holes.push_back(h);
+		}
+		if (start + len > end) {
+			// A member straddling the end can't be moved out of its own way
+			if (start < end) return false;
+			movers.push_back(*i);
+		}
+		cursor = std::max(cursor, start + len);
+	}
+
+	// Largest first, each into the smallest hole it fits
+	std::stable_sort(movers.begin(), movers.end(), bySizeDesc);
+	for (std::vector<stream::sub_sptr>::const_iterator
+		i = movers.begin(); i != movers.end(); i++
+	) {
+		stream::len len = (*i)->size();
+		std::vector<compact_hole>::iterator best = holes.end();
+		for (std::vector<compact_hole>::iterator
+			h = holes.begin(); h != holes.end(); h++
+		) {
+			if ((h->len >= len) && ((best == holes.end()) || (h->len < best->len))) {
+				best = h;
+			}
+		}
+		if (best == holes.end()) {
+			this->steps.clear();
+			return false;
+		}
+		step s;
+		s.member = *i;
+		s.from = (*i)->get_offset();
+		s.to = best->start;
+		this->steps.push_back(s);
+		best->start += len;
+		best->len -= len;
+	}
+	std::sort(this->steps.begin(), this->steps.end(), byDest);
+	return true;
+}
+
+void compactor::planSlide()
+{
+	stream::pos cursor = this->base;
+	for (std::vector<stream::sub_sptr>::const_iterator
+		i = this->members.begin(); i != this->members.end(); i++
+	) {
+		stream::pos start = (*i)->get_offset();
+		if (start != cursor) {
+			step s;
+			s.member = *i;
+			s.from = start;
+			s.to = cursor;
+			this->steps.push_back(s);
+		}
+		cursor += (*i)->size();
+	}
+	return;
+}
+
+} // namespace camoto
@@ -0,0 +1,100 @@
+/**
+ * @file   cpu.cpp
+ * @brief  Pick the fastest version of a kernel for the CPU we're running on.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <iostream>
+#include <camoto/cpu.hpp>
+
+namespace camoto {
+
+/// Names of each cpu_level, for CAMOTO_CPU_LEVEL.
+static const char *cpuLevelName[cpu_level_count] = {
+	"scalar", "sse4.2", "avx2", "avx512"
+};
+
+/// Ask the CPU what it can do.
+static cpu_level cpuDetect()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	// These also check the OS saves the wider registers on a context switch.
+	__builtin_cpu_init();
+	if (
+		__builtin_cpu_supports("avx512f")
+		&& __builtin_cpu_supports("avx512bw")
+	) return cpu_avx512;
+	if (__builtin_cpu_supports("avx2")) return cpu_avx2;
+	if (
+		__builtin_cpu_supports("sse4.2")
+		&& __builtin_cpu_supports("ssse3")
+	) return cpu_sse42;
+#endif
+	return cpu_scalar;
+}
+
+/// Apply CAMOTO_CPU_LEVEL to the detected level.
+static cpu_level cpuChoose()
+{
+	cpu_level level = cpu_detected();
+	const char *env = getenv("CAMOTO_CPU_LEVEL");
+	if (env && env[0]) {
+		cpu_level wanted;
+		if (!cpu_level_from_name(env, &wanted)) {
+			std::cerr << "WARNING: Ignoring unknown CAMOTO_CPU_LEVEL \"" << env
+				<< "\", using " << cpuLevelName[level] << std::endl;
+		} else if (wanted > level) {
+			std::cerr << "WARNING: CAMOTO_CPU_LEVEL \"" << env << "\" is not "
+				"supported by this CPU, using " << cpuLevelName[level] << std::endl;
+		} else {
+			level = wanted;
+		}
+	}
+	return level;
+}
+
+cpu_level cpu_detected()
+{
+	static const cpu_level level = cpuDetect();
+	return level;
+}
+
+cpu_level cpu_active()
+{
+	static const cpu_level level = cpuChoose();
+	return level;
+}
+
+const char *cpu_level_name(cpu_level level)
+{
+	if (level >= cpu_level_count) return "unknown";
+	return cpuLevelName[level];
+}
+
+bool cpu_level_from_name(const std::string& name, cpu_level *level)
+{
+	for (unsigned int i = 0; i < cpu_level_count; i++) {
+		if (name.compare(cpuLevelName[i]) == 0) {
+			*level = (cpu_level)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace camoto
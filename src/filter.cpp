@@ -27,4 +27,9 @@ filter_error::filter_error(const std::string& msg)
 {
 }
 
+std::string filter::fingerprint() const
+{
+	return std::string();
+}
+
 } // namespace camoto
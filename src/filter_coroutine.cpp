@@ -0,0 +1,183 @@
+/**
+ * @file   filter_coroutine.cpp
+ * @brief  Adapter allowing a filter algorithm to be written as straight-line
+ *         code, run incrementally as a coroutine.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/bind.hpp>
+#include <camoto/filter_coroutine.hpp>
+
+/// Mask covering the lowest \e n bits.
+#define BITMASK(n) ((1U << (n)) - 1)
+
+namespace camoto {
+
+filter_coroutine::filter_coroutine(bitstream::endian endianType)
+	:	lenInput(0),
+		endianType(endianType),
+		caller(NULL),
+		inPos(NULL),
+		inEnd(NULL),
+		inEOF(false),
+		outPos(NULL),
+		outEnd(NULL),
+		readBuf(0),
+		readBufBits(0),
+		writeBuf(0),
+		writeBufBits(0)
+{
+}
+
+filter_coroutine::~filter_coroutine()
+{
+	// Unwind run() if it hasn't finished yet, while the rest of this object
+	// still exists.
+	this->coro.reset();
+}
+
+void filter_coroutine::reset(stream::len lenInput)
+{
+	this->lenInput = lenInput;
+	this->readBuf = 0;
+	this->readBufBits = 0;
+	this->writeBuf = 0;
+	this->writeBufBits = 0;
+
+	// Destroying any previous coroutine unwinds it first.  The new one doesn't
+	// start running until the first call to transform().
+	this->coro.reset();
+	this->coro.reset(new coroutine::push_type(
+		boost::bind(&filter_coroutine::entry, this, _1)));
+	return;
+}
+
+void filter_coroutine::transform(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	assert(this->coro); // reset() must be called first
+
+	this->inPos = in;
+	this->inEnd = in + *lenIn;
+	// The caller only ever passes in an empty buffer once all the input data
+	// has been consumed.
+	this->inEOF = (*lenIn == 0);
+	this->outPos = out;
+	this->outEnd = out + *lenOut;
+
+	// Run until run() needs more input or output space, or finishes.  Any
+	// exception thrown by run() is rethrown here.
+	if (*this->coro) (*this->coro)();
+
+	*lenIn = this->inPos - in;
+	*lenOut = this->outPos - out;
+	return;
+}
+
+unsigned int filter_coroutine::readBits(unsigned int bits, unsigned int *out)
+{
+	assert(bits <= 24);
+	bool little = this->endianType == bitstream::littleEndian;
+	while (this->readBufBits < bits) {
+		uint8_t b;
+		if (!this->read(&b)) {
+			// EOF, return whatever is left
+			unsigned int got = this->readBufBits;
+			*out = this->readBuf & BITMASK(got);
+			if (!little) *out <<= bits - got;
+			this->readBuf = 0;
+			this->readBufBits = 0;
+			return got;
+		}
+		if (little) {
+			this->readBuf |= (uint32_t)b << this->readBufBits;
+		} else {
+			this->readBuf = (this->readBuf << 8) | b;
+		}
+		this->readBufBits += 8;
+	}
+	this->readBufBits -= bits;
+	if (little) {
+		*out = this->readBuf & BITMASK(bits);
+		this->readBuf >>= bits;
+	} else {
+		*out = (this->readBuf >> this->readBufBits) & BITMASK(bits);
+		this->readBuf &= BITMASK(this->readBufBits);
+	}
+	return bits;
+}
+
+void filter_coroutine::flushReadBits()
+{
+	// Only whole bytes are ever loaded, so anything left over is the unused
+	// part of the last byte read.
+	this->readBuf = 0;
+	this->readBufBits = 0;
+	return;
+}
+
+void filter_coroutine::writeBits(unsigned int bits, unsigned int in)
+{
+	assert(bits <= 24);
+	in &= BITMASK(bits);
+	if (this->endianType == bitstream::littleEndian) {
+		this->writeBuf |= in << this->writeBufBits;
+		this->writeBufBits += bits;
+		while (this->writeBufBits >= 8) {
+			this->write(this->writeBuf & 0xFF);
+			this->writeBuf >>= 8;
+			this->writeBufBits -= 8;
+		}
+	} else {
+		this->writeBuf = (this->writeBuf << bits) | in;
+		this->writeBufBits += bits;
+		while (this->writeBufBits >= 8) {
+			this->writeBufBits -= 8;
+			this->write((this->writeBuf >> this->writeBufBits) & 0xFF);
+		}
+		this->writeBuf &= BITMASK(this->writeBufBits);
+	}
+	return;
+}
+
+void filter_coroutine::flushWriteBits()
+{
+	if (this->writeBufBits == 0) return;
+	if (this->endianType == bitstream::littleEndian) {
+		this->write(this->writeBuf & 0xFF);
+	} else {
+		this->write((this->writeBuf << (8 - this->writeBufBits)) & 0xFF);
+	}
+	this->writeBuf = 0;
+	this->writeBufBits = 0;
+	return;
+}
+
+void filter_coroutine::suspend()
+{
+	(*this->caller)();
+	return;
+}
+
+void filter_coroutine::entry(coroutine::pull_type& caller)
+{
+	this->caller = &caller;
+	this->run();
+	return;
+}
+
+} // namespace camoto
@@ -41,4 +41,9 @@ void filter_dummy::transform(uint8_t *out, stream::len *lenOut,
 	return;
 }
 
+std::string filter_dummy::fingerprint() const
+{
+	return "dummy";
+}
+
 } // namespace camoto
@@ -0,0 +1,204 @@
+/**
+ * @file   free_space.cpp
+ * @brief  Track unused space in an archive, to update it in place.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <camoto/free_space.hpp>
+
+namespace camoto {
+
+free_space::free_space(stream::len extent)
+	:	length(extent),
+		freeBytes(0)
+{
+}
+
+void free_space::release(stream::pos start, stream::len len)
+{
+	if ((len == 0) || (start >= this->length)) return;
+	stream::pos end = std::min(start + len, this->length);
+
+	// Swallow any hole touching or overlapping this one
+	std::map<stream::pos, stream::len>::iterator i =
+		this->byStart.upper_bound(start);
+	if (i != this->byStart.begin()) {
+		std::map<stream::pos, stream::len>::iterator prev = i;
+		prev--;
+		if (prev->first + prev->second >= start) {
+			start = prev->first;
+			end = std::max(end, prev->first + prev->second);
+			this->removeHole(prev->first, prev->second);
+		}
+	}
+	while ((i != this->byStart.end()) && (i->first <= end)) {
+		stream::pos s = i->first;
+		stream::len l = i->second;
+		i++;
+		end = std::max(end, s + l);
+		this->removeHole(s, l);
+	}
+
+	if (end >= this->length) {
+		this->length = start;
+	} else {
+		this->addHole(start, end - start);
+	}
+	return;
+}
+
+void free_space::reserve(stream::pos start, stream::len len)
+{
+	if (len == 0) return;
+	stream::pos end = start + len;
+
+	// Cut the range out of any holes it overlaps
+	std::map<stream::pos, stream::len>::iterator i =
+		this->byStart.upper_bound(start);
+	if (i != this->byStart.begin()) {
+		i--;
+		if (i->first + i->second <= start) i++;
+	}
+	while ((i != this->byStart.end()) && (i->first < end)) {
+		stream::pos s = i->first;
+		stream::len l = i->second;
+		i++;
+		this->removeHole(s, l);
+		if (s < start) this->addHole(s, start - s);
+		if (s + l > end) this->addHole(end, s + l - end);
+	}
+
+	if (end > this->length) {
+		if (start > this->length) {
+			this->addHole(this->length, start - this->length);
+		}
+		this->length = end;
+	}
+	return;
+}
+
+stream::pos free_space::allocate(stream::len len, placement policy)
+{
+	if ((policy == best_fit) && (len > 0)) {
+		std::multimap<stream::len, stream::pos>::iterator i =
+			this->bySize.lower_bound(len);
+		if (i != this->bySize.end()) {
+			stream::pos s = i->second;
+			stream::len l = i->first;
+			this->removeHole(s, l);
+			if (l > len) this->addHole(s + len, l - len);
+			return s;
+		}
+	}
+	stream::pos s = this->length;
+	this->length += len;
+	return s;
+}
+
+stream::pos free_space::resize(stream::inout_sptr parent,
+	stream::sub_sptr member, stream::len newLen, placement policy)
+{
+	stream::pos old = member->get_offset();
+	stream::len oldLen = member->size();
+
+	if (newLen <= oldLen) {
+		this->release(old + newLen, oldLen - newLen);
+		member->resize(newLen);
+		return old;
+	}
+
+	// Grow in place if the space after the member is free
+	stream::pos tail = old + oldLen;
+	stream::len extra = newLen - oldLen;
+	std::map<stream::pos, stream::len>::const_iterator next =
+		this->byStart.find(tail);
+	if (
+		(tail >= this->length)
+		|| ((next != this->byStart.end()) && (next->second >= extra))
+	) {
+		this->reserve(tail, extra);
+		if (parent->size() < old + newLen) parent->truncate(old + newLen);
+		member->resize(newLen);
+		return old;
+	}
+
+	// Otherwise move it.  The old space is freed first so that it can be
+	// combined with a neighbouring hole, in which case stream::move() copes with
+	// the overlap.
+	std::map<stream::pos, stream::len> origByStart = this->byStart;
+	std::multimap<stream::len, stream::pos> origBySize = this->bySize;
+	stream::len origLength = this->length;
+	stream::len origFree = this->freeBytes;
+	stream::pos dest;
+	try {
+		this->release(old, oldLen);
+		dest = this->allocate(newLen, policy);
+		if (parent->size() < dest + newLen) parent->truncate(dest + newLen);
+		stream::move(parent, old, dest, oldLen);
+	} catch (...) {
+		this->byStart.swap(origByStart);
+		this->bySize.swap(origBySize);
+		this->length = origLength;
+		this->freeBytes = origFree;
+		throw;
+	}
+	member->relocate((stream::delta)dest - (stream::delta)old);
+	member->resize(newLen);
+	return dest;
+}
+
+stream::len free_space::extent() const
+{
+	return this->length;
+}
+
+stream::len free_space::totalFree() const
+{
+	return this->freeBytes;
+}
+
+const std::map<stream::pos, stream::len>& free_space::holes() const
+{
+	return this->byStart;
+}
+
+void free_space::addHole(stream::pos start, stream::len len)
+{
+	this->byStart[start] = len;
+	this->bySize.insert(std::make_pair(len, start));
+	this->freeBytes += len;
+	return;
+}
+
+void free_space::removeHole(stream::pos start, stream::len len)
+{
+	this->byStart.erase(start);
+	std::multimap<stream::len, stream::pos>::iterator i =
+		this->bySize.lower_bound(len);
+	while ((i != this->bySize.end()) && (i->first == len)) {
+		if (i->second == start) {
+			this->bySize.erase(i);
+			break;
+		}
+		i++;
+	}
+	this->freeBytes -= len;
+	return;
+}
+
+} // namespace camoto
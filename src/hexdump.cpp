@@ -0,0 +1,232 @@
+/**
+ * @file   hexdump.cpp
+ * @brief  Hex dumps and binary comparisons of streams of any size.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <ostream>
+#include <camoto/hexdump.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Size of the blocks diff() compares at a time.
+#define DIFF_BLOCK_SIZE (64 * 1024)
+
+/// Precomputed text for each byte value.
+struct hex_table {
+	char pair[256][2];  ///< Two lowercase hex digits
+	char print[256];    ///< Printable character, or '.'
+
+	hex_table()
+	{
+		static const char digits[] = "0123456789abcdef";
+		for (unsigned int i = 0; i < 256; i++) {
+			this->pair[i][0] = digits[i >> 4];
+			this->pair[i][1] = digits[i & 0x0F];
+			this->print[i] = ((i < 32) || (i >= 127)) ? '.' : (char)i;
+		}
+	}
+};
+
+static const hex_table hexTable;
+
+/// Restores a stream's read pointer when it goes out of scope.
+class restore_pos
+{
+	public:
+		restore_pos(input_sptr s)
+			:	s(s),
+				pos(s->tellg())
+		{
+		}
+
+		~restore_pos()
+		{
+			try {
+				this->s->seekg(this->pos, stream::start);
+			} catch (const seek_error&) {
+				// Nothing sensible to do, and we may already be unwinding
+			}
+		}
+
+	protected:
+		input_sptr s;
+		stream::pos pos;
+};
+
+/// Format one line of a hex dump.
+/**
+ * @return Pointer just past the end of the line.
+ */
+static char *formatLine(char *p, const hexdump_options& opts,
+	stream::pos offset, unsigned int offsetDigits, const uint8_t *data,
+	unsigned int len)
+{
+	memcpy(p, opts.prefix.data(), opts.prefix.length());
+	p += opts.prefix.length();
+	for (unsigned int i = offsetDigits; i > 0; i -= 2) {
+		const char *pair = hexTable.pair[(offset >> ((i - 2) * 4)) & 0xFF];
+		*p++ = pair[0];
+		*p++ = pair[1];
+	}
+	*p++ = ':';
+	for (unsigned int i = 0; i < len; i++) {
+		*p++ = ' ';
+		*p++ = hexTable.pair[data[i]][0];
+		*p++ = hexTable.pair[data[i]][1];
+	}
+	if (opts.ascii) {
+		// Pad a short last line so the text lines up
+		memset(p, ' ', (opts.width - len) * 3 + 2);
+		p += (opts.width - len) * 3 + 2;
+		for (unsigned int i = 0; i < len; i++) *p++ = hexTable.print[data[i]];
+	}
+	*p++ = '\n';
+	return p;
+}
+
+hexdump_options::hexdump_options()
+	:	width(16),
+		ascii(true)
+{
+}
+
+void hexdump(std::ostream& out, input_sptr data, stream::pos start,
+	stream::len len, const hexdump_options& opts)
+{
+	hexdump_options o = opts;
+	if (o.width == 0) o.width = 16;
+
+	restore_pos restore(data);
+	stream::len size = data->size();
+	if (start > size) start = size;
+	len = std::min(len, size - start);
+	if (len == 0) return;
+	unsigned int offsetDigits = (start + len > 0xFFFFFFFFULL) ? 16 : 8;
+
+	unsigned int lines = std::max(1u, (unsigned int)(BUFFER_SIZE / o.width));
+	unsigned int lineText = o.prefix.length() + offsetDigits + 1 + o.width * 4
+		+ 3;
+	std::vector<uint8_t> in(lines * o.width);
+	std::vector<char> text(lines * lineText);
+
+	data->seekg(start, stream::start);
+	while (len) {
+		stream::len chunk = std::min(len, (stream::len)in.size());
+		data->read(&in[0], chunk);
+		char *p = &text[0];
+		for (stream::len i = 0; i < chunk; i += o.width) {
+			p = formatLine(p, o, start + i, offsetDigits, &in[i],
+				std::min((stream::len)o.width, chunk - i));
+		}
+		out.write(&text[0], p - &text[0]);
+		start += chunk;
+		len -= chunk;
+	}
+	out.flush();
+	return;
+}
+
+/// Add a difference, joining it to the last one if it's close enough.
+/**
+ * @return false if \e maxRanges has been reached and the difference wasn't
+ *   added.
+ */
+static bool addRange(std::vector<diff_range>& ranges, unsigned int maxRanges,
+	stream::len merge, stream::pos start, stream::len len)
+{
+	if (!ranges.empty()) {
+		diff_range& last = ranges.back();
+		if (start <= last.start + last.len + merge) {
+			last.len = start + len - last.start;
+			return true;
+		}
+	}
+	if (maxRanges && (ranges.size() >= maxRanges)) return false;
+	diff_range r;
+	r.start = start;
+	r.len = len;
+	ranges.push_back(r);
+	return true;
+}
+
+std::vector<diff_range> diff(input_sptr a, input_sptr b,
+	unsigned int maxRanges, stream::len merge)
+{
+	std::vector<diff_range> ranges;
+	restore_pos restoreA(a), restoreB(b);
+	stream::len lenA = a->size();
+	stream::len lenB = b->size();
+	stream::len common = std::min(lenA, lenB);
+
+	std::vector<uint8_t> bufA(DIFF_BLOCK_SIZE), bufB(DIFF_BLOCK_SIZE);
+	a->seekg(0, stream::start);
+	b->seekg(0, stream::start);
+	for (stream::pos off = 0; off < common; ) {
+		stream::len chunk = std::min(common - off, (stream::len)DIFF_BLOCK_SIZE);
+		a->read(&bufA[0], chunk);
+		b->read(&bufB[0], chunk);
+		if (memcmp(&bufA[0], &bufB[0], chunk) != 0) {
+			stream::len i = 0;
+			while (i < chunk) {
+				if (bufA[i] == bufB[i]) {
+					i++;
+					continue;
+				}
+				stream::len j = i + 1;
+				while ((j < chunk) && (bufA[j] != bufB[j])) j++;
+				if (!addRange(ranges, maxRanges, merge, off + i, j - i)) {
+					return ranges;
+				}
+				i = j;
+			}
+		}
+		off += chunk;
+	}
+	if (lenA != lenB) {
+		addRange(ranges, maxRanges, merge, common,
+			std::max(lenA, lenB) - common);
+	}
+	return ranges;
+}
+
+void hexdumpDiff(std::ostream& out, input_sptr a, input_sptr b,
+	const std::vector<diff_range>& ranges, const hexdump_options& opts)
+{
+	hexdump_options optA = opts, optB = opts;
+	if (optA.width == 0) optA.width = optB.width = 16;
+	optA.prefix += "- ";
+	optB.prefix += "+ ";
+	for (std::vector<diff_range>::const_iterator
+		i = ranges.begin(); i != ranges.end(); i++
+	) {
+		stream::pos lineStart = i->start - i->start % optA.width;
+		stream::pos end = i->start + i->len;
+		stream::pos lineEnd = end + (optA.width - end % optA.width) % optA.width;
+		out << opts.prefix << "@@ " << std::hex << "0x" << i->start << std::dec
+			<< ", " << i->len << " byte" << (i->len == 1 ? "" : "s") << " @@\n";
+		hexdump(out, a, lineStart, lineEnd - lineStart, optA);
+		hexdump(out, b, lineStart, lineEnd - lineStart, optB);
+	}
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
@@ -31,6 +31,15 @@ IFFReader::IFFReader(stream::input_sptr iff, Filetype filetype)
 	this->root();
 }
 
+IFFReader::IFFReader(stream::input_sptr iff, Filetype filetype,
+	chunk_index_sptr index)
+	:	iff(iff),
+		filetype(filetype),
+		index(index)
+{
+	this->root();
+}
+
 void IFFReader::root()
 {
 	this->iff->seekg(0, stream::start);
@@ -75,16 +84,23 @@ stream::len IFFReader::seek(unsigned int index)
 
 stream::len IFFReader::open(const fourcc& name, fourcc *type)
 {
-	stream::len len = this->seek(name);
-	this->iff >> fixedLength(*type, 4);
-	this->loadChunks(len - 4);
-	return len;
+	for (unsigned int i = 0; i < this->chunks.size(); i++) {
+		if (name.compare(this->chunks[i].name) == 0) return this->open(i, type);
+	}
+	throw stream::error(createString("IFF: Could not find chunk " << name));
 }
 
 stream::len IFFReader::open(unsigned int index, fourcc *type)
 {
 	stream::len len = this->seek(index);
-	this->iff >> fixedLength(*type, 4);
+	const std::string& known = this->chunks[index].type;
+	if (this->index && !known.empty()) {
+		*type = known;
+		this->iff->seekg(4, stream::cur);
+	} else {
+		this->iff >> fixedLength(*type, 4);
+		if (this->index) this->index->setType(this->listStart, index, *type);
+	}
 	this->loadChunks(len - 4);
 	return len;
 }
@@ -92,6 +108,14 @@ stream::len IFFReader::open(unsigned int index, fourcc *type)
 void IFFReader::loadChunks(stream::len lenChunk)
 {
 	this->chunks.clear();
+	this->listStart = this->iff->tellg();
+	if (this->index) {
+		const chunk_index::list *known = this->index->find(this->listStart);
+		if (known) {
+			this->chunks = *known;
+			return;
+		}
+	}
 	while (lenChunk > 8) {
 		lenChunk -= 8; // ID and chunk size fields
 		Chunk c;
@@ -127,6 +151,7 @@ void IFFReader::loadChunks(stream::len lenChunk)
 		lenChunk -= lenPaddedSub;
 		this->iff->seekg(lenPaddedSub, stream::cur);
 	}
+	if (this->index) this->index->add(this->listStart, this->chunks);
 	return;
 }
 
@@ -0,0 +1,176 @@
+/**
+ * @file   kernels.cpp
+ * @brief  Bulk data processing routines with versions for each CPU level.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <camoto/kernels.hpp>
+
+// The vector versions are compiled with per-function target attributes, so
+// the library as a whole still runs on any x86 CPU.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAMOTO_KERNELS_X86
+#include <immintrin.h>
+#define CPU_TARGET(x) __attribute__((target(x)))
+#endif
+
+namespace camoto {
+
+static void swap16_scalar(uint16_t *data, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		data[i] = (uint16_t)((data[i] >> 8) | (data[i] << 8));
+	}
+	return;
+}
+
+static void swap32_scalar(uint32_t *data, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		uint32_t v = data[i];
+		data[i] = (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000)
+			| (v << 24);
+	}
+	return;
+}
+
+#ifdef CAMOTO_KERNELS_X86
+
+/// Byte shuffle reversing each 16-bit value in a 128-bit lane.
+#define SHUFFLE16 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+
+/// Byte shuffle reversing each 32-bit value in a 128-bit lane.
+#define SHUFFLE32 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+
+static const uint8_t shuffle16[64] = {
+	SHUFFLE16, SHUFFLE16, SHUFFLE16, SHUFFLE16
+};
+
+static const uint8_t shuffle32[64] = {
+	SHUFFLE32, SHUFFLE32, SHUFFLE32, SHUFFLE32
+};
+
+CPU_TARGET("ssse3")
+static void shuffle_sse42(uint8_t *data, size_t len, const uint8_t *mask)
+{
+	const __m128i m = _mm_loadu_si128((const __m128i *)mask);
+	for (size_t i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		_mm_storeu_si128((__m128i *)(data + i), _mm_shuffle_epi8(v, m));
+	}
+	return;
+}
+
+CPU_TARGET("avx2")
+static void shuffle_avx2(uint8_t *data, size_t len, const uint8_t *mask)
+{
+	const __m256i m = _mm256_loadu_si256((const __m256i *)mask);
+	for (size_t i = 0; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+		_mm256_storeu_si256((__m256i *)(data + i), _mm256_shuffle_epi8(v, m));
+	}
+	return;
+}
+
+CPU_TARGET("avx512f,avx512bw")
+static void shuffle_avx512(uint8_t *data, size_t len, const uint8_t *mask)
+{
+	const __m512i m = _mm512_loadu_si512(mask);
+	for (size_t i = 0; i + 64 <= len; i += 64) {
+		__m512i v = _mm512_loadu_si512(data + i);
+		_mm512_storeu_si512(data + i, _mm512_shuffle_epi8(v, m));
+	}
+	return;
+}
+
+// Each vector version does whole blocks and leaves the tail to the scalar one.
+
+static void swap16_sse42(uint16_t *data, size_t count)
+{
+	size_t whole = count & ~(size_t)7;
+	shuffle_sse42((uint8_t *)data, whole * 2, shuffle16);
+	swap16_scalar(data + whole, count - whole);
+	return;
+}
+
+static void swap16_avx2(uint16_t *data, size_t count)
+{
+	size_t whole = count & ~(size_t)15;
+	shuffle_avx2((uint8_t *)data, whole * 2, shuffle16);
+	swap16_sse42(data + whole, count - whole);
+	return;
+}
+
+static void swap16_avx512(uint16_t *data, size_t count)
+{
+	size_t whole = count & ~(size_t)31;
+	shuffle_avx512((uint8_t *)data, whole * 2, shuffle16);
+	swap16_avx2(data + whole, count - whole);
+	return;
+}
+
+static void swap32_sse42(uint32_t *data, size_t count)
+{
+	size_t whole = count & ~(size_t)3;
+	shuffle_sse42((uint8_t *)data, whole * 4, shuffle32);
+	swap32_scalar(data + whole, count - whole);
+	return;
+}
+
+static void swap32_avx2(uint32_t *data, size_t count)
+{
+	size_t whole = count & ~(size_t)7;
+	shuffle_avx2((uint8_t *)data, whole * 4, shuffle32);
+	swap32_sse42(data + whole, count - whole);
+	return;
+}
+
+static void swap32_avx512(uint32_t *data, size_t count)
+{
+	size_t whole = count & ~(size_t)15;
+	shuffle_avx512((uint8_t *)data, whole * 4, shuffle32);
+	swap32_avx2(data + whole, count - whole);
+	return;
+}
+
+#endif // CAMOTO_KERNELS_X86
+
+static const cpu_variant<fn_swap16> swap16_variants[] = {
+	{cpu_scalar, swap16_scalar},
+#ifdef CAMOTO_KERNELS_X86
+	{cpu_sse42, swap16_sse42},
+	{cpu_avx2, swap16_avx2},
+	{cpu_avx512, swap16_avx512},
+#endif
+};
+
+static const cpu_variant<fn_swap32> swap32_variants[] = {
+	{cpu_scalar, swap32_scalar},
+#ifdef CAMOTO_KERNELS_X86
+	{cpu_sse42, swap32_sse42},
+	{cpu_avx2, swap32_avx2},
+	{cpu_avx512, swap32_avx512},
+#endif
+};
+
+const cpu_kernel<fn_swap16> kernel_swap16("swap16", swap16_variants,
+	sizeof(swap16_variants) / sizeof(swap16_variants[0]));
+
+const cpu_kernel<fn_swap32> kernel_swap32("swap32", swap32_variants,
+	sizeof(swap32_variants) / sizeof(swap32_variants[0]));
+
+} // namespace camoto
@@ -23,8 +23,11 @@
  */
 
 #include <iostream>
-#include <boost/bind.hpp>
+#include <string.h>
+#include <boost/ref.hpp>
 #include <camoto/lzw.hpp>
+#include <camoto/trace.hpp>
+#include <camoto/util.hpp> // createString
 
 /// How many bytes should be left in reserve
 /**
@@ -38,6 +41,16 @@
 
 namespace camoto {
 
+/// Describe the LZW parameters shared by the compressor and decompressor.
+static std::string lzwFingerprint(int initialBits, int maxBits, int firstCode,
+	int eofCode, int resetCode, int flags)
+{
+	return createString("lzw:" << initialBits << "," << maxBits << ","
+		<< firstCode << ","
+		<< ((flags & LZW_EOF_PARAM_VALID) ? eofCode : 0) << ","
+		<< ((flags & LZW_RESET_PARAM_VALID) ? resetCode : 0) << "," << flags);
+}
+
 CodeString::CodeString(byte newByte, unsigned pI)
 	:	prefixIndex(pI), first(~0U),
 		nextLeft(~0U), nextRight(~0U),
@@ -79,7 +92,7 @@ Dictionary::Dictionary(unsigned maxBits, unsigned codeStart)
 }
 
 void Dictionary::decode(unsigned oldCode, unsigned code,
-	std::deque<byte>& outStream)
+	std::vector<byte>& outStream)
 {
 	const bool exists = code < newCodeStringIndex;
 
@@ -122,7 +135,9 @@ filter_lzw_decompress::filter_lzw_decompress(int initialBits, int maxBits,
 		flags(flags),
 		eofCode(eofCode),
 		resetCode(resetCode),
+		firstCode(firstCode),
 		initialBits(initialBits),
+		bufferPos(0),
 		dictionary(maxBits, firstCode),
 		data(((flags & LZW_BIG_ENDIAN) != LZW_BIG_ENDIAN) ? bitstream::littleEndian : bitstream::bigEndian),
 		code(0)
@@ -138,22 +153,40 @@ void filter_lzw_decompress::reset(stream::len lenInput)
 	return;
 }
 
-int nextChar(const uint8_t **in, stream::len *lenIn, stream::len *r, uint8_t *out)
+/// Supplies the bitstream with bytes from the transform() input buffer.
+/**
+ * This is passed to the bitstream wrapped in boost::ref(), so boost::function
+ * only stores a pointer to it rather than allocating a copy of the callback
+ * on every call to transform().
+ */
+struct lzw_next_char
 {
-	if (*r < *lenIn) {
-		*out = **in; // "read" byte
-		(*in)++;     // increment read buffer
-		(*r)++;      // increment read count
-		return 1;    // return number of bytes read
+	const uint8_t *in;  ///< Next byte to read
+	stream::len lenIn;  ///< Size of the input buffer
+	stream::len r;      ///< Number of bytes read so far
+
+	int operator() (uint8_t *out)
+	{
+		if (this->r < this->lenIn) {
+			*out = *this->in++;
+			this->r++;
+			return 1; // return number of bytes read
+		}
+		return 0; // EOF
 	}
-	return 0; // EOF
-}
+};
 
 void filter_lzw_decompress::transform(uint8_t *out, stream::len *lenOut,
 	const uint8_t *in, stream::len *lenIn)
 {
-	stream::len r = 0, w = 0;
-	fn_getnextchar cbNext = boost::bind(nextChar, &in, lenIn, &r, _1);
+	CAMOTO_TRACE("filter", "lzw_decompress::transform", this, *lenIn);
+	lzw_next_char next;
+	next.in = in;
+	next.lenIn = *lenIn;
+	next.r = 0;
+	stream::len& r = next.r;
+	stream::len w = 0;
+	fn_getnextchar cbNext = boost::ref(next);
 	while (
 		(w < *lenOut) && (
 			(
@@ -163,9 +196,18 @@ void filter_lzw_decompress::transform(uint8_t *out, stream::len *lenOut,
 		)
 	) {
 		if (!this->buffer.empty()) {
-			*out++ = this->buffer.front();
-			this->buffer.pop_front();
-			w++;
+			// Copy out as much of the last decoded string as will fit
+			stream::len len = std::min((stream::len)this->buffer.size()
+				- this->bufferPos, *lenOut - w);
+			memcpy(out, &this->buffer[this->bufferPos], len);
+			out += len;
+			w += len;
+			this->bufferPos += len;
+			if (this->bufferPos == this->buffer.size()) {
+				// Keep the capacity so the next string doesn't need an allocation
+				this->buffer.clear();
+				this->bufferPos = 0;
+			}
 		} else {
 			if ((this->flags & LZW_EOF_PARAM_VALID) && (this->code == this->curEOFCode)) break;
 
@@ -234,6 +276,12 @@ void filter_lzw_decompress::transform(uint8_t *out, stream::len *lenOut,
 	return;
 }
 
+std::string filter_lzw_decompress::fingerprint() const
+{
+	return lzwFingerprint(this->initialBits, this->maxBits, this->firstCode,
+		this->eofCode, this->resetCode, this->flags);
+}
+
 void filter_lzw_decompress::resetDictionary()
 {
 	this->dictionary.reset();
@@ -283,7 +331,7 @@ filter_lzw_compress::filter_lzw_compress(int initialBits, int maxBits,
 		resetCode(resetCode),
 		firstCode(firstCode),
 		initialBits(initialBits),
-		dictSize(256),
+		dictSize(firstCode),
 		currentBits(initialBits),
 		data(((flags & LZW_BIG_ENDIAN) != LZW_BIG_ENDIAN) ? bitstream::littleEndian : bitstream::bigEndian)
 {
@@ -299,22 +347,38 @@ void filter_lzw_compress::reset(stream::len lenInput)
 	return;
 }
 
-int putChar(uint8_t **out, const stream::len *lenOut, stream::len *w, uint8_t in)
+/// Takes bytes from the bitstream and puts them in the transform() output.
+/**
+ * @see lzw_next_char
+ */
+struct lzw_put_char
 {
-	if (*w < *lenOut) {
-		**out = in; // "write" byte
-		(*out)++;     // increment write buffer
-		(*w)++;      // increment write count
-		return 1;    // return number of bytes written
+	uint8_t *out;       ///< Where to write the next byte
+	stream::len lenOut; ///< Size of the output buffer
+	stream::len w;      ///< Number of bytes written so far
+
+	int operator() (uint8_t in)
+	{
+		if (this->w < this->lenOut) {
+			*this->out++ = in;
+			this->w++;
+			return 1; // return number of bytes written
+		}
+		return 0; // EOF
 	}
-	return 0; // EOF
-}
+};
 
 void filter_lzw_compress::transform(uint8_t *out, stream::len *lenOut,
 	const uint8_t *in, stream::len *lenIn)
 {
-	stream::len r = 0, w = 0;
-	fn_putnextchar cbNext = boost::bind(putChar, &out, lenOut, &w, _1);
+	CAMOTO_TRACE("filter", "lzw_compress::transform", this, *lenIn);
+	lzw_put_char put;
+	put.out = out;
+	put.lenOut = *lenOut;
+	put.w = 0;
+	stream::len r = 0;
+	stream::len& w = put.w;
+	fn_putnextchar cbNext = boost::ref(put);
 	while (
 		(w + LZW_LEFTOVER_BYTES < *lenOut) && ( // leave some leftover bytes to guarantee the codeword will be written
 			(
@@ -346,6 +410,7 @@ void filter_lzw_compress::transform(uint8_t *out, stream::len *lenOut,
 			} else {
 				++this->currentBits;
 				this->recalcCodes();
+				this->dictSize++;
 			}
 		} else {
 			this->dictSize++;
@@ -370,9 +435,17 @@ void filter_lzw_compress::transform(uint8_t *out, stream::len *lenOut,
 	return;
 }
 
+std::string filter_lzw_compress::fingerprint() const
+{
+	return lzwFingerprint(this->initialBits, this->maxBits, this->firstCode,
+		this->eofCode, this->resetCode, this->flags);
+}
+
 void filter_lzw_compress::resetDictionary()
 {
-	this->dictSize = 256;
+	// Codewords reserved at the start of the dictionary come before firstCode,
+	// the same as in the decompressor.
+	this->dictSize = this->firstCode;
 	if (!(this->flags & LZW_NO_BITSIZE_RESET)) {
 		// Only reset the bit length with the dictionary if wanted
 		this->currentBits = this->initialBits;
@@ -396,10 +469,7 @@ void filter_lzw_compress::recalcCodes()
 			// the last codeword, with 0 being the largest possible codeword.
 			this->curEOFCode = actualMaxCode + this->eofCode;
 			this->maxCode--;
-		} else {
-			this->curEOFCode = this->eofCode;
-			this->dictSize++; // this assumes the code is at the start
-		}
+		} else this->curEOFCode = this->eofCode;
 	}
 
 	if (this->flags & LZW_RESET_PARAM_VALID) {
@@ -408,12 +478,7 @@ void filter_lzw_compress::recalcCodes()
 			// the last codeword, with 0 being the largest possible codeword.
 			this->curResetCode = actualMaxCode + this->resetCode;
 			this->maxCode--;
-		} else {
-			this->curResetCode = this->resetCode;
-			if (this->curEOFCode != this->curResetCode) {
-				this->dictSize++; // this assumes the code is at the start
-			}
-		}
+		} else this->curResetCode = this->resetCode;
 	}
 	return;
 }
@@ -0,0 +1,337 @@
+/**
+ * @file   mem_budget.cpp
+ * @brief  Accounting and limits for stream data held in memory.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iomanip>
+#include <boost/atomic.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <camoto/mem_budget.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/trace.hpp>
+#include <camoto/util.hpp> // createString
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+namespace camoto {
+namespace stream {
+
+/// Bytes held in memory by each pool.
+static boost::atomic<stream::len> memPoolUsed[mem_pool_count];
+
+/// Bytes held in memory by all pools.
+static boost::atomic<stream::len> memUsed(0);
+
+/// Highest value of memUsed since the last reset.
+static boost::atomic<stream::len> memPeak(0);
+
+/// Bytes held in temporary files.
+static boost::atomic<stream::len> memSpilled(0);
+
+/// Budget, or 0 for no limit.  Read without the lock to keep the common case
+/// of no limit fast.
+static boost::atomic<stream::len> memLimit(0);
+
+/// Policy applied when the budget is exceeded.
+static mem_policy memPolicy = mem_block;
+
+/// Names of each mem_pool, for print().
+static const char *memPoolName[mem_pool_count] = {
+	"memory", "filtered-read", "filtered-write", "seg-insert"
+};
+
+/// Protects memPolicy, the spill folder and waiting for memory.
+static boost::mutex& memMutex()
+{
+	static boost::mutex m;
+	return m;
+}
+
+/// Signalled whenever memory is released.
+static boost::condition_variable& memReleased()
+{
+	static boost::condition_variable c;
+	return c;
+}
+
+/// Folder to put spilled data in, or empty for the default.
+static std::string& memSpillDir()
+{
+	static std::string dir;
+	return dir;
+}
+
+/// Count more bytes in a pool.
+static void memAdd(mem_pool pool, stream::len bytes)
+{
+	memPoolUsed[pool].fetch_add(bytes, boost::memory_order_relaxed);
+	stream::len now = memUsed.fetch_add(bytes, boost::memory_order_relaxed)
+		+ bytes;
+	stream::len peak = memPeak.load(boost::memory_order_relaxed);
+	while ((now > peak) && !memPeak.compare_exchange_weak(peak, now,
+		boost::memory_order_relaxed));
+	return;
+}
+
+/// Stop counting bytes in a pool, waking anyone waiting for memory.
+static void memRelease(mem_pool pool, stream::len bytes)
+{
+	memPoolUsed[pool].fetch_sub(bytes, boost::memory_order_relaxed);
+	memUsed.fetch_sub(bytes, boost::memory_order_relaxed);
+	if (memLimit.load(boost::memory_order_relaxed)) {
+		// Take the lock so a waiter can't miss the notification between
+		// checking the total and going to sleep.
+		boost::unique_lock<boost::mutex> lock(memMutex());
+		memReleased().notify_all();
+	}
+	return;
+}
+
+
+budget_error::budget_error(const std::string& msg)
+	:	error(msg)
+{
+}
+
+
+stream::len mem_budget::used()
+{
+	return memUsed.load(boost::memory_order_relaxed);
+}
+
+stream::len mem_budget::used(mem_pool pool)
+{
+	return memPoolUsed[pool].load(boost::memory_order_relaxed);
+}
+
+stream::len mem_budget::peak()
+{
+	return memPeak.load(boost::memory_order_relaxed);
+}
+
+void mem_budget::resetPeak()
+{
+	memPeak.store(memUsed.load());
+	return;
+}
+
+stream::len mem_budget::spilled()
+{
+	return memSpilled.load(boost::memory_order_relaxed);
+}
+
+void mem_budget::setLimit(stream::len bytes, mem_policy policy)
+{
+	boost::unique_lock<boost::mutex> lock(memMutex());
+	memPolicy = policy;
+	memLimit.store(bytes);
+	// Waiters may now fit under a bigger limit, or need to fail instead
+	memReleased().notify_all();
+	return;
+}
+
+stream::len mem_budget::limit()
+{
+	return memLimit.load(boost::memory_order_relaxed);
+}
+
+mem_policy mem_budget::policy()
+{
+	boost::unique_lock<boost::mutex> lock(memMutex());
+	return memPolicy;
+}
+
+void mem_budget::setSpillDir(const std::string& dir)
+{
+	boost::unique_lock<boost::mutex> lock(memMutex());
+	memSpillDir() = dir;
+	return;
+}
+
+inout_sptr mem_budget::createSpillFile()
+{
+	std::string dir;
+	{
+		boost::unique_lock<boost::mutex> lock(memMutex());
+		dir = memSpillDir();
+	}
+	if (dir.empty()) {
+		const char *env = getenv("TMPDIR");
+		dir = (env && env[0]) ? env : "/tmp";
+	}
+	std::string filename = dir + "/camoto-spill-XXXXXX";
+#ifdef WIN32
+	if (_mktemp_s(&filename[0], filename.length() + 1) != 0) {
+		throw open_error("Unable to create a temporary file in " + dir);
+	}
+#else
+	int fd = mkstemp(&filename[0]);
+	if (fd < 0) {
+		throw open_error(createString("Unable to create a temporary file in "
+			<< dir << ": " << strerror(errno)));
+	}
+	::close(fd);
+#endif
+	file_sptr spill(new file());
+	spill->create(filename);
+	spill->remove();
+	CAMOTO_TRACE("stream", "mem_budget::createSpillFile", spill.get(), 0);
+	return spill;
+}
+
+void mem_budget::print(std::ostream& s)
+{
+	stream::len lim = mem_budget::limit();
+	s << "Memory: " << mem_budget::used() << " B held, "
+		<< mem_budget::peak() << " B peak, " << mem_budget::spilled()
+		<< " B spilled, limit ";
+	if (lim) s << lim << " B\n";
+	else s << "none\n";
+	for (unsigned int pool = 0; pool < mem_pool_count; pool++) {
+		s << "  " << std::left << std::setw(15) << memPoolName[pool]
+			<< std::right << std::setw(12) << mem_budget::used((mem_pool)pool)
+			<< " B\n";
+	}
+	s << std::flush;
+	return;
+}
+
+
+mem_account::mem_account(mem_pool pool)
+	:	pool(pool),
+		bytes(0),
+		onDisk(false)
+{
+}
+
+mem_account::~mem_account()
+{
+	if (this->onDisk) {
+		memSpilled.fetch_sub(this->bytes, boost::memory_order_relaxed);
+	} else if (this->bytes) {
+		memRelease(this->pool, this->bytes);
+	}
+}
+
+stream::len mem_account::held() const
+{
+	return this->bytes;
+}
+
+bool mem_account::spilled() const
+{
+	return this->onDisk;
+}
+
+void mem_account::setPool(mem_pool pool)
+{
+	if (pool == this->pool) return;
+	if (!this->onDisk) {
+		memPoolUsed[this->pool].fetch_sub(this->bytes, boost::memory_order_relaxed);
+		memPoolUsed[pool].fetch_add(this->bytes, boost::memory_order_relaxed);
+	}
+	this->pool = pool;
+	return;
+}
+
+bool mem_account::resize(stream::len bytes)
+{
+	return this->resize(bytes, true);
+}
+
+bool mem_account::resize(stream::len bytes, bool canSpill)
+{
+	if (this->onDisk) {
+		if (bytes > this->bytes) {
+			memSpilled.fetch_add(bytes - this->bytes, boost::memory_order_relaxed);
+		} else {
+			memSpilled.fetch_sub(this->bytes - bytes, boost::memory_order_relaxed);
+		}
+		this->bytes = bytes;
+		return false;
+	}
+
+	if (bytes <= this->bytes) {
+		if (bytes < this->bytes) memRelease(this->pool, this->bytes - bytes);
+		this->bytes = bytes;
+		return true;
+	}
+
+	stream::len grow = bytes - this->bytes;
+	if (memLimit.load(boost::memory_order_relaxed) == 0) {
+		memAdd(this->pool, grow);
+		this->bytes = bytes;
+		return true;
+	}
+
+	boost::unique_lock<boost::mutex> lock(memMutex());
+	bool overCommit = false;
+	while (!overCommit) {
+		stream::len lim = memLimit.load(boost::memory_order_relaxed);
+		if ((lim == 0) || (memUsed.load() + grow <= lim)) break;
+		CAMOTO_TRACE("stream", "mem_account::over_budget", this, grow);
+		switch (memPolicy) {
+			case mem_spill:
+				if (canSpill) return false;
+				// Nowhere to move the data, so count it and go over budget
+				overCommit = true;
+				break;
+			case mem_block:
+				if (grow <= lim) {
+					memReleased().wait(lock);
+					continue;
+				}
+				// Waiting would never end, so fail instead
+				// fall through
+			case mem_fail:
+				throw budget_error(createString("Unable to allocate " << grow
+					<< " more bytes for " << memPoolName[this->pool]
+					<< " data: " << memUsed.load() << " of " << lim
+					<< " budgeted bytes already in use"));
+		}
+	}
+	memAdd(this->pool, grow);
+	this->bytes = bytes;
+	return true;
+}
+
+void mem_account::spill()
+{
+	if (this->onDisk) return;
+	if (this->bytes) memRelease(this->pool, this->bytes);
+	memSpilled.fetch_add(this->bytes, boost::memory_order_relaxed);
+	this->onDisk = true;
+	return;
+}
+
+void mem_account::swap(mem_account& other)
+{
+	assert(this->pool == other.pool);
+	assert(!this->onDisk && !other.onDisk);
+	std::swap(this->bytes, other.bytes);
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
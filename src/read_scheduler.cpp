@@ -0,0 +1,209 @@
+/**
+ * @file   read_scheduler.cpp
+ * @brief  Read many parts of an archive in one pass through the file.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <camoto/read_scheduler.hpp>
+#include <camoto/stream_seg.hpp>
+#include <camoto/stream_sub.hpp>
+#include <camoto/trace.hpp>
+
+namespace camoto {
+namespace stream {
+
+read_scheduler::read_scheduler(stream::len mergeGap, stream::len maxRead)
+	:	mergeGap(mergeGap),
+		maxRead(maxRead),
+		numReads(0),
+		numBytes(0),
+		failed(false)
+{
+}
+
+read_scheduler::~read_scheduler()
+{
+	if (this->worker.joinable()) this->worker.join();
+}
+
+void read_scheduler::add(input_sptr src, stream::pos off, stream::len len,
+	uint8_t *dest)
+{
+	assert(!this->worker.joinable());
+	this->resolve(src, off, len, dest);
+	return;
+}
+
+void read_scheduler::run()
+{
+	CAMOTO_TRACE("stream", "read_scheduler::run", this, this->pieces.size());
+	std::sort(this->pieces.begin(), this->pieces.end(), byLocation);
+	this->numReads = 0;
+	this->numBytes = 0;
+
+	std::vector<uint8_t> buffer;
+	std::vector<piece>::const_iterator i = this->pieces.begin();
+	while (i != this->pieces.end()) {
+		// Take in as many following pieces as are close enough
+		stream::pos start = i->off;
+		stream::pos end = i->off + i->len;
+		std::vector<piece>::const_iterator j = i + 1;
+		while (
+			(j != this->pieces.end())
+			&& (j->src == i->src)
+			&& (j->off <= end + this->mergeGap)
+			&& (std::max(end, j->off + j->len) - start <= this->maxRead)
+		) {
+			end = std::max(end, j->off + j->len);
+			j++;
+		}
+
+		i->src->seekg(start, stream::start);
+		if (j == i + 1) {
+			// Nothing to merge, so read straight into the destination
+			i->src->read(i->dest, i->len);
+		} else {
+			buffer.resize(end - start);
+			i->src->read(&buffer[0], end - start);
+			for (std::vector<piece>::const_iterator k = i; k != j; k++) {
+				memcpy(k->dest, &buffer[k->off - start], k->len);
+			}
+		}
+		this->numReads++;
+		this->numBytes += end - start;
+		i = j;
+	}
+
+	this->pieces.clear();
+	this->keep.clear();
+	return;
+}
+
+void read_scheduler::start()
+{
+	assert(!this->worker.joinable());
+	this->failed = false;
+	this->worker = boost::thread(boost::bind(&read_scheduler::runInThread,
+		this));
+	return;
+}
+
+void read_scheduler::wait()
+{
+	if (this->worker.joinable()) this->worker.join();
+	if (this->failed) {
+		this->failed = false;
+		throw read_error(this->failure);
+	}
+	return;
+}
+
+unsigned long read_scheduler::reads() const
+{
+	return this->numReads;
+}
+
+stream::len read_scheduler::bytesRead() const
+{
+	return this->numBytes;
+}
+
+void read_scheduler::resolve(input_sptr src, stream::pos off, stream::len len,
+	uint8_t *dest)
+{
+	if (len == 0) return;
+
+	input_sub *sub = dynamic_cast<input_sub *>(src.get());
+	if (sub) {
+		if ((off > sub->stream_len) || (len > sub->stream_len - off)) {
+			throw read_error("Scheduled read goes past the end of a substream");
+		}
+		this->resolve(sub->in_parent, sub->start + off, len, dest);
+		return;
+	}
+
+	seg *s = dynamic_cast<seg *>(src.get());
+	if (s) {
+		// First the part still in the parent
+		stream::len lenFirst = s->off_endparent - s->off_parent;
+		if (off < lenFirst) {
+			stream::len lenHere = std::min(len, lenFirst - off);
+			this->resolve(s->parent, s->off_parent + off, lenHere, dest);
+			off += lenHere;
+			len -= lenHere;
+			dest += lenHere;
+		}
+		off -= lenFirst;
+
+		// Then data inserted in memory
+		stream::len lenSecond = s->vcSecond.size();
+		if (len && (off < lenSecond)) {
+			stream::len lenHere = std::min(len, lenSecond - off);
+			memcpy(dest, &s->vcSecond[off], lenHere);
+			off += lenHere;
+			len -= lenHere;
+			dest += lenHere;
+		}
+		off -= lenSecond;
+
+		// Then whatever follows it
+		if (len) {
+			if (!s->psegThird) {
+				throw read_error("Scheduled read goes past the end of a segstream");
+			}
+			this->resolve(s->psegThird, off, len, dest);
+		}
+		return;
+	}
+
+	if (this->keep.empty() || (this->keep.back() != src)) {
+		this->keep.push_back(src);
+	}
+	piece p;
+	p.src = src.get();
+	p.off = off;
+	p.len = len;
+	p.dest = dest;
+	this->pieces.push_back(p);
+	return;
+}
+
+bool read_scheduler::byLocation(const piece& a, const piece& b)
+{
+	if (a.src != b.src) return a.src < b.src;
+	return a.off < b.off;
+}
+
+void read_scheduler::runInThread()
+{
+	try {
+		this->run();
+	} catch (const stream::error& e) {
+		this->failure = e.get_message();
+		this->failed = true;
+	} catch (const std::exception& e) {
+		this->failure = e.what();
+		this->failed = true;
+	}
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
@@ -18,7 +18,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include <boost/chrono.hpp>
 #include <camoto/stream.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/trace.hpp>
 
 namespace camoto {
 namespace stream {
@@ -43,6 +49,36 @@ seek_error::seek_error(const std::string& msg)
 {
 }
 
+caps::caps()
+	:	flags(0),
+		blockSize(0)
+{
+}
+
+caps::caps(unsigned int flags, stream::len blockSize)
+	:	flags(flags),
+		blockSize(blockSize)
+{
+}
+
+/// Build the message for seek_error without using an ostringstream, which
+/// costs several allocations every time a stream refuses a seek.
+static std::string seekPastEnd(const char *streamType, stream::pos offset,
+	stream::len length)
+{
+	char msg[128];
+	snprintf(msg, sizeof(msg), "Cannot seek beyond end of %s (offset %llu > "
+		"length %llu)", streamType, (unsigned long long)offset,
+		(unsigned long long)length);
+	return msg;
+}
+
+seek_error::seek_error(const char *streamType, stream::pos offset,
+	stream::len length)
+	:	error(seekPastEnd(streamType, offset, length))
+{
+}
+
 incomplete_write::incomplete_write(stream::len written)
 	:	write_error("Incomplete write"),
 		bytes_written(written)
@@ -79,6 +115,16 @@ std::string input::read(stream::len len)
 	return d;
 }
 
+caps input::read_caps() const
+{
+	return caps(cap_seekable, 0);
+}
+
+input_sptr input::clone_cursor() const
+{
+	throw error("This type of stream can't be cloned");
+}
+
 void output::write(const uint8_t *buffer, stream::len len)
 {
 	stream::len w = this->try_write(buffer, len);
@@ -113,13 +159,69 @@ void output::truncate_here()
 	return;
 }
 
-void copy(output_sptr dest, input_sptr src)
+caps output::write_caps() const
 {
-	uint8_t buffer[BUFFER_SIZE];
+	return caps(cap_seekable, 0);
+}
+
+copy_stats::copy_stats()
+	:	bytes(0),
+		seconds(0),
+		pipelined(false),
+		holes(0)
+{
+}
+
+double copy_stats::throughput() const
+{
+	if (this->seconds <= 0) return 0;
+	return this->bytes / this->seconds;
+}
+
+/// Pick a buffer size suiting both ends of a transfer.
+/**
+ * This is the larger of the two preferred block sizes, but at least
+ * BUFFER_SIZE and at most PIPELINE_BUFFER_SIZE.
+ */
+static stream::len ioBlockSize(const caps& a, const caps& b)
+{
+	stream::len block = std::max(a.blockSize, b.blockSize);
+	if (block < BUFFER_SIZE) return BUFFER_SIZE;
+	return std::min(block, (stream::len)PIPELINE_BUFFER_SIZE);
+}
+
+/// Get a buffer of \e len bytes, only allocating if the stack one is too small.
+static uint8_t *ioBuffer(uint8_t *stackBuffer, std::vector<uint8_t>& heapBuffer,
+	stream::len len)
+{
+	if (len <= BUFFER_SIZE) return stackBuffer;
+	heapBuffer.resize(len);
+	return &heapBuffer[0];
+}
+
+void copy(output_sptr dest, input_sptr src, copy_stats *stats)
+{
+	CAMOTO_TRACE("stream", "copy", dest.get(), 0);
+	if (prefer_sparse(dest, src)) {
+		copy_sparse(dest, src, stats);
+		return;
+	}
+	if (prefer_pipelined(dest, src)) {
+		copy_pipelined(dest, src, stats);
+		return;
+	}
+
+	boost::chrono::steady_clock::time_point tStart;
+	if (stats) tStart = boost::chrono::steady_clock::now();
+
+	uint8_t stackBuffer[BUFFER_SIZE];
+	std::vector<uint8_t> heapBuffer;
+	stream::len lenBuffer = ioBlockSize(src->read_caps(), dest->write_caps());
+	uint8_t *buffer = ioBuffer(stackBuffer, heapBuffer, lenBuffer);
 	stream::len total_written = 0;
 	stream::len r;
 	do {
-		r = src->try_read(buffer, sizeof(buffer));
+		r = src->try_read(buffer, lenBuffer);
 		if (r == 0) break;
 		stream::len w = dest->try_write(buffer, r);
 		total_written += w;
@@ -127,16 +229,31 @@ void copy(output_sptr dest, input_sptr src)
 			// Did not write the full buffer
 			throw incomplete_write(total_written);
 		}
-	} while (r == sizeof(buffer));
+	} while (r == lenBuffer);
+
+	if (stats) {
+		boost::chrono::duration<double> elapsed =
+			boost::chrono::steady_clock::now() - tStart;
+		stats->bytes = total_written;
+		stats->seconds = elapsed.count();
+		stats->pipelined = false;
+		stats->holes = 0;
+	}
 	return;
 }
 
 void move(inout_sptr data, stream::pos from, stream::pos to,
 	stream::len len)
 {
+	CAMOTO_TRACE("stream", "move", data.get(), len);
 	if (from == to) return; // job done, that was easy
 
-	uint8_t buffer[BUFFER_SIZE];
+	caps readCaps = data->read_caps();
+	caps writeCaps = data->write_caps();
+	uint8_t stackBuffer[BUFFER_SIZE];
+	std::vector<uint8_t> heapBuffer;
+	stream::len lenBuffer = ioBlockSize(readCaps, writeCaps);
+	uint8_t *buffer = ioBuffer(stackBuffer, heapBuffer, lenBuffer);
 	stream::len r, w, total_written = 0;
 	stream::len szNext;
 
@@ -150,6 +267,27 @@ void move(inout_sptr data, stream::pos from, stream::pos to,
 	assert(fromEnd <= size);
 	assert(toEnd <= size);
 
+	// If a file has holes in the source data, check each block so holes can be
+	// punched rather than copied.  Files without holes are left to the normal
+	// loop, to avoid the extra system calls.
+	input_file *holeSrc = NULL;
+	output_file *holeDest = NULL;
+	input_file *dataFile = NULL;
+	if (readCaps.has(cap_holes) && writeCaps.has(cap_holes) && len) {
+		dataFile = dynamic_cast<input_file *>(data.get());
+	}
+	if (dataFile) {
+		stream::pos dataStart, dataEnd;
+		if (
+			!dataFile->nextData(from, &dataStart, &dataEnd)
+			|| (dataStart > from)
+			|| (dataEnd < fromEnd)
+		) {
+			holeDest = dynamic_cast<output_file *>(data.get());
+			if (holeDest) holeSrc = dataFile;
+		}
+	}
+
 	if (
 		(from > to) || // The destination starts before the source
 		(fromEnd <= to) || // The source ends before the dest starts (no overlap)
@@ -159,26 +297,31 @@ void move(inout_sptr data, stream::pos from, stream::pos to,
 		// and work towards the last block.
 		do {
 			// Figure out how much to read next (a full block or the last partial one)
-			if (BUFFER_SIZE <= len) {
-				szNext = BUFFER_SIZE;
+			if (lenBuffer <= len) {
+				szNext = lenBuffer;
 			} else {
 				szNext = len;
 			}
 
-			// Despite having separate read and write pointers, moving one affects
-			// the other so we have to keep seeking all the time.
-			try {
-				data->seekg(from, stream::start);
-				r = data->try_read(buffer, szNext);
-			} catch (seek_error& e) {
-				throw read_error(e.get_message());
-			}
-
-			try {
-				data->seekp(to, stream::start);
-				w = data->try_write(buffer, r);
-			} catch (seek_error& e) {
-				throw read_error(e.get_message());
+			if (holeSrc && szNext && holeSrc->isHole(from, szNext)) {
+				holeDest->punchHole(to, szNext);
+				r = w = szNext;
+			} else {
+				// Despite having separate read and write pointers, moving one affects
+				// the other so we have to keep seeking all the time.
+				try {
+					data->seekg(from, stream::start);
+					r = data->try_read(buffer, szNext);
+				} catch (seek_error& e) {
+					throw read_error(e.get_message());
+				}
+
+				try {
+					data->seekp(to, stream::start);
+					w = data->try_write(buffer, r);
+				} catch (seek_error& e) {
+					throw read_error(e.get_message());
+				}
 			}
 
 			from += r; to += w;
@@ -188,12 +331,12 @@ void move(inout_sptr data, stream::pos from, stream::pos to,
 			if (r != w) {
 				throw incomplete_write(total_written);
 			}
-		} while ((r) && (szNext == BUFFER_SIZE));
+		} while ((r) && (szNext == lenBuffer));
 	} else {
 		// Moving data forwards towards the end of the stream, start at the end
 		// and work back towards the first block.
 
-		szNext = BUFFER_SIZE;
+		szNext = lenBuffer;
 /*
 		// Check to see if we'll be moving data out past the end of the stream
 		if (size < toEnd) {
@@ -212,29 +355,34 @@ void move(inout_sptr data, stream::pos from, stream::pos to,
 */
 		do {
 			if (
-				(fromEnd < BUFFER_SIZE)
-				|| (fromEnd - BUFFER_SIZE < from)
+				(fromEnd < lenBuffer)
+				|| (fromEnd - lenBuffer < from)
 			) {
 				szNext = fromEnd - from;
 				fromEnd = from;
 				toEnd = to;
 			} else {
-				fromEnd -= BUFFER_SIZE;
-				toEnd -= BUFFER_SIZE;
+				fromEnd -= lenBuffer;
+				toEnd -= lenBuffer;
 			}
 
-			try {
-				data->seekg(fromEnd, stream::start);
-				r = data->try_read(buffer, szNext);
-			} catch (seek_error& e) {
-				throw read_error(e.get_message());
-			}
-
-			try {
-				data->seekp(toEnd, stream::start);
-				w = data->try_write(buffer, r);
-			} catch (seek_error& e) {
-				throw write_error(e.get_message());
+			if (holeSrc && holeSrc->isHole(fromEnd, szNext)) {
+				holeDest->punchHole(toEnd, szNext);
+				r = w = szNext;
+			} else {
+				try {
+					data->seekg(fromEnd, stream::start);
+					r = data->try_read(buffer, szNext);
+				} catch (seek_error& e) {
+					throw read_error(e.get_message());
+				}
+
+				try {
+					data->seekp(toEnd, stream::start);
+					w = data->try_write(buffer, r);
+				} catch (seek_error& e) {
+					throw write_error(e.get_message());
+				}
 			}
 
 			total_written += w;
@@ -20,6 +20,9 @@
 
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
 #ifndef WIN32
 #include <unistd.h>
 #else
@@ -27,6 +30,7 @@
 #endif
 #include <camoto/stream_file.hpp>
 #include <camoto/util.hpp> // createString
+#include <camoto/trace.hpp>
 
 inline std::string strerror_str(int errno2)
 {
@@ -76,12 +80,42 @@ output_sptr open_stdout()
 
 file_core::file_core()
 	:	handle(NULL),
-		close(false)
+		close(false),
+		cloneFd(-1),
+		cloneOffset(0)
 {
 }
 
+int file_core::fd() const
+{
+	if (this->handle) return fileno(this->handle);
+	return this->cloneFd;
+}
+
 void file_core::seek(stream::delta off, seek_from from)
 {
+	CAMOTO_TRACE("stream", "file::seek", this, off);
+	if (!this->handle) {
+		// A clone keeps its own pointer, which can go past EOF like fseek()'s
+		stream::pos base;
+		switch (from) {
+			case cur: base = this->cloneOffset; break;
+			case end: {
+				struct stat st;
+				if (fstat(this->cloneFd, &st) < 0) {
+					throw seek_error(strerror_str(errno));
+				}
+				base = st.st_size;
+				break;
+			}
+			default: base = 0; break;
+		}
+		if ((off < 0) && (base < (stream::pos)-off)) {
+			throw seek_error("Cannot seek back past start of file");
+		}
+		this->cloneOffset = base + off;
+		return;
+	}
 	int whence;
 	switch (from) {
 		case cur: whence = SEEK_CUR; break;
@@ -96,6 +130,7 @@ void file_core::seek(stream::delta off, seek_from from)
 
 stream::pos file_core::tell() const
 {
+	if (!this->handle) return this->cloneOffset;
 	long p = ftell(this->handle);
 	if (p < 0) {
 		throw seek_error(strerror_str(errno));
@@ -103,6 +138,62 @@ stream::pos file_core::tell() const
 	return p;
 }
 
+bool file_core::nextData(stream::pos from, stream::pos *start,
+	stream::pos *end) const
+{
+	// Make sure anything still sitting in the stdio buffer is in the file
+	if (this->handle) fflush(this->handle);
+	int fd = this->fd();
+	struct stat st;
+	if (fstat(fd, &st) < 0) throw read_error(strerror_str(errno));
+	stream::pos size = st.st_size;
+	if (from >= size) return false;
+
+	*start = from;
+	*end = size;
+#ifdef SEEK_DATA
+	if (!S_ISREG(st.st_mode)) return true;
+
+	// A clone's descriptor shares its offset with the original, so lseek()
+	// would race with other threads.
+	if (!this->handle) return true;
+
+	// lseek() moves the file pointer stdio is using, so put it back after
+	off_t orig = lseek(fd, 0, SEEK_CUR);
+	off_t data = lseek(fd, from, SEEK_DATA);
+	if (data < 0) {
+		int e = errno;
+		lseek(fd, orig, SEEK_SET);
+		// ENXIO means only a hole is left, anything else means holes can't be
+		// reported so it's all data.
+		return e != ENXIO;
+	}
+	off_t hole = lseek(fd, data, SEEK_HOLE);
+	lseek(fd, orig, SEEK_SET);
+	*start = data;
+	if (hole >= 0) *end = hole;
+#endif
+	return true;
+}
+
+caps file_core::fileCaps() const
+{
+	int fd = this->fd();
+	struct stat st;
+	if ((fd < 0) || (fstat(fd, &st) < 0) || !S_ISREG(st.st_mode)) {
+		// Pipe, terminal, etc.
+		return caps(cap_leaf, 0);
+	}
+#ifndef WIN32
+	stream::len blockSize = st.st_blksize;
+#else
+	stream::len blockSize = BUFFER_SIZE;
+#endif
+	unsigned int flags = cap_seekable | cap_mappable | cap_size_fast | cap_leaf;
+	if (!this->handle) flags |= cap_positional;
+	return caps(flags, blockSize);
+}
+
 
 input_file::input_file()
 {
@@ -114,10 +205,26 @@ input_file::~input_file()
 		fclose(this->handle);
 		this->close = false; // prevent double-close in ~output_file()
 	}
+	if (this->cloneFd >= 0) {
+		::close(this->cloneFd);
+		this->cloneFd = -1;
+	}
 }
 
 stream::len input_file::try_read(uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "file::try_read", this, len);
+#ifndef WIN32
+	if (!this->handle) {
+		ssize_t r;
+		do {
+			r = pread(this->cloneFd, buffer, len, this->cloneOffset);
+		} while ((r < 0) && (errno == EINTR));
+		if (r < 0) throw read_error(strerror_str(errno));
+		this->cloneOffset += r;
+		return r;
+	}
+#endif
 	return fread(buffer, 1, len, this->handle);
 }
 
@@ -134,6 +241,11 @@ stream::pos input_file::tellg() const
 
 stream::pos input_file::size() const
 {
+	if (!this->handle) {
+		struct stat st;
+		if (fstat(this->cloneFd, &st) < 0) throw read_error(strerror_str(errno));
+		return st.st_size;
+	}
 	long start = ftell(this->handle);
 
 	fseek(this->handle, 0, SEEK_END);
@@ -158,9 +270,51 @@ void input_file::open(const std::string& filename)
 	return;
 }
 
+caps input_file::read_caps() const
+{
+	caps c = this->fileCaps();
+#ifdef SEEK_DATA
+	if (c.has(cap_mappable) && this->handle) c.flags |= cap_holes;
+#endif
+	return c;
+}
+
+input_sptr input_file::clone_cursor() const
+{
+#ifndef WIN32
+	if (!this->fileCaps().has(cap_mappable)) {
+		throw error("Only regular files can be cloned");
+	}
+	stream::pos here = this->tell();
+	// Make sure the clone can see anything still sitting in the stdio buffer
+	if (this->handle) fflush(this->handle);
+	input_file_sptr clone(new input_file());
+	clone->cloneFd = dup(this->fd());
+	if (clone->cloneFd < 0) throw error(strerror_str(errno));
+	clone->cloneOffset = here;
+	return clone;
+#else
+	throw error("Files can't be cloned on this platform");
+#endif
+}
+
+bool input_file::nextData(stream::pos from, stream::pos *start,
+	stream::pos *end) const
+{
+	return this->file_core::nextData(from, start, end);
+}
+
+bool input_file::isHole(stream::pos start, stream::len len) const
+{
+	stream::pos dataStart, dataEnd;
+	if (!this->file_core::nextData(start, &dataStart, &dataEnd)) return true;
+	return dataStart >= start + len;
+}
+
 
 output_file::output_file()
-	:	do_remove(false)
+	:	sparse(false),
+		do_remove(false)
 {
 }
 
@@ -179,6 +333,22 @@ output_file::~output_file()
 
 stream::len output_file::try_write(const uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "file::try_write", this, len);
+	if (
+		this->sparse
+		&& (len >= BUFFER_SIZE)
+		&& (buffer[0] == 0)
+		&& (memcmp(buffer, buffer + 1, len - 1) == 0)
+	) {
+		try {
+			stream::pos here = this->tell();
+			this->punchHole(here, len);
+			this->seek(here + len, stream::start);
+			return len;
+		} catch (const stream::error&) {
+			// Fall through and try a normal write
+		}
+	}
 	return fwrite(buffer, 1, len, this->handle);
 }
 
@@ -195,6 +365,7 @@ stream::pos output_file::tellp() const
 
 void output_file::truncate(stream::pos size)
 {
+	CAMOTO_TRACE("stream", "file::truncate", this, size);
 	this->flush();
 	int fd = fileno(this->handle);
 #ifndef WIN32
@@ -216,12 +387,22 @@ void output_file::truncate(stream::pos size)
 
 void output_file::flush()
 {
+	CAMOTO_TRACE("stream", "file::flush", this, 0);
 	if (fflush(this->handle) < 0) {
 		throw write_error(strerror_str(errno));
 	}
 	return;
 }
 
+caps output_file::write_caps() const
+{
+	caps c = this->fileCaps();
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if (c.has(cap_mappable)) c.flags |= cap_holes;
+#endif
+	return c;
+}
+
 void output_file::open(const char *filename)
 {
 	this->filename = std::string(filename);
@@ -286,6 +467,60 @@ void output_file::remove()
 	return;
 }
 
+void output_file::punchHole(stream::pos start, stream::len len)
+{
+	CAMOTO_TRACE("stream", "file::punchHole", this, len);
+	if (len == 0) return;
+	this->flush();
+	int fd = fileno(this->handle);
+	struct stat st;
+	if (fstat(fd, &st) < 0) throw write_error(strerror_str(errno));
+	stream::pos size = st.st_size;
+	stream::pos end = start + len;
+
+	// Growing the file leaves a hole at the end anyway
+	if (end > size) {
+#ifndef WIN32
+		if (ftruncate(fd, end) < 0) {
+#else
+		if (_chsize(fd, end) < 0) {
+#endif
+			throw write_error(strerror_str(errno));
+		}
+	}
+
+	stream::pos punchEnd = std::min(end, size);
+	if (start >= punchEnd) return;
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start,
+		punchEnd - start) == 0) return;
+	if ((errno != EOPNOTSUPP) && (errno != ENOSYS)) {
+		throw write_error(strerror_str(errno));
+	}
+#endif
+
+	// No hole support, so write zeroes instead
+	stream::pos here = this->tell();
+	uint8_t zero[BUFFER_SIZE];
+	memset(zero, 0, sizeof(zero));
+	this->seek(start, stream::start);
+	for (stream::pos p = start; p < punchEnd; ) {
+		stream::len chunk = std::min(punchEnd - p, (stream::len)sizeof(zero));
+		if (fwrite(zero, 1, chunk, this->handle) != chunk) {
+			throw write_error(strerror_str(errno));
+		}
+		p += chunk;
+	}
+	this->seek(here, stream::start);
+	return;
+}
+
+void output_file::setSparse(bool sparse)
+{
+	this->sparse = sparse;
+	return;
+}
+
 
 file::file()
 	: isReadonly(false)
@@ -19,7 +19,9 @@
  */
 
 #include <iostream>
+#include <algorithm>
 #include <camoto/stream_filtered.hpp>
+#include <camoto/trace.hpp>
 
 namespace camoto {
 namespace stream {
@@ -28,8 +30,9 @@ void input_filtered::open(input_sptr parent, filter_sptr read_filter)
 {
 	assert(parent);
 	assert(read_filter);
-	assert(this->data.size() == 0);
+	assert(this->dataSize() == 0);
 
+	this->store->account.setPool(mem_filtered_read);
 	this->in_parent = parent;
 	this->read_filter = read_filter;
 	this->populated = false;
@@ -60,9 +63,22 @@ stream::pos input_filtered::size() const
 	return this->input_memory::size();
 }
 
+caps input_filtered::read_caps() const
+{
+	caps c = this->memoryCaps();
+	if (!this->populated) c.flags &= ~cap_size_fast;
+	return c;
+}
+
+input_sptr input_filtered::clone_cursor() const
+{
+	this->populate();
+	return this->input_memory::clone_cursor();
+}
+
 void input_filtered::populate() const
 {
-	if (this->populated) return;
+	if (this->populated.load(boost::memory_order_acquire)) return;
 	input_filtered *self = const_cast<input_filtered *>(this);
 	self->realPopulate();
 	return;
@@ -70,19 +86,26 @@ void input_filtered::populate() const
 
 void input_filtered::realPopulate()
 {
-	this->populated = true;
+	boost::mutex::scoped_lock lock(this->populateMutex);
+	// Another thread may have got here first
+	if (this->populated.load(boost::memory_order_acquire)) return;
+	CAMOTO_TRACE("filter", "input_filtered::populate", this, 0);
 
 	// Seek to the start here, because we will have to do the same when the time
 	// comes to write the change, so seeking here will make it obvious if the
 	// offset is wrong.
-	try {
-		this->in_parent->seekg(0, stream::start);
-	} catch (const seek_error&) {
-		// Just ignore it, the stream might not be seekable (e.g. stdin)
+	caps parentCaps = this->in_parent->read_caps();
+	if (parentCaps.has(cap_seekable)) {
+		try {
+			this->in_parent->seekg(0, stream::start);
+		} catch (const seek_error&) {
+			// Just ignore it, the stream might not be seekable after all
+		}
 	}
 
 	// Read and filter the entire input into an in-memory buffer
 	uint8_t bufIn[BUFFER_SIZE];
+	uint8_t bufOut[BUFFER_SIZE];
 	stream::len lenIn, lenOut;
 	stream::len lenRead, lenLeftover = 0;
 	stream::len lenTotalOut = 0;
@@ -93,8 +116,14 @@ void input_filtered::realPopulate()
 		assert(lenRead <= BUFFER_SIZE - lenLeftover);
 		lenRead += lenLeftover;
 		lenIn = lenRead;
-		this->data.resize(lenTotalOut + lenOut);
-		read_filter->transform((uint8_t *)(&this->data[lenTotalOut]), &lenOut, bufIn, &lenIn);
+		this->resizeData(lenTotalOut + lenOut);
+		if (this->store->spill) {
+			// Over budget, so decode via a buffer and append to the spill file
+			read_filter->transform(bufOut, &lenOut, bufIn, &lenIn);
+			this->writeData(lenTotalOut, bufOut, lenOut);
+		} else {
+			read_filter->transform((uint8_t *)(&this->store->data[lenTotalOut]), &lenOut, bufIn, &lenIn);
+		}
 		assert(lenIn <= BUFFER_SIZE);  // sanity check
 		assert(lenOut <= BUFFER_SIZE); // sanity check
 		lenTotalOut += lenOut;
@@ -106,8 +135,9 @@ void input_filtered::realPopulate()
 	} while ((lenIn != 0) || (lenOut != 0));
 
 	// Cut off any excess from the last read
-	this->data.resize(lenTotalOut);
+	this->resizeData(lenTotalOut);
 
+	this->populated.store(true, boost::memory_order_release);
 	return;
 }
 
@@ -115,8 +145,12 @@ stream::len output_filtered::try_write(const uint8_t *buffer, stream::len len)
 {
 	this->populate();
 
+	// Leave the buffer alone if clones are still reading it
+	this->unshare(mem_filtered_read);
+
 	// Data has changed, make sure we flush it
 	this->done_filter = false;
+	this->changed = true;
 
 	return this->output_memory::try_write(buffer, len);
 }
@@ -135,18 +169,22 @@ stream::pos output_filtered::tellp() const
 
 void output_filtered::flush()
 {
+	CAMOTO_TRACE("filter", "output_filtered::flush", this, this->dataSize());
 	if (this->done_filter) {
 		std::cout << "WARNING: Tried to flush a filtered stream twice, ignoring "
 			"second flush to avoid additional call to filter." << std::endl;
 		return;
 	}
 	this->done_filter = true;
+	this->changed = false;
 
 	std::vector<uint8_t> bufOut; // data is filtered to here first
+	mem_account bufOutAccount(mem_filtered_write);
 	unsigned long lenFinal = 0;
 
-	const uint8_t *bufIn = this->data.data();
-	stream::len lenRealSize = this->data.size();
+	uint8_t bufSpill[BUFFER_SIZE]; // spilled data is read back through here
+	const uint8_t *bufIn = this->store->data.data();
+	stream::len lenRealSize = this->dataSize();
 	stream::len lenRemaining = lenRealSize;
 	stream::len lenIn, lenOut;
 
@@ -154,10 +192,22 @@ void output_filtered::flush()
 
 	// Filter the in-memory buffer and write it out to the parent stream
 	do {
-		lenIn = lenRemaining;
+		if (this->store->spill) {
+			lenIn = std::min(lenRemaining, (stream::len)BUFFER_SIZE);
+			this->readData(lenRealSize - lenRemaining, bufSpill, lenIn);
+			bufIn = bufSpill;
+		} else {
+			lenIn = lenRemaining;
+		}
 		lenOut = BUFFER_SIZE;
 
-		// Resize the output buffer to allow a full write
+		// Resize the output buffer to allow a full write.  This can't be spilled,
+		// so it is only counted, and may go over budget with that policy.
+		try {
+			bufOutAccount.resize(lenFinal + lenOut, false);
+		} catch (const budget_error& e) {
+			throw write_error("Unable to flush filtered data: " + e.get_message());
+		}
 		bufOut.resize(lenFinal + lenOut);
 
 		try {
@@ -176,7 +226,7 @@ void output_filtered::flush()
 		// Make sure we didn't write past the end of the vector
 		assert(lenFinal <= bufOut.size());
 
-		bufIn += lenIn;
+		if (!this->store->spill) bufIn += lenIn;
 		lenRemaining -= lenIn;
 	} while ((lenIn != 0) && (lenOut != 0));
 
@@ -201,10 +251,12 @@ void output_filtered::open(output_sptr parent, filter_sptr write_filter,
 	assert(parent);
 	assert(write_filter);
 
+	this->store->account.setPool(mem_filtered_write);
 	this->out_parent = parent;
 	this->write_filter = write_filter;
 	this->fn_resize = resize;
 	this->done_filter = false;
+	this->changed = false;
 	return;
 }
 
@@ -221,6 +273,9 @@ filtered::filtered()
 void filtered::truncate(stream::pos size)
 {
 	if (size == 0) this->populated = true;
+	this->unshare(mem_filtered_read);
+	this->done_filter = false;
+	this->changed = true;
 	this->output_filtered::truncate(size);
 	return;
 }
@@ -230,6 +285,8 @@ void filtered::open(inout_sptr parent, filter_sptr read_filter,
 {
 	this->input_filtered::open(parent, read_filter);
 	this->output_filtered::open(parent, write_filter, resize);
+	// Most of the content will be the decoded parent, so count it as such
+	this->store->account.setPool(mem_filtered_read);
 	return;
 }
 
@@ -239,5 +296,46 @@ void filtered::populate() const
 	return;
 }
 
+
+bool copy_encoded(filtered_sptr dest, input_filtered_sptr src,
+	stream::len lenDecoded)
+{
+	std::string encoding = src->read_filter->fingerprint();
+	if (encoding.empty() || (encoding != dest->write_filter->fingerprint())) {
+		return false;
+	}
+	// Unflushed changes only exist in decoded form
+	output_filtered *srcOut = dynamic_cast<output_filtered *>(src.get());
+	if (srcOut && srcOut->changed) return false;
+
+	CAMOTO_TRACE("filter", "copy_encoded", dest.get(), 0);
+	bool decoded = src->populated.load(boost::memory_order_acquire);
+	if (decoded) lenDecoded = src->dataSize();
+
+	input_sptr from = src->in_parent;
+	output_sptr to = dest->out_parent;
+	from->seekg(0, stream::start);
+	to->truncate(from->size());
+	to->seekp(0, stream::start);
+	stream::copy(to, from);
+	// As in flush(), this must come after truncate() to override its size
+	if (dest->fn_resize) dest->fn_resize(lenDecoded);
+	to->flush();
+
+	// Take on the decoded data too, or decode the new parent if it's read
+	input_filtered *destIn = dest.get();
+	if (decoded) {
+		destIn->store = src->store;
+	} else {
+		destIn->store.reset(new memory_store());
+		destIn->store->account.setPool(mem_filtered_read);
+	}
+	destIn->offset = 0;
+	destIn->populated.store(decoded, boost::memory_order_release);
+	dest->done_filter = true;
+	dest->changed = false;
+	return true;
+}
+
 } // namespace stream
 } // namespace camoto
@@ -0,0 +1,450 @@
+/**
+ * @file   stream_iostream.cpp
+ * @brief  Adapters between camoto streams and C++ iostreams.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <camoto/stream_iostream.hpp>
+#include <camoto/stream_memory.hpp>
+#include <camoto/stream_string.hpp>
+
+namespace camoto {
+namespace stream {
+
+streambuf::streambuf(input_sptr in, output_sptr out, std::size_t bufferSize)
+	:	in(in),
+		out(out),
+		inMemory(dynamic_cast<input_memory *>(in.get())),
+		inString(dynamic_cast<input_string *>(in.get())),
+		buffer(std::max(bufferSize, (std::size_t)1)),
+		base(0),
+		isBorrowed(false),
+		dirty(false)
+{
+}
+
+streambuf::~streambuf()
+{
+	try {
+		this->sync();
+	} catch (...) {
+		// Can't report anything from a destructor
+	}
+}
+
+bool streambuf::borrowed() const
+{
+	return this->isBorrowed && this->eback();
+}
+
+streambuf::int_type streambuf::underflow()
+{
+	if (!this->in) return traits_type::eof();
+	if (this->gptr() < this->egptr()) {
+		return traits_type::to_int_type(*this->gptr());
+	}
+
+	stream::pos pos = this->position();
+	if (!this->flushPut()) return traits_type::eof();
+	this->reset(pos);
+
+	stream::len len;
+	const char *storage = this->borrow(&len);
+	if (storage) {
+		if (pos >= len) return traits_type::eof();
+		char *p = const_cast<char *>(storage);
+		this->setg(p, p + pos, p + len);
+		this->base = 0;
+		this->isBorrowed = true;
+		return traits_type::to_int_type(*this->gptr());
+	}
+
+	stream::len r;
+	try {
+		this->in->seekg(pos, stream::start);
+		r = this->in->try_read((uint8_t *)&this->buffer[0], this->buffer.size());
+	} catch (const stream::error&) {
+		return traits_type::eof();
+	}
+	if (r == 0) return traits_type::eof();
+	this->setg(&this->buffer[0], &this->buffer[0], &this->buffer[0] + r);
+	return traits_type::to_int_type(*this->gptr());
+}
+
+streambuf::int_type streambuf::overflow(int_type c)
+{
+	if (!this->out) return traits_type::eof();
+
+	stream::pos pos = this->position();
+	if (!this->flushPut()) return traits_type::eof();
+	this->reset(pos);
+	this->setp(&this->buffer[0], &this->buffer[0] + this->buffer.size());
+
+	if (!traits_type::eq_int_type(c, traits_type::eof())) {
+		*this->pptr() = traits_type::to_char_type(c);
+		this->pbump(1);
+	}
+	return traits_type::not_eof(c);
+}
+
+std::streamsize streambuf::xsgetn(char *s, std::streamsize n)
+{
+	if (!this->in) return 0;
+	bool canBorrow = this->inMemory || this->inString;
+	std::streamsize done = 0;
+	while (done < n) {
+		std::streamsize avail = this->egptr() - this->gptr();
+		if (avail > 0) {
+			std::streamsize chunk = std::min(avail, n - done);
+			memcpy(s + done, this->gptr(), chunk);
+			this->setg(this->eback(), this->gptr() + chunk, this->egptr());
+			done += chunk;
+			continue;
+		}
+		if (!canBorrow && ((std::size_t)(n - done) >= this->buffer.size())) {
+			// Big enough to read straight into the caller's buffer
+			stream::pos pos = this->position();
+			if (!this->flushPut()) break;
+			stream::len r;
+			try {
+				this->in->seekg(pos, stream::start);
+				r = this->in->try_read((uint8_t *)s + done, n - done);
+			} catch (const stream::error&) {
+				this->reset(pos);
+				break;
+			}
+			this->reset(pos + r);
+			if (r == 0) break;
+			done += r;
+			continue;
+		}
+		if (traits_type::eq_int_type(this->underflow(), traits_type::eof())) {
+			break;
+		}
+	}
+	return done;
+}
+
+std::streamsize streambuf::xsputn(const char *s, std::streamsize n)
+{
+	if (!this->out) return 0;
+	if ((std::size_t)n >= this->buffer.size()) {
+		// Big enough to write straight from the caller's buffer
+		stream::pos pos = this->position();
+		if (!this->flushPut()) return 0;
+		this->reset(pos);
+		stream::len w;
+		try {
+			this->out->seekp(pos, stream::start);
+			w = this->out->try_write((const uint8_t *)s, n);
+		} catch (const stream::error&) {
+			return 0;
+		}
+		this->dirty = true;
+		this->base = pos + w;
+		return w;
+	}
+
+	std::streamsize done = 0;
+	while (done < n) {
+		std::streamsize avail = this->epptr() - this->pptr();
+		if (avail == 0) {
+			if (traits_type::eq_int_type(this->overflow(traits_type::eof()),
+				traits_type::eof())) break;
+			continue;
+		}
+		std::streamsize chunk = std::min(avail, n - done);
+		memcpy(this->pptr(), s + done, chunk);
+		this->pbump(chunk);
+		done += chunk;
+	}
+	return done;
+}
+
+std::streamsize streambuf::showmanyc()
+{
+	if (!this->in) return -1;
+	stream::pos pos = this->position();
+	if (!this->flushPut()) return -1;
+	try {
+		stream::len size = this->in->size();
+		if (pos >= size) return -1;
+		return size - pos;
+	} catch (const stream::error&) {
+		return -1;
+	}
+}
+
+streambuf::pos_type streambuf::seekoff(off_type off, std::ios_base::seekdir dir,
+	std::ios_base::openmode which)
+{
+	stream::pos pos = this->position();
+	if ((dir == std::ios_base::cur) && (off == 0)) return pos;
+
+	stream::delta target;
+	if (dir == std::ios_base::beg) {
+		target = off;
+	} else if (dir == std::ios_base::cur) {
+		target = pos + off;
+	} else {
+		if (!this->flushPut()) return pos_type(off_type(-1));
+		this->reset(pos);
+		try {
+			if (this->in) {
+				target = this->in->size() + off;
+			} else {
+				this->out->seekp(0, stream::end);
+				target = this->out->tellp() + off;
+			}
+		} catch (const stream::error&) {
+			return pos_type(off_type(-1));
+		}
+	}
+	if (target < 0) return pos_type(off_type(-1));
+	return this->seekpos(target, which);
+}
+
+streambuf::pos_type streambuf::seekpos(pos_type pos,
+	std::ios_base::openmode which)
+{
+	off_type target = pos;
+	if (target < 0) return pos_type(off_type(-1));
+
+	if (this->eback() && !this->pbase()) {
+		// Stay within the data we already have, if we can
+		stream::pos areaEnd = this->base + (this->egptr() - this->eback());
+		if (((stream::pos)target >= this->base) && ((stream::pos)target <= areaEnd)) {
+			this->setg(this->eback(), this->eback() + (target - this->base),
+				this->egptr());
+			return pos;
+		}
+	}
+	if (!this->flushPut()) return pos_type(off_type(-1));
+	this->reset(target);
+	return pos;
+}
+
+int streambuf::sync()
+{
+	stream::pos pos = this->position();
+	if (!this->flushPut()) return -1;
+	try {
+		if (this->in) this->in->seekg(pos, stream::start);
+		if (this->out) {
+			this->out->seekp(pos, stream::start);
+			// Only flush if needed, as flushing some streams (e.g. filtered ones)
+			// is expensive
+			if (this->dirty) {
+				this->out->flush();
+				this->dirty = false;
+			}
+		}
+	} catch (const stream::error&) {
+		return -1;
+	}
+	return 0;
+}
+
+stream::pos streambuf::position() const
+{
+	if (this->pbase()) return this->base + (this->pptr() - this->pbase());
+	if (this->eback()) return this->base + (this->gptr() - this->eback());
+	return this->base;
+}
+
+bool streambuf::flushPut()
+{
+	if (!this->pbase()) return true;
+	stream::len len = this->pptr() - this->pbase();
+	stream::pos pos = this->base;
+	this->setp(NULL, NULL);
+	this->base = pos + len;
+	if (len == 0) return true;
+	try {
+		this->out->seekp(pos, stream::start);
+		this->out->write((const uint8_t *)&this->buffer[0], len);
+	} catch (const stream::error&) {
+		return false;
+	}
+	this->dirty = true;
+	return true;
+}
+
+void streambuf::reset(stream::pos pos)
+{
+	this->setg(NULL, NULL, NULL);
+	this->setp(NULL, NULL);
+	this->base = pos;
+	this->isBorrowed = false;
+	return;
+}
+
+const char *streambuf::borrow(stream::len *len)
+{
+	if (this->inMemory) {
+		// Call through the stream so filtered streams decode their data first
+		this->in->size();
+		return (const char *)this->inMemory->contents(len);
+	}
+	if (this->inString) {
+		boost::shared_ptr<std::string> s = this->inString->str();
+		*len = s->length();
+		if (s->empty()) return NULL;
+		return s->data();
+	}
+	return NULL;
+}
+
+
+/// Convert a camoto seek origin into a C++ one.
+static std::ios_base::seekdir toSeekdir(seek_from from)
+{
+	switch (from) {
+		case stream::start: return std::ios_base::beg;
+		case stream::cur: return std::ios_base::cur;
+		case stream::end: return std::ios_base::end;
+	}
+	return std::ios_base::beg;
+}
+
+stream::len input_iostream::try_read(uint8_t *buffer, stream::len len)
+{
+	return this->in_parent->sgetn((char *)buffer, len);
+}
+
+void input_iostream::seekg(stream::delta off, seek_from from)
+{
+	if (this->in_parent->pubseekoff(off, toSeekdir(from), std::ios_base::in)
+		== std::streambuf::pos_type(std::streambuf::off_type(-1))
+	) {
+		throw seek_error("Unable to seek underlying C++ stream");
+	}
+	return;
+}
+
+stream::pos input_iostream::tellg() const
+{
+	std::streambuf::off_type pos = this->in_parent->pubseekoff(0,
+		std::ios_base::cur, std::ios_base::in);
+	if (pos < 0) throw seek_error("Unable to get position of underlying C++ "
+		"stream");
+	return pos;
+}
+
+stream::pos input_iostream::size() const
+{
+	std::streambuf::off_type pos = this->in_parent->pubseekoff(0,
+		std::ios_base::cur, std::ios_base::in);
+	std::streambuf::off_type size = this->in_parent->pubseekoff(0,
+		std::ios_base::end, std::ios_base::in);
+	if ((pos < 0) || (size < 0)) {
+		throw seek_error("Unable to get size of underlying C++ stream");
+	}
+	this->in_parent->pubseekpos(pos, std::ios_base::in);
+	return size;
+}
+
+caps input_iostream::read_caps() const
+{
+	if (this->in_parent->pubseekoff(0, std::ios_base::cur, std::ios_base::in)
+		< 0) return caps();
+	return caps(cap_seekable, 0);
+}
+
+void input_iostream::open(std::istream& parent)
+{
+	this->in_parent = parent.rdbuf();
+	return;
+}
+
+
+stream::len output_iostream::try_write(const uint8_t *buffer, stream::len len)
+{
+	return this->out_parent->sputn((const char *)buffer, len);
+}
+
+void output_iostream::seekp(stream::delta off, seek_from from)
+{
+	if (this->out_parent->pubseekoff(off, toSeekdir(from), std::ios_base::out)
+		== std::streambuf::pos_type(std::streambuf::off_type(-1))
+	) {
+		throw seek_error("Unable to seek underlying C++ stream");
+	}
+	return;
+}
+
+stream::pos output_iostream::tellp() const
+{
+	std::streambuf::off_type pos = this->out_parent->pubseekoff(0,
+		std::ios_base::cur, std::ios_base::out);
+	if (pos < 0) throw seek_error("Unable to get position of underlying C++ "
+		"stream");
+	return pos;
+}
+
+void output_iostream::truncate(stream::pos size)
+{
+	std::streambuf::off_type end = this->out_parent->pubseekoff(0,
+		std::ios_base::end, std::ios_base::out);
+	if (end < 0) throw write_error("Unable to get size of underlying C++ stream");
+	if (size < (stream::pos)end) {
+		throw write_error("C++ streams cannot be made smaller");
+	}
+	char zero[BUFFER_SIZE];
+	memset(zero, 0, sizeof(zero));
+	for (stream::len left = size - end; left > 0; ) {
+		stream::len chunk = std::min(left, (stream::len)sizeof(zero));
+		if ((stream::len)this->out_parent->sputn(zero, chunk) != chunk) {
+			throw write_error("Unable to extend underlying C++ stream");
+		}
+		left -= chunk;
+	}
+	return;
+}
+
+void output_iostream::flush()
+{
+	if (this->out_parent->pubsync() != 0) {
+		throw write_error("Unable to flush underlying C++ stream");
+	}
+	return;
+}
+
+caps output_iostream::write_caps() const
+{
+	if (this->out_parent->pubseekoff(0, std::ios_base::cur, std::ios_base::out)
+		< 0) return caps();
+	return caps(cap_seekable, 0);
+}
+
+void output_iostream::open(std::ostream& parent)
+{
+	this->out_parent = parent.rdbuf();
+	return;
+}
+
+
+void iostream::open(std::iostream& parent)
+{
+	this->in_parent = this->out_parent = parent.rdbuf();
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
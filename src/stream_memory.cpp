@@ -19,14 +19,24 @@
  */
 
 #include <errno.h>
+#include <string.h>
+#include <algorithm>
 #include <camoto/stream_memory.hpp>
-#include <camoto/util.hpp>
+#include <camoto/trace.hpp>
 
 namespace camoto {
 namespace stream {
 
+memory_store::memory_store()
+	:	account(mem_memory),
+		spillLen(0)
+{
+}
+
+
 memory_core::memory_core()
-	:	offset(0)
+	:	store(new memory_store()),
+		offset(0)
 {
 }
 
@@ -34,10 +44,28 @@ memory_core::~memory_core()
 {
 }
 
+stream::len memory_core::memoryHeld() const
+{
+	return this->store->account.held();
+}
+
+bool memory_core::spilled() const
+{
+	return this->store->account.spilled();
+}
+
+const uint8_t *memory_core::contents(stream::len *len) const
+{
+	*len = this->dataSize();
+	if (this->store->spill || this->store->data.empty()) return NULL;
+	return &this->store->data[0];
+}
+
 void memory_core::seek(stream::delta off, seek_from from)
 {
+	CAMOTO_TRACE("stream", "memory::seek", this, off);
 	stream::pos baseOffset;
-	std::vector<uint8_t>::size_type vectorSize = this->data.size();
+	stream::len vectorSize = this->dataSize();
 	switch (from) {
 		case cur:
 			baseOffset = this->offset;
@@ -54,13 +82,125 @@ void memory_core::seek(stream::delta off, seek_from from)
 	}
 	baseOffset += off;
 	if (baseOffset > vectorSize) {
-		throw seek_error(createString("Cannot seek beyond end of memory (offset "
-			<< baseOffset << " > length " << vectorSize << ")"));
+		throw seek_error("memory", baseOffset, vectorSize);
 	}
 	this->offset = baseOffset;
 	return;
 }
 
+stream::len memory_core::dataSize() const
+{
+	if (this->store->spill) return this->store->spillLen;
+	return this->store->data.size();
+}
+
+void memory_core::resizeData(stream::len size)
+{
+	if (!this->store->account.resize(size) && !this->store->spill) {
+		// Over budget, so move everything we have so far out of memory
+		this->spillData();
+		this->store->account.resize(size);
+	}
+	if (this->store->spill) {
+		if (size > this->store->spillLen) {
+			// Extend with zeroes, like vector::resize()
+			static const uint8_t zero[BUFFER_SIZE] = {0};
+			this->store->spill->seekp(this->store->spillLen, stream::start);
+			stream::len remaining = size - this->store->spillLen;
+			while (remaining) {
+				stream::len len = std::min(remaining, (stream::len)BUFFER_SIZE);
+				this->store->spill->write(zero, len);
+				remaining -= len;
+			}
+		} else if (size < this->store->spillLen) {
+			this->store->spill->truncate(size);
+		}
+		this->store->spillLen = size;
+	} else {
+		this->store->data.resize(size);
+	}
+	return;
+}
+
+void memory_core::readData(stream::pos off, uint8_t *buffer, stream::len len)
+{
+	if (this->store->spill) {
+		// Clones share the spill file's pointer
+		boost::mutex::scoped_lock lock(this->store->spillMutex);
+		this->store->spill->seekg(off, stream::start);
+		this->store->spill->read(buffer, len);
+	} else {
+		memcpy(buffer, &this->store->data[off], len);
+	}
+	return;
+}
+
+void memory_core::writeData(stream::pos off, const uint8_t *buffer,
+	stream::len len)
+{
+	if (this->store->spill) {
+		boost::mutex::scoped_lock lock(this->store->spillMutex);
+		this->store->spill->seekp(off, stream::start);
+		this->store->spill->write(buffer, len);
+	} else {
+		memcpy(&this->store->data[off], buffer, len);
+	}
+	return;
+}
+
+void memory_core::spillData()
+{
+	CAMOTO_TRACE("stream", "memory::spill", this, this->store->data.size());
+	this->store->spill = mem_budget::createSpillFile();
+	this->store->spillLen = this->store->data.size();
+	if (this->store->spillLen) this->store->spill->write(&this->store->data[0], this->store->spillLen);
+	// Actually give the memory back, which clear() doesn't do
+	std::vector<uint8_t>().swap(this->store->data);
+	this->store->account.spill();
+	return;
+}
+
+void memory_core::unshare(mem_pool pool)
+{
+	if (this->store.unique()) return;
+	CAMOTO_TRACE("stream", "memory::unshare", this, this->dataSize());
+
+	boost::shared_ptr<memory_store> shared = this->store;
+	stream::len len = this->dataSize();
+	this->store.reset(new memory_store());
+	this->store->account.setPool(pool);
+	try {
+		this->resizeData(len);
+		if (!shared->spill) {
+			if (len) this->writeData(0, &shared->data[0], len);
+		} else {
+			uint8_t buffer[BUFFER_SIZE];
+			for (stream::pos p = 0; p < len; ) {
+				stream::len chunk = std::min(len - p, (stream::len)BUFFER_SIZE);
+				{
+					boost::mutex::scoped_lock lock(shared->spillMutex);
+					shared->spill->seekg(p, stream::start);
+					shared->spill->read(buffer, chunk);
+				}
+				this->writeData(p, buffer, chunk);
+				p += chunk;
+			}
+		}
+	} catch (...) {
+		this->store = shared;
+		throw;
+	}
+	return;
+}
+
+caps memory_core::memoryCaps() const
+{
+	unsigned int flags = cap_seekable | cap_positional | cap_size_fast
+		| cap_leaf;
+	if (!this->store->spill) flags |= cap_memory;
+	return caps(flags, 0);
+}
+
 
 input_memory::input_memory()
 {
@@ -68,15 +208,16 @@ input_memory::input_memory()
 
 stream::len input_memory::try_read(uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "memory::try_read", this, len);
 	stream::pos done = this->offset + len;
-	stream::pos size = this->data.size();
+	stream::pos size = this->dataSize();
 	stream::len amt;
 	if (done > size) amt = size - this->offset;
 	else amt = len;
 	if (amt > 0) {
 		// Don't do a zero-read past the last element, because the vector will throw
 		// an error trying to retrieve the element just past the end.
-		memcpy(buffer, &this->data[this->offset], amt);
+		this->readData(this->offset, buffer, amt);
 		this->offset += amt;
 	}
 	return amt;
@@ -95,7 +236,21 @@ stream::pos input_memory::tellg() const
 
 stream::pos input_memory::size() const
 {
-	return this->data.size();
+	return this->dataSize();
+}
+
+caps input_memory::read_caps() const
+{
+	return this->memoryCaps();
+}
+
+input_sptr input_memory::clone_cursor() const
+{
+	input_memory *c = new input_memory();
+	input_sptr clone(c);
+	c->store = this->store;
+	c->offset = this->offset;
+	return clone;
 }
 
 
@@ -105,16 +260,17 @@ output_memory::output_memory()
 
 stream::len output_memory::try_write(const uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "memory::try_write", this, len);
 	stream::pos done = this->offset + len;
-	stream::pos size = this->data.size();
+	stream::pos size = this->dataSize();
 	if (done > size) {
-		this->data.resize(done);
+		this->resizeData(done);
 	} else if (size == 0) {
 		// Empty write to an empty vector
 		return 0;
 	}
 
-	memcpy(&this->data[this->offset], buffer, len);
+	this->writeData(this->offset, buffer, len);
 	this->offset += len;
 	return len;
 }
@@ -132,12 +288,13 @@ stream::pos output_memory::tellp() const
 
 void output_memory::truncate(stream::pos size)
 {
+	CAMOTO_TRACE("stream", "memory::truncate", this, size);
 	// Nothing is cached by try_write(), so there's nothing we need to flush
 	// before the truncate.
 	//this->flush();
 
 	try {
-		this->data.resize(size);
+		this->resizeData(size);
 		this->seek(size, stream::start);
 	} catch (const seek_error& e) {
 		throw write_error("Unable to seek to EOF after truncate: " + e.get_message());
@@ -150,6 +307,11 @@ void output_memory::flush()
 	return;
 }
 
+caps output_memory::write_caps() const
+{
+	return this->memoryCaps();
+}
+
 
 memory::memory()
 {
@@ -0,0 +1,405 @@
+/**
+ * @file   stream_metered.cpp
+ * @brief  Stream decorator counting and timing the operations performed on
+ *         another stream.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <camoto/stream_metered.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Global switch checked by every metered stream operation.
+static boost::atomic<bool> meterEnabled(false);
+
+/// All metered streams currently in existence.
+static std::vector<metered_core *>& meterList()
+{
+	static std::vector<metered_core *> list;
+	return list;
+}
+
+/// Protects meterList().
+static boost::mutex& meterListMutex()
+{
+	static boost::mutex m;
+	return m;
+}
+
+/// Names of each meter_op, for print().
+static const char *meterOpName[meter_op_count] = {
+	"read", "write", "seek", "tell", "size", "truncate", "flush"
+};
+
+/// Times one call to the parent stream, recording it when it goes out of scope.
+/**
+ * Calls that throw an exception are still counted.  When metering is
+ * disabled this does nothing beyond loading the global flag.
+ */
+class meter_timer
+{
+	public:
+		meter_timer(const metered_core *core, meter_op op)
+			:	on(meterEnabled.load(boost::memory_order_relaxed)),
+				core(core),
+				op(op)
+		{
+			if (this->on) this->tStart = boost::chrono::steady_clock::now();
+		}
+
+		~meter_timer()
+		{
+			if (!this->on) return;
+			boost::chrono::nanoseconds elapsed =
+				boost::chrono::steady_clock::now() - this->tStart;
+			this->core->record(this->op, elapsed.count());
+		}
+
+		const bool on; ///< Was metering enabled when the call started?
+
+	protected:
+		const metered_core *core;
+		meter_op op;
+		boost::chrono::steady_clock::time_point tStart;
+};
+
+meter_counters::meter_counters()
+{
+	this->clear();
+}
+
+void meter_counters::clear()
+{
+	std::fill(this->calls, this->calls + meter_op_count, 0);
+	std::fill(this->nsTotal, this->nsTotal + meter_op_count, 0);
+	std::fill(&this->latency[0][0], &this->latency[0][0]
+		+ meter_op_count * METER_BUCKETS, 0);
+	this->bytesRead = 0;
+	this->bytesWritten = 0;
+	this->seeksRedundant = 0;
+	this->shortReads = 0;
+	this->shortWrites = 0;
+	return;
+}
+
+meter_counters& meter_counters::operator += (const meter_counters& other)
+{
+	for (unsigned int op = 0; op < meter_op_count; op++) {
+		this->calls[op] += other.calls[op];
+		this->nsTotal[op] += other.nsTotal[op];
+		for (unsigned int b = 0; b < METER_BUCKETS; b++) {
+			this->latency[op][b] += other.latency[op][b];
+		}
+	}
+	this->bytesRead += other.bytesRead;
+	this->bytesWritten += other.bytesWritten;
+	this->seeksRedundant += other.seeksRedundant;
+	this->shortReads += other.shortReads;
+	this->shortWrites += other.shortWrites;
+	return *this;
+}
+
+unsigned long long meter_counters::percentile(meter_op op, double fraction)
+	const
+{
+	unsigned long long total = 0;
+	for (unsigned int b = 0; b < METER_BUCKETS; b++) total += this->latency[op][b];
+	if (total == 0) return 0;
+
+	unsigned long long target = (unsigned long long)(fraction * total + 0.5);
+	if (target < 1) target = 1;
+	unsigned long long seen = 0;
+	for (unsigned int b = 0; b < METER_BUCKETS; b++) {
+		seen += this->latency[op][b];
+		if (seen >= target) return 2ULL << b;
+	}
+	return 2ULL << (METER_BUCKETS - 1);
+}
+
+
+void meter_registry::enable(bool on)
+{
+	meterEnabled.store(on);
+	return;
+}
+
+bool meter_registry::enabled()
+{
+	return meterEnabled.load(boost::memory_order_relaxed);
+}
+
+std::vector<meter_snapshot> meter_registry::snapshot()
+{
+	boost::unique_lock<boost::mutex> lock(meterListMutex());
+	std::vector<meter_snapshot> all;
+	all.reserve(meterList().size());
+	for (std::vector<metered_core *>::const_iterator
+		i = meterList().begin(); i != meterList().end(); i++
+	) {
+		all.push_back((*i)->snapshot());
+	}
+	return all;
+}
+
+void meter_registry::clear()
+{
+	boost::unique_lock<boost::mutex> lock(meterListMutex());
+	for (std::vector<metered_core *>::const_iterator
+		i = meterList().begin(); i != meterList().end(); i++
+	) {
+		boost::unique_lock<boost::mutex> lockStream((*i)->mutex);
+		(*i)->counters.clear();
+	}
+	return;
+}
+
+void meter_registry::print(std::ostream& s)
+{
+	std::vector<meter_snapshot> all = meter_registry::snapshot();
+	for (std::vector<meter_snapshot>::const_iterator
+		i = all.begin(); i != all.end(); i++
+	) {
+		const meter_counters& c = i->counters;
+		s << "[" << i->label << "] read " << c.bytesRead << " B ("
+			<< c.shortReads << " short), wrote " << c.bytesWritten << " B ("
+			<< c.shortWrites << " short), " << c.seeksRedundant
+			<< " redundant seeks\n";
+		for (unsigned int op = 0; op < meter_op_count; op++) {
+			if (c.calls[op] == 0) continue;
+			s << "  " << std::left << std::setw(9) << meterOpName[op]
+				<< std::right << std::setw(10) << c.calls[op] << " calls, "
+				<< std::setw(12) << c.nsTotal[op] << " ns total, p50 < "
+				<< c.percentile((meter_op)op, 0.5) << " ns, p99 < "
+				<< c.percentile((meter_op)op, 0.99) << " ns\n";
+		}
+	}
+	s << std::flush;
+	return;
+}
+
+
+metered_core::metered_core()
+	:	pos(0),
+		posKnown(false)
+{
+	boost::unique_lock<boost::mutex> lock(meterListMutex());
+	meterList().push_back(this);
+}
+
+metered_core::~metered_core()
+{
+	boost::unique_lock<boost::mutex> lock(meterListMutex());
+	std::vector<metered_core *>& list = meterList();
+	list.erase(std::remove(list.begin(), list.end(), this), list.end());
+}
+
+meter_snapshot metered_core::snapshot() const
+{
+	meter_snapshot snap;
+	boost::unique_lock<boost::mutex> lock(this->mutex);
+	snap.label = this->label;
+	snap.counters = this->counters;
+	return snap;
+}
+
+void metered_core::record(meter_op op, unsigned long long ns) const
+{
+	// Bucket n holds [2^n, 2^(n+1)) ns
+	unsigned int bucket = 0;
+	for (unsigned long long v = ns >> 1; v && (bucket < METER_BUCKETS - 1);
+		v >>= 1) bucket++;
+
+	boost::unique_lock<boost::mutex> lock(this->mutex);
+	this->counters.calls[op]++;
+	this->counters.nsTotal[op] += ns;
+	this->counters.latency[op][bucket]++;
+	return;
+}
+
+void metered_core::trackSeek(stream::delta off, seek_from from)
+{
+	stream::pos target;
+	bool targetKnown;
+	switch (from) {
+		case start:
+			target = off;
+			targetKnown = true;
+			break;
+		case cur:
+			target = this->pos + off;
+			targetKnown = this->posKnown;
+			break;
+		default:
+			// Would need the parent's size, which costs another call.  The next
+			// tell or absolute seek will bring us back in sync.
+			target = 0;
+			targetKnown = false;
+			break;
+	}
+	if (
+		targetKnown && this->posKnown && (target == this->pos)
+		&& meterEnabled.load(boost::memory_order_relaxed)
+	) {
+		boost::unique_lock<boost::mutex> lock(this->mutex);
+		this->counters.seeksRedundant++;
+	}
+	this->pos = target;
+	this->posKnown = targetKnown;
+	return;
+}
+
+
+stream::len input_metered::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len r;
+	{
+		meter_timer t(this, meter_read);
+		r = this->in_parent->try_read(buffer, len);
+		if (t.on) {
+			boost::unique_lock<boost::mutex> lock(this->mutex);
+			this->counters.bytesRead += r;
+			if (r < len) this->counters.shortReads++;
+		}
+	}
+	this->pos += r;
+	return r;
+}
+
+void input_metered::seekg(stream::delta off, seek_from from)
+{
+	{
+		meter_timer t(this, meter_seek);
+		this->in_parent->seekg(off, from);
+	}
+	this->trackSeek(off, from);
+	return;
+}
+
+stream::pos input_metered::tellg() const
+{
+	meter_timer t(this, meter_tell);
+	this->pos = this->in_parent->tellg();
+	this->posKnown = true;
+	return this->pos;
+}
+
+stream::pos input_metered::size() const
+{
+	meter_timer t(this, meter_size);
+	return this->in_parent->size();
+}
+
+caps input_metered::read_caps() const
+{
+	return this->in_parent->read_caps().inherit(cap_seekable | cap_memory
+		| cap_mappable | cap_size_fast);
+}
+
+void input_metered::open(input_sptr parent, const std::string& label)
+{
+	this->in_parent = parent;
+	{
+		boost::unique_lock<boost::mutex> lock(this->mutex);
+		this->label = label;
+	}
+	this->posKnown = false;
+	return;
+}
+
+
+stream::len output_metered::try_write(const uint8_t *buffer, stream::len len)
+{
+	stream::len w;
+	{
+		meter_timer t(this, meter_write);
+		w = this->out_parent->try_write(buffer, len);
+		if (t.on) {
+			boost::unique_lock<boost::mutex> lock(this->mutex);
+			this->counters.bytesWritten += w;
+			if (w < len) this->counters.shortWrites++;
+		}
+	}
+	this->pos += w;
+	return w;
+}
+
+void output_metered::seekp(stream::delta off, seek_from from)
+{
+	{
+		meter_timer t(this, meter_seek);
+		this->out_parent->seekp(off, from);
+	}
+	this->trackSeek(off, from);
+	return;
+}
+
+stream::pos output_metered::tellp() const
+{
+	meter_timer t(this, meter_tell);
+	this->pos = this->out_parent->tellp();
+	this->posKnown = true;
+	return this->pos;
+}
+
+void output_metered::truncate(stream::pos size)
+{
+	// Some streams move the pointer when truncating, so don't guess.
+	this->posKnown = false;
+	meter_timer t(this, meter_truncate);
+	this->out_parent->truncate(size);
+	return;
+}
+
+void output_metered::flush()
+{
+	meter_timer t(this, meter_flush);
+	this->out_parent->flush();
+	return;
+}
+
+caps output_metered::write_caps() const
+{
+	return this->out_parent->write_caps().inherit(cap_seekable | cap_memory
+		| cap_mappable | cap_size_fast);
+}
+
+void output_metered::open(output_sptr parent, const std::string& label)
+{
+	this->out_parent = parent;
+	{
+		boost::unique_lock<boost::mutex> lock(this->mutex);
+		this->label = label;
+	}
+	this->posKnown = false;
+	return;
+}
+
+
+void metered::open(inout_sptr parent, const std::string& label)
+{
+	this->input_metered::open(parent, label);
+	this->output_metered::open(parent, label);
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
@@ -0,0 +1,542 @@
+/**
+ * @file   stream_packed.cpp
+ * @brief  Memory stream holding its content compressed.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <camoto/stream_packed.hpp>
+#include <camoto/trace.hpp>
+
+namespace camoto {
+namespace stream {
+
+/*
+ * Each page is compressed as a series of sequences, in the same layout as an
+ * LZ4 block.  A sequence is:
+ *
+ *   - A token byte.  The high nibble is the number of literals, the low
+ *     nibble the length of the match less MIN_MATCH.  A nibble of 15 is
+ *     followed by extra bytes that are added to it, until one isn't 255.
+ *   - The literals.
+ *   - The distance back to the match, 16-bit little-endian.
+ *
+ * The last sequence stops after its literals, with no match.
+ */
+
+/// Shortest match worth encoding.
+#define MIN_MATCH 4
+
+/// Number of bits in the match finder's hash.
+#define HASH_BITS 12
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned int hash4(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/// Write the extra bytes of a length that didn't fit in its nibble.
+static inline uint8_t *writeLength(uint8_t *op, stream::len len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+/// Compress one page.
+/**
+ * @param out
+ *   Set to the compressed data.
+ *
+ * @return true on success, false if the data didn't get any smaller.
+ */
+static bool packPage(const uint8_t *in, stream::len len,
+	std::vector<uint8_t> *out)
+{
+	out->resize(len);
+	if (len < MIN_MATCH + 1) return false;
+
+	uint16_t table[1 << HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	uint8_t *op = &(*out)[0];
+	const uint8_t *oend = op + len;
+	const uint8_t *ip = in;
+	const uint8_t *anchor = in;
+	const uint8_t *iend = in + len;
+
+	while (ip + MIN_MATCH <= iend) {
+		uint32_t v = read32(ip);
+		unsigned int h = hash4(v);
+		const uint8_t *ref = in + table[h];
+		table[h] = ip - in;
+		if ((ref >= ip) || (ip - ref > 0xFFFF) || (read32(ref) != v)) {
+			ip++;
+			continue;
+		}
+
+		const uint8_t *mp = ip + MIN_MATCH;
+		const uint8_t *rp = ref + MIN_MATCH;
+		while ((mp < iend) && (*mp == *rp)) {
+			mp++;
+			rp++;
+		}
+		stream::len lenLit = ip - anchor;
+		stream::len lenMatch = mp - ip - MIN_MATCH;
+
+		// Worst case size of this sequence, plus the final empty token
+		if (op + 1 + lenLit + lenLit / 255 + 1 + 2 + lenMatch / 255 + 1 + 1
+			> oend) return false;
+
+		uint8_t *token = op++;
+		*token = (std::min(lenLit, (stream::len)15) << 4)
+			| std::min(lenMatch, (stream::len)15);
+		if (lenLit >= 15) op = writeLength(op, lenLit - 15);
+		memcpy(op, anchor, lenLit);
+		op += lenLit;
+		stream::len dist = ip - ref;
+		*op++ = dist & 0xFF;
+		*op++ = dist >> 8;
+		if (lenMatch >= 15) op = writeLength(op, lenMatch - 15);
+
+		ip = anchor = mp;
+	}
+
+	stream::len lenLit = iend - anchor;
+	if (op + 1 + lenLit + lenLit / 255 + 1 >= oend) return false;
+	*op++ = std::min(lenLit, (stream::len)15) << 4;
+	if (lenLit >= 15) op = writeLength(op, lenLit - 15);
+	memcpy(op, anchor, lenLit);
+	op += lenLit;
+
+	out->resize(op - &(*out)[0]);
+	return true;
+}
+
+/// Read the extra bytes of a length that didn't fit in its nibble.
+static inline bool readLength(const uint8_t **ip, const uint8_t *iend,
+	stream::len *len)
+{
+	uint8_t b;
+	do {
+		if (*ip >= iend) return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+/// Decompress one page.
+/**
+ * @throw read_error
+ *   The compressed data is corrupted.
+ */
+static void unpackPage(const uint8_t *in, stream::len lenIn, uint8_t *out,
+	stream::len lenOut)
+{
+	const uint8_t *ip = in;
+	const uint8_t *iend = in + lenIn;
+	uint8_t *op = out;
+	uint8_t *oend = out + lenOut;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		stream::len lenLit = token >> 4;
+		if ((lenLit == 15) && !readLength(&ip, iend, &lenLit)) break;
+		if ((lenLit > (stream::len)(iend - ip))
+			|| (lenLit > (stream::len)(oend - op))) break;
+		memcpy(op, ip, lenLit);
+		ip += lenLit;
+		op += lenLit;
+		if (ip == iend) {
+			// Final sequence has no match
+			if (op == oend) return;
+			break;
+		}
+
+		if (iend - ip < 2) break;
+		stream::len dist = ip[0] | (ip[1] << 8);
+		ip += 2;
+		stream::len lenMatch = token & 0x0F;
+		if ((lenMatch == 15) && !readLength(&ip, iend, &lenMatch)) break;
+		lenMatch += MIN_MATCH;
+		if ((dist == 0) || (dist > (stream::len)(op - out))
+			|| (lenMatch > (stream::len)(oend - op))) break;
+		// Byte at a time, as the match may overlap what it's copying
+		const uint8_t *ref = op - dist;
+		for (stream::len i = 0; i < lenMatch; i++) *op++ = *ref++;
+	}
+	throw read_error("Corrupted page in packed stream");
+}
+
+
+packed_core::page::page()
+	:	raw(false)
+{
+}
+
+packed_core::packed_core()
+	:	cachePages(PACKED_CACHE_PAGES),
+		clock(0),
+		length(0),
+		packedBytes(0),
+		cacheBytes(0),
+		account(mem_memory),
+		offset(0)
+{
+}
+
+stream::len packed_core::memoryHeld() const
+{
+	return this->packedBytes + this->cacheBytes;
+}
+
+void packed_core::setCachePages(unsigned int pages)
+{
+	this->cachePages = std::max(pages, 1U);
+	while (this->cache.size() > this->cachePages) {
+		// Drop the least recently used
+		std::vector<slot>::iterator oldest = this->cache.begin();
+		for (std::vector<slot>::iterator i = this->cache.begin();
+			i != this->cache.end(); i++
+		) {
+			if (i->lastUse < oldest->lastUse) oldest = i;
+		}
+		this->evict(oldest);
+	}
+	this->recount();
+	return;
+}
+
+void packed_core::seek(stream::delta off, seek_from from)
+{
+	CAMOTO_TRACE("stream", "packed::seek", this, off);
+	stream::pos baseOffset;
+	switch (from) {
+		case cur:
+			baseOffset = this->offset;
+			break;
+		case end:
+			baseOffset = this->length;
+			break;
+		default:
+			baseOffset = 0;
+			break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of packed stream");
+	}
+	baseOffset += off;
+	if (baseOffset > this->length) {
+		throw seek_error("packed stream", baseOffset, this->length);
+	}
+	this->offset = baseOffset;
+	return;
+}
+
+void packed_core::resizeData(stream::len size)
+{
+	if (size == this->length) return;
+	unsigned long lastPage = size / PACKED_PAGE_SIZE;
+	stream::len lastLen = size % PACKED_PAGE_SIZE;
+
+	if (size < this->length) {
+		// Forget the pages past the end.  The new last page is cut short in the
+		// cache, so the old data past the end can't come back if it grows again.
+		if (lastLen) {
+			slot& s = this->loadPage(lastPage, true);
+			this->cacheBytes -= s.data.size() - lastLen;
+			s.data.resize(lastLen);
+		}
+		for (std::vector<slot>::iterator i = this->cache.begin();
+			i != this->cache.end();
+		) {
+			if (i->index * PACKED_PAGE_SIZE >= size) {
+				this->cacheBytes -= i->data.size();
+				i = this->cache.erase(i);
+			} else {
+				i++;
+			}
+		}
+		unsigned long count = lastPage + (lastLen ? 1 : 0);
+		for (unsigned long i = count; i < this->pages.size(); i++) {
+			this->packedBytes -= this->pages[i].data.size();
+		}
+		this->pages.resize(count);
+	} else {
+		// Zero-fill the end of the last page, then add pages of zeroes
+		if (this->length % PACKED_PAGE_SIZE) {
+			unsigned long oldLast = this->length / PACKED_PAGE_SIZE;
+			slot& s = this->loadPage(oldLast, true);
+			stream::len newLen = std::min(size - oldLast * PACKED_PAGE_SIZE,
+				(stream::len)PACKED_PAGE_SIZE);
+			this->cacheBytes += newLen - s.data.size();
+			s.data.resize(newLen);
+		}
+		this->pages.resize(lastPage + (lastLen ? 1 : 0));
+	}
+	this->length = size;
+	this->recount();
+	return;
+}
+
+void packed_core::readData(stream::pos off, uint8_t *buffer, stream::len len)
+{
+	while (len) {
+		unsigned long index = off / PACKED_PAGE_SIZE;
+		stream::pos pageOff = off % PACKED_PAGE_SIZE;
+		stream::len chunk = std::min(len,
+			(stream::len)(PACKED_PAGE_SIZE - pageOff));
+		slot& s = this->loadPage(index, false);
+		memcpy(buffer, &s.data[pageOff], chunk);
+		buffer += chunk;
+		off += chunk;
+		len -= chunk;
+	}
+	return;
+}
+
+void packed_core::writeData(stream::pos off, const uint8_t *buffer,
+	stream::len len)
+{
+	while (len) {
+		unsigned long index = off / PACKED_PAGE_SIZE;
+		stream::pos pageOff = off % PACKED_PAGE_SIZE;
+		stream::len chunk = std::min(len,
+			(stream::len)(PACKED_PAGE_SIZE - pageOff));
+		slot& s = this->loadPage(index, true);
+		memcpy(&s.data[pageOff], buffer, chunk);
+		buffer += chunk;
+		off += chunk;
+		len -= chunk;
+	}
+	return;
+}
+
+void packed_core::packDirty()
+{
+	for (std::vector<slot>::iterator i = this->cache.begin();
+		i != this->cache.end(); i++
+	) {
+		if (i->dirty) this->packSlot(*i);
+	}
+	this->recount();
+	return;
+}
+
+caps packed_core::packedCaps() const
+{
+	return caps(cap_seekable | cap_size_fast | cap_leaf, PACKED_PAGE_SIZE);
+}
+
+stream::len packed_core::pageLength(unsigned long index) const
+{
+	return std::min(this->length - index * PACKED_PAGE_SIZE,
+		(stream::len)PACKED_PAGE_SIZE);
+}
+
+packed_core::slot& packed_core::loadPage(unsigned long index, bool write)
+{
+	this->clock++;
+	std::vector<slot>::iterator s;
+	for (s = this->cache.begin(); s != this->cache.end(); s++) {
+		if (s->index == index) break;
+	}
+
+	if (s == this->cache.end()) {
+		// Not cached, make room and decompress it
+		if (this->cache.size() >= this->cachePages) {
+			std::vector<slot>::iterator oldest = this->cache.begin();
+			for (std::vector<slot>::iterator i = this->cache.begin();
+				i != this->cache.end(); i++
+			) {
+				if (i->lastUse < oldest->lastUse) oldest = i;
+			}
+			this->evict(oldest);
+		}
+		CAMOTO_TRACE("stream", "packed::unpack", this, index);
+		this->cache.push_back(slot());
+		s = this->cache.end() - 1;
+		s->index = index;
+		s->dirty = false;
+		stream::len len = this->pageLength(index);
+		const page& p = this->pages[index];
+		if (p.data.empty()) {
+			s->data.assign(len, 0);
+		} else if (p.raw) {
+			s->data = p.data;
+		} else {
+			s->data.resize(len);
+			unpackPage(&p.data[0], p.data.size(), &s->data[0], len);
+		}
+		this->cacheBytes += len;
+		this->recount();
+	}
+
+	s->lastUse = this->clock;
+	if (write && !s->dirty) {
+		// The compressed copy is out of date now, so don't keep it around
+		s->dirty = true;
+		page& p = this->pages[index];
+		this->packedBytes -= p.data.size();
+		std::vector<uint8_t>().swap(p.data);
+		p.raw = false;
+		this->recount();
+	}
+	return *s;
+}
+
+void packed_core::packSlot(slot& s)
+{
+	CAMOTO_TRACE("stream", "packed::pack", this, s.index);
+	page& p = this->pages[s.index];
+	this->packedBytes -= p.data.size();
+	std::vector<uint8_t>().swap(p.data);
+	p.raw = false;
+	stream::len len = s.data.size();
+	if ((len == 0) || ((s.data[0] == 0)
+		&& (memcmp(&s.data[0], &s.data[1], len - 1) == 0))
+	) {
+		// All zeroes, leave the page empty
+	} else if (!packPage(&s.data[0], len, &p.data)) {
+		p.data = s.data;
+		p.raw = true;
+	} else {
+		// Give back the space reserved for the worst case
+		std::vector<uint8_t>(p.data).swap(p.data);
+	}
+	this->packedBytes += p.data.size();
+	s.dirty = false;
+	return;
+}
+
+void packed_core::evict(std::vector<slot>::iterator s)
+{
+	if (s->dirty) this->packSlot(*s);
+	this->cacheBytes -= s->data.size();
+	this->cache.erase(s);
+	return;
+}
+
+void packed_core::recount()
+{
+	// This can't be spilled, so it may go over budget with that policy
+	this->account.resize(this->packedBytes + this->cacheBytes, false);
+	return;
+}
+
+
+input_packed::input_packed()
+{
+}
+
+stream::len input_packed::try_read(uint8_t *buffer, stream::len len)
+{
+	CAMOTO_TRACE("stream", "packed::try_read", this, len);
+	stream::len amt = std::min(len, this->length - this->offset);
+	if (amt > 0) {
+		this->readData(this->offset, buffer, amt);
+		this->offset += amt;
+	}
+	return amt;
+}
+
+void input_packed::seekg(stream::delta off, seek_from from)
+{
+	this->seek(off, from);
+	return;
+}
+
+stream::pos input_packed::tellg() const
+{
+	return this->offset;
+}
+
+stream::pos input_packed::size() const
+{
+	return this->length;
+}
+
+caps input_packed::read_caps() const
+{
+	return this->packedCaps();
+}
+
+
+output_packed::output_packed()
+{
+}
+
+stream::len output_packed::try_write(const uint8_t *buffer, stream::len len)
+{
+	CAMOTO_TRACE("stream", "packed::try_write", this, len);
+	stream::pos done = this->offset + len;
+	if (done > this->length) this->resizeData(done);
+	this->writeData(this->offset, buffer, len);
+	this->offset += len;
+	return len;
+}
+
+void output_packed::seekp(stream::delta off, seek_from from)
+{
+	this->seek(off, from);
+	return;
+}
+
+stream::pos output_packed::tellp() const
+{
+	return this->offset;
+}
+
+void output_packed::truncate(stream::pos size)
+{
+	CAMOTO_TRACE("stream", "packed::truncate", this, size);
+	this->resizeData(size);
+	this->offset = size;
+	return;
+}
+
+void output_packed::flush()
+{
+	CAMOTO_TRACE("stream", "packed::flush", this, 0);
+	this->packDirty();
+	return;
+}
+
+caps output_packed::write_caps() const
+{
+	return this->packedCaps();
+}
+
+
+packed::packed()
+{
+}
+
+} // namespace stream
+} // namespace camoto
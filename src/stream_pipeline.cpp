@@ -0,0 +1,245 @@
+/**
+ * @file   stream_pipeline.cpp
+ * @brief  Copy data between streams using separate reader and writer threads.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/filter.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Shared state between the reader thread and the writing (calling) thread.
+class pipeline
+{
+	public:
+		pipeline(input_sptr src);
+
+		/// Reader thread entry point.
+		void readLoop();
+
+		/// Tell the reader thread to stop as soon as possible.
+		void abort();
+
+		/// Throw an exception matching whatever the reader thread caught.
+		void rethrowReadError();
+
+		/// Type of exception caught by the reader thread.
+		enum failure {
+			ok,        ///< No error
+			fail_filter, ///< filter_error
+			fail_read, ///< read_error or seek_error
+			fail_other ///< Anything else
+		};
+
+		boost::mutex mutex;            ///< Protects everything below
+		boost::condition_variable cond; ///< Signalled on every state change
+
+		std::vector<uint8_t> data;     ///< All ring blocks, back to back
+		stream::len lenBlock[PIPELINE_BUFFER_COUNT]; ///< Bytes in each block
+		unsigned int head;             ///< Next block to be written
+		unsigned int filled;           ///< Number of blocks ready to write
+		bool eof;                      ///< Has the reader queued its last block?
+		bool stop;                     ///< Set by the writer to end early
+		failure failed;                ///< Set if the reader caught an exception
+		std::string failMessage;       ///< Message from the caught exception
+
+	protected:
+		input_sptr src;                ///< Stream to read from
+};
+
+pipeline::pipeline(input_sptr src)
+	:	data(PIPELINE_BUFFER_SIZE * PIPELINE_BUFFER_COUNT),
+		head(0),
+		filled(0),
+		eof(false),
+		stop(false),
+		failed(ok),
+		src(src)
+{
+}
+
+void pipeline::readLoop()
+{
+	unsigned int tail = 0;
+	try {
+		for (;;) {
+			{
+				boost::unique_lock<boost::mutex> lock(this->mutex);
+				while ((this->filled == PIPELINE_BUFFER_COUNT) && (!this->stop)) {
+					this->cond.wait(lock);
+				}
+				if (this->stop) return;
+			}
+
+			// This block is ours until we increment this->filled, so the read
+			// itself can happen without holding the lock.
+			uint8_t *buffer = &this->data[tail * PIPELINE_BUFFER_SIZE];
+			stream::len r = this->src->try_read(buffer, PIPELINE_BUFFER_SIZE);
+
+			boost::unique_lock<boost::mutex> lock(this->mutex);
+			this->lenBlock[tail] = r;
+			this->filled++;
+			tail = (tail + 1) % PIPELINE_BUFFER_COUNT;
+			// Same end condition as copy(), a short read means EOF.
+			if (r < PIPELINE_BUFFER_SIZE) this->eof = true;
+			this->cond.notify_all();
+			if (this->eof) return;
+		}
+	} catch (const filter_error& e) {
+		boost::unique_lock<boost::mutex> lock(this->mutex);
+		this->failed = fail_filter;
+		this->failMessage = e.get_message();
+	} catch (const camoto::error& e) {
+		boost::unique_lock<boost::mutex> lock(this->mutex);
+		this->failed = fail_read;
+		this->failMessage = e.get_message();
+	} catch (const std::exception& e) {
+		boost::unique_lock<boost::mutex> lock(this->mutex);
+		this->failed = fail_other;
+		this->failMessage = e.what();
+	}
+	this->cond.notify_all();
+	return;
+}
+
+void pipeline::abort()
+{
+	boost::unique_lock<boost::mutex> lock(this->mutex);
+	this->stop = true;
+	this->cond.notify_all();
+	return;
+}
+
+void pipeline::rethrowReadError()
+{
+	switch (this->failed) {
+		case ok: break;
+		case fail_filter: throw filter_error(this->failMessage);
+		case fail_read: throw read_error(this->failMessage);
+		case fail_other:
+			throw read_error("Unexpected error in copy reader thread: "
+				+ this->failMessage);
+	}
+	return;
+}
+
+void copy_pipelined(output_sptr dest, input_sptr src, copy_stats *stats)
+{
+	boost::chrono::steady_clock::time_point tStart =
+		boost::chrono::steady_clock::now();
+
+	pipeline p(src);
+	boost::thread reader(boost::bind(&pipeline::readLoop, &p));
+
+	stream::len total_written = 0;
+	try {
+		for (;;) {
+			stream::len lenNext;
+			uint8_t *buffer;
+			{
+				boost::unique_lock<boost::mutex> lock(p.mutex);
+				while ((p.filled == 0) && (!p.eof) && (p.failed == pipeline::ok)) {
+					p.cond.wait(lock);
+				}
+				if (p.filled == 0) {
+					// Reader has finished or failed, and everything it read has
+					// already been written.
+					p.rethrowReadError();
+					break;
+				}
+				lenNext = p.lenBlock[p.head];
+				buffer = &p.data[p.head * PIPELINE_BUFFER_SIZE];
+			}
+
+			if (lenNext) {
+				stream::len w = dest->try_write(buffer, lenNext);
+				total_written += w;
+				if (w < lenNext) {
+					// Did not write the full buffer
+					throw incomplete_write(total_written);
+				}
+			}
+
+			boost::unique_lock<boost::mutex> lock(p.mutex);
+			p.head = (p.head + 1) % PIPELINE_BUFFER_COUNT;
+			p.filled--;
+			p.cond.notify_all();
+			if (lenNext < PIPELINE_BUFFER_SIZE) break; // that was the last block
+		}
+	} catch (...) {
+		p.abort();
+		reader.join();
+		throw;
+	}
+	reader.join();
+
+	if (stats) {
+		boost::chrono::duration<double> elapsed =
+			boost::chrono::steady_clock::now() - tStart;
+		stats->bytes = total_written;
+		stats->seconds = elapsed.count();
+		stats->pipelined = true;
+		stats->holes = 0;
+	}
+	return;
+}
+
+bool prefer_pipelined(output_sptr dest, input_sptr src)
+{
+	// The same object on both ends would mean two threads sharing one seek
+	// pointer.
+	if (dynamic_cast<void *>(src.get()) == dynamic_cast<void *>(dest.get())) {
+		return false;
+	}
+
+	// Only safe if neither end can share an underlying stream with the other.
+	// Memory-backed streams include the filtered streams, which only touch
+	// their parent when they are first populated.  The size() and tellp() calls
+	// below make sure that happens now, on this thread.
+	caps srcCaps = src->read_caps();
+	caps destCaps = dest->write_caps();
+	if (!srcCaps.has(cap_leaf) || !destCaps.has(cap_leaf)) return false;
+	bool srcFile = srcCaps.has(cap_mappable);
+	bool srcMem = srcCaps.has(cap_memory);
+	bool destFile = destCaps.has(cap_mappable);
+	bool destMem = destCaps.has(cap_memory);
+
+	// Only worth it if at least one end is slow.
+	if (!(srcFile || destFile)) return false;
+	if (!((srcFile || srcMem) && (destFile || destMem))) return false;
+
+	stream::pos size, here;
+	try {
+		size = src->size();
+		here = src->tellg();
+		dest->tellp();
+	} catch (const stream::error&) {
+		// Unseekable, let copy() deal with it the normal way.
+		return false;
+	}
+	if (here > size) return false;
+	return size - here >= PIPELINE_MIN_LENGTH;
+}
+
+} // namespace stream
+} // namespace camoto
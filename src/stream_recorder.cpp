@@ -0,0 +1,461 @@
+/**
+ * @file   stream_recorder.cpp
+ * @brief  Record the sequence of operations performed on streams, and replay
+ *         them later against synthetic data.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <sstream>
+#include <boost/thread/thread.hpp>
+#include <camoto/stream_recorder.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_memory.hpp>
+#include <camoto/util.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// First line of a saved recording.
+#define RECORDING_SIGNATURE "camoto-io-recording 1"
+
+typedef boost::chrono::steady_clock clock;
+
+/// Names of each io_op::type, as used by save() and load().
+static const char *opName[] = {
+	"open", "read", "write", "seek", "truncate", "flush", "insert", "remove"
+};
+
+/// Number of entries in opName.
+#define OP_COUNT (sizeof(opName) / sizeof(opName[0]))
+
+/// Characters used for each seek_from value by save() and load().
+static const char seekName[] = { 's', 'c', 'e' };
+
+/// Fill a buffer with repeatable filler data.
+/**
+ * @param buffer
+ *   Buffer to fill.
+ *
+ * @param len
+ *   Size of \e buffer.
+ *
+ * @param seed
+ *   Value to start from.  The same seed always produces the same data.
+ */
+static void fillSynthetic(uint8_t *buffer, stream::len len, uint32_t seed)
+{
+	uint32_t x = seed * 2654435761U + 1;
+	for (stream::len i = 0; i < len; i++) {
+		// Simple LCG, enough to stop the data being trivially compressible.
+		x = x * 1103515245U + 12345U;
+		buffer[i] = x >> 24;
+	}
+	return;
+}
+
+/// Write \e size bytes of filler data to the start of a stream.
+static void writeSynthetic(inout_sptr s, stream::len size)
+{
+	uint8_t buffer[BUFFER_SIZE];
+	uint32_t block = 0;
+	while (size) {
+		stream::len len = std::min(size, (stream::len)BUFFER_SIZE);
+		fillSynthetic(buffer, len, block++);
+		s->write(buffer, len);
+		size -= len;
+	}
+	s->seekp(0, stream::start);
+	return;
+}
+
+
+recording::recording()
+	:	tBegin(clock::now()),
+		lastId(0)
+{
+}
+
+unsigned int recording::nextId()
+{
+	boost::unique_lock<boost::mutex> lock(this->mutex);
+	return this->lastId++;
+}
+
+void recording::add(io_op op, clock::time_point tStart)
+{
+	boost::unique_lock<boost::mutex> lock(this->mutex);
+	op.time = boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+		tStart - this->tBegin).count();
+	this->list.push_back(op);
+	return;
+}
+
+std::vector<io_op> recording::ops() const
+{
+	boost::unique_lock<boost::mutex> lock(this->mutex);
+	return this->list;
+}
+
+void recording::save(std::ostream& s) const
+{
+	std::vector<io_op> all = this->ops();
+	s << RECORDING_SIGNATURE << "\n";
+	for (std::vector<io_op>::const_iterator i = all.begin(); i != all.end(); i++) {
+		s << i->time << ' ' << i->duration << ' ' << i->id << ' '
+			<< opName[i->op] << ' ' << i->arg << ' ' << seekName[i->from] << ' '
+			<< i->result << "\n";
+	}
+	s << std::flush;
+	return;
+}
+
+void recording::load(std::istream& s)
+{
+	std::string line;
+	if (!std::getline(s, line) || (line != RECORDING_SIGNATURE)) {
+		throw read_error("Not a stream recording");
+	}
+
+	std::vector<io_op> loaded;
+	unsigned int maxId = 0;
+	unsigned long lineNum = 1;
+	while (std::getline(s, line)) {
+		lineNum++;
+		if (line.empty()) continue;
+		std::istringstream fields(line);
+		io_op op;
+		std::string name;
+		char from;
+		fields >> op.time >> op.duration >> op.id >> name >> op.arg >> from
+			>> op.result;
+		if (fields.fail()) {
+			throw read_error(createString("Invalid stream recording on line "
+				<< lineNum));
+		}
+		unsigned int type;
+		for (type = 0; type < OP_COUNT; type++) {
+			if (name == opName[type]) break;
+		}
+		if (type == OP_COUNT) {
+			throw read_error(createString("Unknown operation \"" << name
+				<< "\" in stream recording on line " << lineNum));
+		}
+		op.op = (io_op::type)type;
+		switch (from) {
+			case 's': op.from = stream::start; break;
+			case 'c': op.from = stream::cur; break;
+			case 'e': op.from = stream::end; break;
+			default:
+				throw read_error(createString("Invalid seek origin in stream "
+					"recording on line " << lineNum));
+		}
+		if (op.id >= maxId) maxId = op.id + 1;
+		loaded.push_back(op);
+	}
+
+	boost::unique_lock<boost::mutex> lock(this->mutex);
+	this->list.swap(loaded);
+	this->lastId = maxId;
+	return;
+}
+
+
+recorder_core::recorder_core()
+	:	id(0)
+{
+}
+
+void recorder_core::add(io_op::type op, stream::delta arg, seek_from from,
+	stream::len result, clock::time_point tStart)
+{
+	io_op entry;
+	entry.duration = boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+		clock::now() - tStart).count();
+	entry.id = this->id;
+	entry.op = op;
+	entry.arg = arg;
+	entry.from = from;
+	entry.result = result;
+	this->rec->add(entry, tStart);
+	return;
+}
+
+
+stream::len input_recorder::try_read(uint8_t *buffer, stream::len len)
+{
+	clock::time_point tStart = clock::now();
+	stream::len r = this->in_parent->try_read(buffer, len);
+	this->add(io_op::read, len, stream::start, r, tStart);
+	return r;
+}
+
+void input_recorder::seekg(stream::delta off, seek_from from)
+{
+	clock::time_point tStart = clock::now();
+	this->in_parent->seekg(off, from);
+	this->add(io_op::seek, off, from, 0, tStart);
+	return;
+}
+
+stream::pos input_recorder::tellg() const
+{
+	return this->in_parent->tellg();
+}
+
+stream::pos input_recorder::size() const
+{
+	return this->in_parent->size();
+}
+
+caps input_recorder::read_caps() const
+{
+	return this->in_parent->read_caps().inherit(cap_seekable | cap_memory
+		| cap_mappable | cap_size_fast);
+}
+
+void input_recorder::open(input_sptr parent, recording_sptr rec)
+{
+	this->in_parent = parent;
+	this->rec = rec;
+	this->id = rec->nextId();
+	this->add(io_op::open, parent->size(), stream::start, 0, clock::now());
+	return;
+}
+
+
+stream::len output_recorder::try_write(const uint8_t *buffer, stream::len len)
+{
+	clock::time_point tStart = clock::now();
+	stream::len w = this->out_parent->try_write(buffer, len);
+	this->add(io_op::write, len, stream::start, w, tStart);
+	return w;
+}
+
+void output_recorder::seekp(stream::delta off, seek_from from)
+{
+	clock::time_point tStart = clock::now();
+	this->out_parent->seekp(off, from);
+	this->add(io_op::seek, off, from, 0, tStart);
+	return;
+}
+
+stream::pos output_recorder::tellp() const
+{
+	return this->out_parent->tellp();
+}
+
+void output_recorder::truncate(stream::pos size)
+{
+	clock::time_point tStart = clock::now();
+	this->out_parent->truncate(size);
+	this->add(io_op::truncate, size, stream::start, 0, tStart);
+	return;
+}
+
+void output_recorder::flush()
+{
+	clock::time_point tStart = clock::now();
+	this->out_parent->flush();
+	this->add(io_op::flush, 0, stream::start, 0, tStart);
+	return;
+}
+
+caps output_recorder::write_caps() const
+{
+	return this->out_parent->write_caps().inherit(cap_seekable | cap_memory
+		| cap_mappable | cap_size_fast);
+}
+
+void output_recorder::open(output_sptr parent, recording_sptr rec)
+{
+	this->out_parent = parent;
+	this->rec = rec;
+	this->id = rec->nextId();
+	// Output-only streams have no size(), so they replay as empty streams.
+	this->add(io_op::open, 0, stream::start, 0, clock::now());
+	return;
+}
+
+
+void recorder::open(inout_sptr parent, recording_sptr rec)
+{
+	this->in_parent = parent;
+	this->out_parent = parent;
+	this->seg_parent.reset();
+	this->rec = rec;
+	this->id = rec->nextId();
+	this->add(io_op::open, parent->size(), stream::start, 0, clock::now());
+	return;
+}
+
+void recorder::open(seg_sptr parent, recording_sptr rec)
+{
+	this->open(inout_sptr(parent), rec);
+	this->seg_parent = parent;
+	return;
+}
+
+void recorder::insert(stream::len lenInsert)
+{
+	if (!this->seg_parent) {
+		throw write_error("Cannot insert data, recorder was not opened on a seg");
+	}
+	clock::time_point tStart = clock::now();
+	this->seg_parent->insert(lenInsert);
+	this->add(io_op::insert, lenInsert, stream::start, 0, tStart);
+	return;
+}
+
+void recorder::remove(stream::len lenRemove)
+{
+	if (!this->seg_parent) {
+		throw write_error("Cannot remove data, recorder was not opened on a seg");
+	}
+	clock::time_point tStart = clock::now();
+	this->seg_parent->remove(lenRemove);
+	this->add(io_op::remove, lenRemove, stream::start, 0, tStart);
+	return;
+}
+
+
+inout_sptr replay_memory(stream::len size)
+{
+	memory_sptr s(new memory());
+	writeSynthetic(s, size);
+	return s;
+}
+
+inout_sptr replay_file(const std::string& prefix, stream::len size)
+{
+	static boost::mutex mutex;
+	static unsigned long count = 0;
+	unsigned long n;
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		n = count++;
+	}
+	file_sptr s(new file());
+	s->create(createString(prefix << '.' << n));
+	s->remove();
+	writeSynthetic(s, size);
+	return s;
+}
+
+inout_sptr replay_seg(stream::len size)
+{
+	memory_sptr parent(new memory());
+	writeSynthetic(parent, size);
+	seg_sptr s(new seg());
+	s->open(parent);
+	return s;
+}
+
+replay_stats::replay_stats()
+	:	ops(0),
+		bytesRead(0),
+		bytesWritten(0),
+		mismatches(0),
+		seconds(0)
+{
+}
+
+replay_stats replay(const recording& rec, fn_replay_backend backend,
+	bool paced)
+{
+	replay_stats stats;
+	std::vector<io_op> all = rec.ops();
+	std::vector<inout_sptr> streams;
+	std::vector<uint8_t> buffer(BUFFER_SIZE);
+
+	clock::time_point tBegin = clock::now();
+	for (std::vector<io_op>::const_iterator i = all.begin(); i != all.end(); i++) {
+		if (paced) {
+			boost::this_thread::sleep_until(tBegin
+				+ boost::chrono::nanoseconds(i->time));
+		}
+
+		if (i->op == io_op::open) {
+			if (i->id >= streams.size()) streams.resize(i->id + 1);
+			streams[i->id] = backend(i->arg);
+			stats.ops++;
+			continue;
+		}
+		if ((i->id >= streams.size()) || (!streams[i->id])) {
+			throw error(createString("Stream recording uses stream " << i->id
+				<< " before opening it"));
+		}
+		inout_sptr s = streams[i->id];
+
+		switch (i->op) {
+			case io_op::read: {
+				if (buffer.size() < (stream::len)i->arg) buffer.resize(i->arg);
+				stream::len r = s->try_read(&buffer[0], i->arg);
+				stats.bytesRead += r;
+				if (r != i->result) stats.mismatches++;
+				break;
+			}
+			case io_op::write: {
+				if (buffer.size() < (stream::len)i->arg) buffer.resize(i->arg);
+				fillSynthetic(&buffer[0], i->arg, stats.ops);
+				stream::len w = s->try_write(&buffer[0], i->arg);
+				stats.bytesWritten += w;
+				if (w != i->result) stats.mismatches++;
+				break;
+			}
+			case io_op::seek:
+				s->seekg(i->arg, i->from);
+				break;
+			case io_op::truncate:
+				s->truncate(i->arg);
+				break;
+			case io_op::flush:
+				s->flush();
+				break;
+			case io_op::insert:
+			case io_op::remove: {
+				seg *sg = dynamic_cast<seg *>(s.get());
+				if (sg) {
+					if (i->op == io_op::insert) sg->insert(i->arg);
+					else sg->remove(i->arg);
+					break;
+				}
+				// Not a seg, shuffle the data around the hard way.
+				stream::pos here = s->tellg();
+				stream::pos size = s->size();
+				if (i->op == io_op::insert) {
+					s->truncate(size + i->arg);
+					move(s, here, here + i->arg, size - here);
+				} else {
+					move(s, here + i->arg, here, size - here - i->arg);
+					s->truncate(size - i->arg);
+				}
+				s->seekg(here, stream::start);
+				break;
+			}
+			case io_op::open:
+				break; // already handled
+		}
+		stats.ops++;
+	}
+	boost::chrono::duration<double> elapsed = clock::now() - tBegin;
+	stats.seconds = elapsed.count();
+	return stats;
+}
+
+} // namespace stream
+} // namespace camoto
@@ -0,0 +1,214 @@
+/**
+ * @file   stream_region.cpp
+ * @brief  Write disjoint parts of one file from several threads at once.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+#ifndef WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+#include <camoto/stream_region.hpp>
+#include <camoto/util.hpp> // createString
+#include <camoto/trace.hpp>
+
+namespace camoto {
+namespace stream {
+
+void region_target::writeAt(stream::pos off, const uint8_t *buffer,
+	stream::len len)
+{
+#ifndef WIN32
+	while (len) {
+		ssize_t r = pwrite(this->fd, buffer, len, off);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			throw write_error(createString("Unable to write region: "
+				<< strerror(errno)));
+		}
+		buffer += r;
+		off += r;
+		len -= r;
+	}
+#else
+	// No positional writes, so take turns with the file's own pointer
+	boost::unique_lock<boost::mutex> lock(this->mutex);
+	stream::pos orig = this->dest->tellp();
+	this->dest->seekp(off, stream::start);
+	this->dest->write(buffer, len);
+	this->dest->seekp(orig, stream::start);
+#endif
+	return;
+}
+
+
+output_region::output_region(boost::shared_ptr<region_target> target,
+	stream::pos start, stream::len len)
+	:	target(target),
+		start(start),
+		stream_len(len),
+		offset(0)
+{
+}
+
+stream::len output_region::try_write(const uint8_t *buffer, stream::len len)
+{
+	CAMOTO_TRACE("stream", "region::try_write", this, len);
+	assert(this->offset <= this->stream_len);
+	len = std::min(len, this->stream_len - this->offset);
+	if (len == 0) return 0;
+	this->target->writeAt(this->start + this->offset, buffer, len);
+	this->offset += len;
+	return len;
+}
+
+void output_region::seekp(stream::delta off, seek_from from)
+{
+	CAMOTO_TRACE("stream", "region::seek", this, off);
+	stream::pos baseOffset;
+	switch (from) {
+		case cur:
+			baseOffset = this->offset;
+			break;
+		case end:
+			baseOffset = this->stream_len;
+			break;
+		default:
+			baseOffset = 0;
+			break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of region");
+	}
+	baseOffset += off;
+	if (baseOffset > this->stream_len) {
+		throw seek_error("region", baseOffset, this->stream_len);
+	}
+	this->offset = baseOffset;
+	return;
+}
+
+stream::pos output_region::tellp() const
+{
+	return this->offset;
+}
+
+void output_region::truncate(stream::pos size)
+{
+	if (size != this->stream_len) {
+		throw write_error(createString("Regions can't be resized (tried to "
+			"change from " << this->stream_len << " to " << size << " bytes)"));
+	}
+	this->offset = size;
+	return;
+}
+
+void output_region::flush()
+{
+	return;
+}
+
+caps output_region::write_caps() const
+{
+	caps c = this->target->dest->write_caps();
+	// Still in a file, but no longer seeking it or able to punch holes
+	c.flags &= ~(cap_leaf | cap_holes);
+	c.flags |= cap_positional;
+	return c;
+}
+
+
+region_writer::region_writer(output_file_sptr dest, stream::len size)
+	:	target(new region_target()),
+		size(size)
+{
+	dest->flush();
+	this->target->dest = dest;
+	this->target->fd = dest->fd();
+
+	// Allocate everything once, so workers don't each extend the file
+	int fd = this->target->fd;
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		throw write_error(createString("Unable to examine output file: "
+			<< strerror(errno)));
+	}
+	if ((stream::len)st.st_size >= size) return;
+#ifdef FALLOC_FL_KEEP_SIZE
+	if (fallocate(fd, 0, 0, size) == 0) return;
+	if ((errno != EOPNOTSUPP) && (errno != ENOSYS)) {
+		throw write_error(createString("Unable to allocate " << size
+			<< " bytes for output file: " << strerror(errno)));
+	}
+#endif
+#ifndef WIN32
+	if (ftruncate(fd, size) < 0) {
+#else
+	if (_chsize(fd, size) < 0) {
+#endif
+		throw write_error(createString("Unable to extend output file to "
+			<< size << " bytes: " << strerror(errno)));
+	}
+}
+
+output_sptr region_writer::region(stream::pos start, stream::len len)
+{
+	if ((start > this->size) || (len > this->size - start)) {
+		throw write_error(createString("Region of " << len << " bytes at offset "
+			<< start << " goes past the end of the " << this->size
+			<< " byte file"));
+	}
+	boost::unique_lock<boost::mutex> lock(this->mutex);
+	if (len) {
+		// First region starting after this one, and the one before it
+		std::map<stream::pos, stream::len>::iterator next =
+			this->used.upper_bound(start);
+		if ((next != this->used.end()) && (next->first < start + len)) {
+			throw write_error(createString("Region at offset " << start
+				<< " overlaps the one at offset " << next->first));
+		}
+		if (next != this->used.begin()) {
+			std::map<stream::pos, stream::len>::iterator prev = next;
+			prev--;
+			if (prev->first + prev->second > start) {
+				throw write_error(createString("Region at offset " << start
+					<< " overlaps the one at offset " << prev->first));
+			}
+		}
+		this->used[start] = len;
+	}
+	return output_sptr(new output_region(this->target, start, len));
+}
+
+void region_writer::flush()
+{
+	CAMOTO_TRACE("stream", "region_writer::flush", this, this->size);
+	// Discard anything stdio has cached, since the file changed underneath it
+	output_file_sptr dest = this->target->dest;
+	dest->seekp(dest->tellp(), stream::start);
+	dest->flush();
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
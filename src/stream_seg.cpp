@@ -23,13 +23,15 @@
 #include <errno.h>
 #include <string.h>
 #include <camoto/stream_seg.hpp>
-#include <camoto/util.hpp>
+#include <camoto/stream_sub.hpp>
+#include <camoto/trace.hpp>
 
 namespace camoto {
 namespace stream {
 
 stream::len seg::try_read(uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "seg::try_read", this, len);
 	// Make sure open() has been called
 	assert(this->parent);
 
@@ -105,6 +107,7 @@ stream::len seg::try_read(uint8_t *buffer, stream::len len)
 
 void seg::seekg(stream::delta off, seek_from from)
 {
+	CAMOTO_TRACE("stream", "seg::seek", this, off);
 	// Calculate stream size
 	stream::pos lenFirst = this->off_endparent - this->off_parent;
 	stream::pos lenTotal = lenFirst;
@@ -129,8 +132,7 @@ void seg::seekg(stream::delta off, seek_from from)
 	}
 	baseOffset += off;
 	if (baseOffset > lenTotal) {
-		throw seek_error(createString("Cannot seek beyond end of segstream (offset "
-			<< baseOffset << " > length " << lenTotal << ")"));
+		throw seek_error("segstream", baseOffset, lenTotal);
 	}
 	this->offset = baseOffset;
 
@@ -167,6 +169,7 @@ stream::pos seg::size() const
 
 stream::len seg::try_write(const uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "seg::try_write", this, len);
 	// Make sure open() has been called
 	assert(this->parent);
 
@@ -252,6 +255,7 @@ stream::pos seg::tellp() const
 
 void seg::truncate(stream::pos size)
 {
+	CAMOTO_TRACE("stream", "seg::truncate", this, size);
 	try {
 		stream::len total = this->size();
 		if (size < total) {
@@ -270,6 +274,7 @@ void seg::truncate(stream::pos size)
 
 void seg::flush()
 {
+	CAMOTO_TRACE("stream", "seg::flush", this, 0);
 	// Make sure open() has been called
 	assert(this->parent);
 
@@ -327,6 +332,42 @@ void seg::flush()
 	return;
 }
 
+caps seg::read_caps() const
+{
+	caps c = this->parent->read_caps().inherit(cap_seekable | cap_memory
+		| cap_mappable);
+	c.flags |= cap_size_fast;
+	return c;
+}
+
+caps seg::write_caps() const
+{
+	caps c = this->parent->write_caps().inherit(cap_seekable | cap_memory
+		| cap_mappable);
+	c.flags |= cap_size_fast;
+	return c;
+}
+
+input_sptr seg::clone_cursor() const
+{
+	// Make sure open() has been called
+	assert(this->parent);
+
+	if (!this->vcSecond.empty() || this->psegThird) {
+		throw error("Can't clone a segstream with unflushed changes");
+	}
+	input_sub_sptr clone(new input_sub());
+	clone->open(this->parent->clone_cursor(), this->off_parent,
+		this->off_endparent - this->off_parent);
+	clone->seekg(this->offset, stream::start);
+	return clone;
+}
+
+seg::seg()
+	:	vcSecondAccount(mem_seg_insert)
+{
+}
+
 void seg::open(inout_sptr parent)
 {
 	assert(parent);
@@ -349,6 +390,7 @@ void seg::insert(stream::len lenInsert)
 		this->split();
 		// Make our second source lenInsert bytes long so it will become the newly
 		// inserted block of data.
+		this->vcSecondAccount.resize(lenInsert, false);
 		this->vcSecond.resize(lenInsert);
 		assert(this->vcSecond.size() == lenInsert);
 	} else {
@@ -357,6 +399,7 @@ void seg::insert(stream::len lenInsert)
 			// Extra data is to be inserted in the middle of the second source
 			// TESTED BY: segstream_insert_c02
 
+			this->vcSecondAccount.resize(this->vcSecond.size() + lenInsert, false);
 			this->vcSecond.insert(this->vcSecond.begin() + (this->offset
 				- lenFirst), lenInsert, '\0');
 		} else {
@@ -426,12 +469,14 @@ void seg::remove(stream::len lenRemove)
 				// source, i.e. the entire second source is to be removed.
 				// TESTED BY: segstream_remove_c05
 				this->vcSecond.clear();
+				this->vcSecondAccount.resize(0);
 				lenRemove -= lenSecond;  // in case there's any leftovers
 			} else {
 				// Just some data off the front is to go
 				// TESTED BY: segstream_remove_c06
 				this->vcSecond.erase(this->vcSecond.begin(),
 					this->vcSecond.begin() + lenRemove);
+				this->vcSecondAccount.resize(this->vcSecond.size(), false);
 				lenRemove = 0;
 			}
 		} else {
@@ -454,6 +499,7 @@ void seg::remove(stream::len lenRemove)
 				lenRemove = 0;
 			}
 			this->vcSecond.erase(itCropStart, itCropEnd);
+			this->vcSecondAccount.resize(this->vcSecond.size(), false);
 		}
 	}
 
@@ -470,6 +516,13 @@ void seg::remove(stream::len lenRemove)
 	return;
 }
 
+stream::len seg::memoryHeld() const
+{
+	stream::len held = this->vcSecondAccount.held();
+	if (this->psegThird) held += this->psegThird->memoryHeld();
+	return held;
+}
+
 void seg::split()
 {
 	assert(this->offset < (this->off_endparent - this->off_parent));
@@ -487,8 +540,8 @@ void seg::split()
 	// And we now end at the current file pointer
 	this->off_endparent = psegNew->off_parent;
 	// Move our vcSecond to child segstream's vcSecond
-	psegNew->vcSecond = this->vcSecond;
-	this->vcSecond.clear();
+	psegNew->vcSecond.swap(this->vcSecond);
+	psegNew->vcSecondAccount.swap(this->vcSecondAccount);
 	// Move our psegThird to child segstream's psegThird
 	psegNew->psegThird = this->psegThird; // possibly NULL
 	// Make child segstream our psegThird
@@ -498,6 +551,7 @@ void seg::split()
 
 void seg::commit(stream::pos poffWriteFirst)
 {
+	CAMOTO_TRACE("stream", "seg::commit", this, poffWriteFirst);
 	assert(this->off_parent <= this->off_endparent);
 
 	stream::pos lenFirst = this->off_endparent - this->off_parent;
@@ -545,6 +599,7 @@ void seg::commit(stream::pos poffWriteFirst)
 		this->parent->seekp(poffWriteSecond, stream::start);
 		this->parent->try_write(&this->vcSecond[0], lenSecond);
 		this->vcSecond.clear();
+		this->vcSecondAccount.resize(0);
 		this->off_endparent += lenSecond;
 	}
 
@@ -0,0 +1,232 @@
+/**
+ * @file   stream_simulated.cpp
+ * @brief  Stream decorator making another stream behave like slower storage.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+#include <camoto/stream_simulated.hpp>
+#include <camoto/trace.hpp>
+
+namespace camoto {
+namespace stream {
+
+sim_device::sim_device()
+	:	latencyNs(0),
+		seekNs(0),
+		bytesPerSecond(0),
+		shortReadChance(0),
+		seed(1),
+		realTime(false)
+{
+}
+
+sim_device sim_device::hdd()
+{
+	sim_device d;
+	d.latencyNs = 50000;   // 50us per request
+	d.seekNs = 8000000;    // 8ms average seek plus rotational delay
+	d.bytesPerSecond = 120 * 1024 * 1024;
+	return d;
+}
+
+sim_device sim_device::network()
+{
+	sim_device d;
+	d.latencyNs = 2000000; // 2ms round trip per request
+	d.seekNs = 1000000;    // server-side read-ahead is lost
+	d.bytesPerSecond = 40 * 1024 * 1024;
+	return d;
+}
+
+
+simulated_core::simulated_core()
+	:	rng(1),
+		clockNs(0),
+		seekCount(0),
+		shortCount(0),
+		pos(0),
+		lastEnd(0)
+{
+}
+
+unsigned long long simulated_core::elapsedNs() const
+{
+	return this->clockNs;
+}
+
+unsigned long long simulated_core::seeks() const
+{
+	return this->seekCount;
+}
+
+unsigned long long simulated_core::shortReads() const
+{
+	return this->shortCount;
+}
+
+void simulated_core::resetClock()
+{
+	this->clockNs = 0;
+	this->seekCount = 0;
+	this->shortCount = 0;
+	return;
+}
+
+void simulated_core::start(const sim_device& dev, stream::pos pos)
+{
+	this->dev = dev;
+	this->rng = dev.seed;
+	this->pos = pos;
+	this->lastEnd = pos;
+	this->resetClock();
+	return;
+}
+
+void simulated_core::charge(stream::len bytes, bool access)
+{
+	unsigned long long ns = this->dev.latencyNs;
+	if (access) {
+		if (this->pos != this->lastEnd) {
+			ns += this->dev.seekNs;
+			this->seekCount++;
+		}
+	}
+	if (this->dev.bytesPerSecond) {
+		ns += (unsigned long long)((double)bytes * 1e9
+			/ this->dev.bytesPerSecond);
+	}
+	this->clockNs += ns;
+	if (this->dev.realTime && ns) {
+		CAMOTO_TRACE("stream", "simulated::sleep", this, ns);
+		boost::this_thread::sleep_for(boost::chrono::nanoseconds(ns));
+	}
+	return;
+}
+
+stream::len simulated_core::readLength(stream::len len)
+{
+	if ((len < 2) || (this->dev.shortReadChance <= 0)) return len;
+	this->rng = this->rng * 1103515245U + 12345U;
+	if ((this->rng >> 8) >= this->dev.shortReadChance * (1 << 24)) return len;
+	this->rng = this->rng * 1103515245U + 12345U;
+	this->shortCount++;
+	return 1 + (this->rng >> 8) % (len - 1);
+}
+
+
+stream::len input_simulated::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len r = this->in_parent->try_read(buffer, this->readLength(len));
+	this->charge(r, true);
+	this->pos += r;
+	this->lastEnd = this->pos;
+	return r;
+}
+
+void input_simulated::seekg(stream::delta off, seek_from from)
+{
+	this->in_parent->seekg(off, from);
+	this->pos = this->in_parent->tellg();
+	return;
+}
+
+stream::pos input_simulated::tellg() const
+{
+	return this->in_parent->tellg();
+}
+
+stream::pos input_simulated::size() const
+{
+	return this->in_parent->size();
+}
+
+caps input_simulated::read_caps() const
+{
+	return this->in_parent->read_caps().inherit(cap_seekable | cap_mappable
+		| cap_size_fast);
+}
+
+void input_simulated::open(input_sptr parent, const sim_device& dev)
+{
+	this->in_parent = parent;
+	this->start(dev, parent->tellg());
+	return;
+}
+
+
+stream::len output_simulated::try_write(const uint8_t *buffer, stream::len len)
+{
+	stream::len w = this->out_parent->try_write(buffer, len);
+	this->charge(w, true);
+	this->pos += w;
+	this->lastEnd = this->pos;
+	return w;
+}
+
+void output_simulated::seekp(stream::delta off, seek_from from)
+{
+	this->out_parent->seekp(off, from);
+	this->pos = this->out_parent->tellp();
+	return;
+}
+
+stream::pos output_simulated::tellp() const
+{
+	return this->out_parent->tellp();
+}
+
+void output_simulated::truncate(stream::pos size)
+{
+	this->out_parent->truncate(size);
+	this->charge(0, false);
+	// Some streams move the pointer when truncating.
+	this->pos = this->out_parent->tellp();
+	return;
+}
+
+void output_simulated::flush()
+{
+	this->out_parent->flush();
+	this->charge(0, false);
+	return;
+}
+
+caps output_simulated::write_caps() const
+{
+	return this->out_parent->write_caps().inherit(cap_seekable | cap_mappable
+		| cap_size_fast);
+}
+
+void output_simulated::open(output_sptr parent, const sim_device& dev)
+{
+	this->out_parent = parent;
+	this->start(dev, parent->tellp());
+	return;
+}
+
+
+void simulated::open(inout_sptr parent, const sim_device& dev)
+{
+	this->input_simulated::open(parent, dev);
+	this->output_simulated::open(parent, dev);
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
@@ -0,0 +1,149 @@
+/**
+ * @file   stream_sparse.cpp
+ * @brief  Copy data between streams, recreating holes instead of copying them.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <boost/chrono.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/trace.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Write a hole of \e len bytes at the current write pointer.
+/**
+ * @param total
+ *   Bytes written so far, updated on return and used in any exception.
+ */
+static void writeHole(output_sptr dest, output_file *destFile,
+	stream::len len, stream::len *total)
+{
+	if (destFile) {
+		stream::pos here = dest->tellp();
+		destFile->punchHole(here, len);
+		dest->seekp(here + len, stream::start);
+		*total += len;
+		return;
+	}
+
+	uint8_t zero[BUFFER_SIZE];
+	memset(zero, 0, sizeof(zero));
+	while (len) {
+		stream::len chunk = std::min(len, (stream::len)sizeof(zero));
+		stream::len w = dest->try_write(zero, chunk);
+		*total += w;
+		if (w < chunk) throw incomplete_write(*total);
+		len -= chunk;
+	}
+	return;
+}
+
+void copy_sparse(output_sptr dest, input_sptr src, copy_stats *stats)
+{
+	CAMOTO_TRACE("stream", "copy_sparse", dest.get(), 0);
+	input_file *srcFile = NULL;
+	if (src->read_caps().has(cap_holes)) {
+		srcFile = dynamic_cast<input_file *>(src.get());
+	}
+	if (!srcFile) {
+		// Nothing to tell us where the holes are
+		copy(dest, src, stats);
+		return;
+	}
+	output_file *destFile = NULL;
+	if (dest->write_caps().has(cap_holes)) {
+		destFile = dynamic_cast<output_file *>(dest.get());
+	}
+
+	boost::chrono::steady_clock::time_point tStart;
+	if (stats) tStart = boost::chrono::steady_clock::now();
+
+	uint8_t buffer[BUFFER_SIZE];
+	stream::len total_written = 0;
+	stream::len holes = 0;
+	stream::pos pos = src->tellg();
+	stream::pos size = src->size();
+	while (pos < size) {
+		stream::pos dataStart, dataEnd;
+		if (!srcFile->nextData(pos, &dataStart, &dataEnd)) {
+			dataStart = dataEnd = size;
+		}
+		dataStart = std::min(dataStart, size);
+		dataEnd = std::min(dataEnd, size);
+
+		if (dataStart > pos) {
+			writeHole(dest, destFile, dataStart - pos, &total_written);
+			holes += dataStart - pos;
+			pos = dataStart;
+		}
+
+		src->seekg(pos, stream::start);
+		while (pos < dataEnd) {
+			stream::len r = src->try_read(buffer,
+				std::min(dataEnd - pos, (stream::len)sizeof(buffer)));
+			if (r == 0) {
+				// File got shorter under us
+				size = pos;
+				break;
+			}
+			stream::len w = dest->try_write(buffer, r);
+			total_written += w;
+			if (w < r) {
+				// Did not write the full buffer
+				throw incomplete_write(total_written);
+			}
+			pos += r;
+		}
+	}
+	src->seekg(pos, stream::start);
+
+	if (stats) {
+		boost::chrono::duration<double> elapsed =
+			boost::chrono::steady_clock::now() - tStart;
+		stats->bytes = total_written;
+		stats->seconds = elapsed.count();
+		stats->pipelined = false;
+		stats->holes = holes;
+	}
+	return;
+}
+
+bool prefer_sparse(output_sptr dest, input_sptr src)
+{
+	if (!src->read_caps().has(cap_holes)) return false;
+	input_file *srcFile = dynamic_cast<input_file *>(src.get());
+	if (!srcFile) return false;
+
+	try {
+		stream::pos here = src->tellg();
+		stream::pos size = src->size();
+		if (here >= size) return false;
+		stream::pos dataStart, dataEnd;
+		if (!srcFile->nextData(here, &dataStart, &dataEnd)) return true;
+		return (dataStart > here) || (dataEnd < size);
+	} catch (const stream::error&) {
+		// Unseekable, let copy() deal with it the normal way.
+		return false;
+	}
+}
+
+} // namespace stream
+} // namespace camoto
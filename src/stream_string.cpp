@@ -21,7 +21,7 @@
 #include <errno.h>
 #include <string.h>
 #include <camoto/stream_string.hpp>
-#include <camoto/util.hpp>
+#include <camoto/trace.hpp>
 
 namespace camoto {
 namespace stream {
@@ -34,6 +34,7 @@ string_core::string_core()
 
 void string_core::seek(stream::delta off, seek_from from)
 {
+	CAMOTO_TRACE("stream", "string::seek", this, off);
 	stream::pos baseOffset;
 	std::string::size_type stringSize = this->data->length();
 	switch (from) {
@@ -52,8 +53,7 @@ void string_core::seek(stream::delta off, seek_from from)
 	}
 	baseOffset += off;
 	if (baseOffset > stringSize) {
-		throw seek_error(createString("Cannot seek beyond end of string (offset "
-			<< baseOffset << " > length " << stringSize << ")"));
+		throw seek_error("string", baseOffset, stringSize);
 	}
 	this->offset = baseOffset;
 	return;
@@ -71,6 +71,7 @@ input_string::input_string()
 
 stream::len input_string::try_read(uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "string::try_read", this, len);
 	assert(this->data);
 
 	stream::pos done = this->offset + len;
@@ -99,6 +100,20 @@ stream::pos input_string::size() const
 	return this->data->length();
 }
 
+caps input_string::read_caps() const
+{
+	return caps(cap_seekable | cap_memory | cap_positional | cap_size_fast
+		| cap_leaf, 0);
+}
+
+input_sptr input_string::clone_cursor() const
+{
+	input_string_sptr clone(new input_string());
+	clone->open(this->data);
+	clone->offset = this->offset;
+	return clone;
+}
+
 void input_string::open(boost::shared_ptr<std::string> src)
 {
 	this->data = src;
@@ -113,6 +128,7 @@ output_string::output_string()
 
 stream::len output_string::try_write(const uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "string::try_write", this, len);
 	assert(this->data);
 
 	stream::pos done = this->offset + len;
@@ -145,6 +161,7 @@ stream::pos output_string::tellp() const
 
 void output_string::truncate(stream::pos size)
 {
+	CAMOTO_TRACE("stream", "string::truncate", this, size);
 	this->flush();
 	try {
 		this->data->resize(size);
@@ -160,6 +177,12 @@ void output_string::flush()
 	return;
 }
 
+caps output_string::write_caps() const
+{
+	return caps(cap_seekable | cap_memory | cap_positional | cap_size_fast
+		| cap_leaf, 0);
+}
+
 void output_string::open(boost::shared_ptr<std::string> src)
 {
 	this->data = src;
@@ -21,13 +21,14 @@
 #include <errno.h>
 #include <string.h>
 #include <camoto/stream_sub.hpp>
-#include <camoto/util.hpp>
+#include <camoto/trace.hpp>
 
 namespace camoto {
 namespace stream {
 
 void sub_core::seek(stream::delta off, seek_from from)
 {
+	CAMOTO_TRACE("stream", "sub::seek", this, off);
 	stream::pos baseOffset;
 	switch (from) {
 		case cur:
@@ -45,8 +46,7 @@ void sub_core::seek(stream::delta off, seek_from from)
 	}
 	baseOffset += off;
 	if (baseOffset > this->stream_len) {
-		throw seek_error(createString("Cannot seek beyond end of substream (offset "
-			<< baseOffset << " > length " << this->stream_len << ")"));
+		throw seek_error("substream", baseOffset, this->stream_len);
 	}
 	this->offset = baseOffset;
 	return;
@@ -82,6 +82,7 @@ stream::pos sub_core::get_offset()
 
 stream::len input_sub::try_read(uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "sub::try_read", this, len);
 	// Make sure we didn't somehow end up past the end of the stream
 	assert(this->offset <= this->stream_len);
 
@@ -126,18 +127,40 @@ stream::pos input_sub::size() const
 	return this->stream_len;
 }
 
+caps input_sub::read_caps() const
+{
+	// Reads seek the parent first, so they are only positional when nothing
+	// else uses the parent's pointer.
+	unsigned int keep = cap_seekable | cap_memory | cap_mappable;
+	if (this->ownParent) keep |= cap_positional;
+	caps c = this->in_parent->read_caps().inherit(keep);
+	c.flags |= cap_size_fast;
+	return c;
+}
+
+input_sptr input_sub::clone_cursor() const
+{
+	input_sub_sptr clone(new input_sub());
+	clone->open(this->in_parent->clone_cursor(), this->start, this->stream_len);
+	clone->offset = this->offset;
+	clone->ownParent = true;
+	return clone;
+}
+
 void input_sub::open(input_sptr parent, stream::pos start, stream::len len)
 {
 	this->in_parent = parent;
 	this->start = start;
 	this->stream_len = len;
 	this->offset = 0;
+	this->ownParent = false;
 	return;
 }
 
 
 stream::len output_sub::try_write(const uint8_t *buffer, stream::len len)
 {
+	CAMOTO_TRACE("stream", "sub::try_write", this, len);
 	// Make sure we didn't somehow end up past the end of the stream
 	assert(this->offset <= this->stream_len);
 
@@ -189,6 +212,7 @@ stream::pos output_sub::tellp() const
 
 void output_sub::truncate(stream::pos size)
 {
+	CAMOTO_TRACE("stream", "sub::truncate", this, size);
 	if (this->stream_len == size) return; // nothing to do
 	if (!this->fn_resize) {
 		throw write_error("Cannot truncate substream, no callback function was "
@@ -214,6 +238,15 @@ void output_sub::flush()
 	return;
 }
 
+caps output_sub::write_caps() const
+{
+	// Writes always seek the parent first, so they are never positional
+	caps c = this->out_parent->write_caps().inherit(cap_seekable | cap_memory
+		| cap_mappable);
+	c.flags |= cap_size_fast;
+	return c;
+}
+
 void output_sub::open(output_sptr parent, stream::pos start, stream::len len,
 	fn_truncate fn_resize)
 {
@@ -235,6 +268,7 @@ void sub::open(inout_sptr parent, stream::pos start, stream::len len,
 {
 	this->in_parent = parent;
 	this->out_parent = parent;
+	this->ownParent = false;
 	this->start = start;
 	this->stream_len = len;
 	this->fn_resize = fn_resize;
@@ -0,0 +1,275 @@
+/**
+ * @file   trace.cpp
+ * @brief  Timeline capture of stream and filter operations.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <vector>
+#include <iomanip>
+#include <boost/chrono.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <camoto/trace.hpp>
+
+namespace camoto {
+namespace trace {
+
+boost::atomic<bool> active(false);
+
+/// One recorded event.
+struct event {
+	const char *category;
+	const char *name;
+	const void *obj;
+	uint64_t arg;
+	uint64_t tStart;   ///< Nanoseconds
+	uint64_t duration; ///< Nanoseconds
+};
+
+/// Events recorded by a single thread.
+/**
+ * Only the owning thread ever writes to a ring.  Readers use \e head to work
+ * out which slots hold complete events.  When the owner exits the ring is
+ * marked as orphaned, and the next new thread takes it over.
+ */
+struct ring {
+	ring(unsigned long tid)
+		:	tid(tid),
+			head(0),
+			orphaned(false),
+			events(TRACE_BUFFER_EVENTS)
+	{
+	}
+
+	unsigned long tid;             ///< Small number identifying the thread
+	boost::atomic<uint64_t> head;  ///< Total number of events ever written
+	boost::atomic<bool> orphaned;  ///< Has the owning thread exited?
+	std::vector<event> events;     ///< Slot n % size holds event number n
+};
+
+typedef boost::shared_ptr<ring> ring_sptr;
+
+/// Every ring in use or orphaned.  Rings outlive their threads so their
+/// events can still be exported.
+static std::vector<ring_sptr>& ringList()
+{
+	static std::vector<ring_sptr> list;
+	return list;
+}
+
+/// Protects ringList().
+static boost::mutex& ringListMutex()
+{
+	static boost::mutex m;
+	return m;
+}
+
+/// Called as a thread exits, to hand its ring on.
+static void releaseRing(ring_sptr *r)
+{
+	(*r)->orphaned.store(true, boost::memory_order_release);
+	delete r;
+	return;
+}
+
+/// Get the calling thread's ring, creating it if needed.
+static ring *threadRing()
+{
+	static boost::thread_specific_ptr<ring_sptr> local(releaseRing);
+	ring_sptr *r = local.get();
+	if (!r) {
+		boost::unique_lock<boost::mutex> lock(ringListMutex());
+		std::vector<ring_sptr>& list = ringList();
+		// Take over a ring left by a thread that has exited, so short-lived
+		// threads like those in copy_pipelined() don't each leave one behind.
+		// Its events are kept and this thread carries on after them.
+		for (std::vector<ring_sptr>::iterator
+			i = list.begin(); i != list.end(); i++
+		) {
+			if ((*i)->orphaned.load(boost::memory_order_acquire)) {
+				(*i)->orphaned.store(false);
+				r = new ring_sptr(*i);
+				break;
+			}
+		}
+		if (!r) {
+			static unsigned long lastTid = 0;
+			r = new ring_sptr(new ring(++lastTid));
+			list.push_back(*r);
+		}
+		local.reset(r);
+	}
+	return r->get();
+}
+
+/// Current time in nanoseconds.
+static inline uint64_t now()
+{
+	return boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+		boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Write a string constant as a JSON string.
+static void writeJSONString(std::ostream& s, const char *str)
+{
+	s << '"';
+	for (; *str; str++) {
+		if ((*str == '"') || (*str == '\\')) s << '\\';
+		s << *str;
+	}
+	s << '"';
+	return;
+}
+
+void enable(bool on)
+{
+	active.store(on);
+	return;
+}
+
+bool enabled()
+{
+	return active.load(boost::memory_order_relaxed);
+}
+
+void clear()
+{
+	boost::unique_lock<boost::mutex> lock(ringListMutex());
+	std::vector<ring_sptr>& list = ringList();
+	for (std::vector<ring_sptr>::iterator i = list.begin(); i != list.end(); ) {
+		if ((*i)->orphaned.load(boost::memory_order_acquire)) {
+			// Nothing will record here again, so free the memory
+			i = list.erase(i);
+		} else {
+			(*i)->head.store(0);
+			i++;
+		}
+	}
+	return;
+}
+
+unsigned long buffers()
+{
+	boost::unique_lock<boost::mutex> lock(ringListMutex());
+	return ringList().size();
+}
+
+unsigned long events()
+{
+	boost::unique_lock<boost::mutex> lock(ringListMutex());
+	std::vector<ring_sptr>& list = ringList();
+	unsigned long total = 0;
+	for (std::vector<ring_sptr>::iterator i = list.begin(); i != list.end(); i++) {
+		uint64_t head = (*i)->head.load(boost::memory_order_acquire);
+		// Once the ring has wrapped, the oldest slot is always treated as
+		// possibly being overwritten, as in exportChrome().
+		total += std::min(head, (uint64_t)TRACE_BUFFER_EVENTS - 1);
+	}
+	return total;
+}
+
+void exportChrome(std::ostream& s)
+{
+	// Take a copy of the list so no lock is held while writing, as new threads
+	// would otherwise block on their first event.
+	std::vector<ring_sptr> list;
+	{
+		boost::unique_lock<boost::mutex> lock(ringListMutex());
+		list = ringList();
+	}
+
+	std::ios::fmtflags oldFlags = s.flags();
+	std::streamsize oldPrecision = s.precision();
+	s << std::fixed << std::setprecision(3);
+	s << "{\"traceEvents\":[";
+	bool first = true;
+	std::vector<event> copy;
+	for (std::vector<ring_sptr>::const_iterator
+		i = list.begin(); i != list.end(); i++
+	) {
+		ring& r = **i;
+		uint64_t headBefore = r.head.load(boost::memory_order_acquire);
+		if (headBefore == 0) continue;
+		uint64_t start = (headBefore > TRACE_BUFFER_EVENTS)
+			? headBefore - TRACE_BUFFER_EVENTS : 0;
+		copy.resize(headBefore - start);
+		for (uint64_t n = start; n < headBefore; n++) {
+			copy[n - start] = r.events[n % TRACE_BUFFER_EVENTS];
+		}
+
+		// The owning thread may have kept recording while we copied.  Anything
+		// it could have overwritten since (including the slot it may be writing
+		// right now) is dropped.
+		uint64_t headAfter = r.head.load(boost::memory_order_acquire);
+		if (headAfter < headBefore) continue; // cleared while we were copying
+		uint64_t safe = (headAfter >= TRACE_BUFFER_EVENTS)
+			? headAfter - TRACE_BUFFER_EVENTS + 1 : 0;
+
+		if (!first) s << ',';
+		first = false;
+		s << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+			<< r.tid << ",\"args\":{\"name\":\"thread " << r.tid << "\"}}";
+
+		for (uint64_t n = std::max(start, safe); n < headBefore; n++) {
+			const event& e = copy[n - start];
+			s << ",\n{\"name\":";
+			writeJSONString(s, e.name);
+			s << ",\"cat\":";
+			writeJSONString(s, e.category);
+			s << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << r.tid
+				<< ",\"ts\":" << e.tStart / 1000.0
+				<< ",\"dur\":" << e.duration / 1000.0
+				<< ",\"args\":{\"obj\":\"" << e.obj << "\",\"arg\":" << e.arg << "}}";
+		}
+	}
+	s << "\n],\"displayTimeUnit\":\"ns\"}\n";
+	s.flags(oldFlags);
+	s.precision(oldPrecision);
+	return;
+}
+
+void scope::begin(const char *category, const char *name, const void *obj,
+	uint64_t arg)
+{
+	this->category = category;
+	this->name = name;
+	this->obj = obj;
+	this->arg = arg;
+	this->tStart = now();
+	return;
+}
+
+void scope::end()
+{
+	uint64_t tEnd = now();
+	ring *r = threadRing();
+	uint64_t head = r->head.load(boost::memory_order_relaxed);
+	event& e = r->events[head % TRACE_BUFFER_EVENTS];
+	e.category = this->category;
+	e.name = this->name;
+	e.obj = this->obj;
+	e.arg = this->arg;
+	e.tStart = this->tStart;
+	e.duration = tEnd - this->tStart;
+	r->head.store(head + 1, boost::memory_order_release);
+	return;
+}
+
+} // namespace trace
+} // namespace camoto
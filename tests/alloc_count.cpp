@@ -0,0 +1,132 @@
+/**
+ * @file  alloc_count.cpp
+ * @brief Count heap allocations made by the code under test.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <new>
+#include <stdlib.h>
+#include "alloc_count.hpp"
+
+/// Allocations made by this thread.  A plain __thread variable is used as it
+/// needs no constructor and never allocates, unlike boost::thread_specific_ptr.
+static __thread unsigned long long allocsThisThread = 0;
+
+#ifdef __GLIBC__
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+// These replace the C library's versions for the whole process, including
+// calls made from inside libgamecommon and libstdc++.
+
+void *malloc(size_t size)
+{
+	allocsThisThread++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	allocsThisThread++;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocsThisThread++;
+	return __libc_realloc(ptr, size);
+}
+
+} // extern "C"
+
+// libstdc++ already implements operator new with malloc(), but it's replaced
+// too so the counts don't depend on that.
+
+void *operator new(size_t size)
+{
+	void *p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return ::operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+	return;
+}
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+	return;
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+	return;
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	free(p);
+	return;
+}
+
+bool alloc_count_supported()
+{
+	return true;
+}
+
+#else
+
+bool alloc_count_supported()
+{
+	return false;
+}
+
+#endif // __GLIBC__
+
+unsigned long long alloc_count()
+{
+	return allocsThisThread;
+}
+
+alloc_counter::alloc_counter()
+	:	start(alloc_count())
+{
+}
+
+unsigned long long alloc_counter::count() const
+{
+	return alloc_count() - this->start;
+}
+
+void alloc_counter::reset()
+{
+	this->start = alloc_count();
+	return;
+}
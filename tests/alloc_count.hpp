@@ -0,0 +1,71 @@
+/**
+ * @file  alloc_count.hpp
+ * @brief Count heap allocations made by the code under test.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_ALLOC_COUNT_HPP_
+#define _CAMOTO_ALLOC_COUNT_HPP_
+
+#include <boost/test/unit_test.hpp>
+
+/// Can heap allocations be counted on this platform?
+/**
+ * The test program replaces malloc() and operator new with versions that
+ * count each call made by the current thread.  This only works where the C
+ * library lets us call its own allocator underneath (glibc), so elsewhere
+ * the counts are always zero and the allocation checks are skipped.
+ */
+bool alloc_count_supported();
+
+/// Number of heap allocations made by the calling thread so far.
+unsigned long long alloc_count();
+
+/// Counts the heap allocations made by the current thread.
+class alloc_counter
+{
+	public:
+		/// Start counting from now.
+		alloc_counter();
+
+		/// Number of allocations made since construction or the last reset().
+		unsigned long long count() const;
+
+		/// Start counting from zero again.
+		void reset();
+
+	protected:
+		unsigned long long start; ///< alloc_count() when counting started
+};
+
+/// Check that running \e statement makes exactly \e expected heap allocations.
+#define CHECK_ALLOCS(statement, expected) \
+	do { \
+		alloc_counter allocCounter_; \
+		statement; \
+		unsigned long long allocs_ = allocCounter_.count(); \
+		if (alloc_count_supported()) { \
+			BOOST_CHECK_MESSAGE(allocs_ == (unsigned long long)(expected), \
+				"\"" #statement "\" made " << allocs_ \
+				<< " heap allocation(s), expected " << (expected)); \
+		} \
+	} while (0)
+
+/// Check that running \e statement doesn't allocate any memory.
+#define CHECK_NO_ALLOC(statement) CHECK_ALLOCS(statement, 0)
+
+#endif // _CAMOTO_ALLOC_COUNT_HPP_
@@ -31,6 +31,7 @@
 #include <camoto/stream_string.hpp>
 
 #include "tests.hpp"
+#include "alloc_count.hpp"
 
 // mingw32 fix
 #ifndef __STRING
@@ -818,4 +819,41 @@ BOOST_AUTO_TEST_CASE(bitstream_write_partial)
 		"Write partial without stream failed");
 }
 
+/// Write callback with enough bound parameters that boost::function has to
+/// allocate memory to store it.
+int putNextCharCounted(stream::output_sptr src, unsigned int *count,
+	uint8_t out)
+{
+	(*count)++;
+	return src->try_write(&out, 1);
+}
+
+BOOST_AUTO_TEST_CASE(bitstream_no_alloc)
+{
+	BOOST_TEST_MESSAGE("Reading and writing bits doesn't allocate memory");
+
+	// Make room first, so the writes don't have to grow the string.
+	this->base->write(std::string(8, '\0'));
+	this->base->seekp(0, stream::start);
+
+	unsigned int val;
+	CHECK_NO_ALLOC(bit->write(9, 0x123));
+	CHECK_NO_ALLOC(bit->write(12, 0x456));
+	CHECK_NO_ALLOC(bit->seek(0, stream::start));
+	CHECK_NO_ALLOC(bit->read(9, &val));
+	BOOST_CHECK_EQUAL(val, 0x123);
+
+	// The callback is too big for boost::function to store without allocating,
+	// so this also makes sure it isn't being copied on each call.
+	bit.reset(new bitstream(bitstream::bigEndian));
+	this->base->seekp(0, stream::start);
+	unsigned int count = 0;
+	fn_putnextchar cbNext = boost::bind(putNextCharCounted, this->base, &count,
+		_1);
+	CHECK_NO_ALLOC(bit->write(cbNext, 9, 0x123));
+	CHECK_NO_ALLOC(bit->write(cbNext, 12, 0x456));
+	CHECK_NO_ALLOC(bit->flushByte(cbNext));
+	BOOST_CHECK_EQUAL(count, 3);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
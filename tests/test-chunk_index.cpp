@@ -0,0 +1,248 @@
+/**
+ * @file   test-chunk_index.cpp
+ * @brief  Test code for saved chunk indices.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <boost/test/unit_test.hpp>
+#include <camoto/chunk_index.hpp>
+#include <camoto/iff.hpp>
+#include <camoto/iostream_helpers.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_metered.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/util.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+#define TEST_FILE "_test_cidx.$"
+
+#define RIFF_CONTENT makeString( \
+	"RIFF" "\x32\x00\x00\x00" "test" \
+	"one " "\x03\x00\x00\x00" \
+		"abc" "\x00" \
+	"LIST" "\x10\x00\x00\x00" "demo" \
+		"dem1" "\x04\x00\x00\x00" \
+			"dddd" \
+	"two " "\x02\x00\x00\x00" \
+		"ef" \
+)
+
+struct chunk_index_sample: public default_sample {
+
+	index_cache cache;
+
+	chunk_index_sample()
+		:	cache("")
+	{
+		this->writeFile(RIFF_CONTENT);
+	}
+
+	~chunk_index_sample()
+	{
+		::remove(TEST_FILE);
+		::remove(this->cache.indexPath(TEST_FILE).c_str());
+	}
+
+	void writeFile(const std::string& content)
+	{
+		stream::output_file_sptr out(new stream::output_file());
+		out->create(TEST_FILE);
+		out->write(content);
+		out->flush();
+		return;
+	}
+
+	stream::input_file_sptr openFile()
+	{
+		stream::input_file_sptr in(new stream::input_file());
+		in->open(TEST_FILE);
+		return in;
+	}
+
+	/// Walk the whole test file, returning the content of "dem1".
+	std::string walk(stream::input_sptr in, chunk_index_sptr index)
+	{
+		IFFReader iff(in, IFF::Filetype_RIFF, index);
+		IFF::fourcc type;
+		iff.open("RIFF", &type);
+		BOOST_REQUIRE_EQUAL(type, "test");
+		BOOST_REQUIRE_EQUAL(iff.list().size(), 3);
+		iff.open(1, &type);
+		BOOST_REQUIRE_EQUAL(type, "demo");
+		std::string content;
+		in >> fixedLength(content, iff.seek("dem1"));
+		return content;
+	}
+
+	/// Sample index with two lists.
+	chunk_index_sptr sampleIndex()
+	{
+		chunk_index_sptr index(new chunk_index());
+		index->id.path = "example.dat";
+		index->id.size = 1234;
+		index->id.mtime = 5678;
+		index->id.headerHash = 0x0123456789ABCDEFULL;
+		chunk_index::list chunks(2);
+		chunks[0].name = "abcd";
+		chunks[0].start = 8;
+		chunks[0].len = 100;
+		chunks[0].type = "type";
+		chunks[1].name = "efgh";
+		chunks[1].start = 116;
+		chunks[1].len = 0x100000000ULL;
+		index->add(0, chunks);
+		index->add(12, chunk_index::list());
+		return index;
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(chunk_index_suite, chunk_index_sample)
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+	BOOST_TEST_MESSAGE("Index reads back the same as it was written");
+
+	chunk_index_sptr index = this->sampleIndex();
+	stream::string_sptr s(new stream::string());
+	index->write(s);
+
+	chunk_index_sptr loaded(new chunk_index());
+	s->seekg(0, stream::start);
+	loaded->read(s);
+	BOOST_CHECK(loaded->id == index->id);
+	BOOST_CHECK(!loaded->changed());
+
+	const chunk_index::list *chunks = loaded->find(0);
+	BOOST_REQUIRE(chunks);
+	BOOST_REQUIRE_EQUAL(chunks->size(), 2);
+	BOOST_CHECK_EQUAL((*chunks)[0].name, "abcd");
+	BOOST_CHECK_EQUAL((*chunks)[0].type, "type");
+	BOOST_CHECK_EQUAL((*chunks)[1].start, 116);
+	BOOST_CHECK_EQUAL((*chunks)[1].len, 0x100000000ULL);
+
+	chunks = loaded->find(12);
+	BOOST_REQUIRE(chunks);
+	BOOST_CHECK(chunks->empty());
+	BOOST_CHECK(!loaded->find(8));
+}
+
+BOOST_AUTO_TEST_CASE(truncated)
+{
+	BOOST_TEST_MESSAGE("Damaged indices are rejected and leave nothing behind");
+
+	chunk_index_sptr index = this->sampleIndex();
+	stream::string_sptr s(new stream::string());
+	index->write(s);
+	std::string full = *s->str();
+
+	for (unsigned int len = 0; len < full.length(); len++) {
+		stream::string_sptr part(new stream::string());
+		part->write(full.substr(0, len));
+		part->seekg(0, stream::start);
+		chunk_index_sptr loaded(new chunk_index());
+		BOOST_CHECK_THROW(loaded->read(part), stream::error);
+		BOOST_CHECK(!loaded->find(0));
+	}
+
+	// A huge entry count must not try to allocate space for them all
+	std::string bad = full;
+	// The last list is empty, so its count is right at the end
+	unsigned int countAt = full.length() - 4;
+	bad.replace(countAt, 4, "\xFF\xFF\xFF\x7F");
+	stream::string_sptr part(new stream::string());
+	part->write(bad);
+	part->seekg(0, stream::start);
+	chunk_index_sptr loaded(new chunk_index());
+	BOOST_CHECK_THROW(loaded->read(part), stream::error);
+
+	bad = full;
+	bad[0] = 'X';
+	part.reset(new stream::string());
+	part->write(bad);
+	part->seekg(0, stream::start);
+	BOOST_CHECK_THROW(loaded->read(part), stream::error);
+}
+
+BOOST_AUTO_TEST_CASE(iff_uses_index)
+{
+	BOOST_TEST_MESSAGE("IFFReader reads no chunk headers with a full index");
+
+	stream::input_file_sptr file = this->openFile();
+	chunk_index_sptr index = this->cache.load(TEST_FILE, file);
+	BOOST_CHECK(!index->changed());
+	BOOST_CHECK_EQUAL(this->walk(file, index), "dddd");
+	BOOST_CHECK(index->changed());
+	this->cache.save(index);
+
+	// Reopen and count the reads needed this time
+	file = this->openFile();
+	index = this->cache.load(TEST_FILE, file);
+	BOOST_REQUIRE(index->find(12));
+	stream::input_metered_sptr metered(new stream::input_metered());
+	metered->open(file, "cidx");
+	bool wasEnabled = stream::meter_registry::enabled();
+	stream::meter_registry::enable(true);
+	BOOST_CHECK_EQUAL(this->walk(metered, index), "dddd");
+	stream::meter_registry::enable(wasEnabled);
+	BOOST_CHECK(!index->changed());
+	// Only the content of dem1 should have been read
+	BOOST_CHECK_EQUAL(metered->snapshot().counters.bytesRead, 4);
+}
+
+BOOST_AUTO_TEST_CASE(file_changed)
+{
+	BOOST_TEST_MESSAGE("Index is ignored once the file has changed");
+
+	stream::input_file_sptr file = this->openFile();
+	chunk_index_sptr index = this->cache.load(TEST_FILE, file);
+	this->walk(file, index);
+	this->cache.save(index);
+
+	// Same size, so only the header hash can tell them apart
+	std::string changed = RIFF_CONTENT;
+	changed.replace(changed.find("dddd"), 4, "wxyz");
+	this->writeFile(changed);
+
+	file = this->openFile();
+	index = this->cache.load(TEST_FILE, file);
+	BOOST_CHECK(!index->find(0));
+	BOOST_CHECK_EQUAL(this->walk(file, index), "wxyz");
+}
+
+BOOST_AUTO_TEST_CASE(cache_dir)
+{
+	BOOST_TEST_MESSAGE("Indices can be kept in a separate directory");
+
+	index_cache dirCache(".");
+	std::string path = dirCache.indexPath(TEST_FILE);
+	BOOST_CHECK_EQUAL(path.length(), 2 + 16 + 5);
+	BOOST_CHECK(path != dirCache.indexPath(TEST_FILE "2"));
+
+	stream::input_file_sptr file = this->openFile();
+	chunk_index_sptr index = dirCache.load(TEST_FILE, file);
+	this->walk(file, index);
+	dirCache.save(index);
+
+	index = dirCache.load(TEST_FILE, file);
+	BOOST_CHECK(index->find(0));
+	::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,271 @@
+/**
+ * @file   test-compactor.cpp
+ * @brief  Test code for archive compaction.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/compactor.hpp>
+#include <camoto/stream_metered.hpp>
+#include <camoto/stream_simulated.hpp>
+#include <camoto/stream_string.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+/// String stream that fails once a number of writes have been made.
+/**
+ * The failed write still writes the first half of its data, like a device
+ * that fails partway through.
+ */
+class string_failing: public stream::string
+{
+	public:
+		unsigned int writesLeft; ///< Writes to allow before failing
+
+		string_failing()
+			:	writesLeft(1000)
+		{
+		}
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len)
+		{
+			if (this->writesLeft == 0) {
+				this->stream::string::try_write(buffer, len / 2);
+				throw stream::write_error("Simulated failure");
+			}
+			this->writesLeft--;
+			return this->stream::string::try_write(buffer, len);
+		}
+};
+
+struct compactor_sample: public string_sample {
+
+	std::vector<stream::sub_sptr> files;
+
+	/// Open a member of the archive in \e parent.
+	stream::sub_sptr member(stream::inout_sptr parent, stream::pos start,
+		stream::len len)
+	{
+		stream::sub_sptr s(new stream::sub());
+		s->open(parent, start, len, NULL);
+		this->files.push_back(s);
+		return s;
+	}
+
+	/// Data that differs at every offset within a block.
+	std::string pattern(stream::len len)
+	{
+		std::string s;
+		s.reserve(len);
+		for (stream::len i = 0; i < len; i++) s += (char)(i * 7 + (i >> 8));
+		return s;
+	}
+
+	/// Read a member's content.
+	std::string content(stream::sub_sptr s)
+	{
+		s->seekg(0, stream::start);
+		return s->read(s->size());
+	}
+
+	/// Read the compacted part of the archive.
+	std::string compacted(const compactor& c)
+	{
+		this->out->seekg(0, stream::start);
+		return this->out->read(c.extent());
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(compactor_suite, compactor_sample)
+
+BOOST_AUTO_TEST_CASE(fill_holes)
+{
+	BOOST_TEST_MESSAGE("Members at the end move into holes, the rest stay");
+
+	this->out->write("HDR" "AAAA" ".." "BBB" "..." "CC");
+	compactor c(this->out, 3, false);
+	c.add(this->member(this->out, 3, 4));
+	c.add(this->member(this->out, 9, 3));
+	c.add(this->member(this->out, 15, 2));
+
+	BOOST_REQUIRE_EQUAL(c.plan().size(), 1);
+	BOOST_CHECK_EQUAL(c.bytesToMove(), 2);
+	BOOST_CHECK_EQUAL(c.extent(), 12);
+	BOOST_CHECK(c.run(0));
+	BOOST_CHECK_EQUAL(c.bytesToMove(), 0);
+
+	BOOST_CHECK_EQUAL(this->compacted(c), "HDRAAAACCBBB");
+	BOOST_CHECK_EQUAL(this->files[2]->get_offset(), 7);
+	BOOST_CHECK_EQUAL(this->content(this->files[2]), "CC");
+	BOOST_CHECK_EQUAL(this->content(this->files[1]), "BBB");
+}
+
+BOOST_AUTO_TEST_CASE(keep_order)
+{
+	BOOST_TEST_MESSAGE("Members slide down when the order must be kept");
+
+	this->out->write("HDR" "AAAA" ".." "BBB" "..." "CC");
+	compactor c(this->out, 3, true);
+	c.add(this->member(this->out, 15, 2));
+	c.add(this->member(this->out, 3, 4));
+	c.add(this->member(this->out, 9, 3));
+
+	BOOST_CHECK_EQUAL(c.plan().size(), 2);
+	BOOST_CHECK_EQUAL(c.bytesToMove(), 5);
+	BOOST_CHECK(c.run(0));
+	BOOST_CHECK_EQUAL(this->compacted(c), "HDRAAAABBBCC");
+	BOOST_CHECK_EQUAL(this->files[0]->get_offset(), 10);
+	BOOST_CHECK_EQUAL(this->content(this->files[0]), "CC");
+	BOOST_CHECK_EQUAL(this->content(this->files[2]), "BBB");
+}
+
+BOOST_AUTO_TEST_CASE(fill_falls_back)
+{
+	BOOST_TEST_MESSAGE("Members that don't pack into the holes slide instead");
+
+	// Two holes of 2 bytes can't take one 4 byte member
+	this->out->write("AA" ".." "BB" ".." "CCCC");
+	compactor c(this->out, 0, false);
+	c.add(this->member(this->out, 0, 2));
+	c.add(this->member(this->out, 4, 2));
+	c.add(this->member(this->out, 8, 4));
+
+	BOOST_CHECK_EQUAL(c.bytesToMove(), 0);
+	BOOST_CHECK_EQUAL(c.plan().size(), 2);
+	BOOST_CHECK(c.run(0));
+	BOOST_CHECK_EQUAL(this->compacted(c), "AABBCCCC");
+	BOOST_CHECK_EQUAL(this->content(this->files[2]), "CCCC");
+}
+
+BOOST_AUTO_TEST_CASE(already_compact)
+{
+	BOOST_TEST_MESSAGE("Nothing moves in an archive without holes");
+
+	this->out->write("AABBCC");
+	compactor c(this->out, 0, false);
+	c.add(this->member(this->out, 0, 2));
+	c.add(this->member(this->out, 2, 2));
+	c.add(this->member(this->out, 4, 2));
+	BOOST_CHECK(c.plan().empty());
+	BOOST_CHECK(c.run(0));
+	BOOST_CHECK(c.done());
+}
+
+BOOST_AUTO_TEST_CASE(retry_overlapping)
+{
+	BOOST_TEST_MESSAGE("A failed overlapping slide can be retried");
+
+	std::string member = this->pattern(2 * COMPACT_BLOCK_SIZE + 10);
+	boost::shared_ptr<string_failing> data(new string_failing());
+	data->write("AB" "..." + member);
+	compactor c(data, 0, true);
+	c.add(this->member(data, 0, 2));
+	c.add(this->member(data, 5, member.length()));
+	BOOST_REQUIRE_EQUAL(c.plan().size(), 1);
+
+	// The second block fails halfway, after overwriting the start of its own
+	// source.
+	data->writesLeft = 1;
+	BOOST_CHECK_THROW(c.run(0), stream::write_error);
+	BOOST_CHECK(!c.done());
+	BOOST_CHECK_EQUAL(c.bytesToMove(), member.length() - COMPACT_BLOCK_SIZE);
+	BOOST_CHECK_EQUAL(this->files[1]->get_offset(), 5);
+
+	data->writesLeft = 1000;
+	BOOST_CHECK(c.run(0));
+	BOOST_CHECK_EQUAL(this->files[1]->get_offset(), 2);
+	BOOST_CHECK_MESSAGE(is_equal(member, this->content(this->files[1])),
+		"Member was corrupted by the retry");
+}
+
+BOOST_AUTO_TEST_CASE(small_slide)
+{
+	BOOST_TEST_MESSAGE("Sliding a large member a short way uses whole blocks");
+
+	std::string member = this->pattern(4 * COMPACT_BLOCK_SIZE + 123);
+	this->out->write("." + member);
+	stream::metered_sptr metered(new stream::metered());
+	metered->open(this->out, "compact");
+	stream::meter_registry::enable(true);
+	compactor c(metered, 0, true);
+	c.add(this->member(metered, 1, member.length()));
+	BOOST_CHECK(c.run(0));
+	stream::meter_snapshot snap = metered->snapshot();
+	stream::meter_registry::enable(false);
+
+	BOOST_CHECK_EQUAL(snap.counters.calls[stream::meter_write], 5);
+	BOOST_CHECK_MESSAGE(is_equal(member, this->content(this->files[0])),
+		"Member was corrupted by the slide");
+}
+
+BOOST_AUTO_TEST_CASE(time_bounded_member)
+{
+	BOOST_TEST_MESSAGE("A time limit can stop partway through a large member");
+
+	std::string member = this->pattern(3 * COMPACT_BLOCK_SIZE);
+	this->out->write("...." + member);
+
+	stream::sim_device dev;
+	dev.latencyNs = 3000000;
+	dev.realTime = true;
+	stream::simulated_sptr slow(new stream::simulated());
+	slow->open(this->out, dev);
+
+	compactor c(slow, 0, true);
+	c.add(this->member(slow, 4, member.length()));
+
+	// Every block takes more than 1ms, so only one is copied per run
+	BOOST_CHECK(!c.run(1));
+	BOOST_CHECK_EQUAL(c.bytesToMove(), 2 * COMPACT_BLOCK_SIZE);
+	BOOST_CHECK_EQUAL(this->files[0]->get_offset(), 4);
+	BOOST_CHECK(!c.run(1));
+	BOOST_CHECK(c.run(1));
+	BOOST_CHECK_EQUAL(this->files[0]->get_offset(), 0);
+	BOOST_CHECK_MESSAGE(is_equal(member, this->content(this->files[0])),
+		"Member was corrupted when split over several runs");
+}
+
+BOOST_AUTO_TEST_CASE(time_bounded)
+{
+	BOOST_TEST_MESSAGE("A time limit spreads compaction over several runs");
+
+	stream::sim_device dev;
+	dev.latencyNs = 3000000;
+	dev.realTime = true;
+	stream::simulated_sptr slow(new stream::simulated());
+	slow->open(this->out, dev);
+
+	this->out->write("A" "." "B" "." "C" "." "D");
+	compactor c(slow, 0, true);
+	for (unsigned int i = 0; i < 4; i++) c.add(this->member(slow, i * 2, 1));
+	BOOST_REQUIRE_EQUAL(c.plan().size(), 3);
+
+	// Every move takes more than 1ms, so only one happens per run
+	BOOST_CHECK(!c.run(1));
+	BOOST_CHECK_EQUAL(c.bytesToMove(), 2);
+	BOOST_CHECK_EQUAL(this->files[1]->get_offset(), 1);
+	BOOST_CHECK_EQUAL(this->files[2]->get_offset(), 4);
+	// The archive is consistent in between
+	BOOST_CHECK_EQUAL(this->content(this->files[2]), "C");
+
+	BOOST_CHECK(!c.run(1));
+	BOOST_CHECK(c.run(1));
+	BOOST_CHECK_EQUAL(this->compacted(c), "ABCD");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,131 @@
+/**
+ * @file   test-cpu.cpp
+ * @brief  Test code for CPU dispatch and the kernels using it.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <camoto/kernels.hpp>
+
+using namespace camoto;
+
+/// Run every variant of a kernel the CPU supports against the scalar one.
+/**
+ * Each variant is given arrays of every length up to \e maxCount, starting
+ * at a few different alignments, so both the vector loop and the tail are
+ * checked.
+ *
+ * @return Number of variants tested.
+ */
+template <typename T>
+unsigned int checkVariants(const cpu_kernel<void (*)(T *, size_t)>& kernel,
+	size_t maxCount)
+{
+	unsigned int tested = 0;
+	const size_t pad = 8;
+	std::vector<T> input(maxCount + pad), expected, actual;
+	uint32_t rng = 1;
+	for (size_t i = 0; i < input.size(); i++) {
+		rng = rng * 1103515245U + 12345U;
+		input[i] = (T)(((uint64_t)rng << 32) ^ (rng * 2654435761U));
+	}
+
+	for (unsigned int v = 0; v < kernel.count; v++) {
+		cpu_level level = kernel.variants[v].level;
+		if (level > cpu_detected()) {
+			BOOST_TEST_MESSAGE("Skipping " << kernel.name << " at "
+				<< cpu_level_name(level) << ", not supported by this CPU");
+			continue;
+		}
+		tested++;
+		for (size_t off = 0; off < pad; off++) {
+			for (size_t count = 0; count <= maxCount; count++) {
+				expected = input;
+				actual = input;
+				kernel.variants[0].fn(&expected[off], count);
+				kernel.variants[v].fn(&actual[off], count);
+				if (expected != actual) {
+					BOOST_ERROR(kernel.name << " at " << cpu_level_name(level)
+						<< " differs from scalar with " << count
+						<< " values at offset " << off);
+					return tested;
+				}
+			}
+		}
+	}
+	return tested;
+}
+
+BOOST_AUTO_TEST_SUITE(cpu_suite)
+
+BOOST_AUTO_TEST_CASE(cpu_levels)
+{
+	BOOST_TEST_MESSAGE("Level names and the active level");
+
+	for (unsigned int i = 0; i < cpu_level_count; i++) {
+		cpu_level level = cpu_level_count;
+		BOOST_CHECK(cpu_level_from_name(cpu_level_name((cpu_level)i), &level));
+		BOOST_CHECK_EQUAL(level, (cpu_level)i);
+	}
+	cpu_level level = cpu_avx2;
+	BOOST_CHECK(!cpu_level_from_name("mmx", &level));
+	BOOST_CHECK_EQUAL(level, cpu_avx2);
+
+	BOOST_CHECK_LE(cpu_active(), cpu_detected());
+	BOOST_TEST_MESSAGE("CPU supports " << cpu_level_name(cpu_detected())
+		<< ", using " << cpu_level_name(cpu_active()));
+}
+
+BOOST_AUTO_TEST_CASE(cpu_kernel_select)
+{
+	BOOST_TEST_MESSAGE("Kernels pick the best variant for the active level");
+
+	BOOST_CHECK(kernel_swap16.fn == kernel_swap16.variant(cpu_active()));
+	BOOST_CHECK(kernel_swap16.variant(cpu_scalar)
+		== kernel_swap16.variants[0].fn);
+	for (unsigned int v = 1; v < kernel_swap16.count; v++) {
+		BOOST_CHECK_LT(kernel_swap16.variants[v - 1].level,
+			kernel_swap16.variants[v].level);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(cpu_swap)
+{
+	BOOST_TEST_MESSAGE("Byte swapping kernels");
+
+	uint16_t v16[] = {0x0102, 0xA0B0, 0x00FF};
+	swap16_array(v16, 3);
+	BOOST_CHECK_EQUAL(v16[0], 0x0201);
+	BOOST_CHECK_EQUAL(v16[1], 0xB0A0);
+	BOOST_CHECK_EQUAL(v16[2], 0xFF00);
+
+	uint32_t v32[] = {0x01020304, 0xA0B0C0D0};
+	swap32_array(v32, 2);
+	BOOST_CHECK_EQUAL(v32[0], 0x04030201);
+	BOOST_CHECK_EQUAL(v32[1], 0xD0C0B0A0);
+}
+
+BOOST_AUTO_TEST_CASE(cpu_variants_match_scalar)
+{
+	BOOST_TEST_MESSAGE("Every supported kernel variant matches the scalar one");
+
+	BOOST_CHECK_GE(checkVariants(kernel_swap16, 200), 1);
+	BOOST_CHECK_GE(checkVariants(kernel_swap32, 100), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,223 @@
+/**
+ * @file   test-filter_coroutine.cpp
+ * @brief  Test code for the coroutine filter adapter.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/filter_coroutine.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/bitstream.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+/// Invert every byte.
+class filter_test_invert: public filter_coroutine
+{
+	protected:
+		virtual void run()
+		{
+			uint8_t b;
+			while (this->read(&b)) this->write(b ^ 0xFF);
+		}
+};
+
+/// Read nine-bit codewords and write out the low eight bits of each.
+class filter_test_unpack9: public filter_coroutine
+{
+	public:
+		filter_test_unpack9()
+			:	filter_coroutine(bitstream::bigEndian)
+		{
+		}
+
+	protected:
+		virtual void run()
+		{
+			unsigned int code;
+			while (this->readBits(9, &code) == 9) {
+				if (code == 0x100) break; // EOF codeword
+				if (code > 0x100) throw filter_error("Invalid codeword");
+				this->write(code & 0xFF);
+			}
+		}
+};
+
+/// Write every byte out as a nine-bit codeword, followed by an EOF codeword.
+class filter_test_pack9: public filter_coroutine
+{
+	public:
+		filter_test_pack9()
+			:	filter_coroutine(bitstream::bigEndian)
+		{
+		}
+
+	protected:
+		virtual void run()
+		{
+			uint8_t b;
+			while (this->read(&b)) this->writeBits(9, b);
+			this->writeBits(9, 0x100);
+			this->flushWriteBits();
+		}
+};
+
+struct filter_coroutine_sample: public string_sample {
+
+	/// Run data through a filter using tiny buffers.
+	/**
+	 * This forces the coroutine to be suspended as often as possible, including
+	 * in the middle of a codeword.
+	 */
+	std::string transformSmall(filter& f, const std::string& input,
+		stream::len chunkIn, stream::len chunkOut)
+	{
+		std::string result;
+		std::vector<uint8_t> out(chunkOut);
+		f.reset(input.length());
+		stream::len offIn = 0;
+		stream::len lenIn, lenOut;
+		do {
+			lenIn = std::min(chunkIn, (stream::len)input.length() - offIn);
+			lenOut = chunkOut;
+			f.transform(&out[0], &lenOut, (const uint8_t *)input.data() + offIn,
+				&lenIn);
+			offIn += lenIn;
+			result.append((char *)&out[0], lenOut);
+		} while ((lenIn != 0) || (lenOut != 0));
+		return result;
+	}
+
+	std::string pack9(const std::string& input)
+	{
+		stream::string_sptr packed(new stream::string());
+		bitstream bits(packed, bitstream::bigEndian);
+		for (std::string::size_type i = 0; i < input.length(); i++) {
+			bits.write(9, (uint8_t)input[i]);
+		}
+		bits.write(9, 0x100);
+		bits.flush();
+		return *packed->str();
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(filter_coroutine_suite, filter_coroutine_sample)
+
+BOOST_AUTO_TEST_CASE(filter_coroutine_read)
+{
+	BOOST_TEST_MESSAGE("Read through a coroutine filter");
+
+	this->in << "\xBE\xBD\xBC\xBB\xBA";
+
+	filter_sptr algo(new filter_test_invert());
+	stream::input_filtered_sptr f(new stream::input_filtered());
+	f->open(this->in, algo);
+	stream::copy(this->out, f);
+
+	BOOST_CHECK_MESSAGE(is_equal("ABCDE"),
+		"Read through a coroutine filter failed");
+}
+
+BOOST_AUTO_TEST_CASE(filter_coroutine_write)
+{
+	BOOST_TEST_MESSAGE("Write through a coroutine filter");
+
+	filter_sptr algo(new filter_test_invert());
+	stream::output_filtered_sptr f(new stream::output_filtered());
+	f->open(this->out, algo, NULL);
+	f->write("ABCDE");
+	f->flush();
+
+	BOOST_CHECK_MESSAGE(is_equal("\xBE\xBD\xBC\xBB\xBA"),
+		"Write through a coroutine filter failed");
+}
+
+BOOST_AUTO_TEST_CASE(filter_coroutine_split_codeword)
+{
+	BOOST_TEST_MESSAGE("Coroutine filter with codewords split across buffers");
+
+	std::string text = "Hello, this is a test of the coroutine filter.";
+	std::string packed = this->pack9(text);
+	filter_test_unpack9 algo;
+
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal(text, this->transformSmall(algo, packed, 1, 1)),
+		"Coroutine filter failed with 1-byte buffers");
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal(text, this->transformSmall(algo, packed, 3, 2)),
+		"Coroutine filter failed with 3/2-byte buffers");
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal(text, this->transformSmall(algo, packed, 4096,
+			4096)),
+		"Coroutine filter failed with large buffers");
+}
+
+BOOST_AUTO_TEST_CASE(filter_coroutine_write_bits)
+{
+	BOOST_TEST_MESSAGE("Coroutine filter writing codewords matches bitstream");
+
+	std::string text = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	filter_test_pack9 algo;
+
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal(this->pack9(text),
+			this->transformSmall(algo, text, 1, 1)),
+		"Coroutine filter wrote incorrect codewords");
+}
+
+BOOST_AUTO_TEST_CASE(filter_coroutine_reset_midway)
+{
+	BOOST_TEST_MESSAGE("Reset a coroutine filter before it has finished");
+
+	std::string text = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	filter_test_invert algo;
+
+	// Stop after a partial output buffer, leaving the coroutine suspended.
+	uint8_t out[4];
+	stream::len lenIn = text.length(), lenOut = sizeof(out);
+	algo.reset(text.length());
+	algo.transform(out, &lenOut, (const uint8_t *)text.data(), &lenIn);
+	BOOST_REQUIRE_EQUAL(lenOut, sizeof(out));
+
+	// Starting again must begin from scratch.
+	std::string result = this->transformSmall(algo, text, 5, 7);
+	std::string expected = text;
+	for (std::string::size_type i = 0; i < expected.length(); i++) {
+		expected[i] ^= 0xFF;
+	}
+	BOOST_CHECK_MESSAGE(default_sample::is_equal(expected, result),
+		"Coroutine filter did not restart cleanly after reset");
+}
+
+BOOST_AUTO_TEST_CASE(filter_coroutine_error)
+{
+	BOOST_TEST_MESSAGE("Exception thrown inside a coroutine filter");
+
+	bitstream_sptr bits(new bitstream(this->in, bitstream::bigEndian));
+	bits->write(9, 'A');
+	bits->write(9, 0x1FF);
+	bits->flush();
+
+	filter_sptr algo(new filter_test_unpack9());
+	stream::input_filtered_sptr f(new stream::input_filtered());
+	f->open(this->in, algo);
+
+	BOOST_CHECK_THROW(f->size(), filter_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
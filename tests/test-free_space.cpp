@@ -0,0 +1,196 @@
+/**
+ * @file   test-free_space.cpp
+ * @brief  Test code for the archive free space map.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+#include <camoto/free_space.hpp>
+#include <camoto/stream_string.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct free_space_sample: public string_sample {
+
+	/// Open a member of the archive in \e out.
+	stream::sub_sptr member(stream::pos start, stream::len len)
+	{
+		stream::sub_sptr s(new stream::sub());
+		s->open(this->out, start, len, NULL);
+		return s;
+	}
+
+	/// List the holes as text, e.g. "2+3 10+1".
+	std::string holes(const free_space& fs)
+	{
+		std::ostringstream s;
+		for (std::map<stream::pos, stream::len>::const_iterator
+			i = fs.holes().begin(); i != fs.holes().end(); i++
+		) {
+			if (i != fs.holes().begin()) s << ' ';
+			s << i->first << '+' << i->second;
+		}
+		return s.str();
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(free_space_suite, free_space_sample)
+
+BOOST_AUTO_TEST_CASE(release_merges)
+{
+	BOOST_TEST_MESSAGE("Neighbouring holes merge, and holes at the end shrink it");
+
+	free_space fs(100);
+	fs.release(10, 5);
+	fs.release(20, 5);
+	BOOST_CHECK_EQUAL(this->holes(fs), "10+5 20+5");
+	fs.release(15, 5);
+	BOOST_CHECK_EQUAL(this->holes(fs), "10+15");
+	fs.release(12, 20);
+	BOOST_CHECK_EQUAL(this->holes(fs), "10+22");
+	BOOST_CHECK_EQUAL(fs.totalFree(), 22);
+
+	fs.release(90, 10);
+	BOOST_CHECK_EQUAL(fs.extent(), 90);
+	fs.release(40, 50);
+	BOOST_CHECK_EQUAL(fs.extent(), 40);
+	BOOST_CHECK_EQUAL(this->holes(fs), "10+22");
+
+	fs.release(32, 8);
+	BOOST_CHECK_EQUAL(fs.extent(), 10);
+	BOOST_CHECK_EQUAL(this->holes(fs), "");
+	BOOST_CHECK_EQUAL(fs.totalFree(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(reserve_splits)
+{
+	BOOST_TEST_MESSAGE("Reserving space splits holes and can grow the area");
+
+	free_space fs(100);
+	fs.release(10, 30);
+	fs.reserve(20, 5);
+	BOOST_CHECK_EQUAL(this->holes(fs), "10+10 25+15");
+	fs.reserve(5, 10);
+	BOOST_CHECK_EQUAL(this->holes(fs), "15+5 25+15");
+	fs.reserve(110, 10);
+	BOOST_CHECK_EQUAL(this->holes(fs), "15+5 25+15 100+10");
+	BOOST_CHECK_EQUAL(fs.extent(), 120);
+	BOOST_CHECK_EQUAL(fs.totalFree(), 30);
+}
+
+BOOST_AUTO_TEST_CASE(allocate_policies)
+{
+	BOOST_TEST_MESSAGE("Best fit uses the smallest hole, append the end");
+
+	free_space fs(100);
+	fs.release(10, 20);
+	fs.release(50, 8);
+	fs.release(70, 12);
+
+	BOOST_CHECK_EQUAL(fs.allocate(10, free_space::best_fit), 70);
+	BOOST_CHECK_EQUAL(this->holes(fs), "10+20 50+8 80+2");
+	BOOST_CHECK_EQUAL(fs.allocate(8, free_space::best_fit), 50);
+	BOOST_CHECK_EQUAL(fs.allocate(8, free_space::append), 100);
+	BOOST_CHECK_EQUAL(fs.allocate(25, free_space::best_fit), 108);
+	BOOST_CHECK_EQUAL(fs.extent(), 133);
+	BOOST_CHECK_EQUAL(this->holes(fs), "10+20 80+2");
+}
+
+BOOST_AUTO_TEST_CASE(resize_in_place)
+{
+	BOOST_TEST_MESSAGE("A member grows into free space right after it");
+
+	this->out->write("AAAAbbbbCCCC");
+	free_space fs(12);
+	fs.release(4, 4);
+	stream::sub_sptr a = this->member(0, 4);
+
+	BOOST_CHECK_EQUAL(fs.resize(this->out, a, 6, free_space::best_fit), 0);
+	BOOST_CHECK_EQUAL(a->size(), 6);
+	BOOST_CHECK_EQUAL(this->holes(fs), "6+2");
+
+	BOOST_CHECK_EQUAL(fs.resize(this->out, a, 2, free_space::best_fit), 0);
+	BOOST_CHECK_EQUAL(this->holes(fs), "2+6");
+
+	// The last member grows the archive
+	stream::sub_sptr c = this->member(8, 4);
+	BOOST_CHECK_EQUAL(fs.resize(this->out, c, 6, free_space::best_fit), 8);
+	BOOST_CHECK_EQUAL(this->out->size(), 14);
+	BOOST_CHECK_EQUAL(fs.extent(), 14);
+}
+
+BOOST_AUTO_TEST_CASE(resize_moves)
+{
+	BOOST_TEST_MESSAGE("A member that can't grow in place moves to a hole");
+
+	this->out->write("AAAA" "...." "......" "BBBB" "CCCC");
+	free_space fs(22);
+	fs.release(4, 10);
+	stream::sub_sptr b = this->member(14, 4);
+
+	BOOST_CHECK_EQUAL(fs.resize(this->out, b, 6, free_space::best_fit), 4);
+	BOOST_CHECK_EQUAL(b->get_offset(), 4);
+	BOOST_CHECK_EQUAL(b->size(), 6);
+	BOOST_CHECK_EQUAL(this->holes(fs), "10+8");
+	b->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(b->read(4), "BBBB");
+
+	// Nothing else in the archive moved
+	this->out->seekg(18, stream::start);
+	BOOST_CHECK_EQUAL(this->out->read(4), "CCCC");
+	BOOST_CHECK_EQUAL(this->out->size(), 22);
+}
+
+BOOST_AUTO_TEST_CASE(resize_append)
+{
+	BOOST_TEST_MESSAGE("With the append policy a moved member goes to the end");
+
+	this->out->write("AAAA" "...." "BBBB" "CCCC");
+	free_space fs(16);
+	fs.release(4, 4);
+	stream::sub_sptr b = this->member(8, 4);
+
+	BOOST_CHECK_EQUAL(fs.resize(this->out, b, 5, free_space::append), 16);
+	BOOST_CHECK_EQUAL(this->out->size(), 21);
+	BOOST_CHECK_EQUAL(this->holes(fs), "4+8");
+	b->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(b->read(4), "BBBB");
+	b->seekp(4, stream::start);
+	b->write("b");
+	BOOST_CHECK_MESSAGE(
+		is_equal(makeString("AAAA....BBBBCCCCBBBBb")),
+		"Member was not moved intact");
+}
+
+BOOST_AUTO_TEST_CASE(resize_overlap)
+{
+	BOOST_TEST_MESSAGE("A member can move into its own space plus the hole before it");
+
+	this->out->write("AAAA" ".." "BBBB" "CCCC");
+	free_space fs(14);
+	fs.release(4, 2);
+	stream::sub_sptr b = this->member(6, 4);
+
+	BOOST_CHECK_EQUAL(fs.resize(this->out, b, 5, free_space::best_fit), 4);
+	BOOST_CHECK_EQUAL(this->holes(fs), "9+1");
+	b->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(b->read(4), "BBBB");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,189 @@
+/**
+ * @file   test-hexdump.cpp
+ * @brief  Test code for hex dumps and stream comparison.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+#include <camoto/hexdump.hpp>
+#include <camoto/stream_string.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct hexdump_sample: public default_sample {
+
+	stream::string_sptr a;
+	stream::string_sptr b;
+
+	hexdump_sample()
+		:	a(new stream::string()),
+			b(new stream::string())
+	{
+	}
+
+	/// Fill both streams with the same \e len bytes of varied data.
+	void fill(stream::len len)
+	{
+		std::string data(len, '\0');
+		for (stream::len i = 0; i < len; i++) data[i] = (char)(i * 7 + (i >> 9));
+		this->a->write(data);
+		this->b->write(data);
+		return;
+	}
+
+	/// Change \e len bytes of b starting at \e pos.
+	void change(stream::pos pos, stream::len len)
+	{
+		for (stream::len i = 0; i < len; i++) {
+			(*this->b->str())[pos + i] ^= 0x55;
+		}
+		return;
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(hexdump_suite, hexdump_sample)
+
+BOOST_AUTO_TEST_CASE(hexdump_layout)
+{
+	BOOST_TEST_MESSAGE("Hex dump layout");
+
+	this->a->write(makeString("ABCDEFGHIJKLMNOP\x00\x7f\xff" "Q"));
+	this->a->seekg(3, stream::start);
+
+	std::ostringstream out;
+	stream::hexdump(out, this->a);
+	BOOST_CHECK_MESSAGE(is_equal(
+		"00000000: 41 42 43 44 45 46 47 48 49 4a 4b 4c 4d 4e 4f 50  ABCDEFGHIJKLMNOP\n"
+		"00000010: 00 7f ff 51                                      ...Q\n",
+		out.str()), "Wrong hex dump layout");
+	BOOST_CHECK_EQUAL(this->a->tellg(), 3);
+
+	stream::hexdump_options opts;
+	opts.width = 4;
+	opts.ascii = false;
+	opts.prefix = "> ";
+	out.str("");
+	stream::hexdump(out, this->a, 5, 6, opts);
+	BOOST_CHECK_MESSAGE(is_equal(
+		"> 00000005: 46 47 48 49\n"
+		"> 00000009: 4a 4b\n",
+		out.str()), "Wrong hex dump with options");
+
+	// Past the end dumps nothing
+	out.str("");
+	stream::hexdump(out, this->a, 100);
+	BOOST_CHECK_EQUAL(out.str(), "");
+}
+
+BOOST_AUTO_TEST_CASE(hexdump_large)
+{
+	BOOST_TEST_MESSAGE("Hex dump of more than one block");
+
+	this->fill(3 * BUFFER_SIZE + 5);
+	std::ostringstream out;
+	stream::hexdump(out, this->a);
+	std::string text = out.str();
+
+	unsigned int lines = std::count(text.begin(), text.end(), '\n');
+	BOOST_CHECK_EQUAL(lines, (3 * BUFFER_SIZE) / 16 + 1);
+	BOOST_CHECK(text.find("\n00003000: ") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(diff_ranges)
+{
+	BOOST_TEST_MESSAGE("Differences are found across block boundaries");
+
+	this->fill(200 * 1024);
+	BOOST_CHECK(stream::diff(this->a, this->b).empty());
+
+	this->change(10, 1);
+	this->change(64 * 1024 - 2, 4); // spans two blocks
+	this->change(150000, 3);
+	this->a->seekg(7, stream::start);
+
+	std::vector<stream::diff_range> r = stream::diff(this->a, this->b);
+	BOOST_REQUIRE_EQUAL(r.size(), 3);
+	BOOST_CHECK_EQUAL(r[0].start, 10);
+	BOOST_CHECK_EQUAL(r[0].len, 1);
+	BOOST_CHECK_EQUAL(r[1].start, 64 * 1024 - 2);
+	BOOST_CHECK_EQUAL(r[1].len, 4);
+	BOOST_CHECK_EQUAL(r[2].start, 150000);
+	BOOST_CHECK_EQUAL(r[2].len, 3);
+	BOOST_CHECK_EQUAL(this->a->tellg(), 7);
+
+	r = stream::diff(this->a, this->b, 2);
+	BOOST_CHECK_EQUAL(r.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(diff_merge_and_length)
+{
+	BOOST_TEST_MESSAGE("Close differences merge and extra data is a difference");
+
+	this->fill(100);
+	this->change(10, 2);
+	this->change(15, 1);
+	this->b->seekp(0, stream::end);
+	this->b->write("XYZ");
+
+	std::vector<stream::diff_range> r = stream::diff(this->a, this->b);
+	BOOST_CHECK_EQUAL(r.size(), 3);
+
+	r = stream::diff(this->a, this->b, 0, 3);
+	BOOST_REQUIRE_EQUAL(r.size(), 2);
+	BOOST_CHECK_EQUAL(r[0].start, 10);
+	BOOST_CHECK_EQUAL(r[0].len, 6);
+	BOOST_CHECK_EQUAL(r[1].start, 100);
+	BOOST_CHECK_EQUAL(r[1].len, 3);
+}
+
+BOOST_AUTO_TEST_CASE(diff_hexdump)
+{
+	BOOST_TEST_MESSAGE("Dump of differences shows both sides");
+
+	this->a->write("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+	this->b->write("ABCDEFGHIJKLMNOPQRSTUVWxYZ");
+	std::ostringstream out;
+	stream::hexdump_options opts;
+	opts.width = 8;
+	stream::hexdumpDiff(out, this->a, this->b, stream::diff(this->a, this->b),
+		opts);
+	BOOST_CHECK_MESSAGE(is_equal(
+		"@@ 0x17, 1 byte @@\n"
+		"- 00000010: 51 52 53 54 55 56 57 58  QRSTUVWX\n"
+		"+ 00000010: 51 52 53 54 55 56 57 78  QRSTUVWx\n",
+		out.str()), "Wrong dump of differences");
+}
+
+BOOST_AUTO_TEST_CASE(diff_is_equal_large)
+{
+	BOOST_TEST_MESSAGE("Large fixtures only print the lines that differ");
+
+	this->fill(1024 * 1024);
+	BOOST_CHECK(is_equal(this->a, this->b));
+
+	this->change(500000, 1);
+	boost::test_tools::predicate_result res = is_equal(*this->a->str(),
+		*this->b->str());
+	BOOST_CHECK(!res);
+	std::string msg = res.message().str();
+	BOOST_CHECK(msg.find("@@ 0x7a120, 1 byte @@") != std::string::npos);
+	BOOST_CHECK_LT(msg.length(), 1024);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
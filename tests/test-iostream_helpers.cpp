@@ -21,6 +21,7 @@
 #include <boost/test/unit_test.hpp>
 #include <camoto/stream_string.hpp>
 #include <camoto/iostream_helpers.hpp>
+#include "alloc_count.hpp"
 
 using namespace camoto;
 
@@ -107,4 +108,24 @@ BOOST_AUTO_TEST_CASE(null_terminated_read)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(small_field_no_alloc)
+{
+	BOOST_TEST_MESSAGE("Reading and writing integer fields doesn't allocate memory");
+
+	stream::string_sptr data(new stream::string());
+	data << std::string(16, '\0');
+	data->seekp(0, stream::start);
+
+	uint8_t v8 = 0x12;
+	uint16_t v16 = 0x3456;
+	uint32_t v32 = 0x789ABCDE;
+	CHECK_NO_ALLOC(data << u8(v8) << u16le(v16) << u32be(v32));
+	CHECK_NO_ALLOC(data->seekg(0, stream::start));
+	v8 = v16 = v32 = 0;
+	CHECK_NO_ALLOC(data >> u8(v8) >> u16le(v16) >> u32be(v32));
+	BOOST_CHECK_EQUAL(v8, 0x12);
+	BOOST_CHECK_EQUAL(v16, 0x3456);
+	BOOST_CHECK_EQUAL(v32, 0x789ABCDE);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -26,6 +26,7 @@
 #include <camoto/util.hpp>
 
 #include "tests.hpp"
+#include "alloc_count.hpp"
 
 using namespace camoto;
 
@@ -366,6 +367,98 @@ BOOST_AUTO_TEST_CASE(lzw_comp_write_dict_overflow_reset)
 		"Compressing LZW data with an autoreset dictionary failed");
 }
 
+BOOST_AUTO_TEST_CASE(lzw_comp_write_two_reserved)
+{
+	BOOST_TEST_MESSAGE("Compress LZW data with reset and EOF codewords reserved");
+
+	stream::string_sptr exp(new stream::string());
+	bitstream_sptr bit_exp(new bitstream(exp, bitstream::bigEndian));
+	for (int i = 0; i < 255; i++) bit_exp->write(9, 'a');
+	bit_exp->write(10, 'b');
+	bit_exp->write(10, 0x101);
+	bit_exp->flushByte();
+
+	for (int i = 0; i < 255; i++) this->in->write("a");
+	this->in->write("b");
+
+	filter_sptr filt(new filter_lzw_compress(9, 12, 0x102, 0x101, 0x100,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID));
+	stream::input_filtered_sptr processed(new stream::input_filtered());
+	processed->open(this->in, filt);
+
+	stream::copy(this->out, processed);
+
+	BOOST_CHECK_MESSAGE(is_equal(*(exp->str())),
+		"Compressing LZW data with two reserved codewords failed");
+}
+
+BOOST_AUTO_TEST_CASE(lzw_comp_write_no_eof)
+{
+	BOOST_TEST_MESSAGE("Compress LZW data without an EOF codeword");
+
+	stream::string_sptr exp(new stream::string());
+	bitstream_sptr bit_exp(new bitstream(exp, bitstream::bigEndian));
+	for (int i = 0; i < 257; i++) bit_exp->write(9, 'a');
+	bit_exp->write(10, 'b');
+	bit_exp->flushByte();
+
+	for (int i = 0; i < 257; i++) this->in->write("a");
+	this->in->write("b");
+
+	filter_sptr filt(new filter_lzw_compress(9, 12, 0x100, 0, 0,
+		LZW_BIG_ENDIAN));
+	stream::input_filtered_sptr processed(new stream::input_filtered());
+	processed->open(this->in, filt);
+
+	stream::copy(this->out, processed);
+
+	BOOST_CHECK_MESSAGE(is_equal(*(exp->str())),
+		"Compressing LZW data without an EOF codeword failed");
+}
+
+BOOST_AUTO_TEST_CASE(lzw_round_trip_flags)
+{
+	BOOST_TEST_MESSAGE("Compressed LZW data decompresses with every flag combination");
+
+	std::string orig;
+	for (unsigned int i = 0; i < 20000; i++) orig += (char)("abcdefgh"[(i * 7 + i / 3) % 8]);
+
+	static const int params[][4] = {
+		// firstCode, eofCode, resetCode, flags
+		{0x102, 0x101, 0x100, LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+			| LZW_RESET_FULL_DICT},
+		{0x102, 0x101, 0x100, LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+			| LZW_RESET_FULL_DICT | LZW_FLUSH_ON_RESET},
+		{0x102, 0x101, 0x100, LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+			| LZW_RESET_FULL_DICT | LZW_NO_BITSIZE_RESET},
+		{0x100, 0, 0, 0},
+		{0x100, 0, 0, LZW_RESET_FULL_DICT},
+	};
+	for (unsigned int p = 0; p < sizeof(params) / sizeof(params[0]); p++) {
+		for (int endian = 0; endian < 2; endian++) {
+			int flags = params[p][3] | (endian ? LZW_BIG_ENDIAN : LZW_LITTLE_ENDIAN);
+			filter_sptr enc(new filter_lzw_compress(9, 12, params[p][0],
+				params[p][1], params[p][2], flags));
+			filter_sptr dec(new filter_lzw_decompress(9, 12, params[p][0],
+				params[p][1], params[p][2], flags));
+
+			stream::string_sptr src(new stream::string());
+			src->write(orig);
+			src->seekg(0, stream::start);
+			stream::input_filtered_sptr comp(new stream::input_filtered());
+			comp->open(src, enc);
+			stream::string_sptr packed(new stream::string());
+			stream::copy(packed, comp);
+
+			packed->seekg(0, stream::start);
+			stream::input_filtered_sptr decomp(new stream::input_filtered());
+			decomp->open(packed, dec);
+			BOOST_CHECK_MESSAGE(decomp->read(decomp->size()) == orig,
+				"Round trip failed for parameter set " << p << " flags " << flags);
+		}
+	}
+}
+
 BOOST_AUTO_TEST_CASE(lzw_comp_end_write_midbyte)
 {
 	BOOST_TEST_MESSAGE("Compress some LZW data and ensure it ends mid-byte");
@@ -382,4 +475,61 @@ BOOST_AUTO_TEST_CASE(lzw_comp_end_write_midbyte)
 		"Compressing LZW data ensuring it ends mid-byte failed");
 }
 
+BOOST_AUTO_TEST_CASE(lzw_transform_no_alloc)
+{
+	BOOST_TEST_MESSAGE("LZW doesn't allocate memory once it is running");
+
+	std::vector<uint8_t> orig(8192), comp(16384), decomp(8192);
+	for (unsigned int i = 0; i < orig.size(); i++) orig[i] = i * 7;
+
+	filter_lzw_compress enc(9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	enc.reset(orig.size());
+	stream::len lenIn = orig.size(), lenOut = comp.size();
+	CHECK_NO_ALLOC(enc.transform(&comp[0], &lenOut, &orig[0], &lenIn));
+	stream::len lenComp = lenOut;
+
+	filter_lzw_decompress dec(9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	dec.reset(lenComp);
+
+	// The first half may allocate while the internal buffers grow to size.
+	lenIn = lenComp / 2;
+	lenOut = decomp.size();
+	dec.transform(&decomp[0], &lenOut, &comp[0], &lenIn);
+	stream::len used = lenIn, done = lenOut;
+
+	lenIn = lenComp - used;
+	lenOut = decomp.size() - done;
+	CHECK_NO_ALLOC(dec.transform(&decomp[done], &lenOut, &comp[used], &lenIn));
+	done += lenOut;
+
+	BOOST_REQUIRE_GT(done, orig.size() / 2);
+	BOOST_CHECK(std::equal(decomp.begin(), decomp.begin() + done, orig.begin()));
+}
+
+BOOST_AUTO_TEST_CASE(lzw_fingerprint)
+{
+	BOOST_TEST_MESSAGE("LZW filters with the same parameters share a fingerprint");
+
+	filter_lzw_compress enc(9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	filter_lzw_decompress dec(9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	BOOST_CHECK(!enc.fingerprint().empty());
+	BOOST_CHECK_EQUAL(enc.fingerprint(), dec.fingerprint());
+
+	// The reset code is ignored when it isn't in use
+	filter_lzw_decompress decReset(9, 12, 0x101, 0x100, 0x1FF,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	BOOST_CHECK_EQUAL(enc.fingerprint(), decReset.fingerprint());
+
+	filter_lzw_decompress decLE(9, 12, 0x101, 0x100, 0,
+		LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID);
+	BOOST_CHECK(enc.fingerprint() != decLE.fingerprint());
+	filter_lzw_decompress decBits(9, 14, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	BOOST_CHECK(enc.fingerprint() != decBits.fingerprint());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
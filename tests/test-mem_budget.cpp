@@ -0,0 +1,312 @@
+/**
+ * @file   test-mem_budget.cpp
+ * @brief  Test code for memory accounting and the memory budget.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+#include <camoto/filter_dummy.hpp>
+#include <camoto/mem_budget.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_memory.hpp>
+#include <camoto/stream_seg.hpp>
+#include <camoto/stream_string.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct mem_budget_sample: public default_sample {
+
+	stream::len baseUsed;
+	stream::len baseSpilled;
+
+	mem_budget_sample()
+		:	baseUsed(stream::mem_budget::used()),
+			baseSpilled(stream::mem_budget::spilled())
+	{
+	}
+
+	~mem_budget_sample()
+	{
+		stream::mem_budget::setLimit(0, stream::mem_block);
+	}
+
+	/// Memory used by streams created since the fixture started.
+	stream::len used()
+	{
+		return stream::mem_budget::used() - this->baseUsed;
+	}
+
+	/// Read an entire stream back as a string.
+	std::string content(stream::input_sptr s)
+	{
+		s->seekg(0, stream::start);
+		return s->read(s->size());
+	}
+};
+
+/// Write to a stream, setting a flag once the write returns.
+static void writeAndFlag(stream::memory_sptr s, stream::len len,
+	boost::atomic<bool> *done)
+{
+	std::vector<uint8_t> buffer(len, 'x');
+	s->write(&buffer[0], len);
+	done->store(true);
+	return;
+}
+
+BOOST_FIXTURE_TEST_SUITE(mem_budget_suite, mem_budget_sample)
+
+BOOST_AUTO_TEST_CASE(mem_memory_accounting)
+{
+	BOOST_TEST_MESSAGE("Memory streams count their content");
+
+	stream::len basePool = stream::mem_budget::used(stream::mem_memory);
+	{
+		stream::memory_sptr m(new stream::memory());
+		m->write("ABCDEFGHIJ");
+		BOOST_CHECK_EQUAL(m->memoryHeld(), 10);
+		BOOST_CHECK_EQUAL(this->used(), 10);
+		BOOST_CHECK_EQUAL(stream::mem_budget::used(stream::mem_memory),
+			basePool + 10);
+
+		// Overwriting doesn't use any more memory
+		m->seekp(0, stream::start);
+		m->write("abcde");
+		BOOST_CHECK_EQUAL(this->used(), 10);
+
+		m->truncate(4);
+		BOOST_CHECK_EQUAL(m->memoryHeld(), 4);
+		BOOST_CHECK_EQUAL(this->used(), 4);
+		BOOST_CHECK_GE(stream::mem_budget::peak(), this->baseUsed + 10);
+		BOOST_CHECK(!m->spilled());
+	}
+	BOOST_CHECK_EQUAL(this->used(), 0);
+
+	std::ostringstream report;
+	stream::mem_budget::print(report);
+	BOOST_CHECK(report.str().find("seg-insert") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(mem_filtered_accounting)
+{
+	BOOST_TEST_MESSAGE("Filtered streams count decoded and staged data");
+
+	stream::len baseRead = stream::mem_budget::used(stream::mem_filtered_read);
+	stream::len baseWrite = stream::mem_budget::used(stream::mem_filtered_write);
+
+	stream::string_sptr base(new stream::string());
+	base->write("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+
+	filter_sptr algo(new filter_dummy());
+	{
+		stream::input_filtered_sptr f(new stream::input_filtered());
+		f->open(base, algo);
+		BOOST_CHECK_EQUAL(f->size(), 26);
+		BOOST_CHECK_EQUAL(f->memoryHeld(), 26);
+		BOOST_CHECK_EQUAL(stream::mem_budget::used(stream::mem_filtered_read),
+			baseRead + 26);
+	}
+	BOOST_CHECK_EQUAL(stream::mem_budget::used(stream::mem_filtered_read),
+		baseRead);
+
+	{
+		stream::output_filtered_sptr f(new stream::output_filtered());
+		f->open(base, algo, NULL);
+		f->write("1234567890");
+		BOOST_CHECK_EQUAL(stream::mem_budget::used(stream::mem_filtered_write),
+			baseWrite + 10);
+		f->flush();
+	}
+	BOOST_CHECK_EQUAL(stream::mem_budget::used(stream::mem_filtered_write),
+		baseWrite);
+	BOOST_CHECK_MESSAGE(is_equal("1234567890", *base->str()),
+		"Staged data was not written out");
+}
+
+BOOST_AUTO_TEST_CASE(mem_seg_accounting)
+{
+	BOOST_TEST_MESSAGE("Seg streams count inserted data until flush");
+
+	stream::len basePool = stream::mem_budget::used(stream::mem_seg_insert);
+
+	stream::string_sptr base(new stream::string());
+	base->write("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+	stream::seg_sptr s(new stream::seg());
+	s->open(base);
+
+	s->seekp(4, stream::start);
+	s->insert(5);
+	s->seekp(20, stream::start);
+	s->insert(3);
+	BOOST_CHECK_EQUAL(s->memoryHeld(), 8);
+	BOOST_CHECK_EQUAL(stream::mem_budget::used(stream::mem_seg_insert),
+		basePool + 8);
+
+	s->seekp(4, stream::start);
+	s->remove(2);
+	BOOST_CHECK_EQUAL(s->memoryHeld(), 6);
+
+	s->flush();
+	BOOST_CHECK_EQUAL(s->memoryHeld(), 0);
+	BOOST_CHECK_EQUAL(stream::mem_budget::used(stream::mem_seg_insert),
+		basePool);
+}
+
+BOOST_AUTO_TEST_CASE(mem_policy_fail)
+{
+	BOOST_TEST_MESSAGE("Fail policy throws once the budget is used up");
+
+	stream::memory_sptr m(new stream::memory());
+	m->write("ABCDEFGHIJ");
+	stream::mem_budget::setLimit(stream::mem_budget::used() + 10,
+		stream::mem_fail);
+
+	// Exactly filling the budget is fine
+	m->write("0123456789");
+	BOOST_CHECK_THROW(m->write("X"), stream::budget_error);
+
+	// The stream is unchanged after the failure
+	BOOST_CHECK_EQUAL(m->size(), 20);
+	BOOST_CHECK_EQUAL(this->used(), 20);
+
+	// Releasing memory makes room again
+	m->truncate(15);
+	m->write("XYZ");
+	BOOST_CHECK_MESSAGE(is_equal("ABCDEFGHIJ01234XYZ", this->content(m)),
+		"Content changed after running out of budget");
+}
+
+BOOST_AUTO_TEST_CASE(mem_policy_spill)
+{
+	BOOST_TEST_MESSAGE("Spill policy moves memory streams to disk");
+
+	stream::memory_sptr m(new stream::memory());
+	m->write("ABCDEFGHIJ");
+	stream::mem_budget::setLimit(stream::mem_budget::used() + 5,
+		stream::mem_spill);
+
+	m->write("KLMNOPQRSTUVWXYZ");
+	BOOST_REQUIRE(m->spilled());
+	BOOST_CHECK_EQUAL(this->used(), 0);
+	BOOST_CHECK_EQUAL(stream::mem_budget::spilled() - this->baseSpilled, 26);
+	BOOST_CHECK_EQUAL(m->memoryHeld(), 26);
+
+	m->seekp(2, stream::start);
+	m->write("12");
+	m->truncate(28);
+	BOOST_CHECK_EQUAL(stream::mem_budget::spilled() - this->baseSpilled, 28);
+	BOOST_CHECK_MESSAGE(is_equal(std::string("AB12EFGHIJKLMNOPQRSTUVWXYZ\0\0", 28),
+		this->content(m)), "Spilled content is wrong");
+
+	m.reset();
+	BOOST_CHECK_EQUAL(stream::mem_budget::spilled(), this->baseSpilled);
+}
+
+BOOST_AUTO_TEST_CASE(mem_policy_spill_filtered)
+{
+	BOOST_TEST_MESSAGE("Filtered streams still work after spilling");
+
+	std::string expected;
+	for (unsigned int i = 0; i < 3 * BUFFER_SIZE; i++) expected += 'A' + i % 26;
+	stream::string_sptr base(new stream::string());
+	base->write(expected);
+
+	stream::mem_budget::setLimit(stream::mem_budget::used() + 100,
+		stream::mem_spill);
+
+	filter_sptr algo(new filter_dummy());
+	stream::filtered_sptr f(new stream::filtered());
+	f->open(base, algo, algo, NULL);
+	BOOST_CHECK_EQUAL(f->size(), expected.length());
+	BOOST_CHECK(f->spilled());
+	BOOST_CHECK_MESSAGE(is_equal(expected, this->content(f)),
+		"Decoded data was lost when spilling");
+
+	f->seekp(BUFFER_SIZE, stream::start);
+	f->write("1234");
+	f->flush();
+	expected.replace(BUFFER_SIZE, 4, "1234");
+	BOOST_CHECK_MESSAGE(is_equal(expected, *base->str()),
+		"Spilled data was not written out in full");
+}
+
+BOOST_AUTO_TEST_CASE(mem_policy_spill_seg)
+{
+	BOOST_TEST_MESSAGE("Spill policy still counts seg inserts");
+
+	stream::string_sptr base(new stream::string());
+	base->write("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+	stream::seg_sptr s(new stream::seg());
+	s->open(base);
+
+	stream::mem_budget::setLimit(stream::mem_budget::used() + 4,
+		stream::mem_spill);
+
+	// Seg data can't be spilled so it goes over budget, but is still counted
+	s->seekp(4, stream::start);
+	s->insert(10);
+	BOOST_CHECK_EQUAL(s->memoryHeld(), 10);
+	BOOST_CHECK_EQUAL(this->used(), 10);
+
+	s->seekp(6, stream::start);
+	s->insert(2);
+	BOOST_CHECK_EQUAL(s->memoryHeld(), 12);
+	BOOST_CHECK_EQUAL(this->used(), 12);
+
+	s->remove(3);
+	BOOST_CHECK_EQUAL(s->memoryHeld(), 9);
+	BOOST_CHECK_EQUAL(this->used(), 9);
+
+	s->flush();
+	BOOST_CHECK_EQUAL(s->memoryHeld(), 0);
+	BOOST_CHECK_EQUAL(this->used(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(mem_policy_block)
+{
+	BOOST_TEST_MESSAGE("Block policy waits for another stream to shrink");
+
+	stream::memory_sptr a(new stream::memory());
+	stream::memory_sptr b(new stream::memory());
+	std::vector<uint8_t> buffer(100, 'a');
+	a->write(&buffer[0], buffer.size());
+	stream::mem_budget::setLimit(stream::mem_budget::used() + 50,
+		stream::mem_block);
+
+	// A request bigger than the whole budget would wait forever
+	std::vector<uint8_t> huge(stream::mem_budget::limit() + 1, 'h');
+	BOOST_CHECK_THROW(b->write(&huge[0], huge.size()), stream::budget_error);
+
+	boost::atomic<bool> done(false);
+	boost::thread writer(boost::bind(writeAndFlag, b, 100, &done));
+	boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+	BOOST_CHECK(!done.load());
+
+	a->truncate(0);
+	writer.join();
+	BOOST_CHECK(done.load());
+	BOOST_CHECK_EQUAL(b->size(), 100);
+	BOOST_CHECK_EQUAL(this->used(), 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,152 @@
+/**
+ * @file   test-read_scheduler.cpp
+ * @brief  Test code for batched, reordered reads.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/read_scheduler.hpp>
+#include <camoto/stream_metered.hpp>
+#include <camoto/stream_seg.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/stream_sub.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct read_scheduler_sample: public string_sample {
+
+	stream::input_metered_sptr metered;
+
+	read_scheduler_sample()
+		:	metered(new stream::input_metered())
+	{
+		this->in->write("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+		this->metered->open(this->in, "sched");
+		stream::meter_registry::enable(true);
+	}
+
+	~read_scheduler_sample()
+	{
+		stream::meter_registry::enable(false);
+	}
+
+	/// Open a member over the metered stream.
+	stream::input_sptr member(stream::pos start, stream::len len)
+	{
+		stream::input_sub_sptr s(new stream::input_sub());
+		s->open(this->metered, start, len);
+		return s;
+	}
+
+	/// Number of reads the metered stream has seen.
+	unsigned long long parentReads()
+	{
+		return this->metered->snapshot().counters.calls[stream::meter_read];
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(read_scheduler_suite, read_scheduler_sample)
+
+BOOST_AUTO_TEST_CASE(merge_nearby)
+{
+	BOOST_TEST_MESSAGE("Nearby reads in any order become one read");
+
+	char a[3], b[3], c[2];
+	stream::read_scheduler batch(8, 1024);
+	batch.add(this->member(20, 6), 1, 3, (uint8_t *)a);
+	batch.add(this->member(10, 5), 0, 3, (uint8_t *)b);
+	batch.add(this->member(2, 4), 2, 2, (uint8_t *)c);
+	batch.run();
+
+	BOOST_CHECK_EQUAL(std::string(a, 3), "LMN");
+	BOOST_CHECK_EQUAL(std::string(b, 3), "ABC");
+	BOOST_CHECK_EQUAL(std::string(c, 2), "45");
+	BOOST_CHECK_EQUAL(batch.reads(), 1);
+	BOOST_CHECK_EQUAL(batch.bytesRead(), 24 - 4);
+	BOOST_CHECK_EQUAL(this->parentReads(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(limits)
+{
+	BOOST_TEST_MESSAGE("Reads far apart or too large are not merged");
+
+	char a[3], b[3], c[2], d[12];
+	stream::read_scheduler batch(3, 10);
+	batch.add(this->member(20, 6), 1, 3, (uint8_t *)a);
+	batch.add(this->member(10, 5), 0, 3, (uint8_t *)b);
+	batch.add(this->member(2, 4), 2, 2, (uint8_t *)c);
+	// Overlaps b, but merging would go over the limit
+	batch.add(this->in, 11, 12, (uint8_t *)d);
+	batch.run();
+
+	BOOST_CHECK_EQUAL(std::string(a, 3), "LMN");
+	BOOST_CHECK_EQUAL(std::string(b, 3), "ABC");
+	BOOST_CHECK_EQUAL(std::string(c, 2), "45");
+	BOOST_CHECK_EQUAL(std::string(d, 12), "BCDEFGHIJKLM");
+	BOOST_CHECK_EQUAL(batch.reads(), 4);
+}
+
+BOOST_AUTO_TEST_CASE(seg_mapping)
+{
+	BOOST_TEST_MESSAGE("Reads through a seg come from the parent and memory");
+
+	stream::string_sptr base(new stream::string());
+	base->write("ABCDEFGHIJ");
+	stream::seg_sptr s(new stream::seg());
+	s->open(base);
+	s->seekp(4, stream::start);
+	s->insert(3);
+	s->write("xyz");
+	// Now ABCDxyzEFGHIJ
+
+	char a[9];
+	stream::read_scheduler batch;
+	batch.add(s, 2, 9, (uint8_t *)a);
+	batch.run();
+	BOOST_CHECK_EQUAL(std::string(a, 9), "CDxyzEFGH");
+
+	stream::input_sub_sptr sub(new stream::input_sub());
+	sub->open(s, 5, 6);
+	batch.add(sub, 2, 4, (uint8_t *)a);
+	BOOST_CHECK_THROW(batch.add(sub, 4, 3, (uint8_t *)a), stream::read_error);
+	batch.run();
+	BOOST_CHECK_EQUAL(std::string(a, 4), "EFGH");
+}
+
+BOOST_AUTO_TEST_CASE(background)
+{
+	BOOST_TEST_MESSAGE("A batch can run in the background");
+
+	char a[3], b[3];
+	stream::read_scheduler batch;
+	batch.add(this->member(20, 6), 1, 3, (uint8_t *)a);
+	batch.add(this->member(10, 5), 0, 3, (uint8_t *)b);
+	batch.start();
+	batch.wait();
+	BOOST_CHECK_EQUAL(std::string(a, 3), "LMN");
+	BOOST_CHECK_EQUAL(std::string(b, 3), "ABC");
+
+	// Errors come back from wait()
+	char c[10];
+	batch.add(this->in, 30, 10, (uint8_t *)c);
+	batch.start();
+	BOOST_CHECK_THROW(batch.wait(), stream::read_error);
+	batch.wait();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -21,8 +21,16 @@
 #include <errno.h>
 #include <boost/test/unit_test.hpp>
 #include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <camoto/stream.hpp>
+#include <camoto/filter_dummy.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_memory.hpp>
+#include <camoto/stream_seg.hpp>
+#include <camoto/stream_simulated.hpp>
 #include <camoto/stream_string.hpp>
+#include <camoto/stream_sub.hpp>
 #include "tests.hpp"
 
 using namespace camoto;
@@ -153,3 +161,374 @@ BOOST_AUTO_TEST_CASE(stream_move_extend_overlap)
 }
 
 BOOST_AUTO_TEST_SUITE_END() // stream_move_suite
+
+struct stream_copy_sample: public default_sample {
+
+	stream::string_sptr src;
+	stream::string_sptr dest;
+
+	stream_copy_sample()
+		:	src(new stream::string()),
+			dest(new stream::string())
+	{
+		// Enough data to need several passes around the pipeline's buffer ring,
+		// finishing with a partial block.
+		std::string& s = *this->src->str();
+		s.resize(PIPELINE_BUFFER_SIZE * (PIPELINE_BUFFER_COUNT + 2) + 123);
+		for (std::string::size_type i = 0; i < s.length(); i++) {
+			s[i] = (char)(i * 7 + (i >> 12));
+		}
+	}
+
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_copy_suite, stream_copy_sample)
+
+BOOST_AUTO_TEST_CASE(stream_copy_pipelined)
+{
+	BOOST_TEST_MESSAGE("Pipelined stream copy");
+
+	stream::copy_stats stats;
+	stream::copy_pipelined(this->dest, this->src, &stats);
+
+	BOOST_REQUIRE_EQUAL(stats.bytes, this->src->size());
+	BOOST_CHECK(stats.pipelined);
+	BOOST_CHECK_MESSAGE(*this->src->str() == *this->dest->str(),
+		"Error in pipelined stream copy");
+}
+
+BOOST_AUTO_TEST_CASE(stream_copy_pipelined_offset)
+{
+	BOOST_TEST_MESSAGE("Pipelined stream copy from the middle of a stream");
+
+	this->src->seekg(PIPELINE_BUFFER_SIZE + 5, stream::start);
+	stream::copy_pipelined(this->dest, this->src);
+
+	BOOST_CHECK_MESSAGE(
+		this->src->str()->substr(PIPELINE_BUFFER_SIZE + 5) == *this->dest->str(),
+		"Error in pipelined stream copy from the middle of a stream");
+}
+
+BOOST_AUTO_TEST_CASE(stream_copy_pipelined_empty)
+{
+	BOOST_TEST_MESSAGE("Pipelined stream copy of an empty stream");
+
+	this->src->truncate(0);
+	stream::copy_stats stats;
+	stream::copy_pipelined(this->dest, this->src, &stats);
+
+	BOOST_CHECK_EQUAL(stats.bytes, 0);
+	BOOST_CHECK_EQUAL(this->dest->size(), 0);
+}
+
+void copyNoResize(stream::len len)
+{
+	throw stream::write_error("Resize refused for testing purposes");
+}
+
+BOOST_AUTO_TEST_CASE(stream_copy_pipelined_incomplete)
+{
+	BOOST_TEST_MESSAGE("Pipelined stream copy into a stream that is too small");
+
+	this->dest->str()->resize(PIPELINE_BUFFER_SIZE + 10);
+	stream::sub_sptr sub(new stream::sub());
+	sub->open(this->dest, 0, PIPELINE_BUFFER_SIZE + 10, copyNoResize);
+
+	try {
+		stream::copy_pipelined(sub, this->src);
+		BOOST_FAIL("Pipelined copy did not throw incomplete_write");
+	} catch (const stream::incomplete_write& e) {
+		BOOST_CHECK_EQUAL(e.bytes_written, PIPELINE_BUFFER_SIZE + 10);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(stream_copy_stats)
+{
+	BOOST_TEST_MESSAGE("Unpipelined stream copy reports statistics");
+
+	stream::copy_stats stats;
+	stream::copy(this->dest, this->src, &stats);
+
+	BOOST_CHECK(!stats.pipelined);
+	BOOST_REQUIRE_EQUAL(stats.bytes, this->src->size());
+	BOOST_CHECK_MESSAGE(*this->src->str() == *this->dest->str(),
+		"Error in stream copy");
+}
+
+BOOST_AUTO_TEST_SUITE_END() // stream_copy_suite
+
+struct stream_caps_sample: public default_sample {
+
+	stream::file_sptr f;
+	stream::memory_sptr m;
+
+	stream_caps_sample()
+		:	f(new stream::file()),
+			m(new stream::memory())
+	{
+		this->f->create("_test_caps.$");
+		this->f->remove();
+		this->f->write("Hello");
+		this->m->write("Hello");
+	}
+
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_caps_suite, stream_caps_sample)
+
+BOOST_AUTO_TEST_CASE(stream_caps_leaf)
+{
+	BOOST_TEST_MESSAGE("Capabilities of streams holding their own data");
+
+	stream::caps c = this->f->read_caps();
+	BOOST_CHECK(c.has(stream::cap_seekable | stream::cap_mappable
+		| stream::cap_size_fast | stream::cap_leaf));
+	BOOST_CHECK(!c.has(stream::cap_memory));
+	BOOST_CHECK_GT(c.blockSize, 0);
+
+	c = this->m->read_caps();
+	BOOST_CHECK(c.has(stream::cap_seekable | stream::cap_memory
+		| stream::cap_size_fast | stream::cap_leaf));
+	BOOST_CHECK(!c.has(stream::cap_mappable));
+	BOOST_CHECK(this->m->write_caps().has(stream::cap_memory));
+
+	stream::string_sptr str(new stream::string());
+	BOOST_CHECK(str->read_caps().has(stream::cap_memory | stream::cap_leaf));
+}
+
+BOOST_AUTO_TEST_CASE(stream_caps_composite)
+{
+	BOOST_TEST_MESSAGE("Composite streams derive capabilities from the parent");
+
+	stream::sub_sptr sub(new stream::sub());
+	sub->open(this->f, 1, 3, NULL);
+	stream::caps c = sub->read_caps();
+	BOOST_CHECK(c.has(stream::cap_seekable | stream::cap_mappable
+		| stream::cap_size_fast));
+	BOOST_CHECK(!c.has(stream::cap_leaf));
+	BOOST_CHECK(!c.has(stream::cap_holes));
+	BOOST_CHECK_EQUAL(c.blockSize, this->f->read_caps().blockSize);
+
+	stream::seg_sptr seg(new stream::seg());
+	seg->open(this->m);
+	c = seg->write_caps();
+	BOOST_CHECK(c.has(stream::cap_memory | stream::cap_size_fast));
+	BOOST_CHECK(!c.has(stream::cap_leaf));
+
+	// A simulated device is never as fast as memory
+	stream::simulated_sptr sim(new stream::simulated());
+	sim->open(this->m, stream::sim_device());
+	BOOST_CHECK(!sim->read_caps().has(stream::cap_memory));
+	BOOST_CHECK(sim->read_caps().has(stream::cap_seekable));
+}
+
+BOOST_AUTO_TEST_CASE(stream_caps_filtered)
+{
+	BOOST_TEST_MESSAGE("Filtered streams only have a cheap size() once decoded");
+
+	stream::filtered_sptr filt(new stream::filtered());
+	filter_sptr dummy(new filter_dummy());
+	filt->open(this->m, dummy, dummy, NULL);
+	BOOST_CHECK(filt->read_caps().has(stream::cap_memory | stream::cap_leaf));
+	BOOST_CHECK(!filt->read_caps().has(stream::cap_size_fast));
+	BOOST_CHECK_EQUAL(filt->size(), 5);
+	BOOST_CHECK(filt->read_caps().has(stream::cap_size_fast));
+}
+
+BOOST_AUTO_TEST_CASE(stream_caps_pipelined)
+{
+	BOOST_TEST_MESSAGE("Pipelining needs two streams that can't share data");
+
+	std::string big(PIPELINE_MIN_LENGTH, 'x');
+	this->m->write(big);
+	this->m->seekg(0, stream::start);
+	BOOST_CHECK(stream::prefer_pipelined(this->f, this->m));
+
+	// A window onto another stream might share its data with the other end
+	stream::sub_sptr sub(new stream::sub());
+	sub->open(this->m, 0, this->m->size(), NULL);
+	BOOST_CHECK(!stream::prefer_pipelined(this->f, sub));
+}
+
+BOOST_AUTO_TEST_SUITE_END() // stream_caps_suite
+
+struct stream_clone_sample: public default_sample {
+
+	stream::file_sptr f;
+
+	stream_clone_sample()
+		:	f(new stream::file())
+	{
+		this->f->create("_test_clone.$");
+		this->f->remove();
+		this->f->write("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+	}
+
+};
+
+/// Read a clone from start to finish, checking every byte.
+static void readClone(stream::input_sptr clone, unsigned int start,
+	bool *ok)
+{
+	uint8_t buf[64];
+	clone->seekg(start, stream::start);
+	for (int i = 0; i < 100; i++) {
+		stream::pos p = clone->tellg();
+		stream::len r = clone->try_read(buf, sizeof(buf));
+		for (stream::len j = 0; j < r; j++) {
+			if (buf[j] != (uint8_t)((p + j) * 7)) *ok = false;
+		}
+		if (r == 0) clone->seekg(0, stream::start);
+	}
+	return;
+}
+
+BOOST_FIXTURE_TEST_SUITE(stream_clone_suite, stream_clone_sample)
+
+BOOST_AUTO_TEST_CASE(stream_clone_file)
+{
+	BOOST_TEST_MESSAGE("Cloned file has its own read pointer");
+
+	this->f->seekg(2, stream::start);
+	stream::input_sptr c = this->f->clone_cursor();
+	BOOST_CHECK(c->read_caps().has(stream::cap_positional));
+	BOOST_CHECK(!this->f->read_caps().has(stream::cap_positional));
+	BOOST_CHECK_EQUAL(c->tellg(), 2);
+	BOOST_CHECK_EQUAL(c->size(), 26);
+
+	BOOST_CHECK_EQUAL(c->read(4), "CDEF");
+	BOOST_CHECK_EQUAL(this->f->tellg(), 2);
+	BOOST_CHECK_EQUAL(this->f->read(2), "CD");
+	BOOST_CHECK_EQUAL(c->tellg(), 6);
+
+	stream::input_sptr c2 = c->clone_cursor();
+	c->seekg(-1, stream::end);
+	BOOST_CHECK_EQUAL(c->read(1), "Z");
+	BOOST_CHECK_EQUAL(c2->read(2), "GH");
+
+	// Writes are visible once flushed
+	this->f->seekp(0, stream::start);
+	this->f->write("ab");
+	this->f->flush();
+	c2->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(c2->read(3), "abC");
+}
+
+BOOST_AUTO_TEST_CASE(stream_clone_file_threads)
+{
+	BOOST_TEST_MESSAGE("Cloned files can be read from several threads");
+
+	std::string pattern;
+	for (unsigned int i = 0; i < 4096; i++) pattern += (char)(i * 7);
+	this->f->truncate(0);
+	this->f->write(pattern);
+	this->f->flush();
+
+	bool ok[4] = {true, true, true, true};
+	boost::thread_group threads;
+	for (unsigned int i = 0; i < 4; i++) {
+		threads.create_thread(boost::bind(readClone, this->f->clone_cursor(),
+			i * 1000, &ok[i]));
+	}
+	threads.join_all();
+	for (unsigned int i = 0; i < 4; i++) {
+		BOOST_CHECK_MESSAGE(ok[i], "Thread " << i << " read the wrong data");
+	}
+}
+
+BOOST_AUTO_TEST_CASE(stream_clone_memory)
+{
+	BOOST_TEST_MESSAGE("Cloned memory and string streams share the content");
+
+	stream::memory_sptr m(new stream::memory());
+	m->write("Hello");
+	m->seekg(1, stream::start);
+	stream::input_sptr c = m->clone_cursor();
+	BOOST_CHECK_EQUAL(c->read(2), "el");
+	BOOST_CHECK_EQUAL(m->tellg(), 1);
+	m->seekp(4, stream::start);
+	m->write("!");
+	BOOST_CHECK_EQUAL(c->read(2), "l!");
+
+	stream::len lenOrig, lenClone;
+	stream::input_memory *cm = dynamic_cast<stream::input_memory *>(c.get());
+	BOOST_REQUIRE(cm);
+	BOOST_CHECK_EQUAL(cm->contents(&lenClone), m->contents(&lenOrig));
+	BOOST_CHECK_EQUAL(lenClone, lenOrig);
+
+	stream::string_sptr s(new stream::string());
+	s->write("Hello");
+	c = s->clone_cursor();
+	BOOST_CHECK_EQUAL(c->tellg(), 5);
+	c->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(c->read(5), "Hello");
+	BOOST_CHECK(c->read_caps().has(stream::cap_positional));
+}
+
+BOOST_AUTO_TEST_CASE(stream_clone_filtered)
+{
+	BOOST_TEST_MESSAGE("Cloned filtered stream shares the decoded data");
+
+	stream::filtered_sptr filt(new stream::filtered());
+	filter_sptr dummy(new filter_dummy());
+	filt->open(this->f, dummy, dummy, NULL);
+	stream::input_sptr c = filt->clone_cursor();
+	BOOST_CHECK_EQUAL(c->size(), 26);
+	BOOST_CHECK_EQUAL(c->read(3), "ABC");
+	BOOST_CHECK_EQUAL(filt->tellg(), 0);
+
+	stream::len lenOrig, lenClone;
+	stream::input_memory *cm = dynamic_cast<stream::input_memory *>(c.get());
+	BOOST_REQUIRE(cm);
+	BOOST_CHECK_EQUAL(cm->contents(&lenClone), filt->contents(&lenOrig));
+}
+
+BOOST_AUTO_TEST_CASE(stream_clone_sub_seg)
+{
+	BOOST_TEST_MESSAGE("Cloned substreams and segstreams");
+
+	stream::sub_sptr sub(new stream::sub());
+	sub->open(this->f, 10, 5, NULL);
+	sub->seekg(1, stream::start);
+	stream::input_sptr c = sub->clone_cursor();
+	BOOST_CHECK(c->read_caps().has(stream::cap_positional));
+	// The substream itself seeks its shared parent
+	BOOST_CHECK(!sub->read_caps().has(stream::cap_positional));
+	BOOST_CHECK(!sub->write_caps().has(stream::cap_positional));
+	stream::string_sptr str(new stream::string());
+	str->write("ABCDEF");
+	stream::input_sub_sptr strSub(new stream::input_sub());
+	strSub->open(str, 1, 3);
+	BOOST_CHECK(str->read_caps().has(stream::cap_positional));
+	BOOST_CHECK(!strSub->read_caps().has(stream::cap_positional));
+	BOOST_CHECK(strSub->clone_cursor()->read_caps().has(stream::cap_positional));
+	BOOST_CHECK_EQUAL(c->size(), 5);
+	BOOST_CHECK_EQUAL(c->read(4), "LMNO");
+	BOOST_CHECK_EQUAL(sub->read(2), "LM");
+	BOOST_CHECK_THROW(c->seekg(6, stream::start), stream::seek_error);
+
+	stream::string_sptr base(new stream::string());
+	base->write("ABCDEF");
+	stream::seg_sptr seg(new stream::seg());
+	seg->open(base);
+	seg->seekp(2, stream::start);
+	seg->insert(2);
+	seg->write("xy");
+	BOOST_CHECK_THROW(seg->clone_cursor(), stream::error);
+	seg->flush();
+	seg->seekg(1, stream::start);
+	c = seg->clone_cursor();
+	BOOST_CHECK_EQUAL(c->read(5), "BxyCD");
+	BOOST_CHECK_EQUAL(seg->tellg(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(stream_clone_unsupported)
+{
+	BOOST_TEST_MESSAGE("Streams without a clone_cursor() throw");
+
+	stream::simulated_sptr sim(new stream::simulated());
+	sim->open(this->f, stream::sim_device());
+	BOOST_CHECK_THROW(sim->clone_cursor(), stream::error);
+}
+
+BOOST_AUTO_TEST_SUITE_END() // stream_clone_suite
@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <boost/test/unit_test.hpp>
 #include <camoto/stream_file.hpp>
+#include <camoto/stream_string.hpp>
 #include "tests.hpp"
 
 #ifdef WIN32
@@ -31,6 +32,10 @@
 using namespace camoto;
 
 #define TEST_FILE "_test.$"
+#define TEST_FILE2 "_test2.$"
+
+/// Size of the sparse test files, large enough for whole filesystem blocks.
+#define SPARSE_SIZE (1024 * 1024)
 
 struct AtExit {
 	~AtExit()
@@ -152,3 +157,157 @@ BOOST_AUTO_TEST_CASE(expand)
 }
 
 BOOST_AUTO_TEST_SUITE_END()
+
+struct stream_sparse_sample: public default_sample {
+
+	stream::file_sptr f;
+
+	/// Create a file of SPARSE_SIZE bytes, with data only at the two offsets.
+	stream_sparse_sample()
+		:	f(new stream::file())
+	{
+		this->f->create(TEST_FILE);
+		this->f->truncate(SPARSE_SIZE);
+		this->f->seekp(0x10000, stream::start);
+		this->f->write("first");
+		this->f->seekp(0x80000, stream::start);
+		this->f->write("second");
+		this->f->flush();
+	}
+
+	/// Does the filesystem running the tests report holes?
+	bool holesSupported()
+	{
+		return this->f->isHole(0, 0x10000);
+	}
+
+	/// Check the file content matches what the constructor wrote.
+	boost::test_tools::predicate_result is_sample(stream::input_sptr s)
+	{
+		std::string expected(SPARSE_SIZE, '\0');
+		expected.replace(0x10000, 5, "first");
+		expected.replace(0x80000, 6, "second");
+		s->seekg(0, stream::start);
+		return this->is_equal(expected, s->read(s->size()));
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_sparse_suite, stream_sparse_sample)
+
+BOOST_AUTO_TEST_CASE(sparse_extents)
+{
+	BOOST_TEST_MESSAGE("Find data and holes in a sparse file");
+
+	stream::pos start, end;
+	BOOST_REQUIRE(this->f->nextData(0, &start, &end));
+	BOOST_REQUIRE(!this->f->nextData(SPARSE_SIZE, &start, &end));
+	if (!this->holesSupported()) {
+		BOOST_TEST_MESSAGE("Filesystem has no hole support, skipping");
+		return;
+	}
+
+	BOOST_REQUIRE(this->f->nextData(0, &start, &end));
+	BOOST_CHECK_LE(start, 0x10000);
+	BOOST_CHECK_GT(end, 0x10000);
+	BOOST_CHECK_LT(end, 0x80000);
+
+	BOOST_REQUIRE(this->f->nextData(end, &start, &end));
+	BOOST_CHECK_LE(start, 0x80000);
+	BOOST_CHECK_GT(end, 0x80000);
+
+	BOOST_CHECK(!this->f->nextData(0xC0000, &start, &end));
+	BOOST_CHECK(!this->f->isHole(0x10000, 5));
+	BOOST_CHECK(this->f->isHole(0x40000, 0x10000));
+}
+
+BOOST_AUTO_TEST_CASE(sparse_punch)
+{
+	BOOST_TEST_MESSAGE("Punch holes in a file");
+
+	this->f->seekp(0x20000, stream::start);
+	this->f->write(std::string(0x10000, 'x'));
+	this->f->seekp(3, stream::start);
+	this->f->punchHole(0x20000, 0x10000);
+	BOOST_CHECK_EQUAL(this->f->tellp(), 3);
+	BOOST_CHECK_MESSAGE(this->is_sample(this->f),
+		"Punched hole doesn't read back as zeroes");
+	if (this->holesSupported()) {
+		BOOST_CHECK(this->f->isHole(0x20000, 0x10000));
+	}
+
+	// Punching past the end extends the file
+	this->f->punchHole(SPARSE_SIZE - 0x100, 0x200);
+	BOOST_CHECK_EQUAL(this->f->size(), SPARSE_SIZE + 0x100);
+}
+
+BOOST_AUTO_TEST_CASE(sparse_zero_write)
+{
+	BOOST_TEST_MESSAGE("Zero writes punch holes when enabled");
+
+	this->f->seekp(0x20000, stream::start);
+	this->f->write(std::string(0x10000, 'x'));
+
+	this->f->setSparse(true);
+	this->f->seekp(0x20000, stream::start);
+	this->f->write(std::string(0x10000, '\0'));
+	BOOST_CHECK_EQUAL(this->f->tellp(), 0x30000);
+	BOOST_CHECK_MESSAGE(this->is_sample(this->f),
+		"Zero write doesn't read back as zeroes");
+	if (this->holesSupported()) {
+		BOOST_CHECK(this->f->isHole(0x20000, 0x10000));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(sparse_copy)
+{
+	BOOST_TEST_MESSAGE("Copy a sparse file to another file");
+
+	stream::file_sptr dest(new stream::file());
+	dest->create(TEST_FILE2);
+	dest->remove();
+
+	this->f->seekg(0, stream::start);
+	stream::copy_stats stats;
+	stream::copy(dest, this->f, &stats);
+	BOOST_CHECK_EQUAL(stats.bytes, SPARSE_SIZE);
+	BOOST_CHECK_EQUAL(this->f->tellg(), SPARSE_SIZE);
+	BOOST_CHECK_EQUAL(dest->size(), SPARSE_SIZE);
+	BOOST_CHECK_MESSAGE(this->is_sample(dest), "Sparse copy corrupted data");
+
+	if (this->holesSupported()) {
+		BOOST_CHECK_GT(stats.holes, SPARSE_SIZE / 2);
+		BOOST_CHECK(dest->isHole(0x40000, 0x10000));
+		BOOST_CHECK(dest->isHole(0xC0000, SPARSE_SIZE - 0xC0000));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(sparse_copy_to_string)
+{
+	BOOST_TEST_MESSAGE("Copy a sparse file to a non-file stream");
+
+	stream::string_sptr dest(new stream::string());
+	this->f->seekg(0, stream::start);
+	stream::copy(dest, this->f);
+	BOOST_CHECK_MESSAGE(this->is_sample(dest), "Holes not written as zeroes");
+}
+
+BOOST_AUTO_TEST_CASE(sparse_move)
+{
+	BOOST_TEST_MESSAGE("Move data around a sparse file");
+
+	// Move everything back by 0x8000, so data shifts but holes stay holes
+	stream::move(this->f, 0x8000, 0, SPARSE_SIZE - 0x8000);
+	this->f->truncate(SPARSE_SIZE - 0x8000);
+
+	std::string expected(SPARSE_SIZE - 0x8000, '\0');
+	expected.replace(0x8000, 5, "first");
+	expected.replace(0x78000, 6, "second");
+	this->f->seekg(0, stream::start);
+	BOOST_CHECK_MESSAGE(is_equal(expected, this->f->read(this->f->size())),
+		"Moving sparse data corrupted it");
+	if (this->holesSupported()) {
+		BOOST_CHECK(this->f->isHole(0x40000, 0x10000));
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
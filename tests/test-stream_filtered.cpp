@@ -21,6 +21,7 @@
 #include <boost/test/unit_test.hpp>
 #include <boost/algorithm/string.hpp> // for case-insensitive string compare
 #include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <camoto/stream.hpp>
 #include <camoto/stream_string.hpp>
 #include <camoto/stream_filtered.hpp>
@@ -162,4 +163,200 @@ BOOST_AUTO_TEST_CASE(double_stream_filtered_write)
 		"Write to double stream_filtered failed");
 }
 
+/// Filter that counts how many times it has been run.
+class filter_counting: public filter_dummy
+{
+	public:
+		boost::atomic<int> runs;
+
+		filter_counting()
+			:	runs(0)
+		{
+		}
+
+		virtual void reset(stream::len lenInput)
+		{
+			this->runs++;
+			this->filter_dummy::reset(lenInput);
+			return;
+		}
+};
+
+void getSize(stream::input_filtered_sptr f, stream::len *size)
+{
+	*size = f->size();
+	return;
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_populate_threads)
+{
+	BOOST_TEST_MESSAGE("Decode only once when first read from several threads");
+
+	std::string content(100000, 'x');
+	this->in << content;
+
+	boost::shared_ptr<filter_counting> algo(new filter_counting());
+	stream::input_filtered_sptr f(new stream::input_filtered());
+	f->open(this->in, algo);
+
+	stream::len sizes[8];
+	boost::thread_group threads;
+	for (unsigned int i = 0; i < 8; i++) {
+		threads.create_thread(boost::bind(getSize, f, &sizes[i]));
+	}
+	threads.join_all();
+
+	BOOST_CHECK_EQUAL(algo->runs, 1);
+	for (unsigned int i = 0; i < 8; i++) {
+		BOOST_CHECK_EQUAL(sizes[i], content.length());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_clone_copy_on_write)
+{
+	BOOST_TEST_MESSAGE("Writing to stream_filtered leaves clones unchanged");
+
+	this->out << "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+	boost::shared_ptr<filter_counting> algo(new filter_counting());
+	stream::filtered_sptr f(new stream::filtered());
+	f->open(this->out, algo, algo, NULL);
+
+	stream::input_sptr c1 = f->clone_cursor();
+	stream::input_sptr c2 = f->clone_cursor();
+	BOOST_CHECK_EQUAL(algo->runs, 1);
+
+	stream::len len;
+	const uint8_t *shared = f->contents(&len);
+	BOOST_CHECK_EQUAL(
+		dynamic_cast<stream::input_memory *>(c1.get())->contents(&len), shared);
+
+	f->seekp(2, stream::start);
+	f->write("12", 2);
+	BOOST_CHECK(f->contents(&len) != shared);
+	BOOST_CHECK_EQUAL(
+		dynamic_cast<stream::input_memory *>(c2.get())->contents(&len), shared);
+
+	BOOST_CHECK_EQUAL(c1->read(5), "ABCDE");
+	BOOST_CHECK_EQUAL(c2->read(5), "ABCDE");
+	f->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(f->read(5), "AB12E");
+
+	// Once private, further writes don't copy again
+	const uint8_t *priv = f->contents(&len);
+	f->write("!", 1);
+	BOOST_CHECK_EQUAL(f->contents(&len), priv);
+}
+
+/// Counting filter that claims a particular encoding.
+class filter_counting_id: public filter_counting
+{
+	public:
+		std::string id;
+
+		filter_counting_id(const std::string& id)
+			:	id(id)
+		{
+		}
+
+		virtual std::string fingerprint() const
+		{
+			return this->id;
+		}
+};
+
+void setSize(stream::len *store, stream::len size)
+{
+	*store = size;
+	return;
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_copy_encoded)
+{
+	BOOST_TEST_MESSAGE("Copy between identical encodings without filtering");
+
+	this->in << "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	this->out << "old";
+
+	boost::shared_ptr<filter_counting_id> algoSrc(new filter_counting_id("x"));
+	boost::shared_ptr<filter_counting_id> algoDest(new filter_counting_id("x"));
+	stream::filtered_sptr src(new stream::filtered());
+	src->open(this->in, algoSrc, algoSrc, NULL);
+	stream::filtered_sptr dest(new stream::filtered());
+	stream::len newSize = 0;
+	dest->open(this->out, algoDest, algoDest, boost::bind(setSize, &newSize, _1));
+
+	BOOST_REQUIRE(stream::copy_encoded(dest, src, 26));
+	BOOST_CHECK_EQUAL(algoSrc->runs, 0);
+	BOOST_CHECK_EQUAL(algoDest->runs, 0);
+	BOOST_CHECK_EQUAL(newSize, 26);
+	BOOST_CHECK_MESSAGE(is_equal("ABCDEFGHIJKLMNOPQRSTUVWXYZ"),
+		"Encoded data was not copied");
+
+	// The new content is decoded when read
+	BOOST_CHECK_EQUAL(dest->read(3), "ABC");
+	BOOST_CHECK_EQUAL(algoDest->runs, 1);
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_copy_encoded_decoded)
+{
+	BOOST_TEST_MESSAGE("Copying encoded data shares already decoded data");
+
+	this->in << "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+	boost::shared_ptr<filter_counting_id> algoSrc(new filter_counting_id("x"));
+	boost::shared_ptr<filter_counting_id> algoDest(new filter_counting_id("x"));
+	stream::filtered_sptr src(new stream::filtered());
+	src->open(this->in, algoSrc, algoSrc, NULL);
+	stream::filtered_sptr dest(new stream::filtered());
+	stream::len newSize = 0;
+	dest->open(this->out, algoDest, algoDest, boost::bind(setSize, &newSize, _1));
+
+	// Unflushed changes can't be copied encoded
+	src->write("abc", 3);
+	BOOST_CHECK(!stream::copy_encoded(dest, src, 26));
+	src->flush();
+	BOOST_CHECK_EQUAL(algoSrc->runs, 2);
+
+	BOOST_REQUIRE(stream::copy_encoded(dest, src, 999));
+	BOOST_CHECK_EQUAL(newSize, 26);
+	BOOST_CHECK_EQUAL(algoSrc->runs, 2);
+	BOOST_CHECK_EQUAL(dest->read(5), "abcDE");
+	BOOST_CHECK_EQUAL(algoDest->runs, 0);
+
+	// Changing the copy leaves the original alone
+	dest->seekp(0, stream::start);
+	dest->write("!", 1);
+	dest->flush();
+	BOOST_CHECK_MESSAGE(is_equal("!bcDEFGHIJKLMNOPQRSTUVWXYZ"),
+		"Change after copy was not written");
+	src->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(src->read(3), "abc");
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_copy_encoded_differ)
+{
+	BOOST_TEST_MESSAGE("Different encodings are not copied encoded");
+
+	this->in << "ABCDEF";
+	this->out << "old";
+
+	boost::shared_ptr<filter_counting_id> algoSrc(new filter_counting_id("x"));
+	boost::shared_ptr<filter_counting_id> algoDest(new filter_counting_id("y"));
+	boost::shared_ptr<filter_counting_id> algoNone(new filter_counting_id(""));
+	stream::filtered_sptr src(new stream::filtered());
+	src->open(this->in, algoSrc, algoSrc, NULL);
+	stream::filtered_sptr dest(new stream::filtered());
+	dest->open(this->out, algoDest, algoDest, NULL);
+	BOOST_CHECK(!stream::copy_encoded(dest, src, 6));
+
+	// Filters with no fingerprint never match, even each other
+	src.reset(new stream::filtered());
+	src->open(this->in, algoNone, algoNone, NULL);
+	dest.reset(new stream::filtered());
+	dest->open(this->out, algoNone, algoNone, NULL);
+	BOOST_CHECK(!stream::copy_encoded(dest, src, 6));
+	BOOST_CHECK_MESSAGE(is_equal("old"), "Destination was changed");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
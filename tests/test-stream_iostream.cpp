@@ -0,0 +1,239 @@
+/**
+ * @file   test-stream_iostream.cpp
+ * @brief  Test code for the adapters between camoto streams and iostreams.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_iostream.hpp>
+#include <camoto/stream_memory.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/stream_sub.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct stream_iostream_sample: public default_sample {
+
+	stream::string_sptr base;
+	stream::sub_sptr plain;
+
+	stream_iostream_sample()
+		:	base(new stream::string()),
+			plain(new stream::sub())
+	{
+		this->base->write(makeString("ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"));
+		// A substream can't be read directly, so goes through the buffer
+		this->plain->open(this->base, 0, this->base->size(), NULL);
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_iostream_suite, stream_iostream_sample)
+
+BOOST_AUTO_TEST_CASE(read_borrowed_memory)
+{
+	BOOST_TEST_MESSAGE("Read from a memory stream without copying");
+
+	stream::memory_sptr m(new stream::memory());
+	m->write(makeString("hello world"));
+
+	stream::streambuf buf(m, stream::output_sptr());
+	std::istream in(&buf);
+	std::string word;
+	in >> word;
+	BOOST_CHECK_EQUAL(word, "hello");
+	BOOST_CHECK(buf.borrowed());
+	in >> word;
+	BOOST_CHECK_EQUAL(word, "world");
+	BOOST_CHECK(in.eof());
+}
+
+BOOST_AUTO_TEST_CASE(read_borrowed_string)
+{
+	BOOST_TEST_MESSAGE("Read from a string stream without copying");
+
+	stream::streambuf buf(this->base, stream::output_sptr());
+	std::istream in(&buf);
+	char data[5];
+	in.read(data, 4);
+	data[4] = 0;
+	BOOST_CHECK_EQUAL(std::string(data), "ABCD");
+	BOOST_CHECK(buf.borrowed());
+	BOOST_CHECK_EQUAL(in.tellg(), 4);
+}
+
+BOOST_AUTO_TEST_CASE(read_buffered)
+{
+	BOOST_TEST_MESSAGE("Read through a small buffer");
+
+	stream::streambuf buf(this->plain, stream::output_sptr(), 4);
+	std::istream in(&buf);
+	std::string all;
+	char c;
+	while (in.get(c)) all += c;
+	BOOST_CHECK_MESSAGE(is_equal(
+		makeString("ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"), all),
+		"Wrong data read through buffer");
+	BOOST_CHECK(!buf.borrowed());
+}
+
+BOOST_AUTO_TEST_CASE(read_large_unbuffered)
+{
+	BOOST_TEST_MESSAGE("Large reads skip the buffer");
+
+	stream::streambuf buf(this->plain, stream::output_sptr(), 4);
+	std::istream in(&buf);
+	char c;
+	in.get(c);
+	BOOST_CHECK_EQUAL(c, 'A');
+
+	char data[21];
+	in.read(data, 20);
+	BOOST_CHECK_EQUAL(in.gcount(), 20);
+	data[20] = 0;
+	BOOST_CHECK_EQUAL(std::string(data), "BCDEFGHIJKLMNOPQRSTU");
+	BOOST_CHECK_EQUAL(in.tellg(), 21);
+
+	in.read(data, 20);
+	BOOST_CHECK_EQUAL(in.gcount(), 15);
+	BOOST_CHECK(in.eof());
+}
+
+BOOST_AUTO_TEST_CASE(seek)
+{
+	BOOST_TEST_MESSAGE("Seek within the adapted stream");
+
+	stream::streambuf buf(this->plain, stream::output_sptr(), 8);
+	std::istream in(&buf);
+
+	in.seekg(10, std::ios::beg);
+	BOOST_CHECK_EQUAL(in.get(), 'K');
+	in.seekg(-2, std::ios::cur);
+	BOOST_CHECK_EQUAL(in.get(), 'J');
+	in.seekg(-1, std::ios::end);
+	BOOST_CHECK_EQUAL(in.get(), '9');
+	BOOST_CHECK_EQUAL(in.tellg(), 36);
+	in.seekg(-5, std::ios::beg);
+	BOOST_CHECK(in.fail());
+}
+
+BOOST_AUTO_TEST_CASE(sync_moves_pointer)
+{
+	BOOST_TEST_MESSAGE("sync() moves the stream's own pointer");
+
+	stream::streambuf buf(this->plain, stream::output_sptr(), 8);
+	std::istream in(&buf);
+	in.seekg(3, std::ios::beg);
+	in.get();
+	BOOST_CHECK_EQUAL(in.sync(), 0);
+	BOOST_CHECK_EQUAL(this->plain->tellg(), 4);
+}
+
+BOOST_AUTO_TEST_CASE(write_buffered)
+{
+	BOOST_TEST_MESSAGE("Write through a small buffer");
+
+	{
+		stream::streambuf buf(stream::input_sptr(), this->plain, 4);
+		std::ostream out(&buf);
+		out.seekp(2, std::ios::beg);
+		out << "xyzzy" << 42;
+		out.write("0123456789", 10);
+		BOOST_CHECK(out.good());
+	}
+	BOOST_CHECK_MESSAGE(is_equal(
+		makeString("ABxyzzy420123456789TUVWXYZ0123456789"), *this->base->str()),
+		"Wrong data written through buffer");
+}
+
+BOOST_AUTO_TEST_CASE(write_expands_memory)
+{
+	BOOST_TEST_MESSAGE("Write past the end of a memory stream");
+
+	stream::memory_sptr m(new stream::memory());
+	stream::streambuf buf(m, m);
+	std::iostream io(&buf);
+	io << "one two";
+	io.flush();
+	BOOST_CHECK_EQUAL(m->size(), 7);
+
+	io.seekg(4, std::ios::beg);
+	std::string word;
+	io >> word;
+	BOOST_CHECK_EQUAL(word, "two");
+}
+
+BOOST_AUTO_TEST_CASE(read_write_mixed)
+{
+	BOOST_TEST_MESSAGE("Alternate reads and writes");
+
+	stream::streambuf buf(this->plain, this->plain, 4);
+	std::iostream io(&buf);
+	BOOST_CHECK_EQUAL(io.get(), 'A');
+	io.put('-');
+	BOOST_CHECK_EQUAL(io.get(), 'C');
+	io.seekp(0, std::ios::beg);
+	io.put('*');
+	io.seekg(0, std::ios::beg);
+	std::string word;
+	io >> word;
+	BOOST_CHECK_MESSAGE(is_equal(
+		makeString("*-CDEFGHIJKLMNOPQRSTUVWXYZ0123456789"), word),
+		"Reads didn't see earlier writes");
+}
+
+BOOST_AUTO_TEST_CASE(reverse_read)
+{
+	BOOST_TEST_MESSAGE("Read a std::istream as a camoto stream");
+
+	std::istringstream src("Hello, world");
+	stream::input_iostream_sptr s(new stream::input_iostream());
+	s->open(src);
+
+	BOOST_CHECK_EQUAL(s->size(), 12);
+	s->seekg(7, stream::start);
+	uint8_t data[5];
+	s->read(data, 5);
+	BOOST_CHECK_MESSAGE(is_equal(makeString("world"),
+		std::string((char *)data, 5)), "Wrong data read from std::istream");
+	BOOST_CHECK_EQUAL(s->tellg(), 12);
+	BOOST_CHECK_EQUAL(s->try_read(data, 5), 0);
+}
+
+BOOST_AUTO_TEST_CASE(reverse_write)
+{
+	BOOST_TEST_MESSAGE("Write to a std::iostream as a camoto stream");
+
+	std::stringstream dst;
+	stream::iostream_sptr s(new stream::iostream());
+	s->open(dst);
+
+	s->write(makeString("abcdef"));
+	s->seekp(2, stream::start);
+	s->write(makeString("XY"));
+	s->truncate(8);
+	s->flush();
+	BOOST_CHECK_MESSAGE(is_equal(makeString("abXYef\0\0"), dst.str()),
+		"Wrong data written to std::iostream");
+	BOOST_CHECK_THROW(s->truncate(4), stream::write_error);
+
+	s->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(s->size(), 8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,184 @@
+/**
+ * @file   test-stream_metered.cpp
+ * @brief  Test code for metered streams.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_metered.hpp>
+#include <camoto/stream_string.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct stream_metered_sample: public default_sample {
+
+	stream::string_sptr base;
+	stream::metered_sptr m;
+
+	stream_metered_sample()
+		:	base(new stream::string()),
+			m(new stream::metered())
+	{
+		this->base->write("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+		this->base->seekp(0, stream::start);
+		this->m->open(this->base, "sample");
+		stream::meter_registry::enable(true);
+	}
+
+	~stream_metered_sample()
+	{
+		stream::meter_registry::enable(false);
+	}
+
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_metered_suite, stream_metered_sample)
+
+BOOST_AUTO_TEST_CASE(metered_passthrough)
+{
+	BOOST_TEST_MESSAGE("Data passes unchanged through a metered stream");
+
+	this->m->seekp(4, stream::start);
+	this->m->write("1234");
+	this->m->flush();
+
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal("ABCD1234IJKLMNOPQRSTUVWXYZ", *this->base->str()),
+		"Writing through metered stream changed the data");
+
+	this->m->seekg(2, stream::start);
+	std::string got = this->m->read(4);
+	BOOST_CHECK_MESSAGE(default_sample::is_equal("CD12", got),
+		"Reading through metered stream returned the wrong data");
+	BOOST_CHECK_EQUAL(this->m->tellg(), 6);
+	BOOST_CHECK_EQUAL(this->m->size(), 26);
+}
+
+BOOST_AUTO_TEST_CASE(metered_counters)
+{
+	BOOST_TEST_MESSAGE("Metered stream counts operations and bytes");
+
+	uint8_t buf[16];
+	this->m->seekg(0, stream::start);
+	this->m->try_read(buf, 10);
+	this->m->seekg(10, stream::start); // redundant
+	this->m->seekg(0, stream::cur);    // redundant
+	this->m->seekg(20, stream::start);
+	this->m->try_read(buf, 16);        // short, only 6 left
+	this->m->seekp(0, stream::start);
+	this->m->try_write(buf, 3);
+	this->m->flush();
+	this->m->flush();
+
+	stream::meter_counters c = this->m->snapshot().counters;
+	BOOST_CHECK_EQUAL(c.calls[stream::meter_read], 2);
+	BOOST_CHECK_EQUAL(c.calls[stream::meter_write], 1);
+	BOOST_CHECK_EQUAL(c.calls[stream::meter_seek], 5);
+	BOOST_CHECK_EQUAL(c.calls[stream::meter_flush], 2);
+	BOOST_CHECK_EQUAL(c.bytesRead, 16);
+	BOOST_CHECK_EQUAL(c.bytesWritten, 3);
+	BOOST_CHECK_EQUAL(c.shortReads, 1);
+	BOOST_CHECK_EQUAL(c.shortWrites, 0);
+	BOOST_CHECK_EQUAL(c.seeksRedundant, 2);
+
+	unsigned long long inHistogram = 0;
+	for (unsigned int b = 0; b < METER_BUCKETS; b++) {
+		inHistogram += c.latency[stream::meter_seek][b];
+	}
+	BOOST_CHECK_EQUAL(inHistogram, 5);
+	BOOST_CHECK(c.percentile(stream::meter_seek, 0.5) > 0);
+	BOOST_CHECK_EQUAL(c.percentile(stream::meter_truncate, 0.5), 0);
+}
+
+BOOST_AUTO_TEST_CASE(metered_end_seek)
+{
+	BOOST_TEST_MESSAGE("Seek from end is only redundant once the position is known");
+
+	this->m->seekg(0, stream::end);
+	this->m->seekg(0, stream::cur); // position unknown, not counted
+	this->m->tellg();
+	this->m->seekg(26, stream::start); // redundant now tellg() has synced
+
+	BOOST_CHECK_EQUAL(this->m->snapshot().counters.seeksRedundant, 1);
+}
+
+BOOST_AUTO_TEST_CASE(metered_disabled)
+{
+	BOOST_TEST_MESSAGE("Nothing is counted while metering is disabled");
+
+	stream::meter_registry::enable(false);
+	this->m->seekg(0, stream::start);
+	this->m->seekg(0, stream::start);
+	this->m->read(5);
+	this->m->flush();
+
+	stream::meter_counters c = this->m->snapshot().counters;
+	for (unsigned int op = 0; op < stream::meter_op_count; op++) {
+		BOOST_CHECK_EQUAL(c.calls[op], 0);
+	}
+	BOOST_CHECK_EQUAL(c.bytesRead, 0);
+	BOOST_CHECK_EQUAL(c.seeksRedundant, 0);
+}
+
+BOOST_AUTO_TEST_CASE(metered_registry)
+{
+	BOOST_TEST_MESSAGE("Registry reports and clears every metered stream");
+
+	stream::input_metered_sptr second(new stream::input_metered());
+	second->open(this->base, "second");
+
+	this->m->read(4);
+	second->seekg(0, stream::start);
+	second->read(6);
+
+	bool foundFirst = false, foundSecond = false;
+	std::vector<stream::meter_snapshot> all = stream::meter_registry::snapshot();
+	for (std::vector<stream::meter_snapshot>::const_iterator
+		i = all.begin(); i != all.end(); i++
+	) {
+		if (i->label == "sample") {
+			foundFirst = true;
+			BOOST_CHECK_EQUAL(i->counters.bytesRead, 4);
+		} else if (i->label == "second") {
+			foundSecond = true;
+			BOOST_CHECK_EQUAL(i->counters.bytesRead, 6);
+		}
+	}
+	BOOST_CHECK(foundFirst);
+	BOOST_CHECK(foundSecond);
+
+	std::ostringstream report;
+	stream::meter_registry::print(report);
+	BOOST_CHECK(report.str().find("[second] read 6 B") != std::string::npos);
+
+	stream::meter_registry::clear();
+	BOOST_CHECK_EQUAL(second->snapshot().counters.bytesRead, 0);
+	BOOST_CHECK_EQUAL(second->snapshot().counters.calls[stream::meter_read], 0);
+
+	second.reset();
+	all = stream::meter_registry::snapshot();
+	for (std::vector<stream::meter_snapshot>::const_iterator
+		i = all.begin(); i != all.end(); i++
+	) {
+		BOOST_CHECK_MESSAGE(i->label != "second",
+			"Destroyed stream still present in registry");
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,209 @@
+/**
+ * @file   test-stream_packed.cpp
+ * @brief  Test code for the compressed memory stream.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/mem_budget.hpp>
+#include <camoto/stream_memory.hpp>
+#include <camoto/stream_packed.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct stream_packed_sample: public default_sample {
+
+	stream::packed_sptr p;
+	unsigned long seed;
+
+	stream_packed_sample()
+		:	p(new stream::packed()),
+			seed(1)
+	{
+	}
+
+	/// Pseudo-random number, the same sequence every run.
+	unsigned long next()
+	{
+		this->seed = this->seed * 1103515245 + 12345;
+		return (this->seed >> 16) & 0x7FFF;
+	}
+
+	/// Text-like data, which compresses well.
+	std::string words(unsigned int len)
+	{
+		static const char *w[] = {"tile ", "sprite ", "level ", "map ",
+			"palette ", "sound ", "music\n"};
+		std::string s;
+		while (s.length() < len) s += w[this->next() % 7];
+		s.resize(len);
+		return s;
+	}
+
+	/// Noise, which doesn't compress.
+	std::string noise(unsigned int len)
+	{
+		std::string s;
+		for (unsigned int i = 0; i < len; i++) s += (char)this->next();
+		return s;
+	}
+
+	/// Read the whole stream.
+	std::string all(stream::input_sptr s)
+	{
+		s->seekg(0, stream::start);
+		return s->read(s->size());
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_packed_suite, stream_packed_sample)
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+	BOOST_TEST_MESSAGE("Data spanning many pages reads back unchanged");
+
+	std::string content = this->words(PACKED_PAGE_SIZE * 10 + 123);
+	this->p->setCachePages(1);
+	this->p->write(content);
+	this->p->flush();
+	BOOST_CHECK_EQUAL(this->p->size(), content.length());
+	BOOST_CHECK_MESSAGE(is_equal(content, this->all(this->p)),
+		"Data was corrupted going through packed pages");
+
+	// Only one page can be decompressed, the rest must be much smaller
+	BOOST_CHECK_LT(this->p->memoryHeld(), content.length() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(incompressible)
+{
+	BOOST_TEST_MESSAGE("Data that won't compress is stored as is");
+
+	std::string content = this->noise(PACKED_PAGE_SIZE * 3);
+	this->p->setCachePages(1);
+	this->p->write(content);
+	this->p->flush();
+	BOOST_CHECK_MESSAGE(is_equal(content, this->all(this->p)),
+		"Incompressible data was corrupted");
+	BOOST_CHECK_LE(this->p->memoryHeld(), content.length() + PACKED_PAGE_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(runs)
+{
+	BOOST_TEST_MESSAGE("Long runs use overlapping matches");
+
+	std::string content = std::string(70000, 'a') + "b"
+		+ std::string(300, 'c') + "abcabcabcabcabcabc";
+	this->p->setCachePages(1);
+	this->p->write(content);
+	this->p->flush();
+	BOOST_CHECK_MESSAGE(is_equal(content, this->all(this->p)),
+		"Runs were corrupted");
+}
+
+BOOST_AUTO_TEST_CASE(zero_pages)
+{
+	BOOST_TEST_MESSAGE("Pages of zeroes take no space");
+
+	this->p->truncate(PACKED_PAGE_SIZE * 100);
+	this->p->flush();
+	BOOST_CHECK_EQUAL(this->p->memoryHeld(), 0);
+
+	this->p->seekg(PACKED_PAGE_SIZE * 50 + 5, stream::start);
+	BOOST_CHECK_EQUAL(this->p->read(3), std::string(3, '\0'));
+	BOOST_CHECK_LE(this->p->memoryHeld(), PACKED_PAGE_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(budget_spill)
+{
+	BOOST_TEST_MESSAGE("Packed pages are still counted under the spill policy");
+
+	stream::len baseUsed = stream::mem_budget::used();
+	stream::mem_budget::setLimit(baseUsed + 16, stream::mem_spill);
+
+	std::string content = this->noise(PACKED_PAGE_SIZE * 2);
+	this->p->setCachePages(1);
+	this->p->write(content);
+	this->p->flush();
+	stream::len held = this->p->memoryHeld();
+	stream::len used = stream::mem_budget::used() - baseUsed;
+	stream::mem_budget::setLimit(0, stream::mem_block);
+
+	BOOST_CHECK_GT(held, PACKED_PAGE_SIZE);
+	BOOST_CHECK_EQUAL(used, held);
+	BOOST_CHECK_MESSAGE(is_equal(content, this->all(this->p)),
+		"Data was corrupted while over budget");
+}
+
+BOOST_AUTO_TEST_CASE(truncate_then_grow)
+{
+	BOOST_TEST_MESSAGE("Shrinking then growing fills the gap with zeroes");
+
+	std::string content = this->words(PACKED_PAGE_SIZE * 2);
+	this->p->setCachePages(1);
+	this->p->write(content);
+	this->p->truncate(100);
+	this->p->flush();
+	this->p->truncate(PACKED_PAGE_SIZE + 100);
+	std::string expected = content.substr(0, 100)
+		+ std::string(PACKED_PAGE_SIZE, '\0');
+	BOOST_CHECK_MESSAGE(is_equal(expected, this->all(this->p)),
+		"Old data came back after truncate");
+}
+
+BOOST_AUTO_TEST_CASE(matches_memory)
+{
+	BOOST_TEST_MESSAGE("Random writes give the same result as stream::memory");
+
+	stream::memory_sptr m(new stream::memory());
+	this->p->setCachePages(3);
+	for (int i = 0; i < 300; i++) {
+		unsigned long op = this->next() % 10;
+		stream::pos size = m->size();
+		if (op == 0) {
+			stream::pos newSize = (this->next() * 37) % (PACKED_PAGE_SIZE * 8);
+			m->truncate(newSize);
+			this->p->truncate(newSize);
+		} else {
+			stream::pos at = size ? (this->next() * 31) % (size + 1) : 0;
+			unsigned int len = this->next() % (PACKED_PAGE_SIZE / 2);
+			std::string data = (op & 1) ? this->noise(len) : this->words(len);
+			m->seekp(at, stream::start);
+			m->write(data);
+			this->p->seekp(at, stream::start);
+			this->p->write(data);
+		}
+		if (op == 9) this->p->flush();
+		BOOST_REQUIRE_EQUAL(this->p->tellp(), m->tellp());
+	}
+	BOOST_CHECK_MESSAGE(is_equal(this->all(m), this->all(this->p)),
+		"packed stream differs from memory stream");
+}
+
+BOOST_AUTO_TEST_CASE(seek_past_end)
+{
+	BOOST_TEST_MESSAGE("Seeking past the end fails like a memory stream");
+
+	this->p->write("hello");
+	BOOST_CHECK_THROW(this->p->seekg(6, stream::start), stream::seek_error);
+	BOOST_CHECK_THROW(this->p->seekg(-1, stream::start), stream::seek_error);
+	this->p->seekg(-2, stream::end);
+	BOOST_CHECK_EQUAL(this->p->read(2), "lo");
+	BOOST_CHECK_EQUAL(this->p->try_read(NULL, 0), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
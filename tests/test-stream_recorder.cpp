@@ -0,0 +1,205 @@
+/**
+ * @file   test-stream_recorder.cpp
+ * @brief  Test code for recording and replaying stream operations.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <camoto/stream_recorder.hpp>
+#include <camoto/stream_memory.hpp>
+#include <camoto/stream_string.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+/// Replay backend wrapper keeping hold of every stream it creates.
+static stream::inout_sptr keepBackend(std::vector<stream::inout_sptr> *kept,
+	stream::fn_replay_backend backend, stream::len size)
+{
+	stream::inout_sptr s = backend(size);
+	kept->push_back(s);
+	return s;
+}
+
+struct stream_recorder_sample: public default_sample {
+
+	stream::recording_sptr rec;
+	stream::string_sptr base;
+	stream::recorder_sptr r;
+
+	stream_recorder_sample()
+		:	rec(new stream::recording()),
+			base(new stream::string()),
+			r(new stream::recorder())
+	{
+		this->base->write("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+		this->base->seekp(0, stream::start);
+	}
+
+	/// Record some typical operations on a seg.
+	void recordSegEdit()
+	{
+		stream::seg_sptr s(new stream::seg());
+		s->open(this->base);
+		this->r->open(s, this->rec);
+		this->r->seekg(4, stream::start);
+		this->r->insert(6);
+		this->r->write("123456");
+		this->r->seekg(20, stream::start);
+		this->r->remove(3);
+		this->r->seekg(0, stream::start);
+		uint8_t buf[64];
+		this->r->try_read(buf, sizeof(buf));
+		this->r->flush();
+		return;
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_recorder_suite, stream_recorder_sample)
+
+BOOST_AUTO_TEST_CASE(recorder_ops)
+{
+	BOOST_TEST_MESSAGE("Recorder logs operations without changing the data");
+
+	this->r->open(this->base, this->rec);
+	this->r->seekg(2, stream::start);
+	std::string got = this->r->read(3);
+	this->r->seekp(-2, stream::end);
+	this->r->write("yz");
+	this->r->truncate(20);
+	this->r->flush();
+
+	BOOST_CHECK_MESSAGE(default_sample::is_equal("CDE", got),
+		"Reading through recorder returned the wrong data");
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal("ABCDEFGHIJKLMNOPQRST", *this->base->str()),
+		"Writing through recorder changed the data");
+
+	std::vector<stream::io_op> ops = this->rec->ops();
+	BOOST_REQUIRE_EQUAL(ops.size(), 7);
+	BOOST_CHECK_EQUAL(ops[0].op, stream::io_op::open);
+	BOOST_CHECK_EQUAL(ops[0].arg, 26);
+	BOOST_CHECK_EQUAL(ops[1].op, stream::io_op::seek);
+	BOOST_CHECK_EQUAL(ops[1].arg, 2);
+	BOOST_CHECK_EQUAL(ops[2].op, stream::io_op::read);
+	BOOST_CHECK_EQUAL(ops[2].arg, 3);
+	BOOST_CHECK_EQUAL(ops[2].result, 3);
+	BOOST_CHECK_EQUAL(ops[3].op, stream::io_op::seek);
+	BOOST_CHECK_EQUAL(ops[3].arg, -2);
+	BOOST_CHECK_EQUAL(ops[3].from, stream::end);
+	BOOST_CHECK_EQUAL(ops[4].op, stream::io_op::write);
+	BOOST_CHECK_EQUAL(ops[5].op, stream::io_op::truncate);
+	BOOST_CHECK_EQUAL(ops[5].arg, 20);
+	BOOST_CHECK_EQUAL(ops[6].op, stream::io_op::flush);
+
+	for (unsigned int i = 1; i < ops.size(); i++) {
+		BOOST_CHECK(ops[i].time >= ops[i - 1].time);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(recorder_save_load)
+{
+	BOOST_TEST_MESSAGE("Save and reload a recording");
+
+	this->recordSegEdit();
+
+	std::stringstream saved;
+	this->rec->save(saved);
+
+	stream::recording loaded;
+	loaded.load(saved);
+
+	std::vector<stream::io_op> a = this->rec->ops();
+	std::vector<stream::io_op> b = loaded.ops();
+	BOOST_REQUIRE_EQUAL(a.size(), b.size());
+	for (unsigned int i = 0; i < a.size(); i++) {
+		BOOST_CHECK_EQUAL(a[i].time, b[i].time);
+		BOOST_CHECK_EQUAL(a[i].duration, b[i].duration);
+		BOOST_CHECK_EQUAL(a[i].id, b[i].id);
+		BOOST_CHECK_EQUAL(a[i].op, b[i].op);
+		BOOST_CHECK_EQUAL(a[i].arg, b[i].arg);
+		BOOST_CHECK_EQUAL(a[i].from, b[i].from);
+		BOOST_CHECK_EQUAL(a[i].result, b[i].result);
+	}
+	BOOST_CHECK_EQUAL(loaded.nextId(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(recorder_load_invalid)
+{
+	BOOST_TEST_MESSAGE("Loading an invalid recording fails");
+
+	stream::recording loaded;
+	std::istringstream notRecording("hello\n");
+	BOOST_CHECK_THROW(loaded.load(notRecording), stream::read_error);
+
+	std::istringstream badOp("camoto-io-recording 1\n0 0 0 jump 0 s 0\n");
+	BOOST_CHECK_THROW(loaded.load(badOp), stream::read_error);
+
+	std::istringstream shortLine("camoto-io-recording 1\n0 0 0 read\n");
+	BOOST_CHECK_THROW(loaded.load(shortLine), stream::read_error);
+}
+
+BOOST_AUTO_TEST_CASE(recorder_insert_needs_seg)
+{
+	BOOST_TEST_MESSAGE("Insert and remove only work on a seg");
+
+	this->r->open(this->base, this->rec);
+	BOOST_CHECK_THROW(this->r->insert(4), stream::write_error);
+	BOOST_CHECK_THROW(this->r->remove(4), stream::write_error);
+}
+
+BOOST_AUTO_TEST_CASE(recorder_replay)
+{
+	BOOST_TEST_MESSAGE("Replay a recording against each backend");
+
+	this->recordSegEdit();
+	stream::len expectedSize = this->base->size();
+	BOOST_REQUIRE_EQUAL(expectedSize, 26 + 6 - 3);
+
+	stream::fn_replay_backend backends[] = {
+		stream::replay_memory,
+		stream::replay_seg,
+		boost::bind(stream::replay_file, "test-replay", _1),
+	};
+	for (unsigned int i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		std::vector<stream::inout_sptr> kept;
+		stream::replay_stats stats = stream::replay(*this->rec,
+			boost::bind(keepBackend, &kept, backends[i], _1));
+
+		BOOST_CHECK_EQUAL(stats.ops, this->rec->ops().size());
+		BOOST_CHECK_EQUAL(stats.bytesRead, expectedSize);
+		BOOST_CHECK_EQUAL(stats.bytesWritten, 6);
+		BOOST_CHECK_EQUAL(stats.mismatches, 0);
+		BOOST_REQUIRE_EQUAL(kept.size(), 1);
+		BOOST_CHECK_EQUAL(kept[0]->size(), expectedSize);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(recorder_replay_unopened)
+{
+	BOOST_TEST_MESSAGE("Replaying a recording with no open operation fails");
+
+	std::istringstream saved("camoto-io-recording 1\n0 0 0 read 4 s 4\n");
+	stream::recording loaded;
+	loaded.load(saved);
+	BOOST_CHECK_THROW(stream::replay(loaded, stream::replay_memory),
+		stream::error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
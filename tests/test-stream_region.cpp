@@ -0,0 +1,163 @@
+/**
+ * @file   test-stream_region.cpp
+ * @brief  Test code for writing regions of a file in parallel.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_region.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+#define TEST_FILE "_test_region.$"
+
+/// Size of each member written by the threaded test.
+#define MEMBER_SIZE 65536
+
+/// Byte expected at the given offset of a member.
+static char memberByte(unsigned int member, unsigned int off)
+{
+	return (char)(member * 31 + off * 7 + (off >> 8));
+}
+
+/// Write one member in small pieces, as an encoder would.
+static void writeMember(stream::output_sptr region, unsigned int member)
+{
+	std::string piece;
+	for (unsigned int off = 0; off < MEMBER_SIZE; off++) {
+		piece += memberByte(member, off);
+		if (piece.length() == 1000) {
+			region->write(piece);
+			piece.clear();
+			boost::this_thread::yield();
+		}
+	}
+	region->write(piece);
+	return;
+}
+
+struct stream_region_sample: public default_sample {
+
+	stream::file_sptr f;
+
+	stream_region_sample()
+		:	f(new stream::file())
+	{
+		this->f->create(TEST_FILE);
+		this->f->write("existing");
+	}
+
+	~stream_region_sample()
+	{
+		this->f.reset();
+		::remove(TEST_FILE);
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_region_suite, stream_region_sample)
+
+BOOST_AUTO_TEST_CASE(parallel_members)
+{
+	BOOST_TEST_MESSAGE("Threads write members into their own regions at once");
+
+	const unsigned int members = 8;
+	stream::region_writer w(this->f, MEMBER_SIZE * members);
+	BOOST_CHECK_EQUAL(this->f->size(), MEMBER_SIZE * members);
+
+	boost::thread_group threads;
+	for (unsigned int i = 0; i < members; i++) {
+		// Hand out regions in reverse order, so later ones are written first
+		unsigned int m = members - 1 - i;
+		threads.create_thread(boost::bind(writeMember,
+			w.region(m * MEMBER_SIZE, MEMBER_SIZE), m));
+	}
+	threads.join_all();
+	w.flush();
+
+	// The file's own pointer hasn't moved
+	BOOST_CHECK_EQUAL(this->f->tellp(), 8);
+
+	this->f->seekg(0, stream::start);
+	std::string content = this->f->read(MEMBER_SIZE * members);
+	unsigned int bad = 0;
+	for (unsigned int m = 0; m < members; m++) {
+		for (unsigned int off = 0; off < MEMBER_SIZE; off++) {
+			if (content[m * MEMBER_SIZE + off] != memberByte(m, off)) bad++;
+		}
+	}
+	BOOST_CHECK_EQUAL(bad, 0);
+}
+
+BOOST_AUTO_TEST_CASE(overlap)
+{
+	BOOST_TEST_MESSAGE("Overlapping regions are refused");
+
+	stream::region_writer w(this->f, 100);
+	w.region(10, 10);
+	w.region(30, 10);
+	BOOST_CHECK_THROW(w.region(5, 6), stream::write_error);
+	BOOST_CHECK_THROW(w.region(19, 2), stream::write_error);
+	BOOST_CHECK_THROW(w.region(12, 2), stream::write_error);
+	BOOST_CHECK_THROW(w.region(0, 100), stream::write_error);
+	BOOST_CHECK_THROW(w.region(95, 6), stream::write_error);
+
+	// Adjacent regions and empty ones are fine
+	w.region(20, 10);
+	w.region(0, 10);
+	w.region(40, 60);
+	w.region(15, 0);
+}
+
+BOOST_AUTO_TEST_CASE(fixed_size)
+{
+	BOOST_TEST_MESSAGE("Regions can't be written past their end");
+
+	stream::region_writer w(this->f, 20);
+	stream::output_sptr r = w.region(4, 8);
+	BOOST_CHECK(r->write_caps().has(stream::cap_positional));
+
+	r->write("abcdef");
+	BOOST_CHECK_THROW(r->write("ghij"), stream::incomplete_write);
+	BOOST_CHECK_EQUAL(r->tellp(), 8);
+	BOOST_CHECK_THROW(r->seekp(9, stream::start), stream::seek_error);
+	BOOST_CHECK_THROW(r->truncate(4), stream::write_error);
+	r->seekp(-1, stream::end);
+	r->write("Z");
+	w.flush();
+
+	this->f->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(this->f->read(20),
+		makeString("exisabcdefgZ" "\x00\x00\x00\x00\x00\x00\x00\x00"));
+}
+
+BOOST_AUTO_TEST_CASE(no_shrink)
+{
+	BOOST_TEST_MESSAGE("A file larger than needed is left as it is");
+
+	stream::region_writer w(this->f, 4);
+	BOOST_CHECK_EQUAL(this->f->size(), 8);
+	w.region(0, 4)->write("EXIS");
+	w.flush();
+	this->f->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(this->f->read(8), "EXISting");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,207 @@
+/**
+ * @file   test-stream_simulated.cpp
+ * @brief  Test code for streams simulating slower storage.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/chrono.hpp>
+#include <camoto/stream_simulated.hpp>
+#include <camoto/stream_string.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct stream_simulated_sample: public default_sample {
+
+	stream::string_sptr base;
+	stream::simulated_sptr s;
+
+	stream_simulated_sample()
+		:	base(new stream::string()),
+			s(new stream::simulated())
+	{
+		this->base->write("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+		this->base->seekp(0, stream::start);
+	}
+
+	/// Read the whole stream in \e chunk sized pieces, noting each length.
+	std::vector<stream::len> readLengths(stream::simulated_sptr sim,
+		stream::len chunk)
+	{
+		std::vector<stream::len> lengths;
+		uint8_t buf[32];
+		sim->seekg(0, stream::start);
+		stream::len r;
+		while ((r = sim->try_read(buf, chunk)) > 0) lengths.push_back(r);
+		return lengths;
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_simulated_suite, stream_simulated_sample)
+
+BOOST_AUTO_TEST_CASE(simulated_passthrough)
+{
+	BOOST_TEST_MESSAGE("Data passes unchanged through a simulated stream");
+
+	this->s->open(this->base, stream::sim_device());
+	this->s->seekp(4, stream::start);
+	this->s->write("1234");
+	this->s->flush();
+
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal("ABCD1234IJKLMNOPQRSTUVWXYZ", *this->base->str()),
+		"Writing through simulated stream changed the data");
+
+	this->s->seekg(2, stream::start);
+	std::string got = this->s->read(4);
+	BOOST_CHECK_MESSAGE(default_sample::is_equal("CD12", got),
+		"Reading through simulated stream returned the wrong data");
+	BOOST_CHECK_EQUAL(this->s->tellg(), 6);
+	BOOST_CHECK_EQUAL(this->s->size(), 26);
+	BOOST_CHECK_EQUAL(this->s->elapsedNs(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(simulated_latency_bandwidth)
+{
+	BOOST_TEST_MESSAGE("Latency and bandwidth are charged to the clock");
+
+	stream::sim_device dev;
+	dev.latencyNs = 1000;
+	dev.bytesPerSecond = 1000000; // 1us per byte
+	this->s->open(this->base, dev);
+
+	uint8_t buf[10];
+	this->s->try_read(buf, 10);
+	BOOST_CHECK_EQUAL(this->s->elapsedNs(), 1000 + 10 * 1000);
+
+	this->s->write("12");
+	this->s->flush();
+	BOOST_CHECK_EQUAL(this->s->elapsedNs(), 11000 + 1000 + 2 * 1000 + 1000);
+	BOOST_CHECK_EQUAL(this->s->seeks(), 0);
+
+	this->s->resetClock();
+	BOOST_CHECK_EQUAL(this->s->elapsedNs(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(simulated_seek_penalty)
+{
+	BOOST_TEST_MESSAGE("Only non-sequential access is charged a seek");
+
+	stream::sim_device dev;
+	dev.seekNs = 5000;
+	this->s->open(this->base, dev);
+
+	uint8_t buf[4];
+	this->s->try_read(buf, 4);
+	this->s->try_read(buf, 4);
+	BOOST_CHECK_EQUAL(this->s->seeks(), 0);
+
+	// Seeking to where we already are doesn't cost anything
+	this->s->seekg(8, stream::start);
+	this->s->try_read(buf, 4);
+	BOOST_CHECK_EQUAL(this->s->seeks(), 0);
+
+	this->s->seekg(20, stream::start);
+	this->s->try_read(buf, 4);
+	BOOST_CHECK_EQUAL(this->s->seeks(), 1);
+
+	this->s->seekp(0, stream::start);
+	this->s->write("a");
+	BOOST_CHECK_EQUAL(this->s->seeks(), 2);
+	BOOST_CHECK_EQUAL(this->s->elapsedNs(), 2 * 5000);
+}
+
+BOOST_AUTO_TEST_CASE(simulated_short_reads)
+{
+	BOOST_TEST_MESSAGE("Short reads are repeatable and never lose data");
+
+	stream::sim_device dev;
+	dev.shortReadChance = 0.5;
+	dev.seed = 1234;
+	this->s->open(this->base, dev);
+
+	std::vector<stream::len> a = this->readLengths(this->s, 8);
+
+	stream::simulated_sptr s2(new stream::simulated());
+	s2->open(this->base, dev);
+	std::vector<stream::len> b = this->readLengths(s2, 8);
+
+	BOOST_CHECK(a == b);
+	BOOST_CHECK_GT(this->s->shortReads(), 0);
+
+	stream::len total = 0;
+	for (std::vector<stream::len>::const_iterator
+		i = a.begin(); i != a.end(); i++
+	) {
+		BOOST_CHECK_GT(*i, 0);
+		BOOST_CHECK_LE(*i, 8);
+		total += *i;
+	}
+	BOOST_CHECK_EQUAL(total, 26);
+
+	// A different seed should give a different pattern
+	dev.seed = 99;
+	s2->open(this->base, dev);
+	BOOST_CHECK(a != this->readLengths(s2, 8));
+}
+
+BOOST_AUTO_TEST_CASE(simulated_presets_full_reads)
+{
+	BOOST_TEST_MESSAGE("Device presets never return short reads");
+
+	std::string content;
+	for (unsigned int i = 0; i < 4 * BUFFER_SIZE; i++) content += 'A' + i % 26;
+	stream::string_sptr big(new stream::string());
+	big->write(content);
+
+	BOOST_CHECK_EQUAL(stream::sim_device::hdd().shortReadChance, 0);
+	BOOST_CHECK_EQUAL(stream::sim_device::network().shortReadChance, 0);
+
+	this->s->open(big, stream::sim_device::network());
+	this->s->seekg(0, stream::start);
+	stream::string_sptr copy(new stream::string());
+	stream::copy(copy, this->s);
+	BOOST_CHECK_EQUAL(this->s->shortReads(), 0);
+	BOOST_CHECK_MESSAGE(is_equal(content, *copy->str()),
+		"Copy through the network preset stopped early");
+
+	this->s->open(big, stream::sim_device::hdd());
+	this->s->seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(this->s->read(content.length()), content);
+	BOOST_CHECK_EQUAL(this->s->shortReads(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(simulated_real_time)
+{
+	BOOST_TEST_MESSAGE("Real-time simulation actually takes the time");
+
+	stream::sim_device dev;
+	dev.latencyNs = 20000000; // 20ms
+	dev.realTime = true;
+	this->s->open(this->base, dev);
+
+	boost::chrono::steady_clock::time_point tStart
+		= boost::chrono::steady_clock::now();
+	uint8_t buf[4];
+	this->s->try_read(buf, 4);
+	boost::chrono::duration<double> elapsed
+		= boost::chrono::steady_clock::now() - tStart;
+	BOOST_CHECK_GE(elapsed.count(), 0.02);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
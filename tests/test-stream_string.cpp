@@ -22,6 +22,7 @@
 #include <boost/test/unit_test.hpp>
 #include <camoto/stream_string.hpp>
 #include "tests.hpp"
+#include "alloc_count.hpp"
 
 using namespace camoto;
 
@@ -164,4 +165,24 @@ BOOST_AUTO_TEST_CASE(expand)
 	f.reset();
 }
 
+BOOST_AUTO_TEST_CASE(seek_error_allocs)
+{
+	BOOST_TEST_MESSAGE("Seek errors only allocate the exception and its message");
+
+	stream::string_sptr s(new stream::string());
+	s->write("abcdef");
+
+	// One for the exception object, one for the message and one for the copy
+	// kept in the exception.
+	CHECK_ALLOCS(
+		try {
+			s->seekg(10, stream::start);
+		} catch (const stream::seek_error&) {
+		},
+		3
+	);
+	BOOST_CHECK_THROW(s->seekg(10, stream::start), stream::seek_error);
+	BOOST_CHECK_EQUAL(s->tellg(), 6);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
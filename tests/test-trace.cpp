@@ -0,0 +1,205 @@
+/**
+ * @file   test-trace.cpp
+ * @brief  Test code for trace capture.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <camoto/trace.hpp>
+#include <camoto/lzw.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_sub.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct trace_sample: public string_sample {
+
+	trace_sample()
+	{
+		trace::enable(false);
+		trace::clear();
+	}
+
+	~trace_sample()
+	{
+		trace::enable(false);
+		trace::clear();
+	}
+
+	std::string exportJSON()
+	{
+		std::ostringstream json;
+		trace::exportChrome(json);
+		return json.str();
+	}
+
+	/// Count how many times a string appears in another.
+	unsigned int count(const std::string& haystack, const std::string& needle)
+	{
+		unsigned int n = 0;
+		for (std::string::size_type pos = haystack.find(needle);
+			pos != std::string::npos; pos = haystack.find(needle, pos + 1)) n++;
+		return n;
+	}
+};
+
+/// Read from a string stream a few times on another thread.
+static void traceOtherThread(stream::string_sptr s)
+{
+	uint8_t buf[4];
+	s->seekg(0, stream::start);
+	s->try_read(buf, sizeof(buf));
+	return;
+}
+
+BOOST_FIXTURE_TEST_SUITE(trace_suite, trace_sample)
+
+BOOST_AUTO_TEST_CASE(trace_disabled)
+{
+	BOOST_TEST_MESSAGE("Nothing is recorded while tracing is disabled");
+
+	this->in->write("ABCDEFGH");
+	this->in->seekg(0, stream::start);
+	stream::copy(this->out, this->in);
+
+	BOOST_CHECK_EQUAL(trace::events(), 0);
+	BOOST_CHECK_EQUAL(this->count(this->exportJSON(), "\"ph\":\"X\""), 0);
+}
+
+BOOST_AUTO_TEST_CASE(trace_streams)
+{
+	BOOST_TEST_MESSAGE("Stream operations are recorded");
+
+	this->in->write("ABCDEFGH");
+	stream::sub_sptr sub(new stream::sub());
+	sub->open(this->in, 2, 4, NULL);
+
+	trace::enable(true);
+	stream::copy(this->out, sub);
+	trace::enable(false);
+
+	// These must not be recorded
+	sub->seekg(0, stream::start);
+	sub->read(4);
+
+	BOOST_CHECK_MESSAGE(is_equal("CDEF"), "Copy while tracing gave wrong data");
+
+	std::string json = this->exportJSON();
+	BOOST_CHECK_EQUAL(this->count(json, "\"name\":\"copy\""), 1);
+	BOOST_CHECK(this->count(json, "\"name\":\"sub::try_read\"") >= 1);
+	BOOST_CHECK(this->count(json, "\"name\":\"string::try_read\"") >= 1);
+	BOOST_CHECK(this->count(json, "\"name\":\"string::try_write\"") >= 1);
+	BOOST_CHECK_EQUAL(this->count(json, "\"ph\":\"X\""), trace::events());
+
+	BOOST_CHECK_EQUAL(json.substr(0, 15), "{\"traceEvents\":");
+	BOOST_CHECK_EQUAL(json.substr(json.length() - 2), "}\n");
+}
+
+BOOST_AUTO_TEST_CASE(trace_filter)
+{
+	BOOST_TEST_MESSAGE("Filter operations are recorded");
+
+	bitstream_sptr bits(new bitstream(this->in, bitstream::bigEndian));
+	bits->write(9, 'A');
+	bits->write(9, 'B');
+	bits->write(9, 0x100);
+	bits->flush();
+
+	filter_sptr filt(new filter_lzw_decompress(9, 9, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID));
+	stream::input_filtered_sptr processed(new stream::input_filtered());
+	processed->open(this->in, filt);
+
+	trace::enable(true);
+	stream::copy(this->out, processed);
+	trace::enable(false);
+
+	BOOST_CHECK_MESSAGE(is_equal("AB"), "Filtering while tracing gave wrong data");
+
+	std::string json = this->exportJSON();
+	BOOST_CHECK_EQUAL(
+		this->count(json, "\"name\":\"input_filtered::populate\""), 1);
+	BOOST_CHECK(
+		this->count(json, "\"name\":\"lzw_decompress::transform\"") >= 1);
+	BOOST_CHECK(this->count(json, "\"cat\":\"filter\"") >= 2);
+}
+
+BOOST_AUTO_TEST_CASE(trace_threads)
+{
+	BOOST_TEST_MESSAGE("Each thread records into its own buffer");
+
+	this->in->write("ABCDEFGH");
+
+	trace::enable(true);
+	traceOtherThread(this->in);
+	boost::thread t(boost::bind(traceOtherThread, this->in));
+	t.join();
+	trace::enable(false);
+
+	// The second thread has exited, but its events must still be there.
+	BOOST_CHECK_EQUAL(trace::events(), 4);
+	std::string json = this->exportJSON();
+	BOOST_CHECK(this->count(json, "\"name\":\"thread_name\"") >= 2);
+	BOOST_CHECK_EQUAL(this->count(json, "\"name\":\"string::try_read\""), 2);
+}
+
+BOOST_AUTO_TEST_CASE(trace_thread_reuse)
+{
+	BOOST_TEST_MESSAGE("Buffers of threads that have exited are reused and freed");
+
+	this->in->write("ABCDEFGH");
+
+	trace::enable(true);
+	traceOtherThread(this->in);
+	unsigned long base = trace::buffers();
+	for (unsigned int i = 0; i < 10; i++) {
+		boost::thread t(boost::bind(traceOtherThread, this->in));
+		t.join();
+	}
+	trace::enable(false);
+
+	// One buffer is shared by all the threads, and their events are kept
+	BOOST_CHECK_EQUAL(trace::buffers(), base + 1);
+	BOOST_CHECK_EQUAL(this->count(this->exportJSON(),
+		"\"name\":\"string::try_read\""), 11);
+
+	trace::clear();
+	BOOST_CHECK_EQUAL(trace::buffers(), base);
+}
+
+BOOST_AUTO_TEST_CASE(trace_wrap)
+{
+	BOOST_TEST_MESSAGE("Oldest events are overwritten when the buffer is full");
+
+	this->in->write("ABCDEFGH");
+
+	trace::enable(true);
+	for (unsigned int i = 0; i < TRACE_BUFFER_EVENTS + 100; i++) {
+		this->in->seekg(0, stream::start);
+	}
+	trace::enable(false);
+
+	BOOST_CHECK_EQUAL(trace::events(), TRACE_BUFFER_EVENTS - 1);
+	BOOST_CHECK_EQUAL(this->count(this->exportJSON(), "\"ph\":\"X\""),
+		TRACE_BUFFER_EVENTS - 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
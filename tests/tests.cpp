@@ -23,10 +23,13 @@
 #include <boost/test/unit_test.hpp>
 
 #include <boost/algorithm/string.hpp> // for case-insensitive string compare
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 
 #include <camoto/debug.hpp>
+#include <camoto/hexdump.hpp>
 #include <camoto/util.hpp>
 #include "tests.hpp"
 
@@ -99,6 +102,13 @@ boost::test_tools::predicate_result default_sample::is_equal(
 	const std::string& strExpected, const std::string& strCheck)
 {
 	if (strExpected.compare(strCheck)) {
+		if (std::max(strExpected.length(), strCheck.length()) > LARGE_FIXTURE) {
+			camoto::stream::input_string_sptr exp(new camoto::stream::input_string());
+			exp->open(boost::shared_ptr<std::string>(new std::string(strExpected)));
+			camoto::stream::input_string_sptr got(new camoto::stream::input_string());
+			got->open(boost::shared_ptr<std::string>(new std::string(strCheck)));
+			return this->is_equal(exp, got);
+		}
 		boost::test_tools::predicate_result res(false);
 		this->print_wrong(res, strExpected, strCheck);
 		return res;
@@ -106,3 +116,23 @@ boost::test_tools::predicate_result default_sample::is_equal(
 
 	return true;
 }
+
+boost::test_tools::predicate_result default_sample::is_equal(
+	camoto::stream::input_sptr expected, camoto::stream::input_sptr actual)
+{
+	// Only show the first few differences, as a long run of them is usually
+	// just one problem shifting everything after it.
+	std::vector<camoto::stream::diff_range> ranges =
+		camoto::stream::diff(expected, actual, 8, this->outputWidth);
+	if (ranges.empty()) return true;
+
+	boost::test_tools::predicate_result res(false);
+	std::ostringstream dump;
+	dump << "\nExpected " << expected->size() << " bytes, got "
+		<< actual->size() << ".  First differences (- expected, + got):\n";
+	camoto::stream::hexdump_options opts;
+	opts.width = this->outputWidth;
+	camoto::stream::hexdumpDiff(dump, expected, actual, ranges, opts);
+	res.message() << dump.str();
+	return res;
+}
@@ -24,6 +24,9 @@
 #include <boost/test/unit_test.hpp>
 #include <camoto/stream_string.hpp>
 
+/// Strings longer than this only have their differences printed by is_equal()
+#define LARGE_FIXTURE 4096
+
 // Allow a string constant to be passed around with embedded nulls
 #define makeString(x)  std::string((x), sizeof((x)) - 1)
 
@@ -39,6 +42,14 @@ struct default_sample {
 	boost::test_tools::predicate_result is_equal(const std::string& strExpected,
 		const std::string& strCheck);
 
+	/// Compare two streams, showing only the lines that differ.
+	/**
+	 * Suitable for fixtures too big to print in full.  Strings longer than
+	 * LARGE_FIXTURE passed to the other is_equal() are compared this way too.
+	 */
+	boost::test_tools::predicate_result is_equal(
+		camoto::stream::input_sptr expected, camoto::stream::input_sptr actual);
+
 	unsigned int outputWidth; ///< Width of output hexdump, as number of bytes shown per line
 
 };